@@ -0,0 +1,20 @@
+# Load on the control API: requests per second and latency of GET /status and of uploads
+
+include(../bench.pri)
+include(../common/link.pri)
+
+QT += network
+QT -= gui
+
+TARGET = bench_apiload
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/farmscheduler.cpp \
+    $$SRC/controlapi.cpp
+
+HEADERS += \
+    $$SRC/farmscheduler.h \
+    $$SRC/controlapi.h \
+    $$PWD/../common/gcodegen.h
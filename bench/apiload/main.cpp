@@ -0,0 +1,280 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTimer>
+#include <QThread>
+#include <QTcpSocket>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QQueue>
+#include <QVector>
+#include <stdio.h>
+#include <algorithm>
+#include "controlapi.h"
+#include "farmscheduler.h"
+#include "gcodegen.h"
+
+// Port of the benchmark, not the default one of a running print_server
+#define BENCH_PORT              (18080)
+// Length of one load run
+#define BENCH_RUN_MS            (5000)
+// Farm behind /status, the snapshot grows with the jobs
+#define BENCH_PRINTERS          (40)
+#define BENCH_JOBS              (500)
+// The scheduler changes this often during the churn run
+#define BENCH_CHURN_MS          (10)
+// Size of an uploaded file, layers of 1500 moves, about 57 kB each
+#define BENCH_UPLOAD_LAYERS     (20)
+
+/**
+ * Connections to the API that keep a number of requests in flight each, in their own thread so
+ * the clients do not share the event loop of the GUI thread with ControlApi.
+ */
+class LoadClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadClient(int connections, int depth, const QByteArray &request) :
+        connections(connections), depth(depth), request(request), responses(0), errors(0), bytes(0), running(false) {}
+
+    int connections;
+    int depth;
+    QByteArray request;
+    quint64 responses;
+    quint64 errors;                 ///< Answers other than 2xx and lost connections
+    quint64 bytes;                  ///< Requests sent and response bodies received
+    QVector<qint64> latencies;      ///< ns from sending a request to its whole response
+
+public slots:
+    void start()
+    {
+        running = true;
+        clock.start();
+        for(int i = 0; i < connections; i++)
+        {
+            Connection *c = new Connection;
+            c->socket = new QTcpSocket(this);
+            connect(c->socket, SIGNAL(connected()), this, SLOT(connected()));
+            connect(c->socket, SIGNAL(readyRead()), this, SLOT(readyRead()));
+            connect(c->socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+            open.insert(c->socket, c);
+            c->socket->connectToHost("127.0.0.1", BENCH_PORT);
+        }
+    }
+
+    void stop()
+    {
+        running = false;
+        foreach (Connection *c, open)
+        {
+            c->socket->disconnect(this);
+            c->socket->abort();
+            delete c;
+        }
+        open.clear();
+    }
+
+private slots:
+    void connected()
+    {
+        Connection *c = open.value(qobject_cast<QTcpSocket *>(sender()));
+        for(int i = 0; c && i < depth; i++)
+            send(c);
+    }
+
+    void readyRead()
+    {
+        Connection *c = open.value(qobject_cast<QTcpSocket *>(sender()));
+        if(!c)
+            return;
+        c->buffer.append(c->socket->readAll());
+
+        /* Odpowiedzi potokowe przychodzą w kolejności żądań */
+        while(true)
+        {
+            int end = c->buffer.indexOf("\r\n\r\n");
+            if(end < 0)
+                return;
+            int length = 0;
+            int field = c->buffer.indexOf("Content-Length: ");
+            if(field >= 0 && field < end)
+                length = c->buffer.mid(field + 16, c->buffer.indexOf("\r\n", field) - field - 16).toInt();
+            if(c->buffer.size() < end + 4 + length)
+                return;
+
+            if(!c->buffer.startsWith("HTTP/1.1 2"))
+                errors++;
+            responses++;
+            bytes += static_cast<quint64>(length);
+            latencies.append(clock.nsecsElapsed() - c->sent.dequeue());
+            c->buffer.remove(0, end + 4 + length);
+            if(running)
+                send(c);
+        }
+    }
+
+    void disconnected()
+    {
+        errors++;
+    }
+
+private:
+    typedef struct {
+        QTcpSocket *socket;
+        QByteArray buffer;
+        QQueue<qint64> sent;        ///< Send times of the requests not answered yet
+    } Connection;
+
+    void send(Connection *c)
+    {
+        c->sent.enqueue(clock.nsecsElapsed());
+        c->socket->write(request);
+        bytes += static_cast<quint64>(request.size());
+    }
+
+    QHash<QTcpSocket *, Connection *> open;
+    QElapsedTimer clock;
+    bool running;
+};
+
+/**
+ * Keeps the scheduler changing, so ControlApi rebuilds the snapshot every API_SNAPSHOT_PERIOD_MS
+ * while it is read.
+ */
+class Churn : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Churn(FarmScheduler *scheduler) : changes(0), scheduler(scheduler) {}
+
+    quint64 changes;
+
+public slots:
+    void change()
+    {
+        JobRequirements r = {100.0f, 100.0f, 50.0f, 0.0f, QString()};
+        quint32 id = scheduler->submit(QString("churn%1.gcode").arg(changes), r, 3600.0f);
+        scheduler->cancel(id);
+        changes++;
+    }
+
+private:
+    FarmScheduler *scheduler;
+};
+
+/**
+ * Runs the event loop of the GUI thread for a while, ControlApi works in it.
+ */
+static void wait(int ms)
+{
+    QEventLoop loop;
+    QTimer::singleShot(ms, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+/**
+ * @return number of responses
+ */
+static quint64 run(const char *name, int connections, int depth, const QByteArray &request, int ms)
+{
+    QThread thread;
+    LoadClient *client = new LoadClient(connections, depth, request);
+    client->moveToThread(&thread);
+    thread.start();
+
+    QElapsedTimer timer;
+    timer.start();
+    QMetaObject::invokeMethod(client, "start", Qt::QueuedConnection);
+    wait(ms);
+    QMetaObject::invokeMethod(client, "stop", Qt::BlockingQueuedConnection);
+    double seconds = timer.nsecsElapsed() / 1e9;
+    thread.quit();
+    thread.wait();
+
+    std::sort(client->latencies.begin(), client->latencies.end());
+    double mean = 0.0;
+    for(int i = 0; i < client->latencies.size(); i++)
+        mean += client->latencies[i];
+    int n = client->latencies.size();
+    mean = n ? mean / n : 0.0;
+    printf("%-22s %5d x %-3d %9.0f %8.1f %8.2f %8.2f %8.2f %6llu\n", name, connections, depth, client->responses / seconds,
+           client->bytes / seconds / 1e6, mean / 1e6, n ? client->latencies[n / 2] / 1e6 : 0.0,
+           n ? client->latencies[n * 99 / 100] / 1e6 : 0.0, static_cast<unsigned long long>(client->errors));
+    quint64 responses = client->responses;
+    delete client;
+    return responses;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    /* Własne ustawienia, nie te działającego print_server */
+    app.setOrganizationName("NESTIMO");
+    app.setApplicationName("bench_apiload");
+
+    QTemporaryDir uploads;
+    QSettings settings;
+    settings.setValue("api/enabled", true);
+    settings.setValue("api/address", "127.0.0.1");
+    settings.setValue("api/port", BENCH_PORT);
+    settings.setValue("api/uploadDir", uploads.path());
+    settings.sync();
+
+    FarmScheduler scheduler;
+    for(int i = 0; i < BENCH_PRINTERS; i++)
+    {
+        PrinterCapabilities c = {250.0f, 210.0f, 210.0f, 0.4f, "PLA", 1.0f};
+        scheduler.addPrinter(nullptr, c);
+    }
+    for(int i = 0; i < BENCH_JOBS; i++)
+    {
+        JobRequirements r = {100.0f, 100.0f, 50.0f, 0.0f, QString()};
+        scheduler.submit(QString("job%1.gcode").arg(i), r, 600.0f + 60.0f * (i % 100));
+    }
+
+    ControlApi api(&scheduler);
+    if(!api.start())
+    {
+        printf("API disabled\n");
+        return 1;
+    }
+    /* Serwer startuje w swoim wątku, migawka po API_SNAPSHOT_PERIOD_MS */
+    wait(2 * API_SNAPSHOT_PERIOD_MS);
+    printf("%d printers, %d jobs, /status is %d bytes, %d s per run\n\n", BENCH_PRINTERS, BENCH_JOBS,
+           api.snapshot().size(), BENCH_RUN_MS / 1000);
+    printf("%-22s %-11s %9s %8s %8s %8s %8s %6s\n", "run", "conn x pipe", "req/s", "MB/s", "mean ms", "p50 ms", "p99 ms", "errors");
+
+    QByteArray status = "GET /status HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    run("GET /status", 1, 1, status, BENCH_RUN_MS);
+    run("GET /status", 16, 1, status, BENCH_RUN_MS);
+    run("GET /status", 16, 8, status, BENCH_RUN_MS);
+    run("GET /status", 64, 8, status, BENCH_RUN_MS);
+
+    Churn churn(&scheduler);
+    QTimer churnTimer;
+    QObject::connect(&churnTimer, SIGNAL(timeout()), &churn, SLOT(change()));
+    churnTimer.start(BENCH_CHURN_MS);
+    run("GET /status, churn", 16, 8, status, BENCH_RUN_MS);
+    churnTimer.stop();
+
+    /* Wysyłane pliki szacowane w puli API i dopisywane do harmonogramu */
+    GcodeGenerator generator;
+    std::string gcode = generator.generate(BENCH_UPLOAD_LAYERS, 1500);
+    QByteArray upload = "POST /jobs?name=bench.gcode&sizeX=100&sizeY=100&sizeZ=4 HTTP/1.1\r\nHost: 127.0.0.1\r\n"
+                        "Content-Length: " + QByteArray::number(static_cast<int>(gcode.size())) + "\r\n\r\n";
+    upload.append(gcode.data(), static_cast<int>(gcode.size()));
+    int before = scheduler.getJobs().size();
+    int answered = static_cast<int>(run("POST /jobs, 1 MB", 4, 1, upload, BENCH_RUN_MS));
+
+    QElapsedTimer timer;
+    timer.start();
+    while(scheduler.getJobs().size() - before < answered && timer.elapsed() < 60000)
+        wait(10);
+    printf("\n%d uploads answered, %d of them in the scheduler %.2f s after the run\n", answered,
+           scheduler.getJobs().size() - before, timer.elapsed() / 1000.0);
+    return 0;
+}
+
+#include "main.moc"
@@ -0,0 +1,24 @@
+# Batching of small bulk frames: commands per second with short G-code lines, and the delay a
+# single command on an idle line pays for the batch deadline
+
+include(../bench.pri)
+
+CONFIG -= qt
+
+TARGET = bench_batching
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/icommandinterpreter.cpp
+
+HEADERS += \
+    $$SRC/min.h \
+    $$SRC/mincodec.h \
+    $$SRC/messages.h \
+    $$PWD/../common/simline.h \
+    $$PWD/../common/gcodegen.h
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "min.h"
+#include "simline.h"
+#include "gcodegen.h"
+
+// Synthetic file, about 2.3 MB of short G1 lines, sent round and round
+#define BENCH_LAYERS            (40)
+#define BENCH_MOVES_PER_LAYER   (1500)
+// Simulated time of one rate run and its step
+#define BENCH_DURATION_US       (20000000U)
+#define BENCH_STEP_US           (100U)
+// Single commands on an idle line: how many and how far apart
+#define BENCH_SINGLE_COMMANDS   (500U)
+#define BENCH_SINGLE_PERIOD_US  (20000U)
+
+typedef struct {
+    const char *name;
+    uint32_t bytesPerSecond;
+    uint32_t latencyUs;
+    double corruption;
+} LinkConfig;
+
+/**
+ * Firmware end, checks that every line arrives whole and in order and notes when the last one came.
+ */
+class Device : public ICommandInterpreter
+{
+public:
+    Device(const std::vector<std::string> *lines, SimClock *clock) :
+        lines(lines), clock(clock), received(0), mismatches(0), lastUs(0) {}
+
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        if(min_id != MSG_GCODE_LINE || len_payload < MsgGcodeLine::wire_size)
+            return true;
+        const std::string &expected = (*lines)[received % lines->size()];
+        MsgGcodeLine::View view(min_payload);
+        uint16_t length = static_cast<uint16_t>(len_payload - MsgGcodeLine::wire_size);
+        if(view.command_id() != static_cast<uint16_t>(received) || length != expected.size()
+                || memcmp(min_payload + MsgGcodeLine::wire_size, expected.data(), length) != 0)
+            mismatches++;
+        received++;
+        lastUs = clock->us;
+        return true;
+    }
+
+    const std::vector<std::string> *lines;
+    SimClock *clock;
+    uint64_t received;
+    uint64_t mismatches;
+    uint32_t lastUs;
+};
+
+class Host : public ICommandInterpreter
+{
+public:
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_id;
+        (void)min_payload;
+        (void)len_payload;
+        return true;
+    }
+};
+
+/**
+ * Like PrinterLink::poll(): the received data, then up to a window of frames while one is due.
+ */
+static void pollEnd(MinProtocol &end, SimLine &rx)
+{
+    uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+    uint32_t n = rx.receive(data, sizeof(data));
+    end.min_poll(n ? data : nullptr, n);
+    for(uint32_t i = 0; i < TRANSPORT_MAX_WINDOW_SIZE && end.min_next_deadline_ms() == 0; i++)
+        end.min_poll(nullptr, 0);
+}
+
+/**
+ * Host settings of PrinterLink::loadProfile(), batching and compression switched by the profile keys.
+ */
+static void configureHost(MinProtocol &hostEnd, const LinkConfig &config, bool batches, bool compression)
+{
+    uint32_t baud = config.bytesPerSecond * 10U;
+    uint8_t features = static_cast<uint8_t>(MIN_DEFAULT_FEATURES);
+    if(!compression)
+        features = static_cast<uint8_t>(features & ~MIN_FEATURE_COMPRESSION);
+    hostEnd.min_set_features(features);
+    hostEnd.min_set_batch_deadline_us(batches ? MIN_DEFAULT_BATCH_DEADLINE_US : 0U);
+    hostEnd.min_set_max_payload(static_cast<uint16_t>(std::max(baud / 1000U, static_cast<uint32_t>(MAX_PAYLOAD))));
+    hostEnd.min_set_line_rate(config.bytesPerSecond);
+    hostEnd.min_transport_reset(true);
+}
+
+static bool queueLine(MinProtocol &hostEnd, const std::vector<std::string> &lines, uint64_t index)
+{
+    const std::string &line = lines[index % lines.size()];
+    MsgGcodeLine message;
+    message.command_id = static_cast<uint16_t>(index);
+    return hostEnd.min_queue_message(message, reinterpret_cast<const uint8_t *>(line.data()), static_cast<uint16_t>(line.size()));
+}
+
+/**
+ * Effective command rate: the bulk lane kept full of short lines.
+ */
+static void benchRate(const std::vector<std::string> &lines, const LinkConfig &config, bool batches, bool compression)
+{
+    SimClock clock;
+    SimLine toPrinter(&clock, config.bytesPerSecond, config.latencyUs, config.corruption);
+    SimLine toHost(&clock, config.bytesPerSecond, config.latencyUs);
+    Host host;
+    Device device(&lines, &clock);
+    MinProtocol hostEnd(&toPrinter, &clock, &host);
+    MinProtocol printerEnd(&toHost, &clock, &device);
+    configureHost(hostEnd, config, batches, compression);
+
+    srand(1);
+    uint64_t sent = 0;
+    for(clock.us = 0; clock.us < BENCH_DURATION_US; clock.us += BENCH_STEP_US)
+    {
+        while(queueLine(hostEnd, lines, sent))
+            sent++;
+        toPrinter.advance();
+        toHost.advance();
+        pollEnd(printerEnd, toPrinter);
+        pollEnd(hostEnd, toHost);
+    }
+
+    uint32_t batchesSent = hostEnd.min_batches_sent();
+    printf("%-28s %-7s %-4s %9.0f %9.2f %9.1f %10llu\n", config.name, batches ? "on" : "off", compression ? "on" : "off",
+           device.received * 1e6 / BENCH_DURATION_US,
+           device.received ? static_cast<double>(toPrinter.getSent()) / device.received : 0.0,
+           batchesSent ? static_cast<double>(hostEnd.min_batched_frames()) / batchesSent : 1.0,
+           static_cast<unsigned long long>(device.mismatches));
+}
+
+/**
+ * The price of the deadline: one command at a time on an otherwise idle line, time from
+ * min_queue_message() until the printer end has it.
+ */
+static void benchSingle(const std::vector<std::string> &lines, const LinkConfig &config, bool batches)
+{
+    SimClock clock;
+    SimLine toPrinter(&clock, config.bytesPerSecond, config.latencyUs);
+    SimLine toHost(&clock, config.bytesPerSecond, config.latencyUs);
+    Host host;
+    Device device(&lines, &clock);
+    MinProtocol hostEnd(&toPrinter, &clock, &host);
+    MinProtocol printerEnd(&toHost, &clock, &device);
+    configureHost(hostEnd, config, batches, true);
+
+    std::vector<uint32_t> delays;
+    uint64_t sent = 0;
+    uint32_t queuedUs = 0;
+    for(clock.us = 0; sent < BENCH_SINGLE_COMMANDS || device.received < sent; clock.us += BENCH_STEP_US)
+    {
+        if(device.received == sent && sent < BENCH_SINGLE_COMMANDS && clock.us >= sent * BENCH_SINGLE_PERIOD_US)
+        {
+            queuedUs = clock.us;
+            if(queueLine(hostEnd, lines, sent))
+                sent++;
+        }
+        toPrinter.advance();
+        toHost.advance();
+        pollEnd(printerEnd, toPrinter);
+        pollEnd(hostEnd, toHost);
+        if(device.received == sent && delays.size() < sent)
+            delays.push_back(device.lastUs - queuedUs);
+    }
+
+    std::sort(delays.begin(), delays.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < delays.size(); i++)
+        sum += delays[i];
+    printf("%-28s %-7s %9.2f %9.2f\n", config.name, batches ? "on" : "off", sum / delays.size() / 1000.0,
+           delays.back() / 1000.0);
+}
+
+int main()
+{
+    GcodeGenerator generator;
+    std::string text = generator.generate(BENCH_LAYERS, BENCH_MOVES_PER_LAYER);
+    std::vector<std::string> lines;
+    uint64_t bytes = 0;
+    size_t start = 0;
+    while(start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos)
+            end = text.size();
+        /* Bez komentarzy, jak po preprocesorze */
+        if(end > start && text[start] != ';')
+        {
+            lines.push_back(text.substr(start, end - start));
+            bytes += end - start;
+        }
+        start = end + 1;
+    }
+
+    static const LinkConfig configs[] = {
+        {"115200 baud, USB 1 ms", 11520, 1000, 0.0},
+        {"250000 baud, USB 1 ms", 25000, 1000, 0.0},
+        {"1 Mbaud, USB 1 ms", 100000, 1000, 0.0},
+        {"1 Mbaud, USB 1 ms, 0.05%", 100000, 1000, 0.0005},
+        {"12 Mbaud, native 1 ms", 1200000, 1000, 0.0},
+    };
+
+    printf("%zu G-code lines, %.1f bytes each on average, MsgGcodeLine adds %u.\n\n", lines.size(),
+           static_cast<double>(bytes) / lines.size(), static_cast<unsigned>(MsgGcodeLine::wire_size));
+    printf("Commands delivered for %u s with the bulk lane kept full; wire = bytes host -> printer per command,\n"
+           "per batch = commands in a batch frame. The percentage is the share of bytes corrupted.\n\n",
+           BENCH_DURATION_US / 1000000U);
+    printf("%-28s %-7s %-4s %9s %9s %9s %10s\n", "link", "batches", "lz", "cmds/s", "wire/cmd", "per batch", "mismatches");
+    for(size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    {
+        for(int batches = 0; batches < 2; batches++)
+        {
+            benchRate(lines, configs[i], batches != 0, false);
+            benchRate(lines, configs[i], batches != 0, true);
+        }
+    }
+
+    printf("\nOne command every %u ms on an idle line, %u commands, delay until the printer has it.\n\n",
+           BENCH_SINGLE_PERIOD_US / 1000U, BENCH_SINGLE_COMMANDS);
+    printf("%-28s %-7s %9s %9s\n", "link", "batches", "mean ms", "max ms");
+    for(size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    {
+        if(configs[i].corruption > 0.0)
+            continue;
+        benchSingle(lines, configs[i], false);
+        benchSingle(lines, configs[i], true);
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+# Settings shared by the benchmarks. SRC is the directory of print_server, the sources a
+# benchmark needs are added from there.
+
+SRC = $$PWD/..
+
+CONFIG += console c++11 release
+CONFIG -= app_bundle debug
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += $$SRC $$PWD/common
+DEPENDPATH += $$SRC $$PWD/common
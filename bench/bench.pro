@@ -0,0 +1,24 @@
+# Benchmarks of print_server, each one a console program built from the sources in the parent
+# directory. Not part of the application build: qmake bench/bench.pro && make, then run the
+# programs from their directories.
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    delegate \
+    realtime \
+    scheduler \
+    apiload \
+    telemetry \
+    telemetrystore \
+    preview \
+    compression \
+    framesize \
+    window \
+    batching \
+    idle \
+    flowcontrol \
+    planner \
+    preprocess \
+    estimator \
+    charts
@@ -0,0 +1,20 @@
+# Telemetry charts: frame time of ChartRenderer against the 60 fps budget, with hours of history
+# of several printers. Runs without a display (QT_QPA_PLATFORM=offscreen unless set).
+
+include(../bench.pri)
+
+QT += core gui widgets
+
+TARGET = bench_charts
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/telemetrychart.cpp \
+    $$SRC/telemetrystore.cpp \
+    $$SRC/telemetrybus.cpp
+
+HEADERS += \
+    $$SRC/telemetrychart.h \
+    $$SRC/telemetrystore.h \
+    $$SRC/telemetrybus.h
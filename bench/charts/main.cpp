@@ -0,0 +1,190 @@
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QVector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include "telemetrychart.h"
+#include "telemetrystore.h"
+
+// History recorded before the charts open, every printer at 10 Hz
+#define BENCH_PRINTERS          (8)
+#define BENCH_HOURS             (4)
+#define BENCH_RATE_HZ           (10)
+// Live part: a frame every CHART_FRAME_MS for this long, new samples keep coming
+#define BENCH_LIVE_MS           (20000)
+// Size of the chart image
+#define BENCH_WIDTH             (800)
+#define BENCH_HEIGHT            (200)
+// Frame budget at 60 fps, ms
+#define BENCH_BUDGET_MS         (1000.0 / 60.0)
+
+typedef struct {
+    qint32 hotend;
+    double x;
+    double vx;
+    qint64 n;
+} PrinterState;
+
+/**
+ * One frame of every printer, printing as in the telemetry store benchmark: a noisy hotend,
+ * a steady bed, X going back and forth, Z in layers and E growing.
+ */
+static void appendFrame(TelemetryStore &store, QVector<PrinterState> &printers, qint64 time)
+{
+    for(int p = 0; p < printers.size(); p++)
+    {
+        PrinterState &s = printers[p];
+        qint32 rows[TSTORE_TABLES][TSTORE_MAX_COLUMNS] = {};
+        if(rand() % 4 == 0)
+            s.hotend += rand() % 3 - 1;
+        rows[TSTORE_TEMPERATURES][0] = s.hotend;
+        rows[TSTORE_TEMPERATURES][1] = 2100;
+        rows[TSTORE_TEMPERATURES][2] = 600 + (rand() % 20 == 0 ? rand() % 3 - 1 : 0);
+        rows[TSTORE_TEMPERATURES][3] = 600;
+
+        s.x += s.vx / BENCH_RATE_HZ;
+        if(s.x > 200.0 || s.x < 0.0)
+            s.vx = -s.vx;
+        rows[TSTORE_POSITION][0] = static_cast<qint32>(lround(s.x * 1000.0));
+        rows[TSTORE_POSITION][1] = static_cast<qint32>(lround(100000.0 + 30000.0 * sin(s.n * 0.01)));
+        rows[TSTORE_POSITION][2] = static_cast<qint32>(200 + (s.n / 3000) * 200);
+        /* Retrakcja co 20 s, żeby wykres przepływu miał spadki */
+        rows[TSTORE_POSITION][3] = static_cast<qint32>(s.n * 33 - (s.n % 200 < 5 ? 1000 : 0));
+        rows[TSTORE_PROGRESS][0] = static_cast<qint32>(s.n % 10000);
+        rows[TSTORE_STATE][0] = 3;
+
+        for(int table = 0; table < TSTORE_TABLES; table++)
+            store.append(p, table, time, rows[table]);
+        s.n++;
+    }
+}
+
+typedef struct {
+    double firstMs;                 ///< Frame with nothing to reuse
+    double meanMs;
+    double maxMs;
+    int frames;
+    int overBudget;
+} FrameTimes;
+
+/**
+ * Renders the chart as its thread does, a frame every CHART_FRAME_MS while the samples keep
+ * coming at BENCH_RATE_HZ. Every frame is rendered, the chart skips those with nothing new.
+ */
+static FrameTimes run(TelemetryStore &store, QVector<PrinterState> &printers, qint64 *now,
+                      const QVector<ChartSeries> &series, qint64 span)
+{
+    ChartRenderer renderer(&store);
+    renderer.setSeries(series);
+    QSize size(BENCH_WIDTH, BENCH_HEIGHT);
+    QElapsedTimer timer;
+
+    FrameTimes times = {0.0, 0.0, 0.0, 0, 0};
+    timer.start();
+    renderer.render(*now, span, size);
+    times.firstMs = timer.nsecsElapsed() / 1e6;
+
+    double total = 0.0;
+    qint64 nextSample = *now + 1000 / BENCH_RATE_HZ;
+    for(qint64 end = *now + BENCH_LIVE_MS; *now < end; *now += CHART_FRAME_MS)
+    {
+        for(; nextSample <= *now; nextSample += 1000 / BENCH_RATE_HZ)
+            appendFrame(store, printers, nextSample);
+        timer.start();
+        renderer.render(*now, span, size);
+        double ms = timer.nsecsElapsed() / 1e6;
+        total += ms;
+        times.maxMs = std::max(times.maxMs, ms);
+        times.frames++;
+        if(ms > BENCH_BUDGET_MS)
+            times.overBudget++;
+    }
+    /* Następny przebieg zaczyna od próbki, na której ten skończył */
+    *now = nextSample - 1000 / BENCH_RATE_HZ;
+    times.meanMs = total / times.frames;
+    return times;
+}
+
+static ChartSeries makeSeries(int printer, int field, int kind, const QColor &color)
+{
+    ChartSeries s;
+    s.printer = printer;
+    s.field = field;
+    s.kind = kind;
+    s.color = color;
+    s.name = QString("%1").arg(printer);
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Bez ekranu, rysowanie i tak idzie do QImage */
+    if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    srand(1);
+
+    TelemetryStore store;
+    QVector<PrinterState> printers;
+    for(int p = 0; p < BENCH_PRINTERS; p++)
+    {
+        store.addPrinter();
+        PrinterState s = {2100, 20.0 * p, 50.0, 0};
+        printers.append(s);
+    }
+    qint64 now = 1700000000000LL;
+    for(qint64 n = 0; n < static_cast<qint64>(BENCH_HOURS) * 3600 * BENCH_RATE_HZ; n++)
+    {
+        now += 1000 / BENCH_RATE_HZ;
+        appendFrame(store, printers, now);
+    }
+
+    /* Wykresy jak w MainWindow, do tego jeden z wszystkimi drukarkami */
+    QVector<ChartSeries> temperatures;
+    temperatures.append(makeSeries(0, TELEMETRY_HOTEND, CHART_VALUE, QColor(220, 50, 30)));
+    temperatures.append(makeSeries(0, TELEMETRY_HOTEND_TARGET, CHART_VALUE, QColor(240, 160, 150)));
+    temperatures.append(makeSeries(0, TELEMETRY_BED, CHART_VALUE, QColor(30, 90, 220)));
+    temperatures.append(makeSeries(0, TELEMETRY_BED_TARGET, CHART_VALUE, QColor(150, 180, 240)));
+    QVector<ChartSeries> flow;
+    flow.append(makeSeries(0, TELEMETRY_E, CHART_RATE, QColor(40, 160, 60)));
+    QVector<ChartSeries> hotends;
+    QVector<ChartSeries> flows;
+    for(int p = 0; p < BENCH_PRINTERS; p++)
+    {
+        hotends.append(makeSeries(p, TELEMETRY_HOTEND, CHART_VALUE, QColor::fromHsv(p * 360 / BENCH_PRINTERS, 200, 200)));
+        flows.append(makeSeries(p, TELEMETRY_E, CHART_RATE, QColor::fromHsv(p * 360 / BENCH_PRINTERS, 200, 200)));
+    }
+
+    const struct {
+        const char *name;
+        const QVector<ChartSeries> *series;
+    } charts[] = {
+        {"temperatures, 1 printer", &temperatures},
+        {"flow, 1 printer", &flow},
+        {"hotends of all printers", &hotends},
+        {"flow of all printers", &flows},
+    };
+    static const qint64 spans[] = {60 * 1000LL, CHART_DEFAULT_SPAN_MS, 2 * 3600 * 1000LL};
+
+    printf("%d printers with %d h of history at %d Hz, %dx%d chart, a frame every %d ms for %d s while\n"
+           "samples keep coming. Time of ChartRenderer::render(), columns and painting, which runs in the\n"
+           "thread of the chart; the GUI thread only paints the image. Budget %.1f ms (60 fps).\n\n",
+           BENCH_PRINTERS, BENCH_HOURS, BENCH_RATE_HZ, BENCH_WIDTH, BENCH_HEIGHT, CHART_FRAME_MS,
+           BENCH_LIVE_MS / 1000, BENCH_BUDGET_MS);
+    printf("%-26s %8s %10s %9s %9s %7s %7s\n", "chart", "span", "first ms", "mean ms", "max ms", "frames", "over");
+    for(size_t c = 0; c < sizeof(charts) / sizeof(charts[0]); c++)
+    {
+        for(size_t s = 0; s < sizeof(spans) / sizeof(spans[0]); s++)
+        {
+            FrameTimes t = run(store, printers, &now, *charts[c].series, spans[s]);
+            char span[16];
+            snprintf(span, sizeof(span), spans[s] >= 3600 * 1000LL ? "%lld h" : "%lld min",
+                     static_cast<long long>(spans[s] >= 3600 * 1000LL ? spans[s] / 3600000 : spans[s] / 60000));
+            printf("%-26s %8s %10.2f %9.3f %9.2f %7d %7d\n", charts[c].name, span, t.firstMs, t.meanMs, t.maxMs,
+                   t.frames, t.overBudget);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#ifndef GCODEGEN_H
+#define GCODEGEN_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+
+/**
+ * @brief GcodeGenerator
+ *
+ * Synthetic slicer-like G-code for the benchmarks, the tree has no job corpus. Every layer starts
+ * with a ";LAYER:" comment and a Z move, then short extruding G1 moves in random directions with
+ * travels and retracts (2%), arcs (1%) and dwells (0.2%). E is reset every 10 layers. A large file is
+ * written in pieces, each piece continuing from the layer the previous one stopped at.
+ *
+ * generateOrganic() gives the small-segment curves of an organic model instead.
+ *
+ * The same seed always gives the same file. No Qt, so the MIN benchmarks use it too.
+ */
+class GcodeGenerator
+{
+public:
+    explicit GcodeGenerator(uint32_t seed = 1) : state(seed ? seed : 1) {}
+
+    /**
+     * @param firstLayer layer to start with, the setup lines come only before layer 1
+     */
+    std::string generate(int layers, int movesPerLayer, int firstLayer = 1)
+    {
+        std::string out = firstLayer == 1 ? "G21\nG90\nM82\nG28\nM109 S200\nG92 E0\n" : "";
+        double e = 0.0;
+        for(int layer = firstLayer; layer < firstLayer + layers; layer++)
+        {
+            append(out, ";LAYER:%d\nG1 Z%.3f F600\n", layer, 0.2 * layer);
+            double x = 100.0;
+            double y = 100.0;
+            for(int k = 0; k < movesPerLayer; k++)
+            {
+                double r = uniform(0.0, 1.0);
+                if(r < 0.02)
+                {
+                    append(out, "G1 E%.5f F2400\n", e - 1.0);
+                    append(out, "G0 X%.3f Y%.3f F9000\n", uniform(10.0, 200.0), uniform(10.0, 200.0));
+                    append(out, "G1 E%.5f F2400\n", e);
+                }
+                else if(r < 0.03)
+                {
+                    append(out, "G2 X%.3f Y%.3f I5 J0 E%.5f F1800\n", x + 10.0, y, e + 0.5);
+                    e += 0.5;
+                    x += 10.0;
+                }
+                else if(r < 0.032)
+                {
+                    out += "G4 P200\n";
+                }
+                else
+                {
+                    static const int feeds[3] = {1800, 2400, 3000};
+                    double a = uniform(0.0, 2.0 * M_PI);
+                    double l = uniform(0.2, 5.0);
+                    x += l * cos(a);
+                    y += l * sin(a);
+                    e += l * 0.033;
+                    append(out, "G1 X%.3f Y%.3f E%.5f F%d\n", x, y, e, feeds[next() % 3U]);
+                }
+            }
+            if(layer % 10 == 0)
+            {
+                out += "G92 E0\n";
+                e = 0.0;
+            }
+        }
+        return out;
+    }
+
+    /**
+     * Organic model: every layer is one closed wavy outline made of short G1 chords, as slicers
+     * write curved surfaces (about 0.3 mm per chord at 600 chords per layer). The outline drifts
+     * from layer to layer and the chords get a little noise, so no two layers are the same.
+     */
+    std::string generateOrganic(int layers, int movesPerLayer, int feedrate = 2400)
+    {
+        std::string out = "G21\nG90\nM82\nG28\nM109 S200\nG92 E0\n";
+        double e = 0.0;
+        for(int layer = 1; layer <= layers; layer++)
+        {
+            append(out, ";LAYER:%d\nG1 Z%.3f F600\n", layer, 0.2 * layer);
+            double phase = 0.05 * layer;
+            double lastX = 0.0;
+            double lastY = 0.0;
+            for(int k = 0; k <= movesPerLayer; k++)
+            {
+                double a = 2.0 * M_PI * k / movesPerLayer;
+                double r = 30.0 + 6.0 * sin(3.0 * a + phase) + 2.5 * sin(7.0 * a - 2.0 * phase) + uniform(-0.02, 0.02);
+                double x = 110.0 + r * cos(a);
+                double y = 110.0 + r * sin(a);
+                if(k == 0)
+                {
+                    append(out, "G0 X%.3f Y%.3f F9000\n", x, y);
+                }
+                else
+                {
+                    e += sqrt((x - lastX) * (x - lastX) + (y - lastY) * (y - lastY)) * 0.033;
+                    append(out, "G1 X%.3f Y%.3f E%.5f F%d\n", x, y, e, feedrate);
+                }
+                lastX = x;
+                lastY = y;
+            }
+            if(layer % 10 == 0)
+            {
+                out += "G92 E0\n";
+                e = 0.0;
+            }
+        }
+        return out;
+    }
+
+private:
+    /* xorshift32, niezależny od rand() biblioteki */
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    double uniform(double low, double high)
+    {
+        return low + (high - low) * (next() / 4294967296.0);
+    }
+
+    template <class... Args>
+    static void append(std::string &out, const char *format, Args... args)
+    {
+        char line[96];
+        int length = snprintf(line, sizeof(line), format, args...);
+        out.append(line, static_cast<size_t>(length));
+    }
+
+    uint32_t state;
+};
+
+#endif // GCODEGEN_H
@@ -0,0 +1,51 @@
+# Sources of a printer link, for benchmarks of the parts built on PrinterLink. Include after
+# bench.pri.
+
+QT += core serialport
+
+SOURCES += \
+    $$SRC/printerlink.cpp \
+    $$SRC/communication.cpp \
+    $$SRC/portregistry.cpp \
+    $$SRC/jobstreamer.cpp \
+    $$SRC/commandinterpreter.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/icommandinterpreter.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/system.cpp \
+    $$SRC/linkarena.cpp \
+    $$SRC/telemetrybus.cpp \
+    $$SRC/telemetrystore.cpp \
+    $$SRC/gcodeparser.cpp \
+    $$SRC/gcodepreprocessor.cpp \
+    $$SRC/gcodeindex.cpp \
+    $$SRC/motionplanner.cpp \
+    $$SRC/printestimator.cpp
+
+HEADERS += \
+    $$SRC/printerlink.h \
+    $$SRC/communication.h \
+    $$SRC/portregistry.h \
+    $$SRC/jobstreamer.h \
+    $$SRC/commandinterpreter.h \
+    $$SRC/commanddispatcher.h \
+    $$SRC/min.h \
+    $$SRC/mincodec.h \
+    $$SRC/messages.h \
+    $$SRC/types.h \
+    $$SRC/callback.h \
+    $$SRC/delegate.h \
+    $$SRC/iserialcommunication.h \
+    $$SRC/icommandinterpreter.h \
+    $$SRC/isystem.h \
+    $$SRC/system.h \
+    $$SRC/linkarena.h \
+    $$SRC/telemetrybus.h \
+    $$SRC/telemetrystore.h \
+    $$SRC/gcodeparser.h \
+    $$SRC/gcodepreprocessor.h \
+    $$SRC/gcodeindex.h \
+    $$SRC/motionplanner.h \
+    $$SRC/printestimator.h
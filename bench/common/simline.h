@@ -0,0 +1,130 @@
+#ifndef SIMLINE_H
+#define SIMLINE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <deque>
+#include "iserialcommunication.h"
+#include "isystem.h"
+
+// Transmit buffer of the simulated port, as COMMUNICATION_TX_BUFFER_SIZE
+#define SIMLINE_TX_BUFFER_SIZE      (4096)
+
+/**
+ * @brief SimClock
+ *
+ * Time of a simulation, advanced by the benchmark. Both ends of a link use the same clock.
+ */
+class SimClock : public ISystem
+{
+public:
+    SimClock() : us(0) {}
+
+    virtual int getCurrentTimeInMs()
+    {
+        return static_cast<int>(us / 1000U);
+    }
+
+    virtual int getCurrentTimeInUs()
+    {
+        return static_cast<int>(us);
+    }
+
+    uint32_t us;
+};
+
+/**
+ * @brief SimLine
+ *
+ * One direction of a serial link. Bytes written by the sending MinProtocol wait in a transmit
+ * buffer, leave it at the rate of the line and arrive after the latency (e.g. the USB polling of
+ * a USB-serial converter). A byte may be corrupted on the way.
+ *
+ * As in Communication the buffer size is only what transmitSpace() reports: MIN checks the space
+ * without the stuff bytes, the few bytes more are buffered too.
+ */
+class SimLine : public ISerialCommunication
+{
+public:
+    SimLine(SimClock *clock, uint32_t bytesPerSecond, uint32_t latencyUs, double corruption = 0.0) :
+        clock(clock), bytesPerSecond(bytesPerSecond), latencyUs(latencyUs),
+        corruption(static_cast<uint32_t>(corruption * RAND_MAX)), credit(0), lastUs(0), sent(0) {}
+
+    virtual void sendByte(char c)
+    {
+        buffer.push_back(static_cast<uint8_t>(c));
+    }
+
+    virtual int transmitSpace()
+    {
+        return buffer.size() >= SIMLINE_TX_BUFFER_SIZE ? 0 : static_cast<int>(SIMLINE_TX_BUFFER_SIZE - buffer.size());
+    }
+
+    virtual void transmitFinished()
+    {
+    }
+
+    /**
+     * Moves the bytes the line carried since the last call from the buffer onto the wire.
+     */
+    void advance()
+    {
+        /* Kredyt w bajtach * 1e6, żeby wolne linie nie gubiły ułamków */
+        credit += static_cast<uint64_t>(clock->us - lastUs) * bytesPerSecond;
+        lastUs = clock->us;
+        while(credit >= 1000000U && !buffer.empty())
+        {
+            credit -= 1000000U;
+            uint8_t byte = buffer.front();
+            buffer.pop_front();
+            if(corruption != 0 && static_cast<uint32_t>(rand()) < corruption)
+                byte ^= 0x10U;
+            wire.push_back(Byte(clock->us + latencyUs, byte));
+            sent++;
+        }
+        /* Bezczynna linia nie zbiera kredytu */
+        if(buffer.empty())
+            credit = 0;
+    }
+
+    /**
+     * Takes the bytes which arrived at the other end by now.
+     *
+     * @return number of bytes in data
+     */
+    uint32_t receive(uint8_t *data, uint32_t size)
+    {
+        uint32_t n = 0;
+        while(n < size && !wire.empty() && static_cast<int32_t>(clock->us - wire.front().arrival) >= 0)
+        {
+            data[n++] = wire.front().byte;
+            wire.pop_front();
+        }
+        return n;
+    }
+
+    uint64_t getSent() const
+    {
+        return sent;
+    }
+
+private:
+    struct Byte {
+        uint32_t arrival;
+        uint8_t byte;
+
+        Byte(uint32_t arrival, uint8_t byte) : arrival(arrival), byte(byte) {}
+    };
+
+    SimClock *clock;
+    uint32_t bytesPerSecond;
+    uint32_t latencyUs;
+    uint32_t corruption;            ///< Probability of a corrupted byte, in units of 1/RAND_MAX
+    uint64_t credit;
+    uint32_t lastUs;
+    std::deque<uint8_t> buffer;
+    std::deque<Byte> wire;
+    uint64_t sent;
+};
+
+#endif // SIMLINE_H
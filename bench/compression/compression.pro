@@ -0,0 +1,23 @@
+# Payload compression of MIN: ratio and speed of the codec, lines per second with and without it
+
+include(../bench.pri)
+
+CONFIG -= qt
+
+TARGET = bench_compression
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/icommandinterpreter.cpp
+
+HEADERS += \
+    $$SRC/min.h \
+    $$SRC/mincodec.h \
+    $$SRC/messages.h \
+    $$PWD/../common/simline.h \
+    $$PWD/../common/gcodegen.h
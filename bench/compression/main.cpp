@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "min.h"
+#include "mincodec.h"
+#include "simline.h"
+#include "gcodegen.h"
+
+// Synthetic file when none is given, about 6.8 MB
+#define BENCH_LAYERS            (120)
+#define BENCH_MOVES_PER_LAYER   (1500)
+// Simulated time of one line rate run and its step
+#define BENCH_DURATION_US       (20000000U)
+#define BENCH_STEP_US           (100U)
+
+typedef struct {
+    const char *name;
+    uint32_t bytesPerSecond;
+    uint32_t latencyUs;
+    double corruption;
+} LinkConfig;
+
+/**
+ * Firmware end, checks that every line arrives whole and in order.
+ */
+class Device : public ICommandInterpreter
+{
+public:
+    explicit Device(const std::vector<std::string> *lines) : lines(lines), received(0), mismatches(0) {}
+
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        if(min_id != MSG_GCODE_LINE || len_payload < MsgGcodeLine::wire_size)
+            return true;
+        const std::string &expected = (*lines)[received % lines->size()];
+        MsgGcodeLine::View view(min_payload);
+        uint16_t length = static_cast<uint16_t>(len_payload - MsgGcodeLine::wire_size);
+        if(view.command_id() != static_cast<uint16_t>(received) || length != expected.size()
+                || memcmp(min_payload + MsgGcodeLine::wire_size, expected.data(), length) != 0)
+            mismatches++;
+        received++;
+        return true;
+    }
+
+    const std::vector<std::string> *lines;
+    uint64_t received;
+    uint64_t mismatches;
+};
+
+class Host : public ICommandInterpreter
+{
+public:
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_id;
+        (void)min_payload;
+        (void)len_payload;
+        return true;
+    }
+};
+
+/**
+ * Like PrinterLink::poll(): the received data, then up to a window of frames while one is due.
+ */
+static void pollEnd(MinProtocol &end, SimLine &rx)
+{
+    uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+    uint32_t n = rx.receive(data, sizeof(data));
+    end.min_poll(n ? data : nullptr, n);
+    for(uint32_t i = 0; i < TRANSPORT_MAX_WINDOW_SIZE && end.min_next_deadline_ms() == 0; i++)
+        end.min_poll(nullptr, 0);
+}
+
+/**
+ * Lines as JobStreamer sends them, without comments and trailing blanks.
+ */
+static void splitLines(const std::string &text, std::vector<std::string> *lines)
+{
+    size_t start = 0;
+    while(start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(start, end - start);
+        size_t comment = line.find(';');
+        if(comment != std::string::npos)
+            line.erase(comment);
+        while(!line.empty() && (line[line.size() - 1] == ' ' || line[line.size() - 1] == '\r'))
+            line.erase(line.size() - 1);
+        if(!line.empty())
+            lines->push_back(line);
+        start = end + 1;
+    }
+}
+
+/**
+ * The codec alone: every line compressed as a bulk frame payload would be, then decoded.
+ */
+static void benchCodec(const std::vector<std::string> &lines)
+{
+    static struct min_encoder encoder;
+    static struct min_codec decoder;
+    min_encoder_reset(&encoder);
+    min_codec_reset(&decoder);
+
+    std::vector<uint8_t> frames;
+    std::vector<uint16_t> lengths;
+    uint64_t raw = 0;
+    uint64_t compressed = 0;
+    uint64_t plain = 0;
+    uint8_t payload[MAX_PAYLOAD];
+    uint8_t out[MAX_PAYLOAD];
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < lines.size(); i++)
+    {
+        uint16_t n = static_cast<uint16_t>(MsgGcodeLine::wire_size + lines[i].size());
+        payload[0] = static_cast<uint8_t>(i);
+        payload[1] = static_cast<uint8_t>(i >> 8);
+        memcpy(payload + MsgGcodeLine::wire_size, lines[i].data(), lines[i].size());
+        uint16_t m = min_encoder_compress(&encoder, payload, n, out, static_cast<uint16_t>(n - 1U));
+        raw += n;
+        /* Ramka, która się nie skróciła, idzie bez kompresji i nie trafia do okna */
+        if(m == 0)
+        {
+            plain++;
+            compressed += n;
+            lengths.push_back(0);
+            continue;
+        }
+        compressed += m;
+        lengths.push_back(m);
+        frames.insert(frames.end(), out, out + m);
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+    uint64_t bad = 0;
+    size_t offset = 0;
+    for(size_t i = 0; i < lines.size(); i++)
+    {
+        if(lengths[i] == 0)
+            continue;
+        int16_t n = min_codec_decode(&decoder, &frames[offset], lengths[i], payload, sizeof(payload));
+        offset += lengths[i];
+        if(n != static_cast<int16_t>(MsgGcodeLine::wire_size + lines[i].size()) || payload[0] != static_cast<uint8_t>(i)
+                || memcmp(payload + MsgGcodeLine::wire_size, lines[i].data(), lines[i].size()) != 0)
+            bad++;
+    }
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    double encodeS = std::chrono::duration<double>(t1 - t0).count();
+    double decodeS = std::chrono::duration<double>(t2 - t1).count();
+    printf("codec: %zu lines, %llu payload bytes -> %llu (%.3f), %llu frames not shorter, %llu decoded wrong\n",
+           lines.size(), static_cast<unsigned long long>(raw), static_cast<unsigned long long>(compressed),
+           static_cast<double>(compressed) / raw, static_cast<unsigned long long>(plain), static_cast<unsigned long long>(bad));
+    printf("       encode %.1f MB/s (%.0f ns per line), decode %.1f MB/s\n\n", raw / encodeS / 1e6,
+           encodeS * 1e9 / lines.size(), raw / decodeS / 1e6);
+}
+
+/**
+ * Sends the lines over a simulated line with the host settings of PrinterLink::loadProfile().
+ */
+static void benchLink(const std::vector<std::string> &lines, const LinkConfig &config, bool compression)
+{
+    SimClock clock;
+    SimLine toPrinter(&clock, config.bytesPerSecond, config.latencyUs, config.corruption);
+    SimLine toHost(&clock, config.bytesPerSecond, config.latencyUs);
+    Host host;
+    Device device(&lines);
+    MinProtocol hostEnd(&toPrinter, &clock, &host);
+    MinProtocol printerEnd(&toHost, &clock, &device);
+
+    uint32_t baud = config.bytesPerSecond * 10U;
+    uint8_t features = static_cast<uint8_t>(MIN_DEFAULT_FEATURES);
+    if(!compression)
+        features = static_cast<uint8_t>(features & ~MIN_FEATURE_COMPRESSION);
+    hostEnd.min_set_features(features);
+    hostEnd.min_set_max_payload(static_cast<uint16_t>(std::max(baud / 1000U, static_cast<uint32_t>(MAX_PAYLOAD))));
+    hostEnd.min_set_line_rate(config.bytesPerSecond);
+    hostEnd.min_transport_reset(true);
+
+    srand(1);
+    uint64_t sent = 0;
+    for(clock.us = 0; clock.us < BENCH_DURATION_US; clock.us += BENCH_STEP_US)
+    {
+        while(true)
+        {
+            const std::string &line = lines[sent % lines.size()];
+            MsgGcodeLine message;
+            message.command_id = static_cast<uint16_t>(sent);
+            if(!hostEnd.min_queue_message(message, reinterpret_cast<const uint8_t *>(line.data()), static_cast<uint16_t>(line.size())))
+                break;
+            sent++;
+        }
+        toPrinter.advance();
+        toHost.advance();
+        pollEnd(printerEnd, toPrinter);
+        pollEnd(hostEnd, toHost);
+    }
+
+    uint32_t in = hostEnd.min_compressed_bytes_in();
+    uint32_t out = hostEnd.min_compressed_bytes_out();
+    printf("%-28s %-4s %9.0f %9.2f %9.3f %10llu\n", config.name, compression ? "on" : "off",
+           device.received * 1e6 / BENCH_DURATION_US,
+           device.received ? static_cast<double>(toPrinter.getSent()) / device.received : 0.0,
+           in ? static_cast<double>(out) / in : 1.0, static_cast<unsigned long long>(device.mismatches));
+}
+
+int main(int argc, char *argv[])
+{
+    std::string text;
+    if(argc > 1)
+    {
+        std::ifstream file(argv[1], std::ios::binary);
+        if(!file)
+        {
+            printf("can not read %s\n", argv[1]);
+            return 1;
+        }
+        text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        GcodeGenerator generator;
+        text = generator.generate(BENCH_LAYERS, BENCH_MOVES_PER_LAYER);
+    }
+    std::vector<std::string> lines;
+    splitLines(text, &lines);
+    if(lines.empty())
+    {
+        printf("no G-code lines\n");
+        return 1;
+    }
+
+    benchCodec(lines);
+
+    static const LinkConfig configs[] = {
+        {"115200 baud, USB 1 ms", 11520, 1000, 0.0},
+        {"250000 baud, USB 1 ms", 25000, 1000, 0.0},
+        {"250000 baud, 0.05% corrupt", 25000, 1000, 0.0005},
+        {"1 Mbaud, USB 1 ms", 100000, 1000, 0.0},
+    };
+    printf("Lines sent for %u s, the bulk lane kept full; wire = bytes host -> printer per line.\n\n", BENCH_DURATION_US / 1000000U);
+    printf("%-28s %-4s %9s %9s %9s %10s\n", "link", "lz", "lines/s", "wire/line", "ratio", "mismatches");
+    for(size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    {
+        benchLink(lines, configs[i], false);
+        benchLink(lines, configs[i], true);
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+# Frame delivery: MulticastDelegate against the frameReady(QByteArray) signal
+
+include(../bench.pri)
+
+QT += core
+QT -= gui
+
+TARGET = bench_delegate
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    $$SRC/delegate.h
@@ -0,0 +1,163 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QByteArray>
+#include <QAtomicInt>
+#include <stdio.h>
+#include "delegate.h"
+
+// Frames delivered in one measurement
+#define BENCH_FRAMES            (1000000)
+// Longest frame of Communication::ReadData()
+#define BENCH_FRAME_SIZE        (28)
+// Same as COMMUNICATION_MAX_SUBSCRIBERS
+#define BENCH_MAX_SUBSCRIBERS   (4)
+
+/**
+ * Subscriber of the delegate, reads every frame like the statistics of a link would.
+ */
+class SpanConsumer
+{
+public:
+    SpanConsumer() : bytes(0), frames(0) {}
+
+    void onFrame(const FrameSpan &frame)
+    {
+        bytes += frame.data[0] + frame.length;
+        frames++;
+    }
+
+    quint64 bytes;
+    quint64 frames;
+};
+
+/**
+ * Emits frames the way Communication did before the delegate.
+ */
+class FrameSource : public QObject
+{
+    Q_OBJECT
+
+signals:
+    void frameReady(QByteArray data);
+};
+
+class FrameConsumer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FrameConsumer(QAtomicInt *done) : bytes(0), frames(0), done(done) {}
+
+    quint64 bytes;
+    quint64 frames;
+
+public slots:
+    void onFrame(QByteArray data)
+    {
+        bytes += static_cast<quint8>(data.at(0)) + data.size();
+        frames++;
+        done->fetchAndAddRelease(1);
+    }
+
+private:
+    QAtomicInt *done;
+};
+
+/**
+ * Ramka składana tak jak w Communication::ReadData(), ten sam bufor dla każdej ścieżki.
+ */
+static void buildFrame(QByteArray &frame, int n)
+{
+    frame.clear();
+    for(int i = 0; i < BENCH_FRAME_SIZE; i++)
+        frame.append(static_cast<char>(n + i));
+}
+
+static double benchDelegate(int subscribers)
+{
+    MulticastDelegate<const FrameSpan&, BENCH_MAX_SUBSCRIBERS> delegate;
+    SpanConsumer consumers[BENCH_MAX_SUBSCRIBERS];
+    for(int i = 0; i < subscribers; i++)
+        delegate.add<SpanConsumer, &SpanConsumer::onFrame>(&consumers[i]);
+
+    QByteArray frame;
+    QElapsedTimer timer;
+    timer.start();
+    for(int n = 0; n < BENCH_FRAMES; n++)
+    {
+        buildFrame(frame, n);
+        delegate.invoke(FrameSpan(reinterpret_cast<const uint8_t *>(frame.constData()), static_cast<uint16_t>(frame.size())));
+    }
+    qint64 ns = timer.nsecsElapsed();
+
+    /* Wynik używany, żeby kompilator nie usunął pętli */
+    quint64 check = 0;
+    for(int i = 0; i < subscribers; i++)
+        check += consumers[i].frames;
+    if(check != static_cast<quint64>(BENCH_FRAMES) * subscribers)
+        printf("delegate: lost frames\n");
+    return static_cast<double>(ns) / BENCH_FRAMES;
+}
+
+/**
+ * Direct connections run the slots in the emitting thread, queued ones in a consumer thread like
+ * the GUI. The time of a queued run ends when the last subscriber got the last frame.
+ */
+static double benchSignal(int subscribers, bool queued)
+{
+    QAtomicInt done(0);
+    FrameSource source;
+    QThread thread;
+    FrameConsumer *consumers[BENCH_MAX_SUBSCRIBERS];
+    for(int i = 0; i < subscribers; i++)
+    {
+        consumers[i] = new FrameConsumer(&done);
+        if(queued)
+            consumers[i]->moveToThread(&thread);
+        QObject::connect(&source, SIGNAL(frameReady(QByteArray)), consumers[i], SLOT(onFrame(QByteArray)),
+                         queued ? Qt::QueuedConnection : Qt::DirectConnection);
+    }
+    if(queued)
+        thread.start();
+
+    QByteArray frame;
+    QElapsedTimer timer;
+    timer.start();
+    for(int n = 0; n < BENCH_FRAMES; n++)
+    {
+        buildFrame(frame, n);
+        emit source.frameReady(frame);
+    }
+    int expected = BENCH_FRAMES * subscribers;
+    while(done.loadAcquire() < expected)
+        QThread::yieldCurrentThread();
+    qint64 ns = timer.nsecsElapsed();
+
+    if(queued)
+    {
+        thread.quit();
+        thread.wait();
+    }
+    for(int i = 0; i < subscribers; i++)
+        delete consumers[i];
+    return static_cast<double>(ns) / BENCH_FRAMES;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    printf("%d frames of %d bytes, ns per frame delivered to all subscribers\n\n", BENCH_FRAMES, BENCH_FRAME_SIZE);
+    printf("subscribers  delegate  signal direct  signal queued\n");
+    for(int subscribers = 1; subscribers <= BENCH_MAX_SUBSCRIBERS; subscribers++)
+    {
+        double delegate = benchDelegate(subscribers);
+        double direct = benchSignal(subscribers, false);
+        double queued = benchSignal(subscribers, true);
+        printf("%11d  %8.1f  %13.1f  %13.1f\n", subscribers, delegate, direct, queued);
+    }
+    return 0;
+}
+
+#include "main.moc"
@@ -0,0 +1,23 @@
+# Print time estimator: seconds to index and estimate a 500 MB G-code file, and to open it again
+# from the sidecars. A G-code file may be given.
+
+include(../bench.pri)
+
+QT = core
+
+TARGET = bench_estimator
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/gcodeindex.cpp \
+    $$SRC/printestimator.cpp \
+    $$SRC/gcodeparser.cpp \
+    $$SRC/motionplanner.cpp
+
+HEADERS += \
+    $$SRC/gcodeindex.h \
+    $$SRC/printestimator.h \
+    $$SRC/gcodeparser.h \
+    $$SRC/motionplanner.h \
+    $$PWD/../common/gcodegen.h
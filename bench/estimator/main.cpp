@@ -0,0 +1,103 @@
+#include <QTemporaryDir>
+#include <QFile>
+#include <QThread>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include "gcodegen.h"
+#include "gcodeindex.h"
+#include "printestimator.h"
+
+// Synthetic file when none is given, written in pieces of BENCH_PIECE_LAYERS layers (about 6.9 MB)
+#define BENCH_SIZE_MB           (500)
+#define BENCH_PIECE_LAYERS      (120)
+#define BENCH_MOVES_PER_LAYER   (1500)
+
+static double seconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+{
+    return std::chrono::duration<double>(to - from).count();
+}
+
+/**
+ * Writes the slicer-like file until it has at least BENCH_SIZE_MB, the layers go on from piece to piece.
+ */
+static bool writeFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    GcodeGenerator generator;
+    qint64 size = 0;
+    for(int layer = 1; size < static_cast<qint64>(BENCH_SIZE_MB) * 1000000; layer += BENCH_PIECE_LAYERS)
+    {
+        std::string piece = generator.generate(BENCH_PIECE_LAYERS, BENCH_MOVES_PER_LAYER, layer);
+        if(file.write(piece.data(), static_cast<qint64>(piece.size())) != static_cast<qint64>(piece.size()))
+            return false;
+        size += static_cast<qint64>(piece.size());
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QTemporaryDir dir;
+    QString fileName;
+    if(argc > 1)
+    {
+        fileName = QString::fromLocal8Bit(argv[1]);
+    }
+    else
+    {
+        fileName = dir.path() + "/large.gcode";
+        printf("writing %d MB of G-code...\n", BENCH_SIZE_MB);
+        if(!writeFile(fileName))
+        {
+            printf("can not write %s\n", qPrintable(fileName));
+            return 1;
+        }
+    }
+
+    /* Stare pliki pomocnicze dałyby czas wczytania zamiast budowania */
+    QFile::remove(GcodeIndex::sidecarName(fileName));
+    QFile::remove(PrintEstimator::sidecarName(fileName));
+
+    GcodeIndex index;
+    PrintEstimator estimator;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if(!index.build(fileName))
+    {
+        printf("can not index %s\n", qPrintable(fileName));
+        return 1;
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    if(!estimator.estimate(index))
+    {
+        printf("can not estimate %s\n", qPrintable(fileName));
+        return 1;
+    }
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    index.save();
+    estimator.save();
+
+    /* Drugie otwarcie, jak przy ponownym wyborze pliku: same pliki pomocnicze */
+    GcodeIndex cachedIndex;
+    PrintEstimator cachedEstimator;
+    std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();
+    bool cached = cachedIndex.load(fileName) && cachedEstimator.load(fileName);
+    std::chrono::steady_clock::time_point t4 = std::chrono::steady_clock::now();
+
+    QFile file(fileName);
+    double megabytes = file.open(QIODevice::ReadOnly) ? file.size() / 1e6 : 0.0;
+    const PrintEstimate &estimate = estimator.getEstimate();
+    printf("%.1f MB, %u lines, %u layers, %d checkpoints, %d threads\n\n", megabytes, index.getLineCount(),
+           index.getLayerCount(), index.getEntries().size(), QThread::idealThreadCount());
+    printf("%-28s %9s %9s\n", "step", "s", "MB/s");
+    printf("%-28s %9.2f %9.1f\n", "index (GcodeIndex::build)", seconds(t0, t1), megabytes / seconds(t0, t1));
+    printf("%-28s %9.2f %9.1f\n", "estimate (PrintEstimator)", seconds(t1, t2), megabytes / seconds(t1, t2));
+    printf("%-28s %9.2f %9.1f\n", "file opened the first time", seconds(t0, t2), megabytes / seconds(t0, t2));
+    printf("%-28s %9.4f %9s\n\n", cached ? "opened again, sidecars" : "sidecars not loaded", seconds(t3, t4), "-");
+    printf("estimate: %.1f h (%.1f h without acceleration), %u segments, %.1f m of filament, %.0f g\n",
+           estimate.time / 3600.0, index.getTotalTime() / 3600.0, estimate.segments, estimate.filament / 1000.0,
+           estimate.filamentMass);
+    return 0;
+}
@@ -0,0 +1,36 @@
+# Planner-buffer flow control: starvations of an emulated firmware planner while JobStreamer sends
+# an organic model, with and without MSG_PLANNER reports. A G-code file may be given.
+
+include(../bench.pri)
+
+QT = core
+
+TARGET = bench_flowcontrol
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/jobstreamer.cpp \
+    $$SRC/commandinterpreter.cpp \
+    $$SRC/gcodeparser.cpp \
+    $$SRC/gcodepreprocessor.cpp \
+    $$SRC/motionplanner.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/icommandinterpreter.cpp
+
+HEADERS += \
+    $$SRC/jobstreamer.h \
+    $$SRC/commandinterpreter.h \
+    $$SRC/commanddispatcher.h \
+    $$SRC/gcodeparser.h \
+    $$SRC/gcodepreprocessor.h \
+    $$SRC/gcodeindex.h \
+    $$SRC/motionplanner.h \
+    $$SRC/min.h \
+    $$SRC/mincodec.h \
+    $$SRC/messages.h \
+    $$PWD/../common/simline.h \
+    $$PWD/../common/gcodegen.h
@@ -0,0 +1,292 @@
+#include <QTemporaryDir>
+#include <QFile>
+#include <QStringList>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include "jobstreamer.h"
+#include "commandinterpreter.h"
+#include "min.h"
+#include "simline.h"
+#include "gcodegen.h"
+
+// Organic model: 20 layers of 600 chords of about 0.37 mm, at 40 and 150 mm/s (9 and 2.4 ms a chord)
+#define BENCH_LAYERS            (20)
+#define BENCH_MOVES_PER_LAYER   (600)
+#define BENCH_SLOW_FEEDRATE     (2400)
+#define BENCH_FAST_FEEDRATE     (9000)
+// Simulation step and the longest a job may take
+#define BENCH_STEP_US           (100U)
+#define BENCH_TIMEOUT_US        (600000000U)
+// Emulated firmware: planner slots, UART receive buffer, planner report period
+#define FIRMWARE_SLOTS          (16U)
+#define FIRMWARE_RX_BUFFER      (128U)
+#define FIRMWARE_REPORT_US      (20000U)
+
+typedef struct {
+    const char *name;
+    uint32_t bytesPerSecond;
+    uint32_t latencyUs;
+} LinkConfig;
+
+/**
+ * Firmware of the printer: a planner of FIRMWARE_SLOTS moves executed in real time. While the
+ * planner is full the firmware does not read the UART, the bytes wait in its receive buffer and
+ * what does not fit is lost, as on an AVR board. With reports on it sends MSG_PLANNER every
+ * FIRMWARE_REPORT_US.
+ */
+class Firmware : public ICommandInterpreter
+{
+public:
+    explicit Firmware(bool reports) :
+        reports(reports), lastCommand(0), starvations(0), printing(false), nextReportUs(0), overruns(0), motionUs(0) {}
+
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        if(min_id != MSG_GCODE_LINE || len_payload < MsgGcodeLine::wire_size)
+            return true;
+        MsgGcodeLine::View view(min_payload);
+        lastCommand = view.command_id();
+
+        /* Czas ruchu z długości i prędkości, inne komendy wykonują się od razu */
+        uint64_t durationUs = 0;
+        GcodeCommand command;
+        GcodeMove move;
+        if(GcodeParser::parse(reinterpret_cast<const char *>(min_payload + MsgGcodeLine::wire_size),
+                              len_payload - MsgGcodeLine::wire_size, &command) && machine.apply(command, &move))
+        {
+            double length = 0.0;
+            for(int axis = GCODE_X; axis <= GCODE_Z; axis++)
+                length += (move.to[axis] - move.from[axis]) * (move.to[axis] - move.from[axis]);
+            length = sqrt(length);
+            if(move.feedrate > 0.0f)
+                durationUs = static_cast<uint64_t>(length / move.feedrate * 1e6);
+        }
+        planner.push_back(durationUs);
+        motionUs += durationUs;
+        return true;
+    }
+
+    /**
+     * One step of the firmware main loop.
+     */
+    void step(MinProtocol &end, SimLine &rx, uint32_t nowUs)
+    {
+        uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+        uint32_t n = rx.receive(data, sizeof(data));
+        for(uint32_t i = 0; i < n; i++)
+        {
+            if(uart.size() < FIRMWARE_RX_BUFFER)
+                uart.push_back(data[i]);
+            else
+                overruns++;
+        }
+
+        /* Bajt po bajcie, żeby nie przyjąć komendy bez wolnego miejsca */
+        while(planner.size() < FIRMWARE_SLOTS && !uart.empty())
+        {
+            uint8_t byte = uart.front();
+            uart.pop_front();
+            end.min_poll(&byte, 1);
+        }
+        end.min_poll(nullptr, 0);
+
+        uint64_t budget = BENCH_STEP_US;
+        while(budget > 0 && !planner.empty())
+        {
+            uint64_t run = std::min(budget, planner.front());
+            planner.front() -= run;
+            budget -= run;
+            printing = true;
+            if(planner.front() == 0)
+                planner.pop_front();
+        }
+        if(printing && planner.empty())
+        {
+            starvations++;
+            printing = false;
+        }
+
+        if(reports && static_cast<int32_t>(nowUs - nextReportUs) >= 0)
+        {
+            MsgPlanner report;
+            report.command_id = lastCommand;
+            report.free_slots = static_cast<uint8_t>(FIRMWARE_SLOTS - planner.size());
+            report.total_slots = static_cast<uint8_t>(FIRMWARE_SLOTS);
+            report.starvation_count = starvations;
+            end.min_queue_message(report);
+            nextReportUs = nowUs + FIRMWARE_REPORT_US;
+        }
+    }
+
+    bool isIdle() const
+    {
+        return planner.empty() && uart.empty();
+    }
+
+    bool reports;
+    uint16_t lastCommand;
+    uint16_t starvations;
+    bool printing;
+    uint32_t nextReportUs;
+    uint64_t overruns;              ///< Bytes lost because the receive buffer was full
+    uint64_t motionUs;              ///< Time of all moves received
+    GcodeMachine machine;
+    std::deque<uint64_t> planner;   ///< Time left of the moves in the planner, us
+    std::deque<uint8_t> uart;
+};
+
+typedef struct {
+    double jobSeconds;
+    double motionSeconds;
+    uint32_t starvations;           ///< Planner ran empty while the streamer still had lines
+    double stalledSeconds;          ///< Time the planner was empty during the job
+    uint64_t overruns;
+    double wirePerLine;
+    StreamerStats stats;
+} JobResult;
+
+/**
+ * Streams the file through JobStreamer as PrinterLink::poll() does, against the emulated firmware.
+ *
+ * @param targetFill fill level the streamer keeps, 0 for firmware which does not report
+ */
+static JobResult run(const QString &fileName, const LinkConfig &config, uint8_t targetFill)
+{
+    bool reports = targetFill != 0;
+    SimClock clock;
+    SimLine toPrinter(&clock, config.bytesPerSecond, config.latencyUs);
+    SimLine toHost(&clock, config.bytesPerSecond, config.latencyUs);
+    CommandInterpreter cmd;
+    Firmware firmware(reports);
+    MinProtocol hostEnd(&toPrinter, &clock, &cmd);
+    MinProtocol printerEnd(&toHost, &clock, &firmware);
+
+    uint32_t baud = config.bytesPerSecond * 10U;
+    hostEnd.min_set_max_payload(static_cast<uint16_t>(std::max(baud / 1000U, static_cast<uint32_t>(MAX_PAYLOAD))));
+    hostEnd.min_set_line_rate(config.bytesPerSecond);
+    hostEnd.min_transport_reset(true);
+
+    JobStreamer streamer(&hostEnd, &cmd);
+    if(reports)
+        streamer.setTargetFill(targetFill);
+    JobResult result;
+    memset(&result, 0, sizeof(result));
+    if(!streamer.start(fileName))
+        return result;
+
+    bool started = false;
+    bool printing = false;
+    uint64_t stalledUs = 0;
+    uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+    for(clock.us = 0; clock.us < BENCH_TIMEOUT_US; clock.us += BENCH_STEP_US)
+    {
+        toPrinter.advance();
+        toHost.advance();
+        firmware.step(printerEnd, toPrinter, clock.us);
+
+        uint32_t n = toHost.receive(data, sizeof(data));
+        hostEnd.min_poll(n ? data : nullptr, n);
+        streamer.pump();
+        for(uint32_t i = 0; i < TRANSPORT_MAX_WINDOW_SIZE && hostEnd.min_next_deadline_ms() == 0; i++)
+            hostEnd.min_poll(nullptr, 0);
+
+        bool busy = !firmware.planner.empty();
+        started = started || busy;
+        if(started && streamer.isRunning())
+        {
+            if(printing && !busy)
+                result.starvations++;
+            if(!busy)
+                stalledUs += BENCH_STEP_US;
+        }
+        printing = busy;
+        /* Koniec, gdy drukarka ma wszystko i wszystko wykonała */
+        if(!streamer.isRunning() && firmware.isIdle()
+                && hostEnd.min_queue_acked_count(TRANSPORT_LANE_BULK) == hostEnd.min_queue_queued_count(TRANSPORT_LANE_BULK))
+            break;
+    }
+
+    StreamerStats stats = streamer.getStats();
+    result.jobSeconds = clock.us / 1e6;
+    result.motionSeconds = firmware.motionUs / 1e6;
+    result.stalledSeconds = stalledUs / 1e6;
+    result.overruns = firmware.overruns;
+    result.wirePerLine = stats.linesSent ? static_cast<double>(toPrinter.getSent()) / stats.linesSent : 0.0;
+    result.stats = stats;
+    return result;
+}
+
+/**
+ * Writes the organic model at the feed rate, mm/min.
+ */
+static bool writeModel(const QString &fileName, int feedrate)
+{
+    GcodeGenerator generator;
+    std::string gcode = generator.generateOrganic(BENCH_LAYERS, BENCH_MOVES_PER_LAYER, feedrate);
+    QFile file(fileName);
+    return file.open(QIODevice::WriteOnly) && file.write(gcode.data(), static_cast<qint64>(gcode.size())) == static_cast<qint64>(gcode.size());
+}
+
+int main(int argc, char *argv[])
+{
+    QTemporaryDir dir;
+    QStringList files;
+    QStringList names;
+    if(argc > 1)
+    {
+        files.append(QString::fromLocal8Bit(argv[1]));
+        names.append(QString::fromLocal8Bit(argv[1]));
+    }
+    else
+    {
+        static const int feedrates[] = {BENCH_SLOW_FEEDRATE, BENCH_FAST_FEEDRATE};
+        for(size_t i = 0; i < sizeof(feedrates) / sizeof(feedrates[0]); i++)
+        {
+            QString fileName = dir.path() + QString("/organic%1.gcode").arg(feedrates[i]);
+            if(!writeModel(fileName, feedrates[i]))
+            {
+                printf("can not write %s\n", qPrintable(fileName));
+                return 1;
+            }
+            files.append(fileName);
+            names.append(QString("organic, %1 mm/s").arg(feedrates[i] / 60));
+        }
+    }
+
+    static const LinkConfig configs[] = {
+        {"115200 baud, USB 1 ms", 11520, 1000},
+        {"250000 baud, USB 1 ms", 25000, 1000},
+        {"1 Mbaud, USB 1 ms", 100000, 1000},
+    };
+    static const uint8_t targets[] = {0, 75, 100};
+
+    printf("Job streamed to an emulated firmware with %u planner slots and a %u byte receive buffer, which\n"
+           "stops reading while the planner is full. target: fill the streamer keeps from MSG_PLANNER reports\n"
+           "sent every %u ms, off for firmware without reports (fed from the MIN window alone). starved = the\n"
+           "planner ran empty while the streamer had more to send, fw = the starvation counter of the firmware,\n"
+           "overruns = bytes lost in the full receive buffer.\n",
+           FIRMWARE_SLOTS, FIRMWARE_RX_BUFFER, FIRMWARE_REPORT_US / 1000U);
+    for(int f = 0; f < files.size(); f++)
+    {
+        printf("\n%s\n", qPrintable(names.at(f)));
+        printf("%-24s %-6s %8s %8s %8s %9s %6s %9s %9s\n", "link", "target", "job s", "motion s", "starved", "stalled s",
+               "fw", "overruns", "wire/line");
+        for(size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+        {
+            for(size_t t = 0; t < sizeof(targets) / sizeof(targets[0]); t++)
+            {
+                JobResult r = run(files.at(f), configs[i], targets[t]);
+                char target[8];
+                snprintf(target, sizeof(target), targets[t] ? "%u%%" : "off", targets[t]);
+                printf("%-24s %-6s %8.1f %8.1f %8u %9.2f %6u %9llu %9.1f\n", configs[i].name, target,
+                       r.jobSeconds, r.motionSeconds, r.starvations, r.stalledSeconds,
+                       targets[t] ? r.stats.deviceStarvations : 0U, static_cast<unsigned long long>(r.overruns), r.wirePerLine);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+# Extended MIN frames: payload throughput against the payload size of the frames
+
+include(../bench.pri)
+
+CONFIG -= qt
+
+TARGET = bench_framesize
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/icommandinterpreter.cpp
+
+HEADERS += \
+    $$SRC/min.h \
+    $$PWD/../common/simline.h
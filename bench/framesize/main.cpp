@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "min.h"
+#include "simline.h"
+
+// Simulated time of one run and its step
+#define BENCH_DURATION_US       (10000000U)
+#define BENCH_STEP_US           (100U)
+// Id of the frames, the printer end only counts their payload
+#define BENCH_FRAME_ID          (0x20U)
+
+typedef struct {
+    const char *name;
+    uint32_t bytesPerSecond;
+    uint32_t latencyUs;
+} LinkConfig;
+
+class Device : public ICommandInterpreter
+{
+public:
+    Device() : bytes(0) {}
+
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_payload;
+        if(min_id == BENCH_FRAME_ID)
+            bytes += len_payload;
+        return true;
+    }
+
+    uint64_t bytes;
+};
+
+class Host : public ICommandInterpreter
+{
+public:
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_id;
+        (void)min_payload;
+        (void)len_payload;
+        return true;
+    }
+};
+
+/**
+ * Like PrinterLink::poll(): the received data, then up to a window of frames while one is due.
+ */
+static void pollEnd(MinProtocol &end, SimLine &rx)
+{
+    uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+    uint32_t n = rx.receive(data, sizeof(data));
+    end.min_poll(n ? data : nullptr, n);
+    for(uint32_t i = 0; i < TRANSPORT_MAX_WINDOW_SIZE && end.min_next_deadline_ms() == 0; i++)
+        end.min_poll(nullptr, 0);
+}
+
+/**
+ * Keeps the bulk lane full of frames of one payload size.
+ *
+ * @return payload delivered, kB/s
+ */
+static double run(const LinkConfig &config, uint16_t size)
+{
+    SimClock clock;
+    SimLine toPrinter(&clock, config.bytesPerSecond, config.latencyUs);
+    SimLine toHost(&clock, config.bytesPerSecond, config.latencyUs);
+    Host host;
+    Device device;
+    MinProtocol hostEnd(&toPrinter, &clock, &host);
+    MinProtocol printerEnd(&toHost, &clock, &device);
+
+    /* Tylko ramki rozszerzone: kompresja i paczki zmieniłyby rozmiar ramek na linii */
+    hostEnd.min_set_features(static_cast<uint8_t>(MIN_FEATURE_EXTENDED_FRAMES));
+    hostEnd.min_set_max_payload(std::max(size, static_cast<uint16_t>(MAX_PAYLOAD)));
+    hostEnd.min_set_line_rate(config.bytesPerSecond);
+    hostEnd.min_transport_reset(true);
+
+    /* Losowe bajty, z bajtami nadziewania jak w prawdziwych danych */
+    srand(1);
+    static uint8_t payload[MAX_EXTENDED_PAYLOAD];
+    for(uint16_t i = 0; i < size; i++)
+        payload[i] = static_cast<uint8_t>(rand());
+
+    for(clock.us = 0; clock.us < BENCH_DURATION_US; clock.us += BENCH_STEP_US)
+    {
+        while(hostEnd.min_queue_frame(BENCH_FRAME_ID, payload, size))
+        {
+        }
+        toPrinter.advance();
+        toHost.advance();
+        pollEnd(printerEnd, toPrinter);
+        pollEnd(hostEnd, toHost);
+    }
+    return device.bytes * 1000.0 / BENCH_DURATION_US;
+}
+
+int main()
+{
+    static const LinkConfig configs[] = {
+        {"100 kB/s, 1 ms", 100000, 1000},
+        {"400 kB/s, 1 ms", 400000, 1000},
+        {"1.2 MB/s, 1 ms", 1200000, 1000},
+        {"1.2 MB/s, 8 ms", 1200000, 8000},
+    };
+    static const uint16_t sizes[] = {64, 128, 254, 512, 1024, 2048, MAX_EXTENDED_PAYLOAD};
+
+    printf("Payload delivered, kB/s, the bulk lane kept full for %u s; columns are payload bytes per frame.\n\n",
+           BENCH_DURATION_US / 1000000U);
+    printf("%-16s", "link, latency");
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        printf(" %6u", sizes[s]);
+    printf("\n");
+    for(size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    {
+        printf("%-16s", configs[i].name);
+        for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+            printf(" %6.0f", run(configs[i], sizes[s]));
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+# Cost of idle links: poll timer wakeups and host MIN time per link, 1 ms polling against polling
+# at the transport deadlines
+
+include(../bench.pri)
+
+CONFIG -= qt
+
+TARGET = bench_idle
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/icommandinterpreter.cpp
+
+HEADERS += \
+    $$SRC/min.h \
+    $$SRC/mincodec.h \
+    $$SRC/messages.h \
+    $$PWD/../common/simline.h
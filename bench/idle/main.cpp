@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "min.h"
+#include "simline.h"
+
+// Links served by one host process and the simulated time
+#define BENCH_LINKS             (100)
+#define BENCH_DURATION_US       (60000000U)
+// QTimer resolution, the host can not wake up in between
+#define BENCH_STEP_US           (1000U)
+// Counting starts after the transport reset and its ACKs
+#define BENCH_WARMUP_US         (2000000U)
+// Poll period of the host before the deadlines, LINK_POLL_PERIOD_MS
+#define BENCH_POLL_PERIOD_US    (1000U)
+
+typedef enum {
+    POLL_PERIODIC = 0,      ///< Timer every millisecond, as before the deadlines
+    POLL_DEADLINE           ///< Single-shot timer at min_next_deadline_ms(), as PrinterLink::schedule()
+} PollMode;
+
+class Endpoint : public ICommandInterpreter
+{
+public:
+    Endpoint() : frames(0) {}
+
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_id;
+        (void)min_payload;
+        (void)len_payload;
+        frames++;
+        return true;
+    }
+
+    uint64_t frames;
+};
+
+/**
+ * One printer on its own serial line. The printer end is firmware, it polls every millisecond
+ * and its work is not counted.
+ */
+class Link
+{
+public:
+    explicit Link(SimClock *clock) :
+        toPrinter(clock, 25000, 1000),
+        toHost(clock, 25000, 1000),
+        hostEnd(&toPrinter, clock, &host),
+        printerEnd(&toHost, clock, &printer),
+        timerUs(0),
+        timerArmed(true)
+    {
+        hostEnd.min_transport_reset(true);
+    }
+
+    SimLine toPrinter;
+    SimLine toHost;
+    Endpoint host;
+    Endpoint printer;
+    MinProtocol hostEnd;
+    MinProtocol printerEnd;
+    uint32_t timerUs;       ///< When the poll timer of the host fires
+    bool timerArmed;
+};
+
+typedef struct {
+    uint64_t timerWakeups;
+    uint64_t dataWakeups;
+    double minNs;           ///< Time spent in min_poll() and min_next_deadline_ms() of the host
+    uint64_t reports;       ///< Reports the host received
+} HostCost;
+
+/**
+ * What PrinterLink::poll() does with the transport after a wakeup, then the timer is armed again.
+ */
+static void hostWakeup(Link &link, PollMode mode, SimClock &clock, uint8_t *data, uint32_t n, HostCost *cost)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    link.hostEnd.min_poll(n ? data : nullptr, n);
+    uint32_t deadline = MIN_NO_DEADLINE;
+    if(mode == POLL_DEADLINE)
+    {
+        deadline = link.hostEnd.min_next_deadline_ms();
+        for(uint32_t i = 0; i < TRANSPORT_MAX_WINDOW_SIZE && deadline == 0; i++)
+        {
+            link.hostEnd.min_poll(nullptr, 0);
+            deadline = link.hostEnd.min_next_deadline_ms();
+        }
+    }
+    if(cost)
+        cost->minNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+
+    if(mode == POLL_PERIODIC)
+    {
+        /* Zegar okresowy, dane nie zmieniają jego terminu */
+        if(!n)
+            link.timerUs = clock.us + BENCH_POLL_PERIOD_US;
+        return;
+    }
+    link.timerArmed = deadline != MIN_NO_DEADLINE;
+    if(link.timerArmed)
+        link.timerUs = clock.us + deadline * 1000U;
+}
+
+/**
+ * @param reportPeriodUs how often each printer sends a temperature report, 0 for never
+ */
+static HostCost run(PollMode mode, uint32_t reportPeriodUs)
+{
+    SimClock clock;
+    std::vector<Link *> links;
+    for(int i = 0; i < BENCH_LINKS; i++)
+        links.push_back(new Link(&clock));
+
+    HostCost cost = {0, 0, 0.0, 0};
+    uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+    for(clock.us = 0; clock.us < BENCH_DURATION_US; clock.us += BENCH_STEP_US)
+    {
+        bool counted = clock.us >= BENCH_WARMUP_US;
+        for(int i = 0; i < BENCH_LINKS; i++)
+        {
+            Link &link = *links[i];
+
+            /* Drukarki raportują przesunięte w czasie, nie wszystkie w tej samej milisekundzie */
+            if(reportPeriodUs && (clock.us + static_cast<uint32_t>(i) * 7U * BENCH_STEP_US) % reportPeriodUs == 0)
+            {
+                MsgTemperatures report;
+                report.hotend_current = 2000;
+                report.hotend_target = 2000;
+                report.bed_current = 600;
+                report.bed_target = 600;
+                link.printerEnd.min_queue_message(report);
+            }
+
+            link.toPrinter.advance();
+            link.toHost.advance();
+            uint32_t n = link.toPrinter.receive(data, sizeof(data));
+            link.printerEnd.min_poll(n ? data : nullptr, n);
+
+            n = link.toHost.receive(data, sizeof(data));
+            if(n)
+            {
+                hostWakeup(link, mode, clock, data, n, counted ? &cost : nullptr);
+                if(counted)
+                    cost.dataWakeups++;
+            }
+            if(link.timerArmed && static_cast<int32_t>(clock.us - link.timerUs) >= 0)
+            {
+                hostWakeup(link, mode, clock, nullptr, 0, counted ? &cost : nullptr);
+                if(counted)
+                    cost.timerWakeups++;
+            }
+        }
+    }
+
+    for(int i = 0; i < BENCH_LINKS; i++)
+    {
+        cost.reports += links[i]->host.frames;
+        delete links[i];
+    }
+    return cost;
+}
+
+static void print(const char *name, PollMode mode, const HostCost &cost)
+{
+    double seconds = static_cast<double>(BENCH_DURATION_US - BENCH_WARMUP_US) / 1e6;
+    double perLink = seconds * BENCH_LINKS;
+    printf("%-22s %-9s %12.1f %12.1f %12.2f %9llu\n", name, mode == POLL_PERIODIC ? "1 ms" : "deadline",
+           cost.timerWakeups / perLink, cost.dataWakeups / perLink, cost.minNs / 1000.0 / perLink,
+           static_cast<unsigned long long>(cost.reports));
+}
+
+int main()
+{
+    printf("%d links at 250000 baud, USB 1 ms, for %u s; per link and second after the first %u s.\n"
+           "timer = poll timer wakeups, data = polls after received data, MIN us = host time in\n"
+           "min_poll() and min_next_deadline_ms(). The event loop dispatch of a wakeup is not included.\n\n",
+           BENCH_LINKS, BENCH_DURATION_US / 1000000U, BENCH_WARMUP_US / 1000000U);
+    printf("%-22s %-9s %12s %12s %12s %9s\n", "printer", "poll", "timer /s", "data /s", "MIN us/s", "reports");
+
+    static const struct {
+        const char *name;
+        uint32_t reportPeriodUs;
+    } cases[] = {
+        {"idle", 0},
+        {"reports every 1 s", 1000000U},
+        {"reports every 250 ms", 250000U},
+    };
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        print(cases[i].name, POLL_PERIODIC, run(POLL_PERIODIC, cases[i].reportPeriodUs));
+        print(cases[i].name, POLL_DEADLINE, run(POLL_DEADLINE, cases[i].reportPeriodUs));
+    }
+    return 0;
+}
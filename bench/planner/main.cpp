@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "min.h"
+#include "simline.h"
+#include "gcodegen.h"
+#include "gcodeparser.h"
+#include "motionplanner.h"
+
+// Organic model when no file is given: 200 layers of 600 chords, about 120000 moves
+#define BENCH_LAYERS            (200)
+#define BENCH_MOVES_PER_LAYER   (600)
+// Planning is repeated to get a stable time
+#define BENCH_PLAN_ROUNDS       (10)
+// Simulated time of one link run and its step
+#define BENCH_DURATION_US       (10000000U)
+#define BENCH_STEP_US           (100U)
+
+typedef struct {
+    const char *name;
+    uint32_t bytesPerSecond;
+    uint32_t latencyUs;
+} LinkConfig;
+
+/**
+ * Firmware end, counts the commands of both kinds.
+ */
+class Device : public ICommandInterpreter
+{
+public:
+    Device() : received(0) {}
+
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_payload;
+        (void)len_payload;
+        if(min_id == MSG_SEGMENT || min_id == MSG_GCODE_LINE)
+            received++;
+        return true;
+    }
+
+    uint64_t received;
+};
+
+class Host : public ICommandInterpreter
+{
+public:
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_id;
+        (void)min_payload;
+        (void)len_payload;
+        return true;
+    }
+};
+
+/**
+ * Like PrinterLink::poll(): the received data, then up to a window of frames while one is due.
+ */
+static void pollEnd(MinProtocol &end, SimLine &rx)
+{
+    uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+    uint32_t n = rx.receive(data, sizeof(data));
+    end.min_poll(n ? data : nullptr, n);
+    for(uint32_t i = 0; i < TRANSPORT_MAX_WINDOW_SIZE && end.min_next_deadline_ms() == 0; i++)
+        end.min_poll(nullptr, 0);
+}
+
+/**
+ * Encodes a segment as JobStreamer::sendSegment() does.
+ */
+static MsgSegment encodeSegment(const PlannedSegment &segment, float acceleration, uint16_t commandId)
+{
+    MsgSegment msg;
+    msg.command_id = commandId;
+    msg.x = static_cast<int32_t>(lroundf(segment.target[GCODE_X] * 1000.0f));
+    msg.y = static_cast<int32_t>(lroundf(segment.target[GCODE_Y] * 1000.0f));
+    msg.z = static_cast<int32_t>(lroundf(segment.target[GCODE_Z] * 1000.0f));
+    msg.e = static_cast<int32_t>(lroundf(segment.target[GCODE_E] * 1000.0f));
+    msg.entry_speed = static_cast<uint32_t>(lroundf(segment.entrySpeed * 1000.0f));
+    msg.cruise_speed = static_cast<uint32_t>(lroundf(segment.cruiseSpeed * 1000.0f));
+    msg.exit_speed = static_cast<uint32_t>(lroundf(segment.exitSpeed * 1000.0f));
+    msg.acceleration = static_cast<uint32_t>(lroundf(acceleration * 1000.0f));
+    msg.accel_distance = static_cast<uint32_t>(lroundf(segment.accelDistance * 1000.0f));
+    msg.decel_distance = static_cast<uint32_t>(lroundf(segment.decelDistance * 1000.0f));
+    return msg;
+}
+
+/**
+ * Parses the lines and plans every move, as JobStreamer does in the host planning mode.
+ *
+ * @param segments filled with the planned segments if not null
+ * @return number of segments
+ */
+static size_t planAll(const std::vector<std::string> &lines, std::vector<PlannedSegment> *segments, bool plan)
+{
+    static MotionPlanner planner;
+    GcodeMachine machine;
+    planner.reset(machine.getPosition());
+    PlannedSegment ready[PLANNER_BATCH];
+    size_t total = 0;
+    for(size_t i = 0; i < lines.size(); i++)
+    {
+        GcodeCommand command;
+        GcodeMove move;
+        if(!GcodeParser::parse(lines[i].data(), static_cast<int>(lines[i].size()), &command) || !machine.apply(command, &move))
+            continue;
+        if(!plan || memcmp(move.from, move.to, sizeof(move.from)) == 0)
+            continue;
+        while(!planner.addMove(move))
+        {
+            int n = planner.takeReady(ready, PLANNER_BATCH);
+            total += n;
+            if(segments)
+                segments->insert(segments->end(), ready, ready + n);
+        }
+    }
+    planner.flush();
+    int n;
+    while((n = planner.takeReady(ready, PLANNER_BATCH)) > 0)
+    {
+        total += n;
+        if(segments)
+            segments->insert(segments->end(), ready, ready + n);
+    }
+    return total;
+}
+
+/**
+ * Keeps the bulk lane full of moves, as text lines or as planned segments, with the host settings
+ * of PrinterLink::loadProfile().
+ *
+ * @return moves delivered per second
+ */
+static double benchLink(const std::vector<std::string> &moves, const std::vector<PlannedSegment> &segments,
+                        const LinkConfig &config, bool planned, double *wirePerMove)
+{
+    SimClock clock;
+    SimLine toPrinter(&clock, config.bytesPerSecond, config.latencyUs);
+    SimLine toHost(&clock, config.bytesPerSecond, config.latencyUs);
+    Host host;
+    Device device;
+    MinProtocol hostEnd(&toPrinter, &clock, &host);
+    MinProtocol printerEnd(&toHost, &clock, &device);
+
+    uint32_t baud = config.bytesPerSecond * 10U;
+    hostEnd.min_set_max_payload(static_cast<uint16_t>(std::max(baud / 1000U, static_cast<uint32_t>(MAX_PAYLOAD))));
+    hostEnd.min_set_line_rate(config.bytesPerSecond);
+    hostEnd.min_transport_reset(true);
+
+    float acceleration = MotionPlanner::defaultConfig().acceleration;
+    uint64_t sent = 0;
+    for(clock.us = 0; clock.us < BENCH_DURATION_US; clock.us += BENCH_STEP_US)
+    {
+        while(true)
+        {
+            bool queued;
+            if(planned)
+            {
+                queued = hostEnd.min_queue_message(encodeSegment(segments[sent % segments.size()], acceleration,
+                                                                 static_cast<uint16_t>(sent)));
+            }
+            else
+            {
+                const std::string &line = moves[sent % moves.size()];
+                MsgGcodeLine message;
+                message.command_id = static_cast<uint16_t>(sent);
+                queued = hostEnd.min_queue_message(message, reinterpret_cast<const uint8_t *>(line.data()), static_cast<uint16_t>(line.size()));
+            }
+            if(!queued)
+                break;
+            sent++;
+        }
+        toPrinter.advance();
+        toHost.advance();
+        pollEnd(printerEnd, toPrinter);
+        pollEnd(hostEnd, toHost);
+    }
+
+    *wirePerMove = device.received ? static_cast<double>(toPrinter.getSent()) / device.received : 0.0;
+    return device.received * 1e6 / BENCH_DURATION_US;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string text;
+    if(argc > 1)
+    {
+        std::ifstream file(argv[1], std::ios::binary);
+        if(!file)
+        {
+            printf("can not read %s\n", argv[1]);
+            return 1;
+        }
+        text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        GcodeGenerator generator;
+        text = generator.generateOrganic(BENCH_LAYERS, BENCH_MOVES_PER_LAYER);
+    }
+
+    /* Linie bez komentarzy; do porównania na linii tylko ruchy, jak segmenty */
+    std::vector<std::string> lines;
+    std::vector<std::string> moves;
+    size_t start = 0;
+    while(start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos)
+            end = text.size();
+        std::string line = text.substr(start, end - start);
+        size_t comment = line.find(';');
+        if(comment != std::string::npos)
+            line.erase(comment);
+        while(!line.empty() && (line[line.size() - 1] == ' ' || line[line.size() - 1] == '\r'))
+            line.erase(line.size() - 1);
+        if(!line.empty())
+        {
+            lines.push_back(line);
+            if(line.compare(0, 3, "G1 ") == 0 || line.compare(0, 3, "G0 ") == 0)
+                moves.push_back(line);
+        }
+        start = end + 1;
+    }
+
+    std::vector<PlannedSegment> segments;
+    size_t count = planAll(lines, &segments, true);
+    if(count == 0)
+    {
+        printf("no moves\n");
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for(int round = 0; round < BENCH_PLAN_ROUNDS; round++)
+        planAll(lines, nullptr, false);
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    for(int round = 0; round < BENCH_PLAN_ROUNDS; round++)
+        planAll(lines, nullptr, true);
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    double parseS = std::chrono::duration<double>(t1 - t0).count() / BENCH_PLAN_ROUNDS;
+    double planS = std::chrono::duration<double>(t2 - t1).count() / BENCH_PLAN_ROUNDS;
+    printf("%zu lines, %zu segments, lookahead %d, batch %d\n", lines.size(), count, PLANNER_LOOKAHEAD, PLANNER_BATCH);
+    printf("parse only        %12.0f lines/s\n", lines.size() / parseS);
+    printf("parse and plan    %12.0f segments/s, %.0f ns per segment for the planner\n\n", count / planS,
+           std::max(0.0, planS - parseS) * 1e9 / count);
+
+    static const LinkConfig configs[] = {
+        {"250000 baud, USB 1 ms", 25000, 1000},
+        {"1 Mbaud, USB 1 ms", 100000, 1000},
+        {"12 Mbaud, native 1 ms", 1200000, 1000},
+    };
+    printf("Moves delivered for %u s with the bulk lane kept full, default features (compression, batches).\n"
+           "text = MSG_GCODE_LINE the firmware plans, segment = MSG_SEGMENT (%u byte payload) planned here.\n\n",
+           BENCH_DURATION_US / 1000000U, static_cast<unsigned>(MsgSegment::wire_size));
+    printf("%-24s %-8s %10s %10s\n", "link", "sent as", "moves/s", "wire/move");
+    for(size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    {
+        double wire;
+        double rate = benchLink(moves, segments, configs[i], false, &wire);
+        printf("%-24s %-8s %10.0f %10.2f\n", configs[i].name, "text", rate, wire);
+        rate = benchLink(moves, segments, configs[i], true, &wire);
+        printf("%-24s %-8s %10.0f %10.2f\n", configs[i].name, "segment", rate, wire);
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+# Host motion planner: segments per second planned from an organic model, and moves per second
+# the link delivers as text lines or as planned segments. A G-code file may be given.
+
+include(../bench.pri)
+
+CONFIG -= qt
+
+TARGET = bench_planner
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/gcodeparser.cpp \
+    $$SRC/motionplanner.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/icommandinterpreter.cpp
+
+HEADERS += \
+    $$SRC/gcodeparser.h \
+    $$SRC/motionplanner.h \
+    $$SRC/min.h \
+    $$SRC/mincodec.h \
+    $$SRC/messages.h \
+    $$PWD/../common/simline.h \
+    $$PWD/../common/gcodegen.h
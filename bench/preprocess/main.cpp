@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "gcodegen.h"
+#include "gcodepreprocessor.h"
+
+// Synthetic files when none is given: slicer-like, about 6.8 MB, and the organic model, about 3.6 MB
+#define BENCH_LAYERS            (120)
+#define BENCH_MOVES_PER_LAYER   (1500)
+#define BENCH_ORGANIC_LAYERS    (200)
+#define BENCH_ORGANIC_MOVES     (600)
+// Every run is repeated to get a stable time
+#define BENCH_ROUNDS            (5)
+
+typedef struct {
+    const char *name;
+    std::string text;
+} BenchFile;
+
+/**
+ * Feeds the file line by line and takes the output after every line, as JobStreamer::readLine() does.
+ *
+ * @return seconds for one pass
+ */
+static double run(const std::string &text, const PreprocessorOptions &options, PreprocessorStats *stats, int64_t *saved)
+{
+    static GcodePreprocessor preprocessor;
+    preprocessor.setOptions(options);
+    uint64_t sink = 0;
+
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for(int round = 0; round < BENCH_ROUNDS; round++)
+    {
+        preprocessor.reset();
+        size_t start = 0;
+        while(start < text.size())
+        {
+            size_t end = text.find('\n', start);
+            end = end == std::string::npos ? text.size() : end + 1U;
+            preprocessor.feed(text.data() + start, static_cast<int>(end - start), static_cast<int64_t>(start));
+            const char *line;
+            int length;
+            while(preprocessor.nextLine(&line, &length))
+                sink += static_cast<uint64_t>(length);
+            start = end;
+        }
+        preprocessor.finish();
+        const char *line;
+        int length;
+        while(preprocessor.nextLine(&line, &length))
+            sink += static_cast<uint64_t>(length);
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+    *stats = preprocessor.getStats();
+    *saved = preprocessor.bytesSaved();
+    /* Wynik musi być użyty, inaczej kompilator może pominąć odczyt */
+    if(sink == 0)
+        printf("no output\n");
+    return std::chrono::duration<double>(t1 - t0).count() / BENCH_ROUNDS;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<BenchFile> files;
+    if(argc > 1)
+    {
+        std::ifstream file(argv[1], std::ios::binary);
+        if(!file)
+        {
+            printf("can not read %s\n", argv[1]);
+            return 1;
+        }
+        BenchFile f;
+        f.name = argv[1];
+        f.text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        files.push_back(f);
+    }
+    else
+    {
+        GcodeGenerator slicer;
+        GcodeGenerator organic;
+        BenchFile f;
+        f.name = "slicer-like";
+        f.text = slicer.generate(BENCH_LAYERS, BENCH_MOVES_PER_LAYER);
+        files.push_back(f);
+        f.name = "organic";
+        f.text = organic.generateOrganic(BENCH_ORGANIC_LAYERS, BENCH_ORGANIC_MOVES);
+        files.push_back(f);
+    }
+
+    PreprocessorOptions keepArcs = GcodePreprocessor::defaultOptions();
+    keepArcs.linearizeArcs = false;
+    PreprocessorOptions linearize = GcodePreprocessor::defaultOptions();
+    linearize.linearizeArcs = true;
+    PreprocessorOptions nothing = GcodePreprocessor::defaultOptions();
+    nothing.dropNoOps = false;
+    nothing.mergeCollinear = false;
+    nothing.linearizeArcs = false;
+    nothing.dedupeFeedrate = false;
+
+    static const char *optionNames[] = {"comments only", "defaults, arcs kept", "arcs linearised"};
+    const PreprocessorOptions *options[] = {&nothing, &keepArcs, &linearize};
+
+    printf("Lines fed one by one and the output taken after each, mean of %d passes. Merge tolerance %.3f mm,\n"
+           "arc tolerance %.3f mm. saved = bytes in - bytes out, comments and line ends included.\n\n", BENCH_ROUNDS,
+           keepArcs.mergeTolerance, keepArcs.arcTolerance);
+    printf("%-12s %-20s %9s %9s %9s %9s %9s %7s %7s %7s\n", "file", "options", "M lines/s", "MB/s", "lines in", "lines out",
+           "saved kB", "saved", "merged", "arcs");
+    for(size_t f = 0; f < files.size(); f++)
+    {
+        for(size_t o = 0; o < sizeof(optionNames) / sizeof(optionNames[0]); o++)
+        {
+            PreprocessorStats stats;
+            int64_t saved;
+            double seconds = run(files[f].text, *options[o], &stats, &saved);
+            printf("%-12s %-20s %9.2f %9.1f %9llu %9llu %9.0f %6.1f%% %7u %7u\n", files[f].name, optionNames[o],
+                   stats.linesIn / seconds / 1e6, stats.bytesIn / seconds / 1e6, static_cast<unsigned long long>(stats.linesIn),
+                   static_cast<unsigned long long>(stats.linesOut), saved / 1000.0,
+                   stats.bytesIn ? 100.0 * saved / stats.bytesIn : 0.0, stats.movesMerged, stats.arcsLinearized);
+        }
+    }
+    return 0;
+}
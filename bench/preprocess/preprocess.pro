@@ -0,0 +1,19 @@
+# G-code preprocessor: lines per second and bytes saved on the slicer-like and organic models.
+# A G-code file may be given.
+
+include(../bench.pri)
+
+CONFIG -= qt
+
+TARGET = bench_preprocess
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/gcodepreprocessor.cpp \
+    $$SRC/gcodeparser.cpp
+
+HEADERS += \
+    $$SRC/gcodepreprocessor.h \
+    $$SRC/gcodeparser.h \
+    $$PWD/../common/gcodegen.h
@@ -0,0 +1,117 @@
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTemporaryDir>
+#include <QFile>
+#include <QThread>
+#include <QVector>
+#include <stdio.h>
+#include <algorithm>
+#include "toolpathpreview.h"
+#include "gcodegen.h"
+
+// Synthetic file when none is given, about 6.8 MB
+#define BENCH_LAYERS            (120)
+#define BENCH_MOVES_PER_LAYER   (1500)
+// Size of the drawn image
+#define BENCH_IMAGE_SIZE        (800)
+
+/**
+ * Runs the event loop until the preview has opened the file.
+ */
+static double openMs(ToolpathPreview &preview, const QString &fileName)
+{
+    QEventLoop loop;
+    QObject::connect(&preview, SIGNAL(opened(quint32)), &loop, SLOT(quit()));
+    QElapsedTimer timer;
+    timer.start();
+    preview.open(fileName);
+    loop.exec();
+    return timer.nsecsElapsed() / 1e6;
+}
+
+/**
+ * Runs the event loop until the image of the layers up to last is drawn, with the layers under it
+ * as ToolpathView asks for them.
+ */
+static double renderMs(ToolpathPreview &preview, quint32 last)
+{
+    QEventLoop loop;
+    QObject::connect(&preview, SIGNAL(rendered(QImage)), &loop, SLOT(quit()));
+    QElapsedTimer timer;
+    timer.start();
+    preview.render(0, last, QSize(BENCH_IMAGE_SIZE, BENCH_IMAGE_SIZE), false);
+    loop.exec();
+    return timer.nsecsElapsed() / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Bez ekranu, rysowanie i tak idzie do QImage */
+    if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+
+    QTemporaryDir dir;
+    QString fileName;
+    if(argc > 1)
+    {
+        fileName = QString::fromLocal8Bit(argv[1]);
+    }
+    else
+    {
+        GcodeGenerator generator;
+        std::string gcode = generator.generate(BENCH_LAYERS, BENCH_MOVES_PER_LAYER);
+        fileName = dir.path() + "/bench.gcode";
+        QFile file(fileName);
+        if(!file.open(QIODevice::WriteOnly) || file.write(gcode.data(), static_cast<qint64>(gcode.size())) != static_cast<qint64>(gcode.size()))
+        {
+            printf("can not write %s\n", qPrintable(fileName));
+            return 1;
+        }
+    }
+
+    ToolpathPreview preview;
+    preview.setBed(220.0f, 220.0f);
+
+    /* Drugie otwarcie czyta indeks z pliku obok */
+    double indexMs = openMs(preview, fileName);
+    double sidecarMs = openMs(preview, fileName);
+    quint32 layers = preview.getLayerCount();
+    if(layers == 0)
+    {
+        printf("no layers in %s\n", qPrintable(fileName));
+        return 1;
+    }
+    printf("%s: %u layers, %d threads, %dx%d image\n\n", qPrintable(fileName), layers, QThread::idealThreadCount(),
+           BENCH_IMAGE_SIZE, BENCH_IMAGE_SIZE);
+    printf("open, index built        %9.1f ms\n", indexMs);
+    printf("open, index from sidecar %9.1f ms\n", sidecarMs);
+
+    double cold = renderMs(preview, layers);
+    double warm = renderMs(preview, layers);
+    printf("top layer, cold          %9.1f ms, %d layers under it\n", cold, PREVIEW_MAX_BELOW);
+    printf("top layer, built         %9.1f ms, drawing only\n", warm);
+
+    /* Przewijanie od dołu, warstwa po warstwie, z wyprzedzaniem PREVIEW_PREFETCH */
+    openMs(preview, fileName);
+    QVector<double> steps;
+    for(quint32 layer = 1; layer <= layers; layer++)
+        steps.append(renderMs(preview, layer));
+    std::sort(steps.begin(), steps.end());
+    double sum = 0.0;
+    for(int i = 0; i < steps.size(); i++)
+        sum += steps[i];
+    printf("scroll up a layer        %9.1f ms mean, %.1f p99, %.1f max\n\n", sum / steps.size(),
+           steps[steps.size() * 99 / 100], steps.last());
+
+    PreviewStats stats = preview.getStats();
+    printf("layers built             %9u, %.2f ms each on one thread\n", stats.layersBuilt,
+           stats.layersBuilt ? stats.buildNs / 1e6 / stats.layersBuilt : 0.0);
+    printf("points                   %9llu, %.0f per layer\n", static_cast<unsigned long long>(stats.points),
+           stats.layersBuilt ? static_cast<double>(stats.points) / stats.layersBuilt : 0.0);
+    printf("layer buffers            %9.2f MB in the cache, %.2f bytes per point\n", stats.cachedBytes / 1e6,
+           stats.points ? static_cast<double>(stats.cachedBytes) / stats.points : 0.0);
+    printf("quantisation             %9.2f um at the coarsest layer\n", stats.maxScale * 1000.0f);
+    return 0;
+}
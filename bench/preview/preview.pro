@@ -0,0 +1,21 @@
+# Toolpath preview: opening a file, building and drawing layers, size of the layer buffers.
+# Runs without a display (QT_QPA_PLATFORM=offscreen unless set), a G-code file may be given.
+
+include(../bench.pri)
+
+QT += core gui widgets
+
+TARGET = bench_preview
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/toolpathpreview.cpp \
+    $$SRC/gcodeindex.cpp \
+    $$SRC/gcodeparser.cpp
+
+HEADERS += \
+    $$SRC/toolpathpreview.h \
+    $$SRC/gcodeindex.h \
+    $$SRC/gcodeparser.h \
+    $$PWD/../common/gcodegen.h
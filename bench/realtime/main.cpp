@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "min.h"
+#include "simline.h"
+
+// Simulated time of one run
+#define BENCH_DURATION_US       (30000000U)
+// Step of the simulation, both ends are polled every step
+#define BENCH_STEP_US           (100U)
+// A realtime command is queued this often, not a divisor of the other periods
+#define BENCH_COMMAND_PERIOD_US (97000U)
+
+typedef struct {
+    const char *name;
+    uint32_t bytesPerSecond;
+    uint32_t latencyUs;             ///< One way, e.g. USB polling of a converter
+    double corruption;              ///< Share of corrupted bytes host -> printer
+} LinkConfig;
+
+typedef struct {
+    size_t commands;
+    double meanMs;
+    double p99Ms;
+    double maxMs;
+    uint32_t queueWorstMs;          ///< min_queue_worst_latency_ms() of the lane, queue to first send
+    double linesPerSecond;          ///< Bulk G-code lines delivered
+} LatencyResult;
+
+/**
+ * Firmware end of the link, records when the realtime commands arrive.
+ */
+class Device : public ICommandInterpreter
+{
+public:
+    explicit Device(SimClock *clock) : clock(clock), lines(0) {}
+
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_payload;
+        (void)len_payload;
+        if(min_id == MSG_PAUSE)
+            arrivals.push_back(clock->us);
+        else if(min_id == MSG_GCODE_LINE)
+            lines++;
+        return true;
+    }
+
+    SimClock *clock;
+    std::vector<uint32_t> arrivals;
+    uint64_t lines;
+};
+
+class Host : public ICommandInterpreter
+{
+public:
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_id;
+        (void)min_payload;
+        (void)len_payload;
+        return true;
+    }
+};
+
+/**
+ * Like PrinterLink::poll(): the received data, then up to a window of frames while one is due.
+ */
+static void pollEnd(MinProtocol &end, SimLine &rx)
+{
+    uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+    uint32_t n = rx.receive(data, sizeof(data));
+    end.min_poll(n ? data : nullptr, n);
+    for(uint32_t i = 0; i < TRANSPORT_MAX_WINDOW_SIZE && end.min_next_deadline_ms() == 0; i++)
+        end.min_poll(nullptr, 0);
+}
+
+static LatencyResult run(const LinkConfig &config, uint8_t lane)
+{
+    SimClock clock;
+    SimLine toPrinter(&clock, config.bytesPerSecond, config.latencyUs, config.corruption);
+    SimLine toHost(&clock, config.bytesPerSecond, config.latencyUs);
+    Host host;
+    Device device(&clock);
+    MinProtocol hostEnd(&toPrinter, &clock, &host);
+    MinProtocol printerEnd(&toHost, &clock, &device);
+
+    /* Ustawienia jak w PrinterLink::loadProfile() dla profilu bez zmian */
+    uint32_t baud = config.bytesPerSecond * 10U;
+    hostEnd.min_set_max_payload(static_cast<uint16_t>(std::max(baud / 1000U, static_cast<uint32_t>(MAX_PAYLOAD))));
+    hostEnd.min_set_line_rate(config.bytesPerSecond);
+    hostEnd.min_transport_reset(true);
+
+    srand(1);
+    std::vector<uint32_t> queued;
+    uint32_t pending = 0;           ///< Commands waiting for space in the bulk lane
+    uint16_t commandId = 0;
+    uint32_t nextCommand = BENCH_COMMAND_PERIOD_US;
+    char line[64];
+    float x = 100.0f;
+    float e = 0.0f;
+
+    for(clock.us = 0; clock.us < BENCH_DURATION_US; clock.us += BENCH_STEP_US)
+    {
+        if(clock.us >= nextCommand)
+        {
+            queued.push_back(clock.us);
+            pending++;
+            nextCommand += BENCH_COMMAND_PERIOD_US;
+        }
+        /* Komenda czasu rzeczywistego przed kolejnymi liniami, na pasie bulk czeka na miejsce */
+        while(pending > 0 && hostEnd.min_queue_message(MsgPause(), lane))
+            pending--;
+
+        /* Linia nasycona: kolejka bulk zawsze pełna */
+        while(true)
+        {
+            x += static_cast<float>(rand() % 1000) / 500.0f - 1.0f;
+            e += 0.03f;
+            int length = snprintf(line, sizeof(line), "G1 X%.3f Y%.3f E%.5f", x, 100.0f + x / 3.0f, e);
+            MsgGcodeLine message;
+            message.command_id = commandId;
+            if(!hostEnd.min_queue_message(message, reinterpret_cast<const uint8_t *>(line), static_cast<uint16_t>(length)))
+                break;
+            commandId++;
+        }
+
+        toPrinter.advance();
+        toHost.advance();
+        pollEnd(printerEnd, toPrinter);
+        pollEnd(hostEnd, toHost);
+    }
+
+    LatencyResult result;
+    std::vector<double> latencies;
+    for(size_t i = 0; i < device.arrivals.size() && i < queued.size(); i++)
+        latencies.push_back((device.arrivals[i] - queued[i]) / 1000.0);
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < latencies.size(); i++)
+        sum += latencies[i];
+    result.commands = latencies.size();
+    result.meanMs = latencies.empty() ? 0.0 : sum / latencies.size();
+    result.p99Ms = latencies.empty() ? 0.0 : latencies[latencies.size() * 99 / 100];
+    result.maxMs = latencies.empty() ? 0.0 : latencies.back();
+    result.queueWorstMs = hostEnd.min_queue_worst_latency_ms(lane);
+    result.linesPerSecond = device.lines * 1e6 / BENCH_DURATION_US;
+    return result;
+}
+
+int main()
+{
+    static const LinkConfig configs[] = {
+        {"115200 baud, USB 1 ms", 11520, 1000, 0.0},
+        {"250000 baud, USB 1 ms", 25000, 1000, 0.0},
+        {"250000 baud, 0.05% corrupt", 25000, 1000, 0.0005},
+        {"1 Mbaud, USB 1 ms", 100000, 1000, 0.0},
+        {"12 Mbit native USB, 125 us", 1200000, 125, 0.0},
+    };
+
+    printf("Pause command every %u ms while the bulk lane is kept full, %u s per run.\n", BENCH_COMMAND_PERIOD_US / 1000U, BENCH_DURATION_US / 1000000U);
+    printf("Latency from queueing to the handler of the printer, ms; queue = worst queue to first send of MIN.\n\n");
+    printf("%-28s %-8s %5s %7s %7s %7s %6s %9s\n", "link", "lane", "cmds", "mean", "p99", "max", "queue", "lines/s");
+    for(size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    {
+        for(int lane = TRANSPORT_LANE_REALTIME; lane <= TRANSPORT_LANE_BULK; lane++)
+        {
+            LatencyResult r = run(configs[i], static_cast<uint8_t>(lane));
+            printf("%-28s %-8s %5zu %7.1f %7.1f %7.1f %6u %9.0f\n", configs[i].name, lane == TRANSPORT_LANE_REALTIME ? "realtime" : "bulk",
+                   r.commands, r.meanMs, r.p99Ms, r.maxMs, r.queueWorstMs, r.linesPerSecond);
+        }
+    }
+    return 0;
+}
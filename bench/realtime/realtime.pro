@@ -0,0 +1,22 @@
+# Latency of realtime commands while the bulk lane of the link is saturated
+
+include(../bench.pri)
+
+CONFIG -= qt
+
+TARGET = bench_realtime
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/icommandinterpreter.cpp
+
+HEADERS += \
+    $$SRC/min.h \
+    $$SRC/mincodec.h \
+    $$SRC/messages.h \
+    $$PWD/../common/simline.h
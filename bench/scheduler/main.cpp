@@ -0,0 +1,220 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "farmscheduler.h"
+
+// Size of the simulated farm
+#define BENCH_PRINTERS          (40)
+#define BENCH_JOBS              (5000)
+// A print takes its estimate times a factor within 1 +- this
+#define BENCH_NOISE             (0.3)
+// Share of prints that fail somewhere on the way
+#define BENCH_FAILURE_RATE      (0.03)
+// Full re-plans timed right after the submits
+#define BENCH_REPLANS           (100)
+
+/**
+ * Scheduler on the simulated time, printers have no link and report through jobFinished().
+ */
+class SimScheduler : public FarmScheduler
+{
+public:
+    SimScheduler() : time(0.0) {}
+
+    virtual double now() const
+    {
+        return time;
+    }
+
+    double time;
+};
+
+typedef struct {
+    quint32 job;                    ///< Job the simulation follows, 0 if idle
+    double start;
+    double end;                     ///< When the print really ends
+    bool fails;
+    double busy;                    ///< Printing time so far
+} SimPrinter;
+
+static double uniform(double low, double high)
+{
+    return low + (high - low) * static_cast<double>(rand()) / RAND_MAX;
+}
+
+static void report(const char *name, std::vector<double> &values, double scale, const char *unit)
+{
+    if(values.empty())
+    {
+        printf("%-24s none\n", name);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < values.size(); i++)
+        sum += values[i];
+    printf("%-24s %6zu x  mean %8.2f  p99 %8.2f  max %8.2f %s\n", name, values.size(), sum / values.size() * scale,
+           values[values.size() * 99 / 100] * scale, values.back() * scale, unit);
+}
+
+static PrinterCapabilities printerCapabilities(int i)
+{
+    static const float beds[4][3] = {{220.0f, 220.0f, 250.0f}, {250.0f, 210.0f, 210.0f}, {300.0f, 300.0f, 400.0f}, {350.0f, 350.0f, 350.0f}};
+    PrinterCapabilities c;
+    c.bedX = beds[i % 4][0];
+    c.bedY = beds[i % 4][1];
+    c.bedZ = beds[i % 4][2];
+    c.nozzleDiameter = i % 5 == 0 ? 0.6f : 0.4f;
+    c.material = i % 3 == 0 ? "PETG" : "PLA";
+    c.speedFactor = static_cast<float>(uniform(0.8, 1.3));
+    return c;
+}
+
+static JobRequirements jobRequirements()
+{
+    JobRequirements r;
+    r.sizeX = static_cast<float>(uniform(20.0, 200.0));
+    r.sizeY = static_cast<float>(uniform(20.0, 200.0));
+    r.sizeZ = static_cast<float>(uniform(10.0, 200.0));
+    double nozzle = uniform(0.0, 1.0);
+    r.nozzleDiameter = nozzle < 0.15 ? 0.4f : (nozzle < 0.2 ? 0.6f : 0.0f);
+    double material = uniform(0.0, 1.0);
+    r.material = material < 0.6 ? "PLA" : (material < 0.85 ? "PETG" : "");
+    return r;
+}
+
+/**
+ * Picks up the jobs the scheduler started since the last call and decides how they really end.
+ */
+static void track(SimScheduler &scheduler, SimPrinter *printers, double *work)
+{
+    for(int i = 0; i < BENCH_PRINTERS; i++)
+    {
+        const FarmPrinter &p = scheduler.getPrinter(i);
+        SimPrinter &s = printers[i];
+        if(p.current == 0 || p.current == s.job)
+            continue;
+
+        FarmJob job;
+        scheduler.findJob(p.current, &job);
+        double duration = job.estimatedTime * uniform(1.0 - BENCH_NOISE, 1.0 + BENCH_NOISE);
+        s.job = p.current;
+        s.start = scheduler.time;
+        s.fails = uniform(0.0, 1.0) < BENCH_FAILURE_RATE;
+        /* Nieudany wydruk przerywany w losowym miejscu */
+        if(s.fails)
+            duration *= uniform(0.0, 1.0);
+        *work += duration;
+        s.end = s.start + duration / p.capabilities.speedFactor;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    srand(1);
+
+    SimScheduler scheduler;
+    SimPrinter printers[BENCH_PRINTERS];
+    double speeds = 0.0;
+    for(int i = 0; i < BENCH_PRINTERS; i++)
+    {
+        PrinterCapabilities c = printerCapabilities(i);
+        speeds += c.speedFactor;
+        scheduler.addPrinter(nullptr, c);
+        printers[i].job = 0;
+        printers[i].busy = 0.0;
+    }
+
+    std::vector<double> submits;
+    std::vector<double> replans;
+    std::vector<double> retimes;
+    std::vector<double> forced;
+    double work = 0.0;
+    QElapsedTimer timer;
+
+    for(int n = 0; n < BENCH_JOBS; n++)
+    {
+        JobRequirements r = jobRequirements();
+        /* Od 20 min do 10 h, równomiernie w skali logarytmicznej */
+        float estimate = static_cast<float>(exp(uniform(log(1200.0), log(36000.0))));
+        timer.start();
+        quint32 id = scheduler.submit(QString("job%1.gcode").arg(n), r, estimate);
+        submits.push_back(timer.nsecsElapsed());
+        if(id == 0)
+            printf("job %d not submitted\n", n);
+    }
+    track(scheduler, printers, &work);
+
+    double plannedMakespan = scheduler.makespan();
+    double plannedIdle = scheduler.idleTime() / (plannedMakespan * BENCH_PRINTERS);
+
+    for(int n = 0; n < BENCH_REPLANS; n++)
+    {
+        /* Zmiana możliwości drukarki planuje od nowa wszystkie zadania */
+        timer.start();
+        scheduler.setCapabilities(n % BENCH_PRINTERS, scheduler.getPrinter(n % BENCH_PRINTERS).capabilities);
+        forced.push_back(timer.nsecsElapsed());
+    }
+
+    int completed = 0;
+    int failed = 0;
+    while(true)
+    {
+        int next = -1;
+        for(int i = 0; i < BENCH_PRINTERS; i++)
+        {
+            if(printers[i].job != 0 && (next < 0 || printers[i].end < printers[next].end))
+                next = i;
+        }
+        if(next < 0)
+            break;
+
+        SimPrinter &s = printers[next];
+        scheduler.time = s.end;
+        s.busy += s.end - s.start;
+        s.job = 0;
+        double planned = scheduler.getPrinter(next).currentEnd;
+        bool replan = s.fails || fabs(scheduler.time - planned) > FARM_REPLAN_SLACK;
+
+        timer.start();
+        scheduler.jobFinished(next, !s.fails);
+        (replan ? replans : retimes).push_back(timer.nsecsElapsed());
+        if(s.fails)
+            failed++;
+        else
+            completed++;
+        track(scheduler, printers, &work);
+    }
+
+    double busy = 0.0;
+    for(int i = 0; i < BENCH_PRINTERS; i++)
+        busy += printers[i].busy;
+    double makespan = scheduler.time;
+    /* Dolna granica bez ograniczeń drukarek: cała praca rozłożona równo na farmę */
+    double bound = work / speeds;
+
+    int given = 0;
+    QVector<FarmJob> jobs = scheduler.getJobs();
+    for(int i = 0; i < jobs.size(); i++)
+    {
+        if(jobs[i].state == FARM_JOB_FAILED)
+            given++;
+    }
+
+    printf("%d printers, %d jobs of 20 min to 10 h, durations +-%.0f%% of the estimate, %.0f%% of prints fail\n\n",
+           BENCH_PRINTERS, BENCH_JOBS, BENCH_NOISE * 100.0, BENCH_FAILURE_RATE * 100.0);
+    report("submit", submits, 1e-3, "us");
+    report("re-plan, forced", forced, 1e-6, "ms");
+    report("end off plan, re-plan", replans, 1e-6, "ms");
+    report("end on plan, retime", retimes, 1e-3, "us");
+    printf("\nplanned makespan         %8.1f h, idle %.2f%% of printer time\n", plannedMakespan / 3600.0, plannedIdle * 100.0);
+    printf("simulated makespan       %8.1f h, idle %.2f%% of printer time\n", makespan / 3600.0, (1.0 - busy / (makespan * BENCH_PRINTERS)) * 100.0);
+    printf("lower bound              %8.1f h, makespan / bound %.3f\n", bound / 3600.0, makespan / bound);
+    printf("prints                   %d completed, %d failed, %d jobs given up\n", completed, failed, given);
+    return 0;
+}
@@ -0,0 +1,16 @@
+# Print farm simulation: makespan, idle time and the cost of submit and re-plan
+
+include(../bench.pri)
+include(../common/link.pri)
+
+QT -= gui
+
+TARGET = bench_scheduler
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/farmscheduler.cpp
+
+HEADERS += \
+    $$SRC/farmscheduler.h
@@ -0,0 +1,115 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QVector>
+#include <stdio.h>
+#include "telemetrybus.h"
+
+// Size of the farm
+#define BENCH_PRINTERS          (40)
+// Status frames of a printer between two flushes, 20 Hz against the default 10 Hz of the bus
+#define BENCH_FRAMES_PER_FLUSH  (2)
+// Flushes of one run, 60 s at the default rate
+#define BENCH_FLUSHES           (600)
+// Every this many subscribers one is slow and takes only at every BENCH_SLOW_PERIOD flush
+#define BENCH_SLOW_EVERY        (10)
+#define BENCH_SLOW_PERIOD       (5)
+
+typedef struct {
+    double publishNs;               ///< One publish()
+    double fanoutMs;                ///< Mean time of a flush spent on the subscribers
+    double maxFanoutMs;
+    double takeNs;                  ///< One take() of a subscriber that keeps up
+    double droppedSlow;             ///< Share of the samples a slow subscriber never saw
+    double droppedFast;
+} BusResult;
+
+/**
+ * Publishes every field of every printer like the received-frame path does, the event loop does
+ * not run so the bus flushes only when the benchmark calls it.
+ */
+static BusResult run(int subscribers)
+{
+    TelemetryBus bus;
+    for(int i = 0; i < BENCH_PRINTERS; i++)
+        bus.addPrinter();
+    QVector<int> ids;
+    for(int i = 0; i < subscribers; i++)
+        ids.append(bus.subscribe());
+
+    QVector<TelemetrySample> samples;
+    QElapsedTimer timer;
+    qint64 publishNs = 0;
+    qint64 takeNs = 0;
+    quint64 takes = 0;
+    qint64 fanoutNs = 0;
+
+    for(int flush = 0; flush < BENCH_FLUSHES; flush++)
+    {
+        timer.start();
+        for(int frame = 0; frame < BENCH_FRAMES_PER_FLUSH; frame++)
+        {
+            for(int printer = 0; printer < BENCH_PRINTERS; printer++)
+            {
+                /* Szum temperatury i ruch osi, stan i postęp co ramkę ten sam */
+                float t = static_cast<float>(flush * BENCH_FRAMES_PER_FLUSH + frame);
+                bus.publish(printer, TELEMETRY_HOTEND, 210.0f + static_cast<float>((printer + flush + frame) % 7) * 0.1f);
+                bus.publish(printer, TELEMETRY_HOTEND_TARGET, 210.0f);
+                bus.publish(printer, TELEMETRY_BED, 60.0f + static_cast<float>((printer + frame) % 3) * 0.1f);
+                bus.publish(printer, TELEMETRY_BED_TARGET, 60.0f);
+                bus.publish(printer, TELEMETRY_X, 100.0f + t * 0.7f);
+                bus.publish(printer, TELEMETRY_Y, 100.0f - t * 0.3f);
+                bus.publish(printer, TELEMETRY_Z, 0.2f * static_cast<float>(flush / 100 + 1));
+                bus.publish(printer, TELEMETRY_E, t * 0.03f);
+                bus.publish(printer, TELEMETRY_PROGRESS, t / (BENCH_FLUSHES * BENCH_FRAMES_PER_FLUSH));
+                bus.publish(printer, TELEMETRY_STATE, 3.0f);
+            }
+        }
+        publishNs += timer.nsecsElapsed();
+
+        QMetaObject::invokeMethod(&bus, "flush", Qt::DirectConnection);
+        fanoutNs += bus.getStats().lastFanoutNs;
+
+        for(int i = 0; i < subscribers; i++)
+        {
+            bool slow = i % BENCH_SLOW_EVERY == 0;
+            if(slow && flush % BENCH_SLOW_PERIOD != 0)
+                continue;
+            samples.clear();
+            timer.start();
+            bus.take(ids[i], &samples);
+            if(!slow)
+            {
+                takeNs += timer.nsecsElapsed();
+                takes++;
+            }
+        }
+    }
+
+    TelemetryStats stats = bus.getStats();
+    quint64 published = stats.published;
+    BusResult result;
+    result.publishNs = static_cast<double>(publishNs) / published;
+    result.fanoutMs = fanoutNs / 1e6 / BENCH_FLUSHES;
+    result.maxFanoutMs = stats.maxFanoutNs / 1e6;
+    result.takeNs = takes ? static_cast<double>(takeNs) / takes : 0.0;
+    result.droppedSlow = subscribers ? static_cast<double>(bus.droppedFor(ids[0])) / published : 0.0;
+    result.droppedFast = subscribers > 1 ? static_cast<double>(bus.droppedFor(ids[1])) / published : 0.0;
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    printf("%d printers, %d fields at %d frames per flush, %d flushes; every %dth subscriber takes every %dth flush\n\n",
+           BENCH_PRINTERS, TELEMETRY_FIELDS, BENCH_FRAMES_PER_FLUSH, BENCH_FLUSHES, BENCH_SLOW_EVERY, BENCH_SLOW_PERIOD);
+    printf("subscribers  publish ns  fan-out ms  max ms  take ns  dropped slow  dropped fast\n");
+    static const int counts[] = {1, 10, 100, 1000};
+    for(size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+    {
+        BusResult r = run(counts[i]);
+        printf("%11d  %10.1f  %10.3f  %6.3f  %7.0f  %11.1f%%  %11.1f%%\n", counts[i], r.publishNs, r.fanoutMs, r.maxFanoutMs,
+               r.takeNs, r.droppedSlow * 100.0, r.droppedFast * 100.0);
+    }
+    return 0;
+}
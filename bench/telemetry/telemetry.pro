@@ -0,0 +1,16 @@
+# Telemetry bus: cost of publish() and of the fan-out to many subscribers, drops of slow ones
+
+include(../bench.pri)
+
+QT += core
+QT -= gui
+
+TARGET = bench_telemetry
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/telemetrybus.cpp
+
+HEADERS += \
+    $$SRC/telemetrybus.h
@@ -0,0 +1,133 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QVector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+#include "telemetrystore.h"
+
+// Recorded history, 2 h at 10 Hz
+#define BENCH_HOURS             (2)
+#define BENCH_RATE_HZ           (10)
+// Timestamps of the frames vary by up to +- this, ms
+#define BENCH_JITTER_MS         (3)
+
+// Units of the tables, as the printer sends them
+static const double scales[TSTORE_TABLES] = { 10.0, 1000.0, 10000.0, 1.0 };
+static const int columns[TSTORE_TABLES] = { 4, 4, 1, 1 };
+static const char *names[TSTORE_TABLES] = { "temperatures", "position", "progress", "state" };
+
+typedef struct {
+    QVector<qint64> times;
+    QVector<qint32> values;         ///< Rows one after another, columns of the table each
+} Reference;
+
+static int uniform(int low, int high)
+{
+    return low + rand() % (high - low + 1);
+}
+
+/**
+ * Frames of one printer printing: a noisy hotend, a steady bed, X going back and forth, Y on a
+ * sine, Z in layers, E growing, the progress and a state changing rarely.
+ */
+static void frame(int n, qint32 rows[TSTORE_TABLES][TSTORE_MAX_COLUMNS], qint32 *hotend, double *x, double *vx)
+{
+    if(rand() % 4 == 0)
+        *hotend += uniform(-1, 1);
+    rows[TSTORE_TEMPERATURES][0] = *hotend;
+    rows[TSTORE_TEMPERATURES][1] = 2100;
+    rows[TSTORE_TEMPERATURES][2] = 600 + (rand() % 20 == 0 ? uniform(-1, 1) : 0);
+    rows[TSTORE_TEMPERATURES][3] = 600;
+
+    *x += *vx / BENCH_RATE_HZ;
+    if(*x > 200.0 || *x < 0.0)
+        *vx = -*vx;
+    rows[TSTORE_POSITION][0] = static_cast<qint32>(lround(*x * 1000.0));
+    rows[TSTORE_POSITION][1] = static_cast<qint32>(lround(100000.0 + 30000.0 * sin(n * 0.01)));
+    rows[TSTORE_POSITION][2] = 200 + (n / 3000) * 200;
+    rows[TSTORE_POSITION][3] = n * 33;
+
+    rows[TSTORE_PROGRESS][0] = static_cast<qint32>(static_cast<qint64>(n) * 10000 / (BENCH_HOURS * 3600 * BENCH_RATE_HZ));
+    rows[TSTORE_STATE][0] = n % 6000 < 5990 ? 3 : 4;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    srand(1);
+
+    TelemetryStore store;
+    int printer = store.addPrinter();
+    Reference reference[TSTORE_TABLES];
+
+    const int frames = BENCH_HOURS * 3600 * BENCH_RATE_HZ;
+    const qint64 start = 1700000000000LL;
+    qint32 rows[TSTORE_TABLES][TSTORE_MAX_COLUMNS];
+    qint32 hotend = 2100;
+    double x = 0.0;
+    double vx = 50.0;
+    qint64 appendNs = 0;
+    QElapsedTimer timer;
+
+    for(int n = 0; n < frames; n++)
+    {
+        qint64 time = start + static_cast<qint64>(n) * 1000 / BENCH_RATE_HZ + uniform(-BENCH_JITTER_MS, BENCH_JITTER_MS);
+        frame(n, rows, &hotend, &x, &vx);
+
+        timer.start();
+        for(int table = 0; table < TSTORE_TABLES; table++)
+            store.append(printer, table, time, rows[table]);
+        appendNs += timer.nsecsElapsed();
+
+        for(int table = 0; table < TSTORE_TABLES; table++)
+        {
+            reference[table].times.append(time);
+            for(int column = 0; column < columns[table]; column++)
+                reference[table].values.append(rows[table][column]);
+        }
+    }
+
+    TelemetryStoreStats stats = store.getStats();
+    printf("%d h at %d Hz, +-%d ms jitter: %d frames of %d tables, %llu samples\n\n", BENCH_HOURS, BENCH_RATE_HZ,
+           BENCH_JITTER_MS, frames, TSTORE_TABLES, static_cast<unsigned long long>(stats.samples));
+    printf("append         %8.1f ns per frame of all tables, rollups included\n", static_cast<double>(appendNs) / frames);
+    printf("stored         %8llu bytes in %d blocks, %.3f bytes per sample, %.3f per row\n\n",
+           static_cast<unsigned long long>(stats.bytes), stats.blocks, static_cast<double>(stats.bytes) / stats.samples,
+           static_cast<double>(stats.bytes) / stats.rows);
+
+    /* Każde pole z powrotem i porównane z tym, co zapisano */
+    printf("%-14s %6s %8s %10s %12s\n", "table", "field", "points", "mismatch", "query ms");
+    QVector<TelemetryPoint> points;
+    for(int field = 0; field < TELEMETRY_FIELDS; field++)
+    {
+        int column;
+        int table = TelemetryStore::tableOf(field, &column);
+        if(table < 0)
+            continue;
+        points.clear();
+        timer.start();
+        store.query(printer, field, 0, LLONG_MAX, &points);
+        double queryMs = timer.nsecsElapsed() / 1e6;
+
+        const Reference &r = reference[table];
+        int mismatch = points.size() == r.times.size() ? 0 : abs(points.size() - r.times.size());
+        for(int i = 0; i < points.size() && i < r.times.size(); i++)
+        {
+            if(points[i].time != r.times[i] || lround(points[i].value * scales[table]) != r.values[i * columns[table] + column])
+                mismatch++;
+        }
+        printf("%-14s %6d %8d %10d %12.2f\n", names[table], field, points.size(), mismatch, queryMs);
+    }
+
+    QVector<TelemetryRollup> rollups;
+    timer.start();
+    store.queryRollup(printer, TELEMETRY_HOTEND, TSTORE_MINUTES, 0, LLONG_MAX, &rollups);
+    printf("\nminute rollups of the hotend  %d in %.3f ms\n", rollups.size(), timer.nsecsElapsed() / 1e6);
+    rollups.clear();
+    timer.start();
+    store.queryRollup(printer, TELEMETRY_HOTEND, TSTORE_SECONDS, 0, LLONG_MAX, &rollups);
+    printf("second rollups of the hotend  %d in %.3f ms\n", rollups.size(), timer.nsecsElapsed() / 1e6);
+    return 0;
+}
@@ -0,0 +1,17 @@
+# Telemetry history: bytes per sample, cost of append() and a lossless round trip
+
+include(../bench.pri)
+
+QT += core
+QT -= gui
+
+TARGET = bench_telemetrystore
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/telemetrystore.cpp
+
+HEADERS += \
+    $$SRC/telemetrystore.h \
+    $$SRC/telemetrybus.h
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "min.h"
+#include "simline.h"
+#include "gcodegen.h"
+
+// Synthetic file, about 2.3 MB, sent round and round
+#define BENCH_LAYERS            (40)
+#define BENCH_MOVES_PER_LAYER   (1500)
+// Simulated time of one run and its step
+#define BENCH_DURATION_US       (20000000U)
+#define BENCH_STEP_US           (100U)
+// The window is sampled from this on, after the first growth
+#define BENCH_WARMUP_US         (2000000U)
+
+typedef struct {
+    const char *name;
+    uint32_t bytesPerSecond;
+    uint32_t latencyUs;
+    double corruption;
+} LinkConfig;
+
+/**
+ * Firmware end, checks that every line arrives whole and in order.
+ */
+class Device : public ICommandInterpreter
+{
+public:
+    explicit Device(const std::vector<std::string> *lines) : lines(lines), received(0), mismatches(0) {}
+
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        if(min_id != MSG_GCODE_LINE || len_payload < MsgGcodeLine::wire_size)
+            return true;
+        const std::string &expected = (*lines)[received % lines->size()];
+        MsgGcodeLine::View view(min_payload);
+        uint16_t length = static_cast<uint16_t>(len_payload - MsgGcodeLine::wire_size);
+        if(view.command_id() != static_cast<uint16_t>(received) || length != expected.size()
+                || memcmp(min_payload + MsgGcodeLine::wire_size, expected.data(), length) != 0)
+            mismatches++;
+        received++;
+        return true;
+    }
+
+    const std::vector<std::string> *lines;
+    uint64_t received;
+    uint64_t mismatches;
+};
+
+class Host : public ICommandInterpreter
+{
+public:
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+    {
+        (void)min_id;
+        (void)min_payload;
+        (void)len_payload;
+        return true;
+    }
+};
+
+typedef struct {
+    double linesPerSecond;
+    double meanWindow;
+    uint32_t roundTripMs;
+    uint32_t retransmitTimeoutMs;
+    uint64_t mismatches;
+} WindowResult;
+
+/**
+ * Like PrinterLink::poll(): the received data, then up to a window of frames while one is due.
+ */
+static void pollEnd(MinProtocol &end, SimLine &rx)
+{
+    uint8_t data[SIMLINE_TX_BUFFER_SIZE];
+    uint32_t n = rx.receive(data, sizeof(data));
+    end.min_poll(n ? data : nullptr, n);
+    for(uint32_t i = 0; i < TRANSPORT_MAX_WINDOW_SIZE && end.min_next_deadline_ms() == 0; i++)
+        end.min_poll(nullptr, 0);
+}
+
+/**
+ * Keeps the bulk lane full of G-code lines, with the host settings of PrinterLink::loadProfile().
+ * Both directions corrupt bytes, so ACKs get lost too. Without nacks the printer end is firmware
+ * which never asks for missing frames, every loss ends in a retransmit timeout.
+ */
+static WindowResult run(const std::vector<std::string> &lines, const LinkConfig &config, bool nacks, bool batches, uint8_t maxWindow)
+{
+    SimClock clock;
+    SimLine toPrinter(&clock, config.bytesPerSecond, config.latencyUs, config.corruption);
+    SimLine toHost(&clock, config.bytesPerSecond, config.latencyUs, config.corruption);
+    Host host;
+    Device device(&lines);
+    MinProtocol hostEnd(&toPrinter, &clock, &host);
+    MinProtocol printerEnd(&toHost, &clock, &device);
+
+    uint32_t baud = config.bytesPerSecond * 10U;
+    if(!nacks)
+        printerEnd.min_set_features(static_cast<uint8_t>(MIN_DEFAULT_FEATURES & ~MIN_FEATURE_NACKS));
+    hostEnd.min_set_batch_deadline_us(batches ? MIN_DEFAULT_BATCH_DEADLINE_US : 0U);
+    hostEnd.min_set_max_payload(static_cast<uint16_t>(std::max(baud / 1000U, static_cast<uint32_t>(MAX_PAYLOAD))));
+    hostEnd.min_set_line_rate(config.bytesPerSecond);
+    hostEnd.min_set_max_window(maxWindow);
+    hostEnd.min_transport_reset(true);
+
+    srand(1);
+    uint64_t sent = 0;
+    uint64_t windowSum = 0;
+    uint64_t windowSamples = 0;
+    for(clock.us = 0; clock.us < BENCH_DURATION_US; clock.us += BENCH_STEP_US)
+    {
+        while(true)
+        {
+            const std::string &line = lines[sent % lines.size()];
+            MsgGcodeLine message;
+            message.command_id = static_cast<uint16_t>(sent);
+            if(!hostEnd.min_queue_message(message, reinterpret_cast<const uint8_t *>(line.data()), static_cast<uint16_t>(line.size())))
+                break;
+            sent++;
+        }
+        toPrinter.advance();
+        toHost.advance();
+        pollEnd(printerEnd, toPrinter);
+        pollEnd(hostEnd, toHost);
+        if(clock.us >= BENCH_WARMUP_US)
+        {
+            windowSum += hostEnd.min_window();
+            windowSamples++;
+        }
+    }
+
+    WindowResult result;
+    result.linesPerSecond = device.received * 1e6 / BENCH_DURATION_US;
+    result.meanWindow = windowSamples ? static_cast<double>(windowSum) / windowSamples : 0.0;
+    result.roundTripMs = hostEnd.min_round_trip_ms();
+    result.retransmitTimeoutMs = hostEnd.min_retransmit_timeout_ms();
+    result.mismatches = device.mismatches;
+    return result;
+}
+
+int main()
+{
+    GcodeGenerator generator;
+    std::string text = generator.generate(BENCH_LAYERS, BENCH_MOVES_PER_LAYER);
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while(start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos)
+            end = text.size();
+        /* Bez komentarzy, jak po preprocesorze */
+        if(end > start && text[start] != ';')
+            lines.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+
+    static const LinkConfig configs[] = {
+        {"1 Mbaud, USB 16 ms", 100000, 16000, 0.0},
+        {"1 Mbaud, USB 16 ms, 0.05%", 100000, 16000, 0.0005},
+        {"12 Mbaud, native 1 ms", 1200000, 1000, 0.0},
+        {"12 Mbaud, native 1 ms, 0.05%", 1200000, 1000, 0.0005},
+    };
+    static const uint8_t windows[] = {16, TRANSPORT_MAX_WINDOW_SIZE};
+
+    printf("G-code lines delivered for %u s with the bulk lane kept full; the percentage is the share of\n"
+           "bytes corrupted in each direction. nak: the printer asks for missing frames. Window is the mean\n"
+           "after the first %u s.\n\n", BENCH_DURATION_US / 1000000U, BENCH_WARMUP_US / 1000000U);
+    printf("%-30s %-4s %-7s %4s %9s %7s %7s %7s %10s\n", "link", "nak", "batches", "max", "lines/s", "window", "rtt ms", "rto ms",
+           "mismatches");
+    for(size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    {
+        /* Na czystej linii prośby o ramki nic nie zmieniają */
+        for(int nacks = configs[i].corruption > 0.0 ? 0 : 1; nacks < 2; nacks++)
+        {
+            for(int batches = 0; batches < 2; batches++)
+            {
+                for(size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+                {
+                    WindowResult r = run(lines, configs[i], nacks != 0, batches != 0, windows[w]);
+                    printf("%-30s %-4s %-7s %4u %9.0f %7.1f %7u %7u %10llu\n", configs[i].name, nacks ? "on" : "off",
+                           batches ? "on" : "off", windows[w], r.linesPerSecond, r.meanWindow, r.roundTripMs, r.retransmitTimeoutMs,
+                           static_cast<unsigned long long>(r.mismatches));
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+# Adaptive transport window: lines per second on clean and lossy links, with and without NAKs
+
+include(../bench.pri)
+
+CONFIG -= qt
+
+TARGET = bench_window
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    $$SRC/min.cpp \
+    $$SRC/mincodec.cpp \
+    $$SRC/iserialcommunication.cpp \
+    $$SRC/isystem.cpp \
+    $$SRC/icommandinterpreter.cpp
+
+HEADERS += \
+    $$SRC/min.h \
+    $$SRC/mincodec.h \
+    $$SRC/messages.h \
+    $$PWD/../common/simline.h \
+    $$PWD/../common/gcodegen.h
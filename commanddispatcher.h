@@ -0,0 +1,128 @@
+#ifndef COMMANDDISPATCHER_H
+#define COMMANDDISPATCHER_H
+
+#include <stdint.h>
+#include <array>
+
+// Number of MIN identifiers, the id is 6 bits
+#define MIN_ID_COUNT                                (64U)
+#define MIN_ID_MASK                                 (0x3fU)
+
+/**
+ * Per-id diagnostic counters of the dispatcher.
+ */
+struct CommandCounters {
+    uint32_t handled[MIN_ID_COUNT];                 // Frames decoded and accepted by the handler
+    uint32_t rejected[MIN_ID_COUNT];                // Unhandled id, wrong length or refused by the handler
+};
+
+/**
+ * Binding of a MIN id to a handler of the Owner class. The primary template is used for the
+ * ids without a handler and rejects the frame.
+ *
+ * The Owner binds an id by specialising CommandBinding, usually by inheriting from
+ * TypedCommandBinding:
+ *
+ *     template <> struct CommandBinding<Owner, MSG_POSITION>
+ *         : TypedCommandBinding<Owner, MsgPosition, &Owner::onPosition> {};
+ *
+ * where onPosition takes a const MsgPosition::View&.
+ *
+ * @tparam Owner The class on which the handlers are called.
+ * @tparam Id    The MIN identifier.
+ */
+template <class Owner, uint8_t Id>
+struct CommandBinding
+{
+    static bool dispatch(Owner &owner, const uint8_t *payload, uint16_t len)
+    {
+        (void)owner;
+        (void)payload;
+        (void)len;
+        return false;
+    }
+};
+
+/**
+ * Wraps the payload in the Message view (fields are read in place from the receive buffer)
+ * and calls the Handler. The handler is a template parameter so the call is resolved (and
+ * usually inlined) at compile time.
+ *
+ * Payloads longer than the message are accepted, newer firmware may append fields.
+ */
+template <class Owner, class Message, bool (Owner::*Handler)(const typename Message::View&)>
+struct TypedCommandBinding
+{
+    static bool dispatch(Owner &owner, const uint8_t *payload, uint16_t len)
+    {
+        if(len < Message::wire_size) {
+            return false;
+        }
+        typename Message::View view(payload);
+        return (owner.*Handler)(view);
+    }
+};
+
+namespace detail {
+
+template <unsigned... I>
+struct IndexList {};
+
+template <unsigned N, unsigned... I>
+struct MakeIndexList : MakeIndexList<N - 1U, N - 1U, I...> {};
+
+template <unsigned... I>
+struct MakeIndexList<0U, I...> {
+    typedef IndexList<I...> type;
+};
+
+template <class Owner>
+struct CommandTable {
+    typedef bool (*Entry)(Owner &owner, const uint8_t *payload, uint16_t len);
+    typedef std::array<Entry, MIN_ID_COUNT> Type;
+
+    template <unsigned... I>
+    static constexpr Type build(IndexList<I...>)
+    {
+        return Type{{ &CommandBinding<Owner, static_cast<uint8_t>(I)>::dispatch... }};
+    }
+};
+
+} // namespace detail
+
+/**
+ * Dispatcher of the MIN frames by min_id.
+ *
+ * The table of 64 entry points is generated at compile time from the CommandBinding
+ * specialisations visible at the point of instantiation, so a frame costs one indexed call.
+ *
+ * @tparam Owner The class on which the handlers are called.
+ */
+template <class Owner>
+class CommandDispatcher
+{
+public:
+    typedef typename detail::CommandTable<Owner>::Entry Entry;
+
+    static bool dispatch(Owner &owner, CommandCounters &counters, uint8_t min_id, const uint8_t *payload, uint16_t len)
+    {
+        uint8_t id = min_id & static_cast<uint8_t>(MIN_ID_MASK);
+        bool ok = table[id](owner, payload, len);
+        if(ok) {
+            counters.handled[id]++;
+        }
+        else {
+            counters.rejected[id]++;
+        }
+        return ok;
+    }
+
+private:
+    static constexpr typename detail::CommandTable<Owner>::Type table =
+            detail::CommandTable<Owner>::build(typename detail::MakeIndexList<MIN_ID_COUNT>::type());
+};
+
+template <class Owner>
+constexpr typename detail::CommandTable<Owner>::Type CommandDispatcher<Owner>::table;
+
+#endif // COMMANDDISPATCHER_H
@@ -1,8 +1,11 @@
 #include "commandinterpreter.h"
+#include <string.h>
 
 CommandInterpreter::CommandInterpreter()
 {
-
+    memset(&state, 0, sizeof(state));
+    memset(&counters, 0, sizeof(counters));
+    listener = nullptr;
 }
 
 CommandInterpreter::~CommandInterpreter()
@@ -11,7 +14,60 @@ CommandInterpreter::~CommandInterpreter()
 }
 
 
-bool CommandInterpreter::commandProceed(uint8_t min_id, uint8_t *min_payload, uint8_t len_payload)
+bool CommandInterpreter::commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
+{
+    return CommandDispatcher<CommandInterpreter>::dispatch(*this, counters, min_id, min_payload, len_payload);
+}
+
+const PrinterState &CommandInterpreter::getState() const
+{
+    return state;
+}
+
+const CommandCounters &CommandInterpreter::getCounters() const
+{
+    return counters;
+}
+
+void CommandInterpreter::setListener(ITelemetryListener *listener)
+{
+    this->listener = listener;
+}
+
+bool CommandInterpreter::onAck(const MsgAck::View &msg)
+{
+    state.last_ack = msg.decode();
+    return true;
+}
+
+bool CommandInterpreter::onStatus(const MsgStatus::View &msg)
+{
+    state.status = msg.decode();
+    state.status_reports++;
+    if(listener)
+        listener->onTelemetry(MSG_STATUS, state);
+    return true;
+}
+
+bool CommandInterpreter::onPosition(const MsgPosition::View &msg)
+{
+    state.position = msg.decode();
+    if(listener)
+        listener->onTelemetry(MSG_POSITION, state);
+    return true;
+}
+
+bool CommandInterpreter::onTemperatures(const MsgTemperatures::View &msg)
+{
+    state.temperatures = msg.decode();
+    if(listener)
+        listener->onTelemetry(MSG_TEMPERATURES, state);
+    return true;
+}
+
+bool CommandInterpreter::onPlanner(const MsgPlanner::View &msg)
 {
-    return false;
+    state.planner = msg.decode();
+    state.planner_reports++;
+    return true;
 }
@@ -2,13 +2,67 @@
 #define COMMANDINTERPRETER_H
 
 #include "icommandinterpreter.h"
+#include "commanddispatcher.h"
+#include "messages.h"
+
+typedef struct {
+    MsgStatus status;
+    uint32_t status_reports;                        // Incremented on every status report
+    MsgPosition position;
+    MsgTemperatures temperatures;
+    MsgPlanner planner;
+    uint32_t planner_reports;                       // Incremented on every planner report
+    MsgAck last_ack;
+} PrinterState;
+
+/*
+ * Told about every status, position and temperature report once the state is updated
+ */
+class ITelemetryListener
+{
+public:
+    virtual ~ITelemetryListener() {}
+    virtual void onTelemetry(uint8_t min_id, const PrinterState &state) = 0;
+};
 
 class CommandInterpreter : public ICommandInterpreter
 {
 public:
     CommandInterpreter();
     ~CommandInterpreter();
-    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint8_t len_payload);
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload);
+
+    const PrinterState &getState() const;
+    const CommandCounters &getCounters() const;
+    void setListener(ITelemetryListener *listener);
+
+    /*
+     * Handlers called by the dispatcher, see the CommandBinding specialisations below
+     */
+    bool onAck(const MsgAck::View &msg);
+    bool onStatus(const MsgStatus::View &msg);
+    bool onPosition(const MsgPosition::View &msg);
+    bool onTemperatures(const MsgTemperatures::View &msg);
+    bool onPlanner(const MsgPlanner::View &msg);
+
+private:
+    PrinterState state;
+    CommandCounters counters;
+    ITelemetryListener *listener;
 };
 
+/*
+ * Binding of the MIN ids to the handlers, ids not listed here are rejected
+ */
+template <> struct CommandBinding<CommandInterpreter, MSG_ACK>
+    : TypedCommandBinding<CommandInterpreter, MsgAck, &CommandInterpreter::onAck> {};
+template <> struct CommandBinding<CommandInterpreter, MSG_STATUS>
+    : TypedCommandBinding<CommandInterpreter, MsgStatus, &CommandInterpreter::onStatus> {};
+template <> struct CommandBinding<CommandInterpreter, MSG_POSITION>
+    : TypedCommandBinding<CommandInterpreter, MsgPosition, &CommandInterpreter::onPosition> {};
+template <> struct CommandBinding<CommandInterpreter, MSG_TEMPERATURES>
+    : TypedCommandBinding<CommandInterpreter, MsgTemperatures, &CommandInterpreter::onTemperatures> {};
+template <> struct CommandBinding<CommandInterpreter, MSG_PLANNER>
+    : TypedCommandBinding<CommandInterpreter, MsgPlanner, &CommandInterpreter::onPlanner> {};
+
 #endif // COMMANDINTERPRETER_H
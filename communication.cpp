@@ -51,6 +51,7 @@ void Communication::serialError(QSerialPort::SerialPortError error)
         connected = false;
         TransmitQueue.clear();
         transmitIsGoing = false;
+        txBuffer.clear();
         qWarning("The device is unexpectedly removed from the system!");
         emit communicationError();
     }
@@ -61,6 +62,19 @@ QString Communication::getSerialID()
     return (serial_struct.sPortName + ": " + serial_struct.serialNumber);
 }
 
+/**
+ * @brief Communication::getBufferBytes
+ *
+ * Capacity of the buffers of the port, the internal buffers of QSerialPort are not included.
+ */
+int Communication::getBufferBytes() const
+{
+    int bytes = frame.capacity() + txBuffer.capacity();
+    for(int i = 0; i < TransmitQueue.size(); i++)
+        bytes += TransmitQueue.at(i).data.capacity();
+    return bytes;
+}
+
 bool Communication::isConfigured()
 {
     return configured;
@@ -80,6 +94,11 @@ void Communication::SetSerialPort(SerialStruct s)
     }
 }
 
+SerialStruct Communication::GetSerialPort()
+{
+    return serial_struct;
+}
+
 int Communication::OpenSerialPort()
 {
     if(!connected)
@@ -100,6 +119,8 @@ int Communication::OpenSerialPort()
             {
                 connected = true;
                 serial->flush();
+                /* Bufor nadawczy od razu w pełnej wielkości, w czasie pracy już nie rośnie */
+                txBuffer.reserve(COMMUNICATION_TX_BUFFER_SIZE);
                 qDebug() << "Info: Connected to the device\n";
                 return 0;
 
@@ -189,6 +210,13 @@ void Communication::ReadData()
     QByteArray RxData;
     serial->waitForReadyRead(1);
     RxData = serial->readAll();
+
+    /* Surowe dane dla protokołów (MIN), w kawałkach bo FrameSpan ma 16-bitową długość */
+    for(int offset = 0; offset < RxData.size(); offset += 0xffff)
+    {
+        int length = qMin(RxData.size() - offset, 0xffff);
+        dataSubscribers.invoke(FrameSpan(reinterpret_cast<const uint8_t *>(RxData.constData()) + offset, static_cast<uint16_t>(length)));
+    }
     static int state = 1;
     static int frameindex = 0;
     static int framelength = 0;
@@ -218,9 +246,8 @@ void Communication::ReadData()
                 /** @todo poważny problem ! w momencie kiedy w jednym buforze znajdzie się kilka pakietów to
                  * tylko pierwszy pakiet jest odbierany ! Trzeba to naprawić */
 
-                /* Rozwiązanie jest następujące, wysyłamy pakiet który musi zostać dodany do kolejki
-                 * i obsłużony przez odpowiednią funkcję */
-                emit frameReady(frame);
+                /* Ramki nie są już wysyłane po jednej sygnałem: cały odczyt dostają wyżej
+                 * subskrybenci danych jednym wywołaniem, a ramka służy tylko do potwierdzenia transmisji */
 
                 //Wymagane jest przerwanie aktualnej pętli bo gdy ostatnia wartość jest równa 0xBC wejdzie to kroku 1
                 //Tak to już się zdażyło :)
@@ -269,10 +296,24 @@ void Communication::ReadData()
 
 void Communication::sendByte(char c)
 {
-
+    /* Bajty są zbierane i wysyłane razem w transmitFinished() */
+    txBuffer.append(c);
 }
 
 int Communication::transmitSpace()
 {
-    return 1;
+    if(!connected)
+        return 0;
+
+    qint64 used = serial->bytesToWrite() + txBuffer.size();
+    return used >= COMMUNICATION_TX_BUFFER_SIZE ? 0 : static_cast<int>(COMMUNICATION_TX_BUFFER_SIZE - used);
+}
+
+void Communication::transmitFinished()
+{
+    if(connected && !txBuffer.isEmpty())
+    {
+        serial->write(txBuffer);
+    }
+    txBuffer.clear();
 }
@@ -3,9 +3,14 @@
 
 #include <QObject>
 #include <QtSerialPort>
-#include "callback.h"
+#include "delegate.h"
 #include "iserialcommunication.h"
 
+// Maximum number of data subscribers of one Communication
+#define COMMUNICATION_MAX_SUBSCRIBERS   (4U)
+// Bytes which may wait in the transmit buffers, reported to the protocol by transmitSpace()
+#define COMMUNICATION_TX_BUFFER_SIZE    (4096)
+
 typedef struct s_data {
     QByteArray data;
 } TData;
@@ -37,20 +42,24 @@ public:
 
     virtual void sendByte(char c);
     virtual int transmitSpace();
+    virtual void transmitFinished();
 
     QString getSerialID();
+    int getBufferBytes() const;
 
     /**
-     * Associates an data ready action with the Communiation class. The action is performed when the data is recived
+     * Subscribes a member function to the raw data read from the serial port (e.g. a MIN context).
+     * Subscribers are called directly from ReadData() with a view of the data, without copying it
+     * or posting an event, so they must be quick.
      *
-     * @param  callback The callback to be executed. The callback will be executed with a
-     *                  reference to the Communication.
+     * @return false if there is no free entry.
      *
-     * @see GenericCallback, handleClickEvent, ClickEvent
+     * @see MulticastDelegate
      */
-    void setDataReadyAction(GenericCallback<const Communication&>& callback)
+    template <class T, void (T::*Method)(const FrameSpan&)>
+    bool subscribeData(T *object)
     {
-        dataReady = &callback;
+        return dataSubscribers.template add<T, Method>(object);
     }
 
 private:
@@ -58,13 +67,14 @@ private:
     QSerialPort *serial;
     SerialStruct serial_struct;
     QByteArray frame;
+    QByteArray txBuffer;
     QQueue<TData> TransmitQueue;
     bool configured;
     bool connected;
     bool transmitIsGoing;
     QTimer *timeout;
 protected:
-    GenericCallback<const Communication&>* dataReady; ///< The callback to be executed when this AbstractButton is clicked
+    MulticastDelegate<const FrameSpan&, COMMUNICATION_MAX_SUBSCRIBERS> dataSubscribers; ///< Called for every read
 
 private slots:
     void ReadData();
@@ -72,7 +82,6 @@ private slots:
     void serialError(QSerialPort::SerialPortError error);
 
 signals:
-    void frameReady(QByteArray data);
     void communicationError();
 };
 
@@ -3,12 +3,16 @@
 #include "ui_configurewindow.h"
 #include <QtSerialPort/QSerialPort>
 
-ConfigureWindow::ConfigureWindow(QWidget *parent) :
+ConfigureWindow::ConfigureWindow(PortRegistry *registry, QWidget *parent) :
     QWidget(parent),
-    ui(new Ui::ConfigureWindow)
+    ui(new Ui::ConfigureWindow),
+    registry(registry)
 {
     ui->setupUi(this);
 
+    /* Lista portów odświeża się sama gdy rejestr wykryje podłączenie/odłączenie adaptera */
+    connect(registry, SIGNAL(portsChanged()), this, SLOT(portsChanged()));
+
     //wpisywanie domyślnych watości konfiguracji portu
     QStringList slDataBits = (QStringList() << "5" << "6" << "7" << "8");
     ui->cbDataBits->addItems(slDataBits);
@@ -32,22 +36,37 @@ ConfigureWindow::ConfigureWindow(QWidget *parent) :
 
 void ConfigureWindow::searchForPort()
 {
-    //dodanie dostępnych portów com do listy
+    //dodanie dostępnych portów com do listy, dane pochodzą z pamięci podręcznej rejestru
+    QString selected = serialList.value(ui->cbSerialPort->currentIndex());
     ui->cbSerialPort->clear();
     portList.clear();
     serialList.clear();
     bool found = false;
 
-    foreach (const QSerialPortInfo &infoport, QSerialPortInfo::availablePorts())
+    foreach (const PortEntry &port, registry->ports())
     {
-            ui->cbSerialPort->addItem(infoport.portName()+": "+infoport.serialNumber());
-            portList.append(infoport.portName());
-            serialList.append(infoport.serialNumber());
+            QString name = port.portName+": "+port.serialNumber;
+            if(!port.printerId.isEmpty())
+                name += " ("+port.printerId+")";
+            ui->cbSerialPort->addItem(name);
+            portList.append(port.portName);
+            serialList.append(port.serialNumber);
             found = true;
     }
 
+    //zachowaj wybór użytkownika po odświeżeniu listy
+    int index = serialList.indexOf(selected);
+    if(!selected.isEmpty() && index >= 0)
+        ui->cbSerialPort->setCurrentIndex(index);
+
     ui->bApply->setEnabled(found);
 }
+
+void ConfigureWindow::portsChanged()
+{
+    if(this->isVisible())
+        this->searchForPort();
+}
 void ConfigureWindow::showEvent(QShowEvent *ev)
 {
     UNUSED(ev);
@@ -61,6 +80,8 @@ ConfigureWindow::~ConfigureWindow()
 
 void ConfigureWindow::on_bRefreshSerialPort_clicked()
 {
+    /* Skanowanie odbywa się w tle, lista zostanie odświeżona przez portsChanged() */
+    registry->rescan();
     this->searchForPort();
 }
 
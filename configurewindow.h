@@ -5,6 +5,7 @@
 #include <QtSerialPort/QtSerialPort>
 #include <QVector>
 #include "communication.h"
+#include "portregistry.h"
 
 namespace Ui {
 class ConfigureWindow;
@@ -15,7 +16,7 @@ class ConfigureWindow : public QWidget
     Q_OBJECT
 
 public:
-    explicit ConfigureWindow(QWidget *parent = 0);
+    explicit ConfigureWindow(PortRegistry *registry, QWidget *parent = 0);
     ~ConfigureWindow();
 
 private slots:
@@ -27,6 +28,8 @@ private slots:
 
     void on_checkBox_toggled(bool checked);
 
+    void portsChanged();
+
 signals:
     void ConfigureResponse(SerialStruct serial);
 
@@ -34,6 +37,7 @@ private:
     void showEvent(QShowEvent *ev);
     void searchForPort();
     Ui::ConfigureWindow *ui;
+    PortRegistry *registry;
     SerialStruct serial;
     QVector<QString> portList;
     QVector<QString> serialList;
@@ -0,0 +1,788 @@
+#include "controlapi.h"
+#include "printestimator.h"
+#include <QHostAddress>
+#include <QCryptographicHash>
+#include <QUrlQuery>
+#include <QFileInfo>
+#include <QDir>
+#include <QDateTime>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QRunnable>
+#include <QMutexLocker>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDebug>
+
+#define API_WEBSOCKET_GUID          "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define API_WS_TEXT                 (0x1)
+#define API_WS_CLOSE                (0x8)
+#define API_WS_PING                 (0x9)
+#define API_WS_PONG                 (0xA)
+
+static const char *telemetryFieldName(int field)
+{
+    switch(field)
+    {
+    case TELEMETRY_HOTEND: return "hotend";
+    case TELEMETRY_HOTEND_TARGET: return "hotendTarget";
+    case TELEMETRY_BED: return "bed";
+    case TELEMETRY_BED_TARGET: return "bedTarget";
+    case TELEMETRY_X: return "x";
+    case TELEMETRY_Y: return "y";
+    case TELEMETRY_Z: return "z";
+    case TELEMETRY_E: return "e";
+    case TELEMETRY_PROGRESS: return "progress";
+    case TELEMETRY_STATE: return "state";
+    default: return "unknown";
+    }
+}
+
+static const char *jobStateName(int state)
+{
+    switch(state)
+    {
+    case FARM_JOB_QUEUED: return "queued";
+    case FARM_JOB_PRINTING: return "printing";
+    case FARM_JOB_DONE: return "done";
+    case FARM_JOB_FAILED: return "failed";
+    case FARM_JOB_CANCELED: return "canceled";
+    default: return "unknown";
+    }
+}
+
+/**
+ * Szacowanie wgranego pliku poza wątkiem GUI i wątkiem API, zadanie trafia do planisty
+ * dopiero z gotowym plikiem ".est".
+ */
+class EstimateTask : public QRunnable
+{
+public:
+    EstimateTask(ControlApi *api, quint32 id, const QString &fileName, const JobRequirements &requirements) :
+        api(api), id(id), fileName(fileName), requirements(requirements) {}
+    void run()
+    {
+        PrintEstimator estimator;
+        estimator.open(fileName);
+        /* ControlApi czeka w destruktorze na wszystkie zadania, wskaźnik jest ważny */
+        QMetaObject::invokeMethod(api, "jobUploaded", Qt::QueuedConnection, Q_ARG(quint32, id),
+                                  Q_ARG(QString, fileName), Q_ARG(JobRequirements, requirements));
+    }
+
+private:
+    ControlApi *api;
+    quint32 id;
+    QString fileName;
+    JobRequirements requirements;
+};
+
+ControlServer::ControlServer(ControlApi *api)
+{
+    this->api = api;
+    server = nullptr;
+    uploads = 0;
+}
+
+ControlServer::~ControlServer()
+{
+    foreach (ApiClient *client, clients)
+    {
+        /* Gniazda są usuwane razem z serwerem, bez wywołania disconnected() */
+        client->socket->disconnect(this);
+        if(client->subscriber >= 0)
+            api->getTelemetry()->unsubscribe(client->subscriber);
+        if(client->upload)
+        {
+            client->upload->remove();
+            delete client->upload;
+        }
+        delete client;
+    }
+    clients.clear();
+    delete server;
+}
+
+/**
+ * @brief ControlServer::start
+ *
+ * Called in the API thread, so the server and its sockets belong to that thread.
+ */
+void ControlServer::start(const QString &address, quint16 port, const QString &uploadDir)
+{
+    this->uploadDir = uploadDir;
+    QDir().mkpath(uploadDir);
+
+    server = new QTcpServer();
+    connect(server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    if(!server->listen(QHostAddress(address), port))
+    {
+        qWarning() << "Warning: Nie można uruchomić API na " << address << ":" << port << " " << server->errorString();
+        return;
+    }
+    qDebug() << "API: " << address << ":" << port << "\n";
+}
+
+void ControlServer::newConnection()
+{
+    while(server->hasPendingConnections())
+    {
+        QTcpSocket *socket = server->nextPendingConnection();
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+        ApiClient *client = new ApiClient();
+        client->socket = socket;
+        client->state = API_CLIENT_HEADER;
+        client->keepAlive = true;
+        client->bodyLeft = 0;
+        client->upload = nullptr;
+        client->subscriber = -1;
+        clients.insert(socket, client);
+
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readyRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(disconnected()));
+    }
+}
+
+void ControlServer::disconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    ApiClient *client = clients.take(socket);
+    if(client)
+    {
+        if(client->subscriber >= 0)
+            api->getTelemetry()->unsubscribe(client->subscriber);
+        /* Przerwane wgrywanie, niepełny plik jest usuwany */
+        if(client->upload)
+        {
+            client->upload->remove();
+            delete client->upload;
+        }
+        delete client;
+    }
+    socket->deleteLater();
+}
+
+void ControlServer::readyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    ApiClient *client = clients.value(socket);
+    if(!client)
+        return;
+
+    client->buffer.append(socket->readAll());
+    process(client);
+}
+
+/**
+ * @brief ControlServer::process
+ *
+ * Handles everything complete in the buffer: request heads, upload data and WebSocket frames.
+ */
+void ControlServer::process(ApiClient *client)
+{
+    while(client->socket->state() == QAbstractSocket::ConnectedState)
+    {
+        if(client->state == API_CLIENT_WEBSOCKET)
+        {
+            if(!readFrame(client))
+                return;
+            continue;
+        }
+
+        if(client->state == API_CLIENT_BODY)
+        {
+            qint64 n = qMin<qint64>(client->bodyLeft, client->buffer.size());
+            if(n == 0)
+                return;
+            if(client->upload->write(client->buffer.constData(), n) != n)
+            {
+                qWarning() << "Warning: Błąd zapisu pliku: " << client->upload->fileName();
+                client->keepAlive = false;
+                reply(client, 500, "Internal Server Error", "{\"error\":\"write failed\"}");
+                return;
+            }
+            client->buffer.remove(0, static_cast<int>(n));
+            client->bodyLeft -= n;
+            if(client->bodyLeft > 0)
+                return;
+            finishUpload(client);
+            continue;
+        }
+
+        int end = client->buffer.indexOf("\r\n\r\n");
+        if(end < 0)
+        {
+            if(client->buffer.size() > API_MAX_HEADER)
+            {
+                client->keepAlive = false;
+                reply(client, 431, "Request Header Fields Too Large", "{\"error\":\"header too large\"}");
+            }
+            return;
+        }
+        QByteArray head = client->buffer.left(end);
+        client->buffer.remove(0, end + 4);
+        handleRequest(client, head);
+    }
+}
+
+void ControlServer::handleRequest(ApiClient *client, const QByteArray &head)
+{
+    QList<QByteArray> lines = head.split('\n');
+    QList<QByteArray> request = lines.first().trimmed().split(' ');
+    if(request.size() != 3)
+    {
+        client->keepAlive = false;
+        reply(client, 400, "Bad Request", "{\"error\":\"bad request line\"}");
+        return;
+    }
+
+    QHash<QByteArray, QByteArray> headers;
+    for(int i = 1; i < lines.size(); i++)
+    {
+        int colon = lines[i].indexOf(':');
+        if(colon > 0)
+            headers.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+    }
+
+    const QByteArray &method = request[0];
+    QByteArray target = request[1];
+    QByteArray connection = headers.value("connection").toLower();
+    client->keepAlive = (request[2] == "HTTP/1.1") ? !connection.contains("close") : connection.contains("keep-alive");
+
+    QByteArray path = target;
+    QUrlQuery query;
+    int question = target.indexOf('?');
+    if(question >= 0)
+    {
+        path = target.left(question);
+        query.setQuery(QString::fromUtf8(target.mid(question + 1)));
+    }
+
+    if(path == "/status")
+    {
+        if(method != "GET")
+            reply(client, 405, "Method Not Allowed", "{\"error\":\"method not allowed\"}");
+        else
+            reply(client, 200, "OK", api->snapshot());
+    }
+    else if(path == "/ws")
+    {
+        if(method != "GET" || headers.value("upgrade").toLower() != "websocket" || !headers.contains("sec-websocket-key"))
+        {
+            reply(client, 400, "Bad Request", "{\"error\":\"websocket upgrade expected\"}");
+            return;
+        }
+        upgrade(client, headers.value("sec-websocket-key"));
+    }
+    else if(path == "/jobs")
+    {
+        if(method != "POST")
+        {
+            reply(client, 405, "Method Not Allowed", "{\"error\":\"method not allowed\"}");
+            return;
+        }
+        if(!headers.contains("content-length"))
+        {
+            client->keepAlive = false;
+            reply(client, 411, "Length Required", "{\"error\":\"content-length required\"}");
+            return;
+        }
+        qint64 length = headers.value("content-length").toLongLong();
+        if(length <= 0 || length > API_MAX_UPLOAD)
+        {
+            client->keepAlive = false;
+            reply(client, 413, "Payload Too Large", "{\"error\":\"bad content-length\"}");
+            return;
+        }
+
+        JobRequirements &r = client->requirements;
+        r.sizeX = query.queryItemValue("sizeX").toFloat();
+        r.sizeY = query.queryItemValue("sizeY").toFloat();
+        r.sizeZ = query.queryItemValue("sizeZ").toFloat();
+        r.nozzleDiameter = query.queryItemValue("nozzle").toFloat();
+        r.material = query.queryItemValue("material", QUrl::FullyDecoded);
+        if(!startUpload(client, query.queryItemValue("name", QUrl::FullyDecoded), length))
+        {
+            client->keepAlive = false;
+            reply(client, 500, "Internal Server Error", "{\"error\":\"can not create file\"}");
+            return;
+        }
+        /* curl przy dużych plikach czeka na zgodę przed wysłaniem treści */
+        if(headers.value("expect").toLower() == "100-continue")
+            client->socket->write("HTTP/1.1 100 Continue\r\n\r\n");
+    }
+    else if(path.startsWith("/jobs/"))
+    {
+        bool ok;
+        quint32 id = path.mid(6).toUInt(&ok);
+        if(!ok)
+            reply(client, 404, "Not Found", "{\"error\":\"not found\"}");
+        else if(method != "DELETE")
+            reply(client, 405, "Method Not Allowed", "{\"error\":\"method not allowed\"}");
+        else
+        {
+            emit cancelRequested(id);
+            reply(client, 202, "Accepted", "{}");
+        }
+    }
+    else if(path.startsWith("/printers/"))
+    {
+        QList<QByteArray> parts = path.mid(10).split('/');
+        bool ok = parts.size() == 2;
+        int printer = ok ? parts[0].toInt(&ok) : -1;
+        int command = -1;
+        int value = 0;
+        if(ok && parts[1] == "pause")
+            command = API_PRINTER_PAUSE;
+        else if(ok && parts[1] == "resume")
+            command = API_PRINTER_RESUME;
+        else if(ok && parts[1] == "stop")
+            command = API_PRINTER_STOP;
+        else if(ok && parts[1] == "feed")
+            command = API_PRINTER_FEED;
+
+        if(!ok || command < 0)
+        {
+            reply(client, 404, "Not Found", "{\"error\":\"not found\"}");
+            return;
+        }
+        if(method != "POST")
+        {
+            reply(client, 405, "Method Not Allowed", "{\"error\":\"method not allowed\"}");
+            return;
+        }
+        if(command == API_PRINTER_FEED)
+        {
+            value = query.queryItemValue("percent").toInt(&ok);
+            if(!ok || value < 1 || value > 0xFFFF)
+            {
+                reply(client, 400, "Bad Request", "{\"error\":\"bad percent\"}");
+                return;
+            }
+        }
+        emit printerCommandRequested(printer, command, value);
+        reply(client, 202, "Accepted", "{}");
+    }
+    else
+    {
+        reply(client, 404, "Not Found", "{\"error\":\"not found\"}");
+    }
+}
+
+bool ControlServer::startUpload(ApiClient *client, const QString &name, qint64 length)
+{
+    /* Tylko nazwa pliku, bez katalogów podanych przez klienta */
+    QString base = QFileInfo(name).fileName();
+    if(base.isEmpty())
+        base = "job.gcode";
+    client->uploadName = QString("%1/%2_%3_%4").arg(uploadDir).arg(QDateTime::currentMSecsSinceEpoch())
+                                               .arg(++uploads).arg(base);
+
+    client->upload = new QFile(client->uploadName + ".part");
+    if(!client->upload->open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        delete client->upload;
+        client->upload = nullptr;
+        return false;
+    }
+    client->bodyLeft = length;
+    client->state = API_CLIENT_BODY;
+    return true;
+}
+
+void ControlServer::finishUpload(ApiClient *client)
+{
+    client->upload->close();
+    QFile::remove(client->uploadName);
+    bool ok = client->upload->rename(client->uploadName);
+    delete client->upload;
+    client->upload = nullptr;
+    client->state = API_CLIENT_HEADER;
+
+    if(!ok)
+    {
+        reply(client, 500, "Internal Server Error", "{\"error\":\"can not store file\"}");
+        return;
+    }
+
+    quint32 id = api->startEstimate(client->uploadName, client->requirements);
+
+    QJsonObject body;
+    body.insert("id", static_cast<qint64>(id));
+    body.insert("file", client->uploadName);
+    reply(client, 202, "Accepted", QJsonDocument(body).toJson(QJsonDocument::Compact));
+}
+
+void ControlServer::upgrade(ApiClient *client, const QByteArray &key)
+{
+    QByteArray accept = QCryptographicHash::hash(key + API_WEBSOCKET_GUID, QCryptographicHash::Sha1).toBase64();
+    client->socket->write("HTTP/1.1 101 Switching Protocols\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: " + accept + "\r\n\r\n");
+    client->state = API_CLIENT_WEBSOCKET;
+    sendFrame(client->socket, API_WS_TEXT, api->snapshot());
+
+    if(api->getTelemetry())
+        client->subscriber = api->getTelemetry()->subscribe();
+}
+
+/**
+ * @brief ControlServer::readFrame
+ *
+ * One client frame (RFC 6455). The API only pushes, data frames are ignored; ping is answered,
+ * close is echoed and the connection closed.
+ *
+ * @return false if the frame is not complete yet or the connection was closed
+ */
+bool ControlServer::readFrame(ApiClient *client)
+{
+    const QByteArray &b = client->buffer;
+    if(b.size() < 2)
+        return false;
+
+    quint8 opcode = static_cast<quint8>(b[0]) & 0x0F;
+    bool masked = (static_cast<quint8>(b[1]) & 0x80) != 0;
+    quint64 length = static_cast<quint8>(b[1]) & 0x7F;
+    int header = 2;
+    if(length == 126)
+    {
+        if(b.size() < 4)
+            return false;
+        length = (static_cast<quint64>(static_cast<quint8>(b[2])) << 8) | static_cast<quint8>(b[3]);
+        header = 4;
+    }
+    else if(length == 127)
+    {
+        if(b.size() < 10)
+            return false;
+        length = 0;
+        for(int i = 0; i < 8; i++)
+            length = (length << 8) | static_cast<quint8>(b[2 + i]);
+        header = 10;
+    }
+    if(length > API_MAX_FRAME)
+    {
+        client->socket->disconnectFromHost();
+        return false;
+    }
+
+    int maskAt = header;
+    if(masked)
+        header += 4;
+    if(static_cast<quint64>(b.size()) < header + length)
+        return false;
+
+    QByteArray payload = b.mid(header, static_cast<int>(length));
+    if(masked)
+    {
+        for(int i = 0; i < payload.size(); i++)
+            payload[i] = payload[i] ^ b[maskAt + (i & 3)];
+    }
+    client->buffer.remove(0, header + static_cast<int>(length));
+
+    if(opcode == API_WS_CLOSE)
+    {
+        sendFrame(client->socket, API_WS_CLOSE, payload.left(2));
+        client->socket->disconnectFromHost();
+        return false;
+    }
+    if(opcode == API_WS_PING)
+        sendFrame(client->socket, API_WS_PONG, payload);
+    return true;
+}
+
+void ControlServer::sendFrame(QTcpSocket *socket, quint8 opcode, const QByteArray &payload)
+{
+    char header[10];
+    int n = 2;
+    quint64 length = static_cast<quint64>(payload.size());
+    header[0] = static_cast<char>(0x80 | opcode);
+    if(length < 126)
+    {
+        header[1] = static_cast<char>(length);
+    }
+    else if(length <= 0xFFFF)
+    {
+        header[1] = 126;
+        header[2] = static_cast<char>(length >> 8);
+        header[3] = static_cast<char>(length);
+        n = 4;
+    }
+    else
+    {
+        header[1] = 127;
+        for(int i = 0; i < 8; i++)
+            header[2 + i] = static_cast<char>(length >> (56 - 8 * i));
+        n = 10;
+    }
+    socket->write(header, n);
+    socket->write(payload);
+}
+
+void ControlServer::reply(ApiClient *client, int status, const char *reason, const QByteArray &body)
+{
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(status) + " " + reason + "\r\n"
+                      "Content-Type: application/json\r\n"
+                      "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                      "Connection: " + (client->keepAlive ? "keep-alive" : "close") + "\r\n\r\n";
+    client->socket->write(head);
+    client->socket->write(body);
+    if(!client->keepAlive)
+        client->socket->disconnectFromHost();
+}
+
+/**
+ * @brief ControlServer::publish
+ *
+ * Pushes the new snapshot to the WebSocket clients, a client still holding an unsent
+ * snapshot beyond API_MAX_PENDING gets the next one instead.
+ */
+void ControlServer::publish()
+{
+    QByteArray status = api->snapshot();
+    foreach (ApiClient *client, clients)
+    {
+        if(client->state != API_CLIENT_WEBSOCKET)
+            continue;
+        if(client->socket->bytesToWrite() > API_MAX_PENDING)
+            continue;
+        sendFrame(client->socket, API_WS_TEXT, status);
+    }
+}
+
+/**
+ * @brief ControlServer::publishTelemetry
+ *
+ * After a flush of the bus. A client with more than API_MAX_PENDING unsent does not take its
+ * samples, the bus keeps only the newest value per key for it until the socket drains.
+ */
+void ControlServer::publishTelemetry()
+{
+    foreach (ApiClient *client, clients)
+    {
+        if(client->subscriber < 0)
+            continue;
+        if(client->socket->bytesToWrite() > API_MAX_PENDING)
+            continue;
+        sendTelemetry(client);
+    }
+}
+
+void ControlServer::sendTelemetry(ApiClient *client)
+{
+    TelemetryBus *telemetry = api->getTelemetry();
+    samples.clear();
+    if(telemetry->take(client->subscriber, &samples) == 0)
+        return;
+
+    /* Przy wielu drukarkach dane są dzielone na kilka ramek */
+    for(int first = 0; first < samples.size(); first += API_MAX_TELEMETRY)
+    {
+        int last = qMin(samples.size(), first + API_MAX_TELEMETRY);
+        QJsonArray values;
+        for(int i = first; i < last; i++)
+        {
+            const TelemetrySample &s = samples[i];
+            QJsonObject value;
+            value.insert("printer", static_cast<int>(s.key / TELEMETRY_FIELDS));
+            value.insert("field", telemetryFieldName(s.key % TELEMETRY_FIELDS));
+            value.insert("value", s.value);
+            value.insert("time", s.time);
+            values.append(value);
+        }
+        QJsonObject root;
+        root.insert("telemetry", values);
+        root.insert("dropped", static_cast<qint64>(telemetry->droppedFor(client->subscriber)));
+        sendFrame(client->socket, API_WS_TEXT, QJsonDocument(root).toJson(QJsonDocument::Compact));
+    }
+}
+
+ControlApi::ControlApi(FarmScheduler *scheduler, TelemetryBus *telemetry, QObject *parent) :
+    QObject(parent)
+{
+    qRegisterMetaType<JobRequirements>("JobRequirements");
+
+    this->scheduler = scheduler;
+    this->telemetry = telemetry;
+    snapshotTimer = new QTimer(this);
+    snapshotTimer->setSingleShot(true);
+    connect(snapshotTimer, SIGNAL(timeout()), this, SLOT(updateSnapshot()));
+    connect(scheduler, SIGNAL(scheduleChanged()), this, SLOT(scheduleChanged()));
+    updateSnapshot();
+
+    server = new ControlServer(this);
+    server->moveToThread(&thread);
+    connect(&thread, SIGNAL(finished()), server, SLOT(deleteLater()));
+    connect(this, SIGNAL(startServer(QString,quint16,QString)), server, SLOT(start(QString,quint16,QString)));
+    connect(this, SIGNAL(snapshotChanged()), server, SLOT(publish()));
+    if(telemetry)
+        connect(telemetry, SIGNAL(updated()), server, SLOT(publishTelemetry()));
+    connect(server, SIGNAL(cancelRequested(quint32)), this, SLOT(cancelRequested(quint32)));
+    connect(server, SIGNAL(printerCommandRequested(int,int,int)), this, SLOT(printerCommandRequested(int,int,int)));
+    thread.start();
+}
+
+ControlApi::~ControlApi()
+{
+    /* Najpierw serwer, potem nie ma już nowych szacowań */
+    thread.quit();
+    thread.wait();
+    estimates.waitForDone();
+}
+
+bool ControlApi::start()
+{
+    QSettings settings;
+    settings.beginGroup("api");
+    bool enabled = settings.value("enabled", true).toBool();
+    QString address = settings.value("address", API_DEFAULT_ADDRESS).toString();
+    quint16 port = static_cast<quint16>(settings.value("port", API_DEFAULT_PORT).toUInt());
+    QString uploadDir = settings.value("uploadDir",
+        QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/uploads").toString();
+    settings.endGroup();
+
+    if(!enabled)
+        return false;
+
+    emit startServer(address, port, uploadDir);
+    return true;
+}
+
+QByteArray ControlApi::snapshot() const
+{
+    QMutexLocker locker(&mutex);
+    return status;
+}
+
+TelemetryBus *ControlApi::getTelemetry() const
+{
+    return telemetry;
+}
+
+void ControlApi::scheduleChanged()
+{
+    if(!snapshotTimer->isActive())
+        snapshotTimer->start(API_SNAPSHOT_PERIOD_MS);
+}
+
+/**
+ * @brief ControlApi::updateSnapshot
+ *
+ * Stan planisty jako JSON, budowany w wątku GUI.
+ */
+void ControlApi::updateSnapshot()
+{
+    QJsonObject root;
+    root.insert("time", scheduler->now());
+    root.insert("makespan", scheduler->makespan());
+    root.insert("idle", scheduler->idleTime());
+
+    QJsonArray printers;
+    for(int i = 0; i < scheduler->printerCount(); i++)
+    {
+        const FarmPrinter &p = scheduler->getPrinter(i);
+        QJsonObject printer;
+        printer.insert("index", i);
+        printer.insert("material", p.capabilities.material);
+        printer.insert("nozzle", p.capabilities.nozzleDiameter);
+        printer.insert("current", static_cast<qint64>(p.current));
+        printer.insert("currentEnd", p.current ? p.currentEnd : 0.0);
+        QJsonArray queue;
+        for(int k = 0; k < p.queue.size(); k++)
+            queue.append(static_cast<qint64>(p.queue[k]));
+        printer.insert("queue", queue);
+        if(p.link)
+            printer.insert("realtimeLatency", static_cast<qint64>(p.link->getStreamer()->getStats().realtimeLatencyMs));
+        printers.append(printer);
+    }
+    root.insert("printers", printers);
+
+    QJsonArray jobs;
+    QVector<FarmJob> list = scheduler->getJobs();
+    for(int i = 0; i < list.size(); i++)
+    {
+        const FarmJob &j = list[i];
+        QJsonObject job;
+        job.insert("id", static_cast<qint64>(j.id));
+        job.insert("file", j.fileName);
+        job.insert("state", jobStateName(j.state));
+        job.insert("printer", j.printer);
+        job.insert("estimatedTime", j.estimatedTime);
+        job.insert("start", j.start);
+        job.insert("end", j.end);
+        job.insert("attempts", j.attempts);
+        jobs.append(job);
+    }
+    root.insert("jobs", jobs);
+
+    QByteArray json = QJsonDocument(root).toJson(QJsonDocument::Compact);
+    {
+        QMutexLocker locker(&mutex);
+        status = json;
+    }
+    emit snapshotChanged();
+}
+
+/**
+ * @brief ControlApi::startEstimate
+ *
+ * Called by the server in the API thread. The id is reserved now, the job is submitted with it
+ * by jobUploaded() when the estimate is ready.
+ */
+quint32 ControlApi::startEstimate(const QString &fileName, const JobRequirements &requirements)
+{
+    quint32 id = scheduler->reserveId();
+    estimates.start(new EstimateTask(this, id, fileName, requirements));
+    return id;
+}
+
+void ControlApi::jobUploaded(quint32 id, const QString &fileName, const JobRequirements &requirements)
+{
+    if(scheduler->submit(fileName, requirements, -1.0f, id) == 0)
+        qWarning() << "Warning: Nie można dodać zadania: " << fileName;
+}
+
+void ControlApi::cancelRequested(quint32 id)
+{
+    scheduler->cancel(id);
+}
+
+void ControlApi::printerCommandRequested(int printer, int command, int value)
+{
+    if(printer < 0 || printer >= scheduler->printerCount() || !scheduler->getPrinter(printer).link)
+    {
+        qWarning() << "Warning: Brak drukarki z łączem: " << printer;
+        return;
+    }
+
+    PrinterLink *link = scheduler->getPrinter(printer).link;
+    JobStreamer *streamer = link->getStreamer();
+    switch(command)
+    {
+    case API_PRINTER_PAUSE:
+        streamer->pause();
+        break;
+    case API_PRINTER_RESUME:
+        /* Zadanie wstrzymane po ponownym podłączeniu wznawia operator */
+        if(link->isAwaitingResume())
+            link->resumeJob();
+        else
+            streamer->resume();
+        break;
+    case API_PRINTER_STOP:
+        /* Zadanie zatrzymane awaryjnie jest anulowane, nie wraca do kolejki jak nieudane */
+        streamer->stop();
+        streamer->emergencyStop();
+        if(scheduler->getPrinter(printer).current)
+            scheduler->cancel(scheduler->getPrinter(printer).current);
+        break;
+    case API_PRINTER_FEED:
+        streamer->setFeedOverride(static_cast<uint16_t>(value));
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,170 @@
+#ifndef CONTROLAPI_H
+#define CONTROLAPI_H
+
+#include <QObject>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+#include <QMutex>
+#include <QHash>
+#include <QByteArray>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QFile>
+#include "farmscheduler.h"
+#include "telemetrybus.h"
+
+#define API_DEFAULT_ADDRESS         "127.0.0.1"
+#define API_DEFAULT_PORT            (8080)
+// Longest request head accepted, a longer one is answered with 431
+#define API_MAX_HEADER              (8 * 1024)
+// Largest G-code file accepted by POST /jobs
+#define API_MAX_UPLOAD              (2048LL * 1024 * 1024)
+// Largest WebSocket frame accepted from a client, the API reads only control frames
+#define API_MAX_FRAME               (64 * 1024)
+// A WebSocket client with more than this unsent skips snapshots until it catches up
+#define API_MAX_PENDING             (1024 * 1024)
+// Telemetry samples sent in one WebSocket frame at most, the rest waits for the next flush
+#define API_MAX_TELEMETRY           (4096)
+// Scheduler changes within this period are published as one snapshot
+#define API_SNAPSHOT_PERIOD_MS      (100)
+
+// Realtime commands of POST /printers/<n>/...
+enum {
+    API_PRINTER_PAUSE = 0,
+    API_PRINTER_RESUME,
+    API_PRINTER_STOP,               ///< Emergency stop
+    API_PRINTER_FEED,               ///< Feed-rate override, percent
+};
+
+enum {
+    API_CLIENT_HEADER = 0,          ///< Waiting for a request head
+    API_CLIENT_BODY,                ///< Streaming an upload to its file
+    API_CLIENT_WEBSOCKET,
+};
+
+typedef struct {
+    QTcpSocket *socket;
+    QByteArray buffer;              ///< Received and not processed yet
+    int state;                      ///< API_CLIENT_*
+    bool keepAlive;
+    qint64 bodyLeft;                ///< Bytes of the upload still to come
+    QFile *upload;                  ///< "<file>.part" while the upload runs
+    QString uploadName;
+    JobRequirements requirements;
+    int subscriber;                 ///< Telemetry subscriber of a WebSocket client, -1 if none
+} ApiClient;
+
+class ControlApi;
+
+/**
+ * @brief ControlServer
+ *
+ * Worker living in the API thread. A minimal HTTP/1.1 server (keep-alive, pipelining) with
+ * WebSocket upgrade on one port, everything driven by the event loop of the API thread:
+ *
+ *  GET /status         snapshot of the farm (JSON)
+ *  GET /ws             WebSocket, the snapshot is pushed whenever it changes and the telemetry
+ *                      at the rate of the bus
+ *  POST /jobs?name=... upload of a G-code file, the body is written to disk as it arrives;
+ *                      sizeX, sizeY, sizeZ, nozzle and material are the job requirements.
+ *                      Answered with the id of the job, listed in /status once it is estimated
+ *  DELETE /jobs/<id>   cancel
+ *  POST /printers/<n>/pause, /resume, /stop
+ *                      realtime commands to the printer, stop is an emergency stop; resume also
+ *                      continues a job the link did not resume after a reconnect
+ *  POST /printers/<n>/feed?percent=...
+ *                      feed-rate override
+ *
+ * Nothing here touches the scheduler or the printer links, reads are served from the snapshot
+ * cached by ControlApi and requests are handed to the GUI thread by queued signals.
+ */
+class ControlServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ControlServer(ControlApi *api);
+    ~ControlServer();
+
+public slots:
+    void start(const QString &address, quint16 port, const QString &uploadDir);
+    void publish();
+    void publishTelemetry();
+
+signals:
+    void cancelRequested(quint32 id);
+    void printerCommandRequested(int printer, int command, int value);
+
+private slots:
+    void newConnection();
+    void readyRead();
+    void disconnected();
+
+private:
+    void process(ApiClient *client);
+    void handleRequest(ApiClient *client, const QByteArray &head);
+    bool startUpload(ApiClient *client, const QString &name, qint64 length);
+    void finishUpload(ApiClient *client);
+    void upgrade(ApiClient *client, const QByteArray &key);
+    bool readFrame(ApiClient *client);
+    void sendFrame(QTcpSocket *socket, quint8 opcode, const QByteArray &payload);
+    void sendTelemetry(ApiClient *client);
+    void reply(ApiClient *client, int status, const char *reason, const QByteArray &body);
+
+    ControlApi *api;
+    QTcpServer *server;
+    QString uploadDir;
+    QHash<QTcpSocket *, ApiClient *> clients;
+    quint32 uploads;
+    QVector<TelemetrySample> samples;   ///< Used by sendTelemetry() only
+};
+
+/**
+ * @brief ControlApi
+ *
+ * Programmatic control surface next to MainWindow. Owns the API thread and the snapshot of the
+ * scheduler: the snapshot is rebuilt in the GUI thread at most every API_SNAPSHOT_PERIOD_MS and
+ * read by the server under a mutex, an implicitly shared QByteArray so a read is only a reference.
+ * Uploads are estimated in a thread pool of the API before they are submitted to the scheduler.
+ *
+ * Settings "api/enabled", "api/address", "api/port" and "api/uploadDir".
+ */
+class ControlApi : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ControlApi(FarmScheduler *scheduler, TelemetryBus *telemetry = nullptr, QObject *parent = nullptr);
+    ~ControlApi();
+
+    bool start();
+    QByteArray snapshot() const;
+    TelemetryBus *getTelemetry() const;
+    quint32 startEstimate(const QString &fileName, const JobRequirements &requirements);
+
+signals:
+    void startServer(const QString &address, quint16 port, const QString &uploadDir);
+    void snapshotChanged();
+
+private slots:
+    void scheduleChanged();
+    void updateSnapshot();
+    void jobUploaded(quint32 id, const QString &fileName, const JobRequirements &requirements);
+    void cancelRequested(quint32 id);
+    void printerCommandRequested(int printer, int command, int value);
+
+private:
+    FarmScheduler *scheduler;
+    TelemetryBus *telemetry;
+    QThread thread;
+    QThreadPool estimates;          ///< Estimation of uploads, waited for before the API is deleted
+    ControlServer *server;
+    QTimer *snapshotTimer;
+    mutable QMutex mutex;
+    QByteArray status;
+};
+
+Q_DECLARE_METATYPE(JobRequirements)
+
+#endif // CONTROLAPI_H
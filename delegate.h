@@ -0,0 +1,125 @@
+#ifndef DELEGATE_H
+#define DELEGATE_H
+
+#include <stdint.h>
+
+/**
+ * View of a received frame. The memory belongs to the sender and is valid only during the
+ * call, a subscriber which needs the data later has to copy it.
+ */
+struct FrameSpan {
+    const uint8_t *data;
+    uint16_t length;
+
+    FrameSpan() : data(nullptr), length(0) {}
+    FrameSpan(const uint8_t *d, uint16_t len) : data(d), length(len) {}
+};
+
+/**
+ * MulticastDelegate calls a fixed number of subscribers with the same argument.
+ *
+ * Unlike GenericCallback, which keeps a pointer to a single Callback object, the delegate
+ * stores up to Capacity (object, function) pairs in place, so subscribing never allocates.
+ * The member function is a template parameter of add(), the call goes through a small
+ * trampoline generated for it instead of a virtual function.
+ *
+ * Subscribers are called synchronously in the thread which calls invoke().
+ *
+ * @tparam Arg      The argument type of the member functions.
+ * @tparam Capacity Maximum number of subscribers.
+ */
+template <class Arg, unsigned Capacity = 4U>
+class MulticastDelegate
+{
+public:
+    MulticastDelegate()
+        : count(0)
+    {
+    }
+
+    /**
+     * Adds a subscriber.
+     *
+     * @return false if the object is already subscribed with this function or there is no free entry.
+     */
+    template <class T, void (T::*Method)(Arg)>
+    bool add(T *object)
+    {
+        if(count >= Capacity || contains(object, &trampoline<T, Method>)) {
+            return false;
+        }
+        entries[count].object = object;
+        entries[count].function = &trampoline<T, Method>;
+        count++;
+        return true;
+    }
+
+    /**
+     * Removes a subscriber, the order of the remaining ones is kept.
+     */
+    template <class T, void (T::*Method)(Arg)>
+    bool remove(T *object)
+    {
+        for(unsigned i = 0; i < count; i++) {
+            if(entries[i].object == object && entries[i].function == &trampoline<T, Method>) {
+                for(unsigned j = i + 1U; j < count; j++) {
+                    entries[j - 1U] = entries[j];
+                }
+                count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    bool isEmpty() const
+    {
+        return count == 0;
+    }
+
+    unsigned size() const
+    {
+        return count;
+    }
+
+    void invoke(Arg arg) const
+    {
+        for(unsigned i = 0; i < count; i++) {
+            entries[i].function(entries[i].object, arg);
+        }
+    }
+
+private:
+    typedef void (*Function)(void *object, Arg arg);
+
+    template <class T, void (T::*Method)(Arg)>
+    static void trampoline(void *object, Arg arg)
+    {
+        (static_cast<T *>(object)->*Method)(arg);
+    }
+
+    bool contains(void *object, Function function) const
+    {
+        for(unsigned i = 0; i < count; i++) {
+            if(entries[i].object == object && entries[i].function == function) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct Slot {
+        void *object;
+        Function function;
+    };
+
+    Slot entries[Capacity];
+    unsigned count;
+};
+
+#endif // DELEGATE_H
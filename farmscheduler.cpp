@@ -0,0 +1,498 @@
+#include "farmscheduler.h"
+#include "printestimator.h"
+#include <QDebug>
+#include <algorithm>
+#include <math.h>
+
+FarmScheduler::FarmScheduler(QObject *parent) :
+    QObject(parent),
+    nextId(1)
+{
+    clock.start();
+}
+
+double FarmScheduler::now() const
+{
+    return clock.elapsed() / 1000.0;
+}
+
+int FarmScheduler::addPrinter(PrinterLink *link, const PrinterCapabilities &capabilities)
+{
+    FarmPrinter printer;
+    printer.link = link;
+    printer.capabilities = capabilities;
+    printer.current = 0;
+    printer.currentEnd = now();
+    printer.queueEnd = printer.currentEnd;
+    printer.reconnectTimeout = nullptr;
+
+    if(link)
+    {
+        connect(link->getStreamer(), SIGNAL(finished()), this, SLOT(streamerFinished()));
+        connect(link->getStreamer(), SIGNAL(failed(QString)), this, SLOT(streamerFailed()));
+        connect(link->getStreamer(), SIGNAL(progress(qint64,qint64)), this, SLOT(streamerProgress(qint64,qint64)));
+        /* Odmowa wznowienia daje operatorowi cały czas na wznowienie ręczne */
+        connect(link, SIGNAL(linkLost()), this, SLOT(linkLost()));
+        connect(link, SIGNAL(resumeRefused(QString)), this, SLOT(linkLost()));
+
+        printer.reconnectTimeout = new QTimer(this);
+        printer.reconnectTimeout->setSingleShot(true);
+        connect(printer.reconnectTimeout, SIGNAL(timeout()), this, SLOT(reconnectTimedOut()));
+    }
+    printers.append(printer);
+
+    replan();
+    dispatch();
+    emit scheduleChanged();
+    return printers.size() - 1;
+}
+
+void FarmScheduler::setCapabilities(int printer, const PrinterCapabilities &capabilities)
+{
+    if(printer < 0 || printer >= printers.size())
+        return;
+
+    printers[printer].capabilities = capabilities;
+    replan();
+    dispatch();
+    emit scheduleChanged();
+}
+
+int FarmScheduler::printerCount() const
+{
+    return printers.size();
+}
+
+const FarmPrinter &FarmScheduler::getPrinter(int printer) const
+{
+    return printers[printer];
+}
+
+quint32 FarmScheduler::reserveId()
+{
+    return static_cast<quint32>(nextId.fetchAndAddRelaxed(1));
+}
+
+quint32 FarmScheduler::submit(const QString &fileName, const JobRequirements &requirements, float estimatedTime, quint32 id)
+{
+    bool estimated = true;
+    if(estimatedTime < 0.0f)
+    {
+        PrintEstimator estimator;
+        estimated = estimator.open(fileName);
+        estimatedTime = estimated ? estimator.getEstimate().time : 0.0f;
+    }
+    if(!estimated)
+    {
+        qDebug() << "Error: Nie można oszacować czasu zadania: " << fileName << "\n";
+        /* Klient zna już zarezerwowany numer, zadanie widoczne jako nieudane */
+        if(id == 0)
+            return 0;
+    }
+
+    FarmJob job;
+    job.id = id ? id : reserveId();
+    job.fileName = fileName;
+    job.requirements = requirements;
+    job.estimatedTime = estimatedTime;
+    job.state = FARM_JOB_QUEUED;
+    job.attempts = 0;
+    job.printer = -1;
+    job.start = 0.0;
+    job.end = 0.0;
+    if(!estimated)
+    {
+        job.state = FARM_JOB_FAILED;
+        jobs.insert(job.id, job);
+        emit jobFailed(job.id);
+        emit scheduleChanged();
+        return 0;
+    }
+    jobs.insert(job.id, job);
+
+    assign(jobs[job.id], now());
+    dispatch();
+    emit scheduleChanged();
+    return job.id;
+}
+
+bool FarmScheduler::cancel(quint32 id)
+{
+    QHash<quint32, FarmJob>::iterator it = jobs.find(id);
+    if(it == jobs.end())
+        return false;
+    FarmJob &job = it.value();
+
+    if(job.state == FARM_JOB_QUEUED)
+    {
+        job.state = FARM_JOB_CANCELED;
+        if(job.printer < 0)
+        {
+            unassigned.removeAll(id);
+        }
+        else
+        {
+            printers[job.printer].queue.removeAll(id);
+            retime(job.printer);
+        }
+    }
+    else if(job.state == FARM_JOB_PRINTING)
+    {
+        FarmPrinter &printer = printers[job.printer];
+        if(printer.link)
+        {
+            printer.link->getStreamer()->stop();
+            printer.reconnectTimeout->stop();
+        }
+        job.state = FARM_JOB_CANCELED;
+        job.end = now();
+        printer.current = 0;
+        printer.currentEnd = job.end;
+
+        /* Drukarka zwolniła się wcześniej niż w planie */
+        replan();
+        dispatch();
+    }
+    else
+    {
+        return false;
+    }
+
+    emit scheduleChanged();
+    return true;
+}
+
+/**
+ * @brief FarmScheduler::jobFinished
+ *
+ * A failed job is queued again until FARM_MAX_ATTEMPTS starts, then given up.
+ */
+void FarmScheduler::jobFinished(int printer, bool ok)
+{
+    if(printer < 0 || printer >= printers.size() || printers[printer].current == 0)
+        return;
+
+    FarmPrinter &p = printers[printer];
+    FarmJob &job = jobs[p.current];
+    double planned = p.currentEnd;
+    double t = now();
+    p.current = 0;
+    p.currentEnd = t;
+    if(p.reconnectTimeout)
+        p.reconnectTimeout->stop();
+
+    if(ok)
+    {
+        job.state = FARM_JOB_DONE;
+        job.end = t;
+        emit jobCompleted(job.id);
+    }
+    else if(job.attempts >= FARM_MAX_ATTEMPTS)
+    {
+        job.state = FARM_JOB_FAILED;
+        job.end = t;
+        emit jobFailed(job.id);
+    }
+    else
+    {
+        job.state = FARM_JOB_QUEUED;
+        job.printer = -1;
+        unassigned.append(job.id);
+    }
+
+    if(!ok || fabs(t - planned) > FARM_REPLAN_SLACK)
+        replan();
+    else
+        retime(printer);
+    dispatch();
+    emit scheduleChanged();
+}
+
+bool FarmScheduler::findJob(quint32 id, FarmJob *job) const
+{
+    QHash<quint32, FarmJob>::const_iterator it = jobs.find(id);
+    if(it == jobs.end())
+        return false;
+    *job = it.value();
+    return true;
+}
+
+QVector<FarmJob> FarmScheduler::getJobs() const
+{
+    return QVector<FarmJob>::fromList(jobs.values());
+}
+
+double FarmScheduler::makespan() const
+{
+    double t = now();
+    double end = t;
+    for(int i = 0; i < printers.size(); i++)
+        end = qMax(end, qMax(printers[i].queueEnd, available(printers[i], t)));
+    return end - t;
+}
+
+double FarmScheduler::idleTime() const
+{
+    double t = now();
+    double end = t + makespan();
+    double idle = 0.0;
+    for(int i = 0; i < printers.size(); i++)
+        idle += end - qMax(printers[i].queueEnd, available(printers[i], t));
+    return idle;
+}
+
+bool FarmScheduler::canPrint(const FarmJob &job, const FarmPrinter &printer) const
+{
+    const JobRequirements &r = job.requirements;
+    const PrinterCapabilities &c = printer.capabilities;
+
+    /* Niepodłączona drukarka nie dostaje zadań, wznawiana po utracie łącza tak */
+    if(printer.link && !printer.link->getCommunication()->isConnected() && !printer.link->isReconnecting())
+        return false;
+
+    bool fits = (r.sizeX <= c.bedX && r.sizeY <= c.bedY) || (r.sizeY <= c.bedX && r.sizeX <= c.bedY);
+    if(!fits || r.sizeZ > c.bedZ)
+        return false;
+    if(r.nozzleDiameter > 0.0f && fabsf(r.nozzleDiameter - c.nozzleDiameter) > FARM_NOZZLE_TOLERANCE)
+        return false;
+    if(!r.material.isEmpty() && r.material.compare(c.material, Qt::CaseInsensitive) != 0)
+        return false;
+    return true;
+}
+
+double FarmScheduler::duration(const FarmJob &job, const FarmPrinter &printer) const
+{
+    float speed = printer.capabilities.speedFactor > 0.0f ? printer.capabilities.speedFactor : 1.0f;
+    return job.estimatedTime / speed;
+}
+
+/**
+ * When the printer can start the next job: t (now) or the expected end of the current one.
+ */
+double FarmScheduler::available(const FarmPrinter &printer, double t) const
+{
+    if(printer.current)
+        return qMax(t, printer.currentEnd);
+    return t;
+}
+
+/**
+ * Dopisuje zadanie do kolejki drukarki, na której skończy się najwcześniej.
+ */
+void FarmScheduler::assign(FarmJob &job, double t)
+{
+    int best = -1;
+    double bestStart = 0.0;
+    double bestEnd = 0.0;
+    for(int i = 0; i < printers.size(); i++)
+    {
+        const FarmPrinter &printer = printers[i];
+        if(!canPrint(job, printer))
+            continue;
+        double start = qMax(printer.queueEnd, available(printer, t));
+        double end = start + duration(job, printer);
+        if(best < 0 || end < bestEnd)
+        {
+            best = i;
+            bestStart = start;
+            bestEnd = end;
+        }
+    }
+
+    job.printer = best;
+    if(best < 0)
+    {
+        unassigned.append(job.id);
+        return;
+    }
+    job.start = bestStart;
+    job.end = bestEnd;
+    printers[best].queue.append(job.id);
+    printers[best].queueEnd = bestEnd;
+}
+
+static bool longerFirst(const FarmJob *a, const FarmJob *b)
+{
+    if(a->estimatedTime != b->estimatedTime)
+        return a->estimatedTime > b->estimatedTime;
+    return a->id < b->id;
+}
+
+/**
+ * @brief FarmScheduler::replan
+ *
+ * All jobs not started yet planned again, longest first.
+ */
+void FarmScheduler::replan()
+{
+    double t = now();
+    QVector<FarmJob *> queued;
+    for(int i = 0; i < printers.size(); i++)
+    {
+        FarmPrinter &printer = printers[i];
+        for(int k = 0; k < printer.queue.size(); k++)
+            queued.append(&jobs[printer.queue[k]]);
+        printer.queue.clear();
+        printer.queueEnd = available(printer, t);
+    }
+    for(int k = 0; k < unassigned.size(); k++)
+        queued.append(&jobs[unassigned[k]]);
+    unassigned.clear();
+
+    std::sort(queued.begin(), queued.end(), longerFirst);
+    for(int k = 0; k < queued.size(); k++)
+        assign(*queued[k], t);
+}
+
+/**
+ * Przesuwa zaplanowane czasy kolejki drukarki bez zmiany przydziału.
+ */
+void FarmScheduler::retime(int printer)
+{
+    FarmPrinter &p = printers[printer];
+    double t = available(p, now());
+    for(int k = 0; k < p.queue.size(); k++)
+    {
+        FarmJob &job = jobs[p.queue[k]];
+        job.start = t;
+        t += duration(job, p);
+        job.end = t;
+    }
+    p.queueEnd = t;
+}
+
+/**
+ * Uruchamia pierwsze zadanie z kolejki na każdej bezczynnej drukarce.
+ */
+void FarmScheduler::dispatch()
+{
+    bool requeued = false;
+    for(int i = 0; i < printers.size(); i++)
+    {
+        FarmPrinter &printer = printers[i];
+        bool started = false;
+        while(printer.current == 0 && !printer.queue.isEmpty())
+        {
+            started = true;
+            FarmJob &job = jobs[printer.queue.takeFirst()];
+            job.attempts++;
+
+            if(printer.link && !printer.link->getStreamer()->start(job.fileName))
+            {
+                if(job.attempts >= FARM_MAX_ATTEMPTS)
+                {
+                    job.state = FARM_JOB_FAILED;
+                    job.end = now();
+                    emit jobFailed(job.id);
+                }
+                else
+                {
+                    job.printer = -1;
+                    unassigned.append(job.id);
+                    requeued = true;
+                }
+                continue;
+            }
+
+            job.state = FARM_JOB_PRINTING;
+            job.start = now();
+            job.end = job.start + duration(job, printer);
+            printer.current = job.id;
+            printer.currentEnd = job.end;
+            emit jobStarted(printer.current, i);
+        }
+        if(started)
+            retime(i);
+    }
+
+    /* Zadanie, którego nie udało się uruchomić, może trafić na inną drukarkę */
+    if(requeued)
+    {
+        replan();
+        dispatch();
+    }
+}
+
+/**
+ * @brief FarmScheduler::findPrinter
+ *
+ * Printer of a link, of its streamer or of its reconnect timeout, the senders of the slots below.
+ */
+int FarmScheduler::findPrinter(QObject *object) const
+{
+    for(int i = 0; i < printers.size(); i++)
+    {
+        const FarmPrinter &p = printers[i];
+        if(p.link && (p.link == object || p.link->getStreamer() == object || p.reconnectTimeout == object))
+            return i;
+    }
+    return -1;
+}
+
+void FarmScheduler::streamerFinished()
+{
+    int printer = findPrinter(sender());
+    if(printer >= 0)
+        jobFinished(printer, true);
+}
+
+void FarmScheduler::streamerFailed()
+{
+    int printer = findPrinter(sender());
+    if(printer >= 0)
+        jobFinished(printer, false);
+}
+
+/**
+ * @brief FarmScheduler::linkLost
+ *
+ * The current job is suspended, either until the printer is back or until the operator resumes it.
+ */
+void FarmScheduler::linkLost()
+{
+    int printer = findPrinter(sender());
+    if(printer >= 0 && printers[printer].current != 0)
+        printers[printer].reconnectTimeout->start(FARM_RECONNECT_TIMEOUT_MS);
+}
+
+/**
+ * @brief FarmScheduler::reconnectTimedOut
+ *
+ * A printer that did not come back gets no more jobs until it is connected again, one that came
+ * back without its state stays connected for the next job.
+ */
+void FarmScheduler::reconnectTimedOut()
+{
+    int printer = findPrinter(sender());
+    if(printer < 0 || printers[printer].current == 0)
+        return;
+
+    PrinterLink *link = printers[printer].link;
+    if(!link->getStreamer()->isSuspended())
+        return;
+
+    qWarning() << "Warning: Drukarka nie wznowiła zadania: " << printer;
+    if(link->isReconnecting())
+        link->disconnectPrinter();
+    else
+        link->getStreamer()->stop();
+    jobFinished(printer, false);
+}
+
+/**
+ * @brief FarmScheduler::streamerProgress
+ *
+ * The current job is expected to end once the rest of the file is printed at the estimated pace.
+ * The queue is not planned again, only jobFinished() does that.
+ */
+void FarmScheduler::streamerProgress(qint64 sentBytes, qint64 totalBytes)
+{
+    int printer = findPrinter(sender());
+    if(printer < 0 || printers[printer].current == 0 || totalBytes <= 0)
+        return;
+
+    FarmPrinter &p = printers[printer];
+    const FarmJob &job = jobs[p.current];
+    double left = 1.0 - static_cast<double>(sentBytes) / static_cast<double>(totalBytes);
+    p.currentEnd = now() + duration(job, p) * left;
+}
@@ -0,0 +1,156 @@
+#ifndef FARMSCHEDULER_H
+#define FARMSCHEDULER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QTimer>
+#include "printerlink.h"
+
+// A job ending this many seconds off its planned end re-plans the queues, smaller errors only shift them
+#define FARM_REPLAN_SLACK       (60.0)
+// Starts of a job before it is given up as failed
+#define FARM_MAX_ATTEMPTS       (2)
+// A job whose printer lost the link fails if it is not printing again after this long, ms
+#define FARM_RECONNECT_TIMEOUT_MS   (5 * 60 * 1000)
+// Slack when comparing nozzle diameters, mm
+#define FARM_NOZZLE_TOLERANCE   (0.01f)
+
+enum {
+    FARM_JOB_QUEUED = 0,
+    FARM_JOB_PRINTING,
+    FARM_JOB_DONE,
+    FARM_JOB_FAILED,
+    FARM_JOB_CANCELED,
+};
+
+typedef struct {
+    float sizeX;                    ///< Bounding box of the print, mm
+    float sizeY;
+    float sizeZ;
+    float nozzleDiameter;           ///< mm, 0 accepts any nozzle
+    QString material;               ///< Empty accepts any material
+} JobRequirements;
+
+typedef struct {
+    quint32 id;
+    QString fileName;
+    JobRequirements requirements;
+    float estimatedTime;            ///< s on a printer with speedFactor 1
+    int state;                      ///< FARM_JOB_*
+    int attempts;
+    int printer;                    ///< Printer it is planned on or printed by, -1 if no printer can print it
+    double start;                   ///< Planned or real start, s on the scheduler clock
+    double end;                     ///< Planned or real end
+} FarmJob;
+
+typedef struct {
+    PrinterLink *link;              ///< nullptr for a printer driven by someone else, see jobFinished()
+    PrinterCapabilities capabilities;
+    quint32 current;                ///< Job printing, 0 if idle
+    double currentEnd;              ///< Expected end of the current job, follows the progress of the streamer
+    QVector<quint32> queue;         ///< Planned jobs in order
+    double queueEnd;                ///< Planned end of the last queued job
+    QTimer *reconnectTimeout;       ///< Runs while the current job waits for the link, nullptr without a link
+} FarmPrinter;
+
+/**
+ * @brief FarmScheduler
+ *
+ * Assigns jobs to the printers of the farm so that the last job ends as early as possible
+ * (makespan) and no printer waits while jobs it could print are queued elsewhere.
+ *
+ * A submitted job is appended to the eligible printer on which it would end first, which costs one
+ * pass over the printers. When a job ends far from its planned end, fails, is canceled or a printer
+ * changes, all jobs not started yet are planned again longest first (LPT), each on the eligible
+ * printer ending it first. Otherwise only the queue of that printer is shifted in time.
+ *
+ * Job times come from PrintEstimator, the current job of a printer follows the progress of its streamer.
+ *
+ * A job fails when its streamer gives it up, or when the link of its printer is lost and the job is
+ * not printing again within FARM_RECONNECT_TIMEOUT_MS (the printer did not come back, or the operator
+ * did not resume the job after a reboot of the printer).
+ */
+class FarmScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FarmScheduler(QObject *parent = nullptr);
+
+    /**
+     * @return index of the printer
+     */
+    int addPrinter(PrinterLink *link, const PrinterCapabilities &capabilities);
+    void setCapabilities(int printer, const PrinterCapabilities &capabilities);
+    int printerCount() const;
+    const FarmPrinter &getPrinter(int printer) const;
+
+    /**
+     * Queues a job. A negative estimated time is taken from the estimator (sidecar of the file).
+     *
+     * @return id of the job, 0 if the file can not be estimated
+     */
+    quint32 submit(const QString &fileName, const JobRequirements &requirements, float estimatedTime = -1.0f, quint32 id = 0);
+
+    /**
+     * Id for a later submit(), e.g. to answer a client before the job is estimated. Thread-safe,
+     * unlike the rest of the scheduler. A reserved job that can not be estimated is listed as failed.
+     */
+    quint32 reserveId();
+    bool cancel(quint32 id);
+
+    /**
+     * End of the current job of a printer. Printers with a link report it themselves when the
+     * streamer finishes or fails and when the link does not come back, call it for printers without a link.
+     */
+    void jobFinished(int printer, bool ok);
+
+    bool findJob(quint32 id, FarmJob *job) const;
+    QVector<FarmJob> getJobs() const;
+
+    /**
+     * Planned time until the last job ends and printer time left idle before that, s.
+     */
+    double makespan() const;
+    double idleTime() const;
+
+    /**
+     * Scheduler clock, s since the scheduler was created. A simulation overrides it with its own time.
+     */
+    virtual double now() const;
+
+signals:
+    void jobStarted(quint32 id, int printer);
+    void jobCompleted(quint32 id);
+    void jobFailed(quint32 id);
+    void scheduleChanged();
+
+private slots:
+    void streamerFinished();
+    void streamerFailed();
+    void streamerProgress(qint64 sentBytes, qint64 totalBytes);
+    void linkLost();
+    void reconnectTimedOut();
+
+private:
+    bool canPrint(const FarmJob &job, const FarmPrinter &printer) const;
+    double duration(const FarmJob &job, const FarmPrinter &printer) const;
+    double available(const FarmPrinter &printer, double t) const;
+    void assign(FarmJob &job, double t);
+    void replan();
+    void retime(int printer);
+    void dispatch();
+    int findPrinter(QObject *object) const;
+
+    QElapsedTimer clock;
+    QVector<FarmPrinter> printers;
+    QHash<quint32, FarmJob> jobs;
+    QVector<quint32> unassigned;    ///< Queued jobs no printer can print
+    QAtomicInt nextId;
+};
+
+#endif // FARMSCHEDULER_H
@@ -0,0 +1,595 @@
+#include "gcodeindex.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QDebug>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#define INDEX_MAGIC                 (0x47494458U)   // "GIDX"
+// Z has to rise this much over the current layer before an extruding move starts a new one
+#define INDEX_MIN_LAYER_HEIGHT      (0.05f)
+
+#define INDEX_AXIS_BIT(axis)        (1U << (axis))
+#define INDEX_XYZ_BITS              (INDEX_AXIS_BIT(GCODE_X) | INDEX_AXIS_BIT(GCODE_Y) | INDEX_AXIS_BIT(GCODE_Z))
+
+/* Wynik szybkiego skanowania fragmentu: liczba linii i zmiany trybów */
+typedef struct {
+    qint64 begin;
+    qint64 end;
+    quint32 lines;
+    qint8 relative;                 ///< -1 not changed in the chunk, 0 absolute, 1 relative
+    qint8 relativeExtrusion;
+    bool layerComments;
+} ChunkScan;
+
+/* Punkt kontrolny względem początku fragmentu */
+typedef struct {
+    GcodeIndexEntry entry;
+    quint8 known;                   ///< Axes holding absolute values, the others are relative to the chunk start
+    bool feedKnown;
+    bool extrusionFix;              ///< An absolute E move was counted from an unknown E, subtract the start E
+    float pendingDistance;          ///< mm moved before the first F of the chunk
+    bool checkpoint;                ///< Interval checkpoint, kept in the index
+    bool candidate;                 ///< Possible start of a layer, decided in the fix-up
+} ChunkEntry;
+
+typedef struct {
+    QVector<ChunkEntry> entries;
+    ChunkEntry end;                 ///< State after the last line of the chunk
+} ChunkResult;
+
+static bool isLayerComment(const char *line, const char *end)
+{
+    const char *comment = static_cast<const char *>(memchr(line, ';', static_cast<size_t>(end - line)));
+    if(!comment)
+        return false;
+    comment++;
+    size_t left = static_cast<size_t>(end - comment);
+    return (left >= 6 && memcmp(comment, "LAYER:", 6) == 0)
+        || (left >= 12 && memcmp(comment, "LAYER_CHANGE", 12) == 0);
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * Pierwsze przejście: linie, G90/G91/M82/M83 i komentarze warstw.
+ */
+static void scanChunk(const char *data, ChunkScan *scan)
+{
+    const char *p = data + scan->begin;
+    const char *end = data + scan->end;
+    scan->lines = 0;
+    scan->relative = -1;
+    scan->relativeExtrusion = -1;
+    scan->layerComments = false;
+
+    while(p < end)
+    {
+        const char *nl = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+        const char *lineEnd = nl ? nl : end;
+        scan->lines++;
+
+        while(p < lineEnd && (*p == ' ' || *p == '\t'))
+            p++;
+        if(lineEnd - p >= 3 && !(lineEnd - p > 3 && (isDigit(p[3]) || p[3] == '.')))
+        {
+            if(p[0] == 'G' && p[1] == '9' && (p[2] == '0' || p[2] == '1'))
+            {
+                scan->relative = (p[2] == '1');
+                scan->relativeExtrusion = (p[2] == '1');
+            }
+            else if(p[0] == 'M' && p[1] == '8' && (p[2] == '2' || p[2] == '3'))
+            {
+                scan->relativeExtrusion = (p[2] == '3');
+            }
+        }
+        if(!scan->layerComments && isLayerComment(p, lineEnd))
+            scan->layerComments = true;
+
+        p = lineEnd + 1;
+    }
+}
+
+/**
+ * Drugie przejście: pełne parsowanie fragmentu od znanych trybów i nieznanej pozycji.
+ */
+static void parseChunk(const char *data, const ChunkScan &scan, bool relative, bool relativeExtrusion,
+                       bool layerComments, ChunkResult *result)
+{
+    const float zero[GCODE_AXES] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    GcodeMachine machine;
+    machine.setState(zero, 0.0f, relative, relativeExtrusion);
+
+    ChunkEntry state;
+    memset(&state, 0, sizeof(state));
+    float layerZ = 0.0f;
+    bool layerZValid = false;
+    quint8 layerZKnown = 0;
+
+    const char *p = data + scan.begin;
+    const char *end = data + scan.end;
+    qint64 nextCheckpoint = scan.begin;
+
+    while(p < end)
+    {
+        const char *nl = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+        const char *lineEnd = nl ? nl : end;
+        qint64 offset = p - data;
+
+        GcodeCommand command;
+        bool hasCommand = GcodeParser::parse(p, static_cast<int>(lineEnd - p), &command);
+        bool motion = hasCommand && command.letter == 'G' && command.code >= 0 && command.code <= 3;
+
+        /* Ruch liczony na kopii, stan przed linią trafia do punktu kontrolnego */
+        GcodeMachine after = machine;
+        GcodeMove move;
+        if(hasCommand)
+            after.apply(command, &move);
+        const float *from = machine.getPosition();
+        const float *to = after.getPosition();
+
+        quint8 known = state.known;
+        if(hasCommand && (motion || (command.letter == 'G' && command.code == 92)))
+        {
+            for(int i = 0; i < GCODE_AXES; i++)
+            {
+                if(!GCODE_HAS(command, GCODE_X + i))
+                    continue;
+                bool rel = (i == GCODE_E) ? machine.isRelativeExtrusion() : machine.isRelative();
+                if(!motion || !rel)
+                    known |= INDEX_AXIS_BIT(i);
+            }
+        }
+
+        bool layerStart = layerComments && isLayerComment(p, lineEnd);
+        bool candidate = false;
+        if(motion && !layerComments && to[GCODE_E] > from[GCODE_E])
+        {
+            bool zKnown = (known & INDEX_AXIS_BIT(GCODE_Z)) != 0;
+            /* Pierwsza warstwa fragmentu jest rozstrzygana dopiero przy scalaniu */
+            if(!layerZValid || (zKnown ? 1U : 0U) != layerZKnown || to[GCODE_Z] >= layerZ + INDEX_MIN_LAYER_HEIGHT)
+            {
+                candidate = true;
+                layerZ = to[GCODE_Z];
+                layerZValid = true;
+                layerZKnown = zKnown ? 1U : 0U;
+            }
+        }
+
+        bool checkpoint = offset >= nextCheckpoint;
+        if(checkpoint || layerStart || candidate)
+        {
+            ChunkEntry entry = state;
+            entry.entry.offset = offset;
+            memcpy(entry.entry.position, from, sizeof(entry.entry.position));
+            entry.entry.feedrate = machine.getFeedrate();
+            entry.entry.relative = machine.isRelative();
+            entry.entry.relativeExtrusion = machine.isRelativeExtrusion();
+            entry.entry.layerStart = layerStart;
+            entry.checkpoint = checkpoint;
+            entry.candidate = candidate;
+            result->entries.append(entry);
+            if(checkpoint)
+                nextCheckpoint = (offset / INDEX_INTERVAL + 1) * INDEX_INTERVAL;
+        }
+
+        if(motion)
+        {
+            quint8 newlyKnown = known & ~state.known;
+            float distance = 0.0f;
+            for(int i = 0; i < 3; i++)
+            {
+                float d = to[i] - from[i];
+                distance += d * d;
+            }
+            distance = sqrtf(distance);
+            if(distance == 0.0f)
+                distance = fabsf(to[GCODE_E] - from[GCODE_E]);
+
+            /* Odległość od nieznanej pozycji nie jest znana, taki ruch pomijamy w czasie */
+            if(!(newlyKnown & INDEX_XYZ_BITS))
+            {
+                if(GCODE_HAS(command, GCODE_F) || state.feedKnown)
+                {
+                    if(after.getFeedrate() > 0.0f)
+                        state.entry.time += distance / after.getFeedrate();
+                }
+                else
+                {
+                    state.pendingDistance += distance;
+                }
+            }
+
+            state.entry.extrusion += to[GCODE_E] - from[GCODE_E];
+            if(newlyKnown & INDEX_AXIS_BIT(GCODE_E))
+                state.extrusionFix = true;
+        }
+        if(hasCommand && GCODE_HAS(command, GCODE_F) && motion)
+            state.feedKnown = true;
+
+        state.known = known;
+        state.entry.line++;
+        machine = after;
+        p = lineEnd + 1;
+    }
+
+    state.entry.offset = scan.end;
+    memcpy(state.entry.position, machine.getPosition(), sizeof(state.entry.position));
+    state.entry.feedrate = machine.getFeedrate();
+    state.entry.relative = machine.isRelative();
+    state.entry.relativeExtrusion = machine.isRelativeExtrusion();
+    result->end = state;
+}
+
+class ScanTask : public QRunnable
+{
+public:
+    ScanTask(const char *data, ChunkScan *scan) : data(data), scan(scan) {}
+    void run() { scanChunk(data, scan); }
+
+private:
+    const char *data;
+    ChunkScan *scan;
+};
+
+class ParseTask : public QRunnable
+{
+public:
+    ParseTask(const char *data, const ChunkScan *scan, bool relative, bool relativeExtrusion,
+              bool layerComments, ChunkResult *result) :
+        data(data), scan(scan), relative(relative), relativeExtrusion(relativeExtrusion),
+        layerComments(layerComments), result(result) {}
+    void run() { parseChunk(data, *scan, relative, relativeExtrusion, layerComments, result); }
+
+private:
+    const char *data;
+    const ChunkScan *scan;
+    bool relative;
+    bool relativeExtrusion;
+    bool layerComments;
+    ChunkResult *result;
+};
+
+/**
+ * Stan po wcześniejszych fragmentach zamienia wartości względne na bezwzględne.
+ */
+static GcodeIndexEntry fixEntry(const ChunkEntry &local, const GcodeIndexEntry &start)
+{
+    GcodeIndexEntry entry = local.entry;
+    for(int i = 0; i < GCODE_AXES; i++)
+    {
+        if(!(local.known & INDEX_AXIS_BIT(i)))
+            entry.position[i] += start.position[i];
+    }
+    if(!local.feedKnown)
+        entry.feedrate = start.feedrate;
+    entry.extrusion += start.extrusion;
+    if(local.extrusionFix)
+        entry.extrusion -= start.position[GCODE_E];
+    entry.time += start.time;
+    if(local.pendingDistance > 0.0f && start.feedrate > 0.0f)
+        entry.time += local.pendingDistance / start.feedrate;
+    entry.line += start.line;
+    entry.layer = start.layer;
+    return entry;
+}
+
+GcodeIndex::GcodeIndex()
+{
+    clear();
+}
+
+void GcodeIndex::clear()
+{
+    fileName.clear();
+    fileSize = 0;
+    fileModified = 0;
+    entries.clear();
+    lineCount = 0;
+    layerCount = 0;
+    totalExtrusion = 0.0f;
+    totalTime = 0.0f;
+}
+
+QString GcodeIndex::sidecarName(const QString &fileName)
+{
+    return fileName + ".idx";
+}
+
+bool GcodeIndex::open(const QString &fileName)
+{
+    if(load(fileName))
+        return true;
+
+    if(!build(fileName))
+        return false;
+
+    if(!save())
+        qWarning() << "Warning: Nie można zapisać indeksu: " << sidecarName(fileName);
+    return true;
+}
+
+/**
+ * @brief GcodeIndex::build
+ *
+ * Two parallel passes over the mapped file, then a sequential fix-up over the chunks.
+ */
+bool GcodeIndex::build(const QString &fileName)
+{
+    clear();
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Error: Nie można otworzyć pliku G-code: " << fileName << "\n";
+        return false;
+    }
+    QFileInfo info(file);
+    qint64 size = file.size();
+
+    const char *data = nullptr;
+    if(size > 0)
+    {
+        data = reinterpret_cast<const char *>(file.map(0, size));
+        if(!data)
+        {
+            qDebug() << "Error: Nie można zmapować pliku G-code: " << fileName << "\n";
+            return false;
+        }
+    }
+
+    /* Podział na fragmenty zaczynające się od początku linii */
+    int threads = qMax(1, QThread::idealThreadCount());
+    qint64 count = qBound<qint64>(1, size / INDEX_MIN_CHUNK, threads * INDEX_CHUNKS_PER_THREAD);
+    QVector<ChunkScan> scans;
+    qint64 begin = 0;
+    for(qint64 i = 1; i <= count && begin < size; i++)
+    {
+        qint64 end = (i == count) ? size : size * i / count;
+        if(end < size)
+        {
+            const char *nl = static_cast<const char *>(memchr(data + end, '\n', static_cast<size_t>(size - end)));
+            end = nl ? (nl - data) + 1 : size;
+        }
+        if(end <= begin)
+            continue;
+        ChunkScan scan;
+        memset(&scan, 0, sizeof(scan));
+        scan.begin = begin;
+        scan.end = end;
+        scans.append(scan);
+        begin = end;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for(int i = 0; i < scans.size(); i++)
+        pool.start(new ScanTask(data, &scans[i]));
+    pool.waitForDone();
+
+    bool layerComments = false;
+    for(int i = 0; i < scans.size(); i++)
+        layerComments = layerComments || scans[i].layerComments;
+
+    QVector<ChunkResult> results(scans.size());
+    bool relative = false;
+    bool relativeExtrusion = false;
+    for(int i = 0; i < scans.size(); i++)
+    {
+        pool.start(new ParseTask(data, &scans[i], relative, relativeExtrusion, layerComments, &results[i]));
+        if(scans[i].relative >= 0)
+            relative = (scans[i].relative != 0);
+        if(scans[i].relativeExtrusion >= 0)
+            relativeExtrusion = (scans[i].relativeExtrusion != 0);
+    }
+    pool.waitForDone();
+
+    /* Scalanie: stan końcowy fragmentu jest stanem początkowym następnego */
+    GcodeIndexEntry start;
+    memset(&start, 0, sizeof(start));
+    GcodeMachine defaults;
+    start.feedrate = defaults.getFeedrate();
+    float layerZ = 0.0f;
+    bool layerZValid = false;
+
+    for(int i = 0; i < results.size(); i++)
+    {
+        const ChunkResult &result = results[i];
+        for(int k = 0; k < result.entries.size(); k++)
+        {
+            const ChunkEntry &local = result.entries[k];
+            GcodeIndexEntry entry = fixEntry(local, start);
+
+            if(local.candidate)
+            {
+                /* Podniesienie Z przy ruchu z ekstruzją zaczyna nową warstwę */
+                float z = entry.position[GCODE_Z];
+                if(!layerZValid || z >= layerZ + INDEX_MIN_LAYER_HEIGHT)
+                {
+                    entry.layerStart = true;
+                    layerZ = z;
+                    layerZValid = true;
+                }
+            }
+            if(entry.layerStart)
+                start.layer++;
+            entry.layer = start.layer;
+
+            if(local.checkpoint || entry.layerStart)
+                entries.append(entry);
+        }
+
+        quint32 layer = start.layer;
+        start = fixEntry(result.end, start);
+        start.layer = layer;
+    }
+
+    if(data)
+        file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
+    file.close();
+
+    this->fileName = fileName;
+    fileSize = size;
+    fileModified = info.lastModified().toMSecsSinceEpoch();
+    lineCount = start.line;
+    layerCount = start.layer;
+    totalExtrusion = start.extrusion;
+    totalTime = start.time;
+    return true;
+}
+
+bool GcodeIndex::save() const
+{
+    if(!isValid())
+        return false;
+
+    QFile file(sidecarName(fileName));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QDataStream out(&file);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    out << quint32(INDEX_MAGIC) << quint32(INDEX_VERSION) << fileSize << fileModified
+        << lineCount << layerCount << totalExtrusion << totalTime << quint32(entries.size());
+    for(int i = 0; i < entries.size(); i++)
+    {
+        const GcodeIndexEntry &e = entries[i];
+        out << e.offset << e.line << e.layer;
+        for(int a = 0; a < GCODE_AXES; a++)
+            out << e.position[a];
+        out << e.feedrate << e.extrusion << e.time << e.relative << e.relativeExtrusion << e.layerStart;
+    }
+    return out.status() == QDataStream::Ok;
+}
+
+/**
+ * @brief GcodeIndex::load
+ *
+ * Reads the sidecar, fails if it is missing, damaged or the file changed since it was written.
+ */
+bool GcodeIndex::load(const QString &fileName)
+{
+    clear();
+
+    QFileInfo info(fileName);
+    QFile file(sidecarName(fileName));
+    if(!info.exists() || !file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    quint32 magic, version, count;
+    qint64 size, modified;
+    in >> magic >> version >> size >> modified;
+    if(in.status() != QDataStream::Ok || magic != INDEX_MAGIC || version != INDEX_VERSION)
+        return false;
+    if(size != info.size() || modified != info.lastModified().toMSecsSinceEpoch())
+        return false;
+
+    in >> lineCount >> layerCount >> totalExtrusion >> totalTime >> count;
+    entries.resize(static_cast<int>(count));
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        GcodeIndexEntry &e = entries[static_cast<int>(i)];
+        in >> e.offset >> e.line >> e.layer;
+        for(int a = 0; a < GCODE_AXES; a++)
+            in >> e.position[a];
+        in >> e.feedrate >> e.extrusion >> e.time >> e.relative >> e.relativeExtrusion >> e.layerStart;
+    }
+    if(in.status() != QDataStream::Ok)
+    {
+        clear();
+        return false;
+    }
+
+    this->fileName = fileName;
+    fileSize = size;
+    fileModified = modified;
+    return true;
+}
+
+bool GcodeIndex::isValid() const
+{
+    return !fileName.isEmpty();
+}
+
+const QString &GcodeIndex::getFileName() const
+{
+    return fileName;
+}
+
+const QVector<GcodeIndexEntry> &GcodeIndex::getEntries() const
+{
+    return entries;
+}
+
+quint32 GcodeIndex::getLineCount() const
+{
+    return lineCount;
+}
+
+quint32 GcodeIndex::getLayerCount() const
+{
+    return layerCount;
+}
+
+float GcodeIndex::getTotalExtrusion() const
+{
+    return totalExtrusion;
+}
+
+float GcodeIndex::getTotalTime() const
+{
+    return totalTime;
+}
+
+static bool offsetLess(qint64 offset, const GcodeIndexEntry &entry)
+{
+    return offset < entry.offset;
+}
+
+static bool lineLess(quint32 line, const GcodeIndexEntry &entry)
+{
+    return line < entry.line;
+}
+
+static bool layerLess(const GcodeIndexEntry &entry, quint32 layer)
+{
+    return entry.layer < layer;
+}
+
+bool GcodeIndex::findByOffset(qint64 offset, GcodeIndexEntry *entry) const
+{
+    QVector<GcodeIndexEntry>::const_iterator it = std::upper_bound(entries.begin(), entries.end(), offset, offsetLess);
+    if(it == entries.begin())
+        return false;
+    *entry = *(it - 1);
+    return true;
+}
+
+bool GcodeIndex::findByLine(quint32 line, GcodeIndexEntry *entry) const
+{
+    QVector<GcodeIndexEntry>::const_iterator it = std::upper_bound(entries.begin(), entries.end(), line, lineLess);
+    if(it == entries.begin())
+        return false;
+    *entry = *(it - 1);
+    return true;
+}
+
+bool GcodeIndex::findByLayer(quint32 layer, GcodeIndexEntry *entry) const
+{
+    QVector<GcodeIndexEntry>::const_iterator it = std::lower_bound(entries.begin(), entries.end(), layer, layerLess);
+    if(it == entries.end() || it->layer != layer)
+        return false;
+    *entry = *it;
+    return true;
+}
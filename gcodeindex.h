@@ -0,0 +1,90 @@
+#ifndef GCODEINDEX_H
+#define GCODEINDEX_H
+
+#include <QString>
+#include <QVector>
+#include "gcodeparser.h"
+
+// A checkpoint is recorded at the first line starting after every this many bytes
+#define INDEX_INTERVAL              (64 * 1024)
+// Files are split into this many chunks per thread so a slow chunk does not hold the others
+#define INDEX_CHUNKS_PER_THREAD     (4)
+// Smallest chunk worth a task of its own
+#define INDEX_MIN_CHUNK             (256 * 1024)
+// Bumped whenever the sidecar layout changes
+#define INDEX_VERSION               (1)
+
+/**
+ * Machine state before the line at offset, enough to start sending from there.
+ */
+typedef struct {
+    qint64 offset;                  ///< Byte offset of the line in the file
+    quint32 line;                   ///< Line number, 0 based
+    quint32 layer;                  ///< Layers started before or at this line, 0 before the first layer
+    float position[GCODE_AXES];     ///< mm, E as the machine counts it (after G92)
+    float feedrate;                 ///< mm/s
+    float extrusion;                ///< Filament pushed since the start of the file, mm
+    float time;                     ///< Estimated print time up to here, s (no acceleration)
+    bool relative;
+    bool relativeExtrusion;
+    bool layerStart;                ///< The line starts the layer
+} GcodeIndexEntry;
+
+/**
+ * @brief GcodeIndex
+ *
+ * Line/layer index of a G-code file kept in a sidecar file ("<file>.idx") next to it.
+ * The sidecar is used only while the size and modification time of the file match.
+ *
+ * The file is memory mapped and split into chunks parsed in parallel. A chunk does not know the
+ * state the previous chunks end with, so its checkpoints are recorded relative to the chunk start
+ * and fixed up once all chunks are done. Only the absolute/relative modes must be known up front,
+ * they change rarely and are found by a quick scan for G90/G91/M82/M83 before the full parse.
+ *
+ * Seeking is a binary search over the checkpoints.
+ */
+class GcodeIndex
+{
+public:
+    GcodeIndex();
+
+    /**
+     * Loads the sidecar of the file, or builds the index and writes the sidecar.
+     */
+    bool open(const QString &fileName);
+    bool build(const QString &fileName);
+    bool load(const QString &fileName);
+    bool save() const;
+    void clear();
+
+    bool isValid() const;
+    const QString &getFileName() const;
+    const QVector<GcodeIndexEntry> &getEntries() const;
+    quint32 getLineCount() const;
+    quint32 getLayerCount() const;
+    float getTotalExtrusion() const;
+    float getTotalTime() const;
+
+    /**
+     * Last checkpoint at or before the offset/line, first checkpoint of the layer.
+     *
+     * @return false if there is none
+     */
+    bool findByOffset(qint64 offset, GcodeIndexEntry *entry) const;
+    bool findByLine(quint32 line, GcodeIndexEntry *entry) const;
+    bool findByLayer(quint32 layer, GcodeIndexEntry *entry) const;
+
+    static QString sidecarName(const QString &fileName);
+
+private:
+    QString fileName;
+    qint64 fileSize;
+    qint64 fileModified;            ///< ms since epoch
+    QVector<GcodeIndexEntry> entries;
+    quint32 lineCount;
+    quint32 layerCount;
+    float totalExtrusion;
+    float totalTime;
+};
+
+#endif // GCODEINDEX_H
@@ -0,0 +1,340 @@
+#include "gcodeparser.h"
+#include <math.h>
+
+// Default feedrate before the first F word, mm/s
+#define GCODE_DEFAULT_FEEDRATE      (25.0f)
+
+#define GCODE_PI                    (3.14159265358979f)
+
+static int paramIndex(char c)
+{
+    switch(c)
+    {
+    case 'X': return GCODE_X;
+    case 'Y': return GCODE_Y;
+    case 'Z': return GCODE_Z;
+    case 'E': return GCODE_E;
+    case 'F': return GCODE_F;
+    case 'I': return GCODE_I;
+    case 'J': return GCODE_J;
+    case 'R': return GCODE_R;
+    case 'S': return GCODE_S;
+    case 'P': return GCODE_P;
+    default: return -1;
+    }
+}
+
+float GcodeParser::parseNumber(const char **p, const char *end)
+{
+    const char *s = *p;
+    bool negative = false;
+    uint32_t integer = 0;
+    uint32_t fraction = 0;
+    float scale = 1.0f;
+
+    if(s < end && (*s == '-' || *s == '+'))
+    {
+        negative = (*s == '-');
+        s++;
+    }
+    while(s < end && *s >= '0' && *s <= '9')
+    {
+        integer = integer * 10U + static_cast<uint32_t>(*s - '0');
+        s++;
+    }
+    if(s < end && *s == '.')
+    {
+        s++;
+        /* Więcej niż 7 miejsc po przecinku i tak przekracza dokładność float */
+        int digits = 0;
+        while(s < end && *s >= '0' && *s <= '9')
+        {
+            if(digits < 7)
+            {
+                fraction = fraction * 10U + static_cast<uint32_t>(*s - '0');
+                scale *= 10.0f;
+                digits++;
+            }
+            s++;
+        }
+    }
+    *p = s;
+
+    float value = static_cast<float>(integer) + static_cast<float>(fraction) / scale;
+    return negative ? -value : value;
+}
+
+bool GcodeParser::parse(const char *line, int length, GcodeCommand *command)
+{
+    const char *p = line;
+    const char *end = line + length;
+    bool found = false;
+
+    command->letter = 0;
+    command->code = 0;
+    command->params = 0;
+
+    while(p < end)
+    {
+        char c = *p;
+        if(c == ';')
+            break;
+        if(c == '(')
+        {
+            /* Komentarz w nawiasach */
+            while(p < end && *p != ')')
+                p++;
+            p++;
+            continue;
+        }
+        if(c >= 'a' && c <= 'z')
+            c = static_cast<char>(c - 'a' + 'A');
+        if(c == 'G' || c == 'M' || c == 'T')
+        {
+            if(command->letter == 0)
+            {
+                p++;
+                command->letter = c;
+                command->code = static_cast<int>(parseNumber(&p, end));
+                found = true;
+                continue;
+            }
+        }
+        else if(c == 'N')
+        {
+            /* Numer linii, pomijany */
+            p++;
+            parseNumber(&p, end);
+            continue;
+        }
+        else if(c == '*')
+        {
+            /* Suma kontrolna kończy linię */
+            break;
+        }
+        else
+        {
+            int index = paramIndex(c);
+            if(index >= 0)
+            {
+                p++;
+                command->value[index] = parseNumber(&p, end);
+                command->params |= (1U << index);
+                found = true;
+                continue;
+            }
+        }
+        p++;
+    }
+    return found;
+}
+
+GcodeMachine::GcodeMachine()
+{
+    reset();
+}
+
+void GcodeMachine::reset()
+{
+    for(int i = 0; i < GCODE_AXES; i++)
+        position[i] = 0.0f;
+    feedrate = GCODE_DEFAULT_FEEDRATE;
+    relative = false;
+    relativeExtrusion = false;
+}
+
+void GcodeMachine::setState(const float *position, float feedrate, bool relative, bool relativeExtrusion)
+{
+    for(int i = 0; i < GCODE_AXES; i++)
+        this->position[i] = position[i];
+    this->feedrate = feedrate;
+    this->relative = relative;
+    this->relativeExtrusion = relativeExtrusion;
+}
+
+bool GcodeMachine::apply(const GcodeCommand &command, GcodeMove *move)
+{
+    if(command.letter == 'G')
+    {
+        switch(command.code)
+        {
+        case 0:
+        case 1:
+            if(GCODE_HAS(command, GCODE_F))
+                feedrate = command.value[GCODE_F] / 60.0f;
+            for(int i = 0; i < GCODE_AXES; i++)
+            {
+                move->from[i] = position[i];
+                if(GCODE_HAS(command, GCODE_X + i))
+                {
+                    bool rel = (i == GCODE_E) ? relativeExtrusion : relative;
+                    position[i] = rel ? position[i] + command.value[GCODE_X + i] : command.value[GCODE_X + i];
+                }
+                move->to[i] = position[i];
+            }
+            move->feedrate = feedrate;
+            move->rapid = (command.code == 0);
+            return true;
+        case 2:
+        case 3:
+            /* Łuk tylko zmienia tu pozycję, drogę wyznacza odbiorca */
+            if(GCODE_HAS(command, GCODE_F))
+                feedrate = command.value[GCODE_F] / 60.0f;
+            for(int i = 0; i < GCODE_AXES; i++)
+            {
+                if(GCODE_HAS(command, GCODE_X + i))
+                {
+                    bool rel = (i == GCODE_E) ? relativeExtrusion : relative;
+                    position[i] = rel ? position[i] + command.value[GCODE_X + i] : command.value[GCODE_X + i];
+                }
+            }
+            break;
+        case 90:
+            relative = false;
+            relativeExtrusion = false;
+            break;
+        case 91:
+            relative = true;
+            relativeExtrusion = true;
+            break;
+        case 92:
+            for(int i = 0; i < GCODE_AXES; i++)
+            {
+                if(GCODE_HAS(command, GCODE_X + i))
+                    position[i] = command.value[GCODE_X + i];
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    else if(command.letter == 'M')
+    {
+        if(command.code == 82)
+            relativeExtrusion = false;
+        else if(command.code == 83)
+            relativeExtrusion = true;
+    }
+    return false;
+}
+
+const float *GcodeMachine::getPosition() const
+{
+    return position;
+}
+
+float GcodeMachine::getFeedrate() const
+{
+    return feedrate;
+}
+
+bool GcodeMachine::isRelative() const
+{
+    return relative;
+}
+
+bool GcodeMachine::isRelativeExtrusion() const
+{
+    return relativeExtrusion;
+}
+
+bool GcodeArc::setup(const GcodeCommand &command, const float *from, const float *to)
+{
+    for(int a = 0; a < GCODE_AXES; a++)
+    {
+        this->from[a] = from[a];
+        this->to[a] = to[a];
+    }
+
+    float x = to[GCODE_X] - from[GCODE_X];
+    float y = to[GCODE_Y] - from[GCODE_Y];
+    bool clockwise = (command.code == 2);
+    float ci;
+    float cj;
+
+    if(GCODE_HAS(command, GCODE_R))
+    {
+        float r = command.value[GCODE_R];
+        float h = 4.0f * r * r - x * x - y * y;
+        float chord = sqrtf(x * x + y * y);
+        if(h < 0.0f || chord == 0.0f)
+            return false;
+        h = -sqrtf(h) / chord;
+        if(!clockwise)
+            h = -h;
+        if(r < 0.0f)
+        {
+            /* Ujemny promień wybiera łuk dłuższy niż pół okręgu */
+            h = -h;
+        }
+        ci = 0.5f * (x - y * h);
+        cj = 0.5f * (y + x * h);
+    }
+    else
+    {
+        ci = GCODE_HAS(command, GCODE_I) ? command.value[GCODE_I] : 0.0f;
+        cj = GCODE_HAS(command, GCODE_J) ? command.value[GCODE_J] : 0.0f;
+    }
+
+    cx = from[GCODE_X] + ci;
+    cy = from[GCODE_Y] + cj;
+    r0 = -ci;
+    r1 = -cj;
+    float rt0 = to[GCODE_X] - cx;
+    float rt1 = to[GCODE_Y] - cy;
+    radius = sqrtf(r0 * r0 + r1 * r1);
+    if(radius == 0.0f)
+        return false;
+
+    travel = atan2f(r0 * rt1 - r1 * rt0, r0 * rt0 + r1 * rt1);
+    if(clockwise)
+    {
+        if(travel >= -1e-6f)
+            travel -= 2.0f * GCODE_PI;
+    }
+    else if(travel <= 1e-6f)
+    {
+        travel += 2.0f * GCODE_PI;
+    }
+    return true;
+}
+
+int GcodeArc::segments(float tolerance) const
+{
+    /* Zerowa, ujemna albo NaN tolerancja dałaby nieskończenie wiele cięciw */
+    if(!(tolerance >= GCODE_MIN_ARC_TOLERANCE))
+        tolerance = GCODE_MIN_ARC_TOLERANCE;
+    if(tolerance > radius)
+        tolerance = radius;
+    float segments = floorf(fabsf(travel) * radius / sqrtf(tolerance * (2.0f * radius - tolerance)));
+
+    /* Rzutowanie na int tylko w zakresie, NaN daje jedną cięciwę */
+    if(!(segments >= 1.0f))
+        return 1;
+    if(segments > static_cast<float>(GCODE_MAX_ARC_SEGMENTS))
+        return GCODE_MAX_ARC_SEGMENTS;
+    return static_cast<int>(segments);
+}
+
+float GcodeArc::length() const
+{
+    float planar = fabsf(travel) * radius;
+    float dz = to[GCODE_Z] - from[GCODE_Z];
+    return sqrtf(planar * planar + dz * dz);
+}
+
+void GcodeArc::point(float t, float *out) const
+{
+    if(t >= 1.0f)
+    {
+        for(int a = 0; a < GCODE_AXES; a++)
+            out[a] = to[a];
+        return;
+    }
+    float c = cosf(travel * t);
+    float s = sinf(travel * t);
+    out[GCODE_X] = cx + r0 * c - r1 * s;
+    out[GCODE_Y] = cy + r0 * s + r1 * c;
+    out[GCODE_Z] = from[GCODE_Z] + (to[GCODE_Z] - from[GCODE_Z]) * t;
+    out[GCODE_E] = from[GCODE_E] + (to[GCODE_E] - from[GCODE_E]) * t;
+}
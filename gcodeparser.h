@@ -0,0 +1,140 @@
+#ifndef GCODEPARSER_H
+#define GCODEPARSER_H
+
+#include <stdint.h>
+
+// Parameters of a G-code command, index into GcodeCommand::value
+enum {
+    GCODE_X = 0,
+    GCODE_Y,
+    GCODE_Z,
+    GCODE_E,
+    GCODE_F,
+    GCODE_I,
+    GCODE_J,
+    GCODE_R,
+    GCODE_S,
+    GCODE_P,
+    GCODE_PARAMS,
+};
+
+#define GCODE_HAS(command, param)   (((command).params & (1U << (param))) != 0)
+
+// Axes of a move, X Y Z E
+#define GCODE_AXES                  (4)
+
+// Smallest tolerance of the chords of an arc, mm
+#define GCODE_MIN_ARC_TOLERANCE     (0.001f)
+// Most chords of one arc
+#define GCODE_MAX_ARC_SEGMENTS      (100000)
+
+typedef struct {
+    char letter;                    ///< 'G', 'M', 'T' or 0 for a line without a command word
+    int code;                       ///< Number of the command, e.g. 1 for G1
+    uint32_t params;                ///< Bit mask of the parameters present
+    float value[GCODE_PARAMS];
+} GcodeCommand;
+
+typedef struct {
+    float from[GCODE_AXES];         ///< Position before the move, mm
+    float to[GCODE_AXES];           ///< Position after the move, mm
+    float feedrate;                 ///< mm/s
+    bool rapid;                     ///< G0
+} GcodeMove;
+
+/**
+ * @brief GcodeParser
+ *
+ * Minimal, allocation-free parser of a single G-code line. Numbers are parsed by hand
+ * (no locale, no exponent) which is all slicers produce and much faster than strtod.
+ */
+class GcodeParser
+{
+public:
+    /**
+     * Parses one line (without the line end). Comments (';' and '(...)') are ignored.
+     *
+     * @return false if the line holds no command and no parameters.
+     */
+    static bool parse(const char *line, int length, GcodeCommand *command);
+
+    /**
+     * Parses a decimal number starting at *p, advances *p past it.
+     */
+    static float parseNumber(const char **p, const char *end);
+};
+
+/**
+ * @brief GcodeMachine
+ *
+ * Tracks the modal state of the printer (position, absolute/relative modes, feedrate) so
+ * G0/G1 commands can be turned into absolute moves.
+ */
+class GcodeMachine
+{
+public:
+    GcodeMachine();
+    void reset();
+    void setState(const float *position, float feedrate, bool relative, bool relativeExtrusion);
+
+    /**
+     * Applies the command to the state. G2/G3 update the position but are not reported as moves.
+     *
+     * @return true if the command is a linear move, the move is then filled in.
+     */
+    bool apply(const GcodeCommand &command, GcodeMove *move);
+
+    const float *getPosition() const;
+    float getFeedrate() const;
+    bool isRelative() const;
+    bool isRelativeExtrusion() const;
+
+private:
+    float position[GCODE_AXES];
+    float feedrate;                 ///< mm/s
+    bool relative;
+    bool relativeExtrusion;
+};
+
+/**
+ * @brief GcodeArc
+ *
+ * Geometry of a G2/G3 move in the XY plane (center I/J or radius R form). Z and E change
+ * linearly along the arc, as the firmware does.
+ */
+class GcodeArc
+{
+public:
+    /**
+     * @return false if the arc can not be constructed (zero radius, radius too small for the chord).
+     */
+    bool setup(const GcodeCommand &command, const float *from, const float *to);
+
+    /**
+     * Number of chords keeping every chord within tolerance mm of the arc, at least 1 and at most
+     * GCODE_MAX_ARC_SEGMENTS. A tolerance below GCODE_MIN_ARC_TOLERANCE (or NaN) is raised to it.
+     */
+    int segments(float tolerance) const;
+
+    /**
+     * Length of the path (helix if Z changes), mm.
+     */
+    float length() const;
+
+    /**
+     * Point at the fraction t of the arc, t == 1 gives exactly the end point.
+     */
+    void point(float t, float *out) const;
+
+private:
+    float from[GCODE_AXES];
+    float to[GCODE_AXES];
+    float cx;                       ///< Center
+    float cy;
+    float r0;                       ///< Start point relative to the center
+    float r1;
+    float radius;
+    float travel;                   ///< Angle, negative clockwise
+};
+
+#endif // GCODEPARSER_H
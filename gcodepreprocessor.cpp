@@ -0,0 +1,459 @@
+#include "gcodepreprocessor.h"
+#include <math.h>
+#include <string.h>
+
+#define PREPROCESSOR_DEFAULT_MERGE_TOLERANCE    (0.01f)
+#define PREPROCESSOR_DEFAULT_ARC_TOLERANCE      (0.01f)
+
+// Relative difference of the extrusion per mm still treated as the same extrusion rate
+#define PREPROCESSOR_EXTRUSION_TOLERANCE        (0.01f)
+
+// Decimal places written, the same as slicers use
+#define PREPROCESSOR_AXIS_DECIMALS              (3)
+#define PREPROCESSOR_EXTRUDER_DECIMALS          (5)
+#define PREPROCESSOR_FEEDRATE_DECIMALS          (1)
+
+// Parameters a G0/G1 may have and still be rewritten
+#define PREPROCESSOR_MOVE_PARAMS    ((1U << GCODE_X) | (1U << GCODE_Y) | (1U << GCODE_Z) | (1U << GCODE_E) | (1U << GCODE_F))
+
+static char *writeNumber(char *p, float value, int decimals)
+{
+    static const int64_t scales[] = { 1, 10, 100, 1000, 10000, 100000 };
+    int64_t scale = scales[decimals];
+    int64_t v = static_cast<int64_t>(lround(static_cast<double>(value) * static_cast<double>(scale)));
+    if(v < 0)
+    {
+        *p++ = '-';
+        v = -v;
+    }
+
+    int64_t integer = v / scale;
+    int64_t fraction = v % scale;
+
+    char digits[20];
+    int n = 0;
+    do
+    {
+        digits[n++] = static_cast<char>('0' + integer % 10);
+        integer /= 10;
+    } while(integer != 0);
+    while(n > 0)
+        *p++ = digits[--n];
+
+    if(fraction != 0)
+    {
+        *p++ = '.';
+        /* Końcowe zera nie są zapisywane */
+        while(fraction % 10 == 0)
+        {
+            fraction /= 10;
+            decimals--;
+        }
+        for(int i = decimals - 1; i >= 0; i--)
+        {
+            p[i] = static_cast<char>('0' + fraction % 10);
+            fraction /= 10;
+        }
+        p += decimals;
+    }
+    return p;
+}
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * Copies the line without comments and surrounding white space.
+ *
+ * @return length of the stripped line
+ */
+static int stripLine(const char *line, int length, char *out)
+{
+    int n = 0;
+    for(int i = 0; i < length; i++)
+    {
+        char c = line[i];
+        if(c == ';')
+            break;
+        if(c == '(')
+        {
+            while(i < length && line[i] != ')')
+                i++;
+            continue;
+        }
+        if(n == 0 && isSpace(c))
+            continue;
+        out[n++] = c;
+    }
+    while(n > 0 && isSpace(out[n - 1]))
+        n--;
+    return n;
+}
+
+GcodePreprocessor::GcodePreprocessor()
+{
+    options = defaultOptions();
+    reset();
+}
+
+PreprocessorOptions GcodePreprocessor::defaultOptions()
+{
+    PreprocessorOptions options;
+    options.dropNoOps = true;
+    options.mergeCollinear = true;
+    options.mergeTolerance = PREPROCESSOR_DEFAULT_MERGE_TOLERANCE;
+    options.linearizeArcs = false;
+    options.arcTolerance = PREPROCESSOR_DEFAULT_ARC_TOLERANCE;
+    options.dedupeFeedrate = true;
+    return options;
+}
+
+void GcodePreprocessor::setOptions(const PreprocessorOptions &options)
+{
+    this->options = options;
+}
+
+const PreprocessorOptions &GcodePreprocessor::getOptions() const
+{
+    return options;
+}
+
+void GcodePreprocessor::reset()
+{
+    memset(&stats, 0, sizeof(stats));
+    machine.reset();
+    held = false;
+    heldCount = 0;
+    emittedFeedrate = -1.0f;
+    feedratePending = false;
+    output.clear();
+    sources.clear();
+    readPos = 0;
+    readLines = 0;
+    lastSkip = -1;
+}
+
+void GcodePreprocessor::setMachine(const GcodeMachine &machine)
+{
+    held = false;
+    heldCount = 0;
+    output.clear();
+    sources.clear();
+    readPos = 0;
+    readLines = 0;
+    lastSkip = -1;
+    this->machine = machine;
+    emittedFeedrate = -1.0f;
+    feedratePending = true;
+}
+
+const PreprocessorStats &GcodePreprocessor::getStats() const
+{
+    return stats;
+}
+
+int64_t GcodePreprocessor::bytesSaved() const
+{
+    return static_cast<int64_t>(stats.bytesIn) - static_cast<int64_t>(stats.bytesOut);
+}
+
+bool GcodePreprocessor::nextLine(const char **text, int *length, GcodeSource *source)
+{
+    if(readPos >= output.size())
+    {
+        output.clear();
+        sources.clear();
+        readPos = 0;
+        readLines = 0;
+        return false;
+    }
+    if(source)
+        *source = sources[readLines];
+    readLines++;
+
+    const char *begin = output.data() + readPos;
+    const char *end = static_cast<const char *>(memchr(begin, '\n', output.size() - readPos));
+    *text = begin;
+    *length = static_cast<int>(end - begin);
+    readPos += static_cast<size_t>(*length) + 1U;
+    return true;
+}
+
+void GcodePreprocessor::emitLine(const char *text, int length, const GcodeSource &source)
+{
+    sources.push_back(source);
+    /* Źródła nie cofają się, wcześniejsze linie z tej samej linii wejścia wyszły tuż przed tą */
+    if(lastSkip >= 0 && lastOffset == source.offset)
+        lastSkip++;
+    else
+        lastSkip = 0;
+    lastOffset = source.offset;
+    sources.back().skip = static_cast<uint32_t>(lastSkip);
+    output.append(text, static_cast<size_t>(length));
+    output.push_back('\n');
+    stats.linesOut++;
+    stats.bytesOut += static_cast<uint64_t>(length) + 1U;
+}
+
+void GcodePreprocessor::feed(const char *line, int length, int64_t offset)
+{
+    if(readPos >= output.size())
+    {
+        output.clear();
+        sources.clear();
+        readPos = 0;
+        readLines = 0;
+    }
+    lineSource.offset = offset;
+    lineSource.skip = 0;
+    lineSource.machine = machine;
+    stats.linesIn++;
+    stats.bytesIn += static_cast<uint64_t>(length);
+
+    if(length > PREPROCESSOR_MAX_LINE)
+    {
+        /* W takiej linii nie ma czego sensownie przepisać, wychodzi bez zmian */
+        flushMove();
+        while(length > 0 && isSpace(line[length - 1]))
+            length--;
+        emitLine(line, length, lineSource);
+        return;
+    }
+
+    char text[PREPROCESSOR_MAX_LINE];
+    int n = stripLine(line, length, text);
+    if(n == 0)
+        return;
+
+    GcodeCommand command;
+    if(!GcodeParser::parse(text, n, &command))
+    {
+        flushMove();
+        emitLine(text, n, lineSource);
+        return;
+    }
+
+    bool motion = (command.letter == 'G' && command.code >= 0 && command.code <= 3);
+    if(!motion)
+    {
+        /* Wstrzymany ruch wychodzi w trybach sprzed tej komendy */
+        flushMove();
+        GcodeMove unused;
+        machine.apply(command, &unused);
+        emitLine(text, n, lineSource);
+        return;
+    }
+
+    float from[GCODE_AXES];
+    memcpy(from, machine.getPosition(), sizeof(from));
+
+    GcodeMove move;
+    bool linear = machine.apply(command, &move);
+    const float *to = machine.getPosition();
+
+    if(!linear)
+    {
+        if(options.linearizeArcs && !GCODE_HAS(command, GCODE_P))
+        {
+            if(linearizeArc(command, from, to))
+                return;
+        }
+        passThrough(text, n, command);
+        return;
+    }
+
+    bool moved = false;
+    for(int i = 0; i < GCODE_AXES; i++)
+        moved = moved || (move.to[i] != move.from[i]);
+    if(!moved && options.dropNoOps)
+    {
+        /* Posuw zostaje w stanie maszyny i wychodzi z następnym ruchem, przepisanym albo przepuszczonym */
+        if(GCODE_HAS(command, GCODE_F))
+            feedratePending = true;
+        stats.movesDropped++;
+        return;
+    }
+
+    bool rewrite = (options.mergeCollinear || options.dedupeFeedrate) && moved
+                   && (command.params & ~PREPROCESSOR_MOVE_PARAMS) == 0;
+    if(!rewrite)
+    {
+        passThrough(text, n, command);
+        return;
+    }
+    addMove(move);
+}
+
+void GcodePreprocessor::finish()
+{
+    flushMove();
+}
+
+/**
+ * Sends a move as it is. A move without F runs at the feedrate of the machine, if the printer may
+ * not have it yet a G1 with only that F goes first.
+ */
+void GcodePreprocessor::passThrough(const char *text, int length, const GcodeCommand &command)
+{
+    flushMove();
+    if(GCODE_HAS(command, GCODE_F))
+    {
+        emitLine(text, length, lineSource);
+        emittedFeedrate = machine.getFeedrate();
+    }
+    else
+    {
+        if(feedratePending && machine.getFeedrate() != emittedFeedrate)
+        {
+            char f[32];
+            char *p = f;
+            *p++ = 'G';
+            *p++ = '1';
+            *p++ = ' ';
+            *p++ = 'F';
+            p = writeNumber(p, machine.getFeedrate() * 60.0f, PREPROCESSOR_FEEDRATE_DECIMALS);
+            emitLine(f, static_cast<int>(p - f), lineSource);
+            emittedFeedrate = machine.getFeedrate();
+        }
+        emitLine(text, length, lineSource);
+    }
+    feedratePending = false;
+}
+
+bool GcodePreprocessor::canMerge(const GcodeMove &move) const
+{
+    if(!options.mergeCollinear || heldCount >= PREPROCESSOR_MAX_MERGE)
+        return false;
+    if(move.rapid != heldMove.rapid || move.feedrate != heldMove.feedrate)
+        return false;
+
+    float a[3];
+    float b[3];
+    float d[3];
+    for(int i = 0; i < 3; i++)
+    {
+        a[i] = heldMove.to[i] - heldMove.from[i];
+        b[i] = move.to[i] - move.from[i];
+        d[i] = move.to[i] - heldMove.from[i];
+    }
+    float la = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    float lb = sqrtf(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+    float ld = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    if(la == 0.0f || lb == 0.0f || ld == 0.0f)
+        return false;
+    if(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] <= 0.0f)
+        return false;
+
+    /* Tyle samo filamentu na mm, inaczej połączony ruch wytłaczałby nierówno */
+    float ea = (heldMove.to[GCODE_E] - heldMove.from[GCODE_E]) / la;
+    float eb = (move.to[GCODE_E] - move.from[GCODE_E]) / lb;
+    float emax = fabsf(ea) > fabsf(eb) ? fabsf(ea) : fabsf(eb);
+    if(fabsf(ea - eb) > emax * PREPROCESSOR_EXTRUSION_TOLERANCE)
+        return false;
+
+    /* Każdy dotąd pominięty punkt musi zostać w tolerancji nowego odcinka */
+    float limit = options.mergeTolerance * ld;
+    for(int k = 0; k <= heldCount; k++)
+    {
+        const float *point = (k < heldCount) ? heldPoints[k] : heldMove.to;
+        float p[3];
+        for(int i = 0; i < 3; i++)
+            p[i] = point[i] - heldMove.from[i];
+        float cx = p[1] * d[2] - p[2] * d[1];
+        float cy = p[2] * d[0] - p[0] * d[2];
+        float cz = p[0] * d[1] - p[1] * d[0];
+        if(cx * cx + cy * cy + cz * cz > limit * limit)
+            return false;
+    }
+    return true;
+}
+
+void GcodePreprocessor::addMove(const GcodeMove &move)
+{
+    if(held && canMerge(move))
+    {
+        for(int i = 0; i < 3; i++)
+            heldPoints[heldCount][i] = heldMove.to[i];
+        heldCount++;
+        memcpy(heldMove.to, move.to, sizeof(heldMove.to));
+        stats.movesMerged++;
+        return;
+    }
+
+    flushMove();
+    if(!options.mergeCollinear)
+    {
+        emitMove(move.from, move.to, move.feedrate, move.rapid, lineSource);
+        return;
+    }
+    heldMove = move;
+    heldSource = lineSource;
+    heldCount = 0;
+    held = true;
+}
+
+void GcodePreprocessor::flushMove()
+{
+    if(!held)
+        return;
+    held = false;
+    emitMove(heldMove.from, heldMove.to, heldMove.feedrate, heldMove.rapid, heldSource);
+}
+
+void GcodePreprocessor::emitMove(const float *from, const float *to, float feedrate, bool rapid, const GcodeSource &source)
+{
+    static const char letters[GCODE_AXES] = { 'X', 'Y', 'Z', 'E' };
+    char text[96];
+    char *p = text;
+
+    *p++ = 'G';
+    *p++ = rapid ? '0' : '1';
+    for(int i = 0; i < GCODE_AXES; i++)
+    {
+        if(to[i] == from[i])
+            continue;
+        bool rel = (i == GCODE_E) ? machine.isRelativeExtrusion() : machine.isRelative();
+        *p++ = ' ';
+        *p++ = letters[i];
+        p = writeNumber(p, rel ? to[i] - from[i] : to[i],
+                        i == GCODE_E ? PREPROCESSOR_EXTRUDER_DECIMALS : PREPROCESSOR_AXIS_DECIMALS);
+    }
+    if(!options.dedupeFeedrate || feedrate != emittedFeedrate)
+    {
+        *p++ = ' ';
+        *p++ = 'F';
+        p = writeNumber(p, feedrate * 60.0f, PREPROCESSOR_FEEDRATE_DECIMALS);
+        emittedFeedrate = feedrate;
+    }
+    emitLine(text, static_cast<int>(p - text), source);
+}
+
+/**
+ * Replaces a G2/G3 in the XY plane by chords no further than arcTolerance from the arc,
+ * Z and E change linearly along it. The chords then go through the same merging as G1.
+ *
+ * @return false if the arc is invalid, it is then passed on unchanged.
+ */
+bool GcodePreprocessor::linearizeArc(const GcodeCommand &command, const float *from, const float *to)
+{
+    GcodeArc arc;
+    if(!arc.setup(command, from, to))
+        return false;
+
+    int segments = arc.segments(options.arcTolerance);
+    GcodeMove move;
+    move.feedrate = machine.getFeedrate();
+    move.rapid = false;
+    memcpy(move.to, from, sizeof(move.to));
+    for(int k = 1; k <= segments; k++)
+    {
+        memcpy(move.from, move.to, sizeof(move.from));
+        arc.point(static_cast<float>(k) / static_cast<float>(segments), move.to);
+        addMove(move);
+        stats.arcSegments++;
+    }
+    stats.arcsLinearized++;
+    return true;
+}
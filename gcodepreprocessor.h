@@ -0,0 +1,124 @@
+#ifndef GCODEPREPROCESSOR_H
+#define GCODEPREPROCESSOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "gcodeparser.h"
+
+// Longest line the preprocessor rewrites, longer lines are passed through unchanged
+#define PREPROCESSOR_MAX_LINE       (256)
+// Most points dropped into one merged move
+#define PREPROCESSOR_MAX_MERGE      (32)
+
+typedef struct {
+    bool dropNoOps;                 ///< Drop moves which do not move any axis
+    bool mergeCollinear;            ///< Merge consecutive moves on one line
+    float mergeTolerance;           ///< mm, furthest a dropped point may be from the merged line
+    bool linearizeArcs;             ///< Replace G2/G3 by G1 chords, otherwise arcs are kept
+    float arcTolerance;             ///< mm, furthest a chord may be from the arc
+    bool dedupeFeedrate;            ///< Drop F words repeating the current feedrate
+} PreprocessorOptions;
+
+typedef struct {
+    uint64_t linesIn;
+    uint64_t linesOut;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint32_t movesDropped;
+    uint32_t movesMerged;
+    uint32_t arcsLinearized;
+    uint32_t arcSegments;           ///< G1 lines produced from arcs
+} PreprocessorStats;
+
+/**
+ * Where an output line came from. Feeding the input again from offset, with the machine in the
+ * given state, produces the same output; the first skip lines of it are the ones before this line.
+ */
+typedef struct {
+    int64_t offset;                 ///< Offset of the input line
+    uint32_t skip;                  ///< Earlier output lines of the same input line
+    GcodeMachine machine;           ///< State before the input line
+} GcodeSource;
+
+/**
+ * @brief GcodePreprocessor
+ *
+ * Streaming stage between the G-code file and the transmitter. Every line fed in produces
+ * zero or more output lines: comments are stripped, no-op moves dropped, collinear moves with
+ * the same feedrate and extrusion rate merged and arcs optionally replaced by chords.
+ *
+ * A move is held back until the next line shows it can not be merged, finish() releases it at
+ * the end of the file. Lines are parsed and formatted by hand and the output buffer is reused,
+ * nothing is allocated once the buffer has grown to the longest burst of output.
+ */
+class GcodePreprocessor
+{
+public:
+    GcodePreprocessor();
+
+    void setOptions(const PreprocessorOptions &options);
+    const PreprocessorOptions &getOptions() const;
+    static PreprocessorOptions defaultOptions();
+
+    void reset();
+
+    /**
+     * Starts from the given state instead of the power-on one, used when a job starts mid-file.
+     * Output not read yet and the held move are dropped.
+     */
+    void setMachine(const GcodeMachine &machine);
+
+    /**
+     * Processes one input line, the line end may be included. The offset is only recorded in
+     * the sources of the output lines.
+     */
+    void feed(const char *line, int length, int64_t offset = 0);
+
+    /**
+     * Releases the held move, call at the end of the input.
+     */
+    void finish();
+
+    /**
+     * Returns the next output line without the line end, valid until the next feed().
+     *
+     * @return false if there is no output left.
+     */
+    bool nextLine(const char **text, int *length, GcodeSource *source = nullptr);
+
+    const PreprocessorStats &getStats() const;
+    int64_t bytesSaved() const;
+
+private:
+    void passThrough(const char *text, int length, const GcodeCommand &command);
+    void addMove(const GcodeMove &move);
+    bool canMerge(const GcodeMove &move) const;
+    void flushMove();
+    bool linearizeArc(const GcodeCommand &command, const float *from, const float *to);
+    void emitMove(const float *from, const float *to, float feedrate, bool rapid, const GcodeSource &source);
+    void emitLine(const char *text, int length, const GcodeSource &source);
+
+    PreprocessorOptions options;
+    PreprocessorStats stats;
+    GcodeMachine machine;
+
+    bool held;                      ///< heldMove waits for the next line
+    GcodeMove heldMove;
+    GcodeSource heldSource;
+    float heldPoints[PREPROCESSOR_MAX_MERGE][3];    ///< Points merged into heldMove
+    int heldCount;
+
+    float emittedFeedrate;          ///< Last F sent, mm/s, negative before the first one
+    bool feedratePending;           ///< The printer may not have the feedrate of the machine (dropped F-only move, new start state)
+
+    GcodeSource lineSource;         ///< Source of the line being fed
+    std::string output;
+    std::vector<GcodeSource> sources;   ///< Source of every output line
+    size_t readPos;
+    size_t readLines;
+    int64_t lastOffset;             ///< Source of the last line emitted
+    int64_t lastSkip;               ///< Its skip, negative before the first line
+};
+
+#endif // GCODEPREPROCESSOR_H
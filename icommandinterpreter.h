@@ -8,7 +8,7 @@ class ICommandInterpreter
 public:
     ICommandInterpreter();
     virtual ~ICommandInterpreter();
-    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint8_t len_payload) = 0;
+    virtual bool commandProceed(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload) = 0;
 };
 
 #endif // ICOMMANDINTERPRETER_H
@@ -10,6 +10,7 @@ public:
 
     virtual void sendByte(char c) = 0;
     virtual int transmitSpace() = 0;
+    virtual void transmitFinished() = 0;
 };
 
 #endif // ISERIALCOMMUNICATION_H
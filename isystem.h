@@ -9,6 +9,7 @@ public:
     virtual ~ISystem();
 
     virtual int getCurrentTimeInMs() = 0;
+    virtual int getCurrentTimeInUs() = 0;
 };
 
 #endif // ISYSTEM_H
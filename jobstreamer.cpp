@@ -0,0 +1,750 @@
+#include "jobstreamer.h"
+#include <QDebug>
+#include <string.h>
+#include <math.h>
+
+JobStreamer::JobStreamer(MinProtocol *protocol, CommandInterpreter *cmd, QObject *parent) :
+    QObject(parent),
+    protocol(protocol),
+    cmd(cmd)
+{
+    lineReady = false;
+    running = false;
+    paused = false;
+    targetFill = STREAMER_DEFAULT_TARGET_FILL;
+    commandId = 0;
+    lastPlannerReport = 0;
+    plannerReported = false;
+    firstStarvationCount = 0;
+    compressedInStart = 0;
+    compressedOutStart = 0;
+    memset(&stats, 0, sizeof(stats));
+    hostPlanning = false;
+    lineIsMove = false;
+    segmentCount = 0;
+    segmentIndex = 0;
+    preprocessing = false;
+    preprocessorFinished = false;
+    inFlightHead = 0;
+    inFlightCount = 0;
+    plannedHead = 0;
+    plannedCount = 0;
+    suspended = false;
+    resumeAtEnd = false;
+    resumeOffset = 0;
+    resumeSkip = 0;
+}
+
+JobStreamer::~JobStreamer()
+{
+    file.close();
+}
+
+bool JobStreamer::start(const QString &fileName, const GcodeIndexEntry *from)
+{
+    if(running)
+    {
+        qDebug() << "Error: Job already running\n";
+        return false;
+    }
+
+    file.setFileName(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Error: Nie można otworzyć pliku G-code: " << fileName << "\n";
+        return false;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    compressedInStart = protocol->min_compressed_bytes_in();
+    compressedOutStart = protocol->min_compressed_bytes_out();
+    lineReady = false;
+    paused = false;
+    running = true;
+    suspended = false;
+    resumeAtEnd = false;
+    resumeSkip = 0;
+    inFlightCount = 0;
+    plannedCount = 0;
+
+    machine.reset();
+    planner.reset(machine.getPosition());
+    segmentCount = 0;
+    segmentIndex = 0;
+
+    preprocessor.reset();
+    preprocessorFinished = false;
+    preamble.clear();
+
+    if(from)
+    {
+        if(!file.seek(from->offset))
+        {
+            qDebug() << "Error: Nie można przejść do pozycji w pliku: " << from->offset << "\n";
+            file.close();
+            running = false;
+            return false;
+        }
+
+        /* Stan drukarki z punktu kontrolnego */
+        machine.setState(from->position, from->feedrate, from->relative, from->relativeExtrusion);
+        planner.reset(machine.getPosition());
+        preprocessor.setMachine(machine);
+
+        StreamCheckpoint point;
+        point.source.offset = from->offset;
+        point.source.skip = 0;
+        point.source.machine = machine;
+        point.printer = machine;
+        queuePreamble(point);
+    }
+
+    /* Raport sprzed rozpoczęcia zadania nie mówi nic o nowych komendach */
+    lastPlannerReport = cmd->getState().planner_reports;
+    plannerReported = false;
+    emit pumpNeeded();
+    return true;
+}
+
+void JobStreamer::stop()
+{
+    running = false;
+    suspended = false;
+    lineReady = false;
+    file.close();
+}
+
+/**
+ * @brief JobStreamer::fail
+ *
+ * Ends the job instead of sending it with a command missing, the printer keeps what it already received.
+ */
+void JobStreamer::fail(const QString &reason)
+{
+    qWarning() << "Job failed:" << reason;
+    stop();
+    emit failed(reason);
+}
+
+/**
+ * @brief JobStreamer::queuePreamble
+ *
+ * Restores the modes and the E position of the checkpoint on the printer before the file continues.
+ */
+void JobStreamer::queuePreamble(const StreamCheckpoint &point)
+{
+    const GcodeMachine &state = point.printer;
+    preamble.clear();
+    preamble.append(state.isRelative() ? "G91" : "G90");
+    preamble.append(state.isRelativeExtrusion() ? "M83" : "M82");
+    preamble.append("G92 E" + QByteArray::number(state.getPosition()[GCODE_E], 'f', 5));
+    preamblePoint = point;
+}
+
+/**
+ * @brief JobStreamer::recordSent
+ *
+ * Keeps the checkpoint of a command just queued until the printer ACKs it. The senders check
+ * transportHasRoom() before queueing, so the table has room. Without it the checkpoint of the
+ * oldest command not ACKed would be lost and a resume would start from the wrong line, so the
+ * job fails instead.
+ * @return false if the table was full and the job failed
+ */
+bool JobStreamer::recordSent(const StreamCheckpoint &checkpoint)
+{
+    if(inFlightCount >= STREAMER_MAX_IN_FLIGHT)
+    {
+        fail("Too many commands in flight");
+        return false;
+    }
+    InFlightCommand &command = inFlight[(inFlightHead + inFlightCount) % STREAMER_MAX_IN_FLIGHT];
+    command.queued = protocol->min_queue_queued_count(TRANSPORT_LANE_BULK);
+    command.checkpoint = checkpoint;
+    inFlightCount++;
+    return true;
+}
+
+/**
+ * @brief JobStreamer::trackAcks
+ *
+ * Drops the commands whose frames the printer has ACKed, frames of a lane are ACKed in order.
+ */
+void JobStreamer::trackAcks()
+{
+    uint32_t acked = protocol->min_queue_acked_count(TRANSPORT_LANE_BULK);
+    while(inFlightCount > 0 && static_cast<int32_t>(acked - inFlight[inFlightHead].queued) >= 0)
+    {
+        inFlightHead = (inFlightHead + 1) % STREAMER_MAX_IN_FLIGHT;
+        inFlightCount--;
+    }
+}
+
+/**
+ * @brief JobStreamer::suspend
+ *
+ * Called when the link is lost. Finds the first command the printer has not received,
+ * the job continues from it in resumeAfterReconnect().
+ * @return false if no job is running
+ */
+bool JobStreamer::suspend()
+{
+    if(!running)
+        return false;
+    if(suspended)
+        return true;
+
+    trackAcks();
+    resumeAtEnd = false;
+    if(inFlightCount > 0)
+        resumePoint = inFlight[inFlightHead].checkpoint;
+    else if(plannedCount > 0)
+        resumePoint = planned[plannedHead];
+    else if(lineReady || readLine())
+        resumePoint = lineCheckpoint;
+    else
+        resumeAtEnd = true;
+
+    suspended = true;
+    qDebug() << "Info: Job suspended, resume offset:" << (resumeAtEnd ? -1 : resumePoint.source.offset)
+             << "skip:" << (resumeAtEnd ? 0U : resumePoint.source.skip) << "\n";
+    return true;
+}
+
+/**
+ * @brief JobStreamer::resumeAfterReconnect
+ *
+ * The transport must already be reset. Everything after the resume point is read from the
+ * file again, output of the preprocessor the printer already has is skipped.
+ * @return false if there is nothing to resume
+ */
+bool JobStreamer::resumeAfterReconnect()
+{
+    if(!running || !suspended)
+        return false;
+
+    suspended = false;
+    stats.resumes++;
+    inFlightCount = 0;
+
+    /* Numeracja po stronie drukarki mogła się zmienić, czekamy na nowy raport */
+    lastPlannerReport = cmd->getState().planner_reports;
+    plannerReported = false;
+
+    if(resumeAtEnd)
+        return true;
+
+    if(!file.seek(resumePoint.source.offset))
+    {
+        qDebug() << "Error: Nie można przejść do pozycji w pliku: " << resumePoint.source.offset << "\n";
+        fail("Seek to the resume point failed");
+        return false;
+    }
+
+    lineReady = false;
+    machine = resumePoint.printer;
+    planner.reset(machine.getPosition());
+    plannedCount = 0;
+    segmentCount = 0;
+    segmentIndex = 0;
+
+    preprocessor.setMachine(resumePoint.source.machine);
+    preprocessorFinished = false;
+    resumeOffset = resumePoint.source.offset;
+    resumeSkip = resumePoint.source.skip;
+
+    queuePreamble(resumePoint);
+    return true;
+}
+
+bool JobStreamer::isSuspended() const
+{
+    return suspended;
+}
+
+/**
+ * @brief JobStreamer::queueRealtime
+ *
+ * Queues a command on the realtime lane, it overtakes the lines not sent yet.
+ * @return false if the realtime lane is full
+ */
+template <class Message>
+bool JobStreamer::queueRealtime(const Message &msg)
+{
+    if(!protocol->min_queue_message(msg, TRANSPORT_LANE_REALTIME))
+    {
+        qWarning() << "Realtime command not queued, min_id:" << static_cast<int>(Message::id);
+        return false;
+    }
+    emit pumpNeeded();
+    return true;
+}
+
+/**
+ * @brief JobStreamer::pause
+ *
+ * Stops sending lines and tells the printer to stop, without waiting for the commands it has buffered.
+ */
+void JobStreamer::pause()
+{
+    paused = true;
+    queueRealtime(MsgPause());
+}
+
+void JobStreamer::resume()
+{
+    paused = false;
+    /* Najpierw wznowienie, kolejne linie wyjdą za nim */
+    queueRealtime(MsgResume());
+    emit pumpNeeded();
+}
+
+/**
+ * @brief JobStreamer::emergencyStop
+ *
+ * Stops the printer at once and ends the job, the firmware ignores everything after it until it is reset.
+ * @return false if the command could not be queued
+ */
+bool JobStreamer::emergencyStop()
+{
+    bool queued = queueRealtime(MsgEmergencyStop());
+    if(running)
+        fail("Emergency stop");
+    return queued;
+}
+
+/**
+ * @brief JobStreamer::setFeedOverride
+ *
+ * Feed rate of the printer in percent of the programmed one, applies to the commands already buffered.
+ */
+bool JobStreamer::setFeedOverride(uint16_t percent)
+{
+    MsgFeedOverride msg;
+    msg.percent = percent;
+    return queueRealtime(msg);
+}
+
+bool JobStreamer::isRunning() const
+{
+    return running;
+}
+
+bool JobStreamer::isPaused() const
+{
+    return paused;
+}
+
+void JobStreamer::setTargetFill(uint8_t percent)
+{
+    targetFill = qBound<uint8_t>(1, percent, 100);
+}
+
+/**
+ * @brief JobStreamer::setHostPlanning
+ *
+ * The firmware has to understand MSG_SEGMENT, the acceleration must match its setting.
+ * @return false while a job is running
+ */
+bool JobStreamer::setHostPlanning(bool enable, const PlannerConfig &config)
+{
+    if(running)
+    {
+        qDebug() << "Error: Host planning can not be changed during a job\n";
+        return false;
+    }
+    hostPlanning = enable;
+    planner.setConfig(config);
+    return true;
+}
+
+bool JobStreamer::isHostPlanning() const
+{
+    return hostPlanning;
+}
+
+/**
+ * @brief JobStreamer::setPreprocessing
+ *
+ * @return false while a job is running
+ */
+bool JobStreamer::setPreprocessing(bool enable, const PreprocessorOptions &options)
+{
+    if(running)
+    {
+        qDebug() << "Error: Preprocessing can not be changed during a job\n";
+        return false;
+    }
+    preprocessing = enable;
+    preprocessor.setOptions(options);
+    return true;
+}
+
+bool JobStreamer::isPreprocessing() const
+{
+    return preprocessing;
+}
+
+PreprocessorStats JobStreamer::getPreprocessorStats() const
+{
+    return preprocessor.getStats();
+}
+
+StreamerStats JobStreamer::getStats() const
+{
+    StreamerStats s = stats;
+    s.compressedIn = protocol->min_compressed_bytes_in() - compressedInStart;
+    s.compressedOut = protocol->min_compressed_bytes_out() - compressedOutStart;
+    s.realtimeLatencyMs = protocol->min_queue_worst_latency_ms(TRANSPORT_LANE_REALTIME);
+    return s;
+}
+
+/**
+ * @brief JobStreamer::getBufferBytes
+ *
+ * Capacity of the line buffers outside the object, the buffer of the open file is not included.
+ */
+int JobStreamer::getBufferBytes() const
+{
+    int bytes = line.capacity();
+    for(int i = 0; i < preamble.size(); i++)
+        bytes += preamble.at(i).capacity();
+    return bytes;
+}
+
+/**
+ * @brief JobStreamer::readLine
+ *
+ * Reads the next line which has to be sent, comments and empty lines are skipped.
+ * @return false at the end of the file
+ */
+bool JobStreamer::readLine()
+{
+    while(!preamble.isEmpty())
+    {
+        line = preamble.takeFirst();
+        lineCheckpoint = preamblePoint;
+        if(acceptLine())
+            return true;
+        if(!running)
+            return false;
+    }
+
+    if(preprocessing)
+    {
+        while(true)
+        {
+            const char *text;
+            int length;
+            if(preprocessor.nextLine(&text, &length, &lineCheckpoint.source))
+            {
+                if(resumeSkip > 0 && lineCheckpoint.source.offset == resumeOffset)
+                {
+                    /* Tę część linii drukarka już otrzymała */
+                    resumeSkip--;
+                    continue;
+                }
+                line = QByteArray(text, length);
+                if(acceptLine())
+                    return true;
+                if(!running)
+                    return false;
+                continue;
+            }
+
+            if(!file.atEnd())
+            {
+                qint64 offset = file.pos();
+                QByteArray raw = file.readLine();
+                preprocessor.feed(raw.constData(), raw.size(), offset);
+            }
+            else if(!preprocessorFinished)
+            {
+                /* Wstrzymany ruch wychodzi na końcu pliku */
+                preprocessor.finish();
+                preprocessorFinished = true;
+                const PreprocessorStats &pre = preprocessor.getStats();
+                qDebug() << "Info: Preprocessor lines in:" << pre.linesIn << "out:" << pre.linesOut
+                         << "bytes saved:" << preprocessor.bytesSaved() << "\n";
+            }
+            else
+            {
+                return false;
+            }
+        }
+    }
+
+    while(!file.atEnd())
+    {
+        lineCheckpoint.source.offset = file.pos();
+        lineCheckpoint.source.skip = 0;
+        lineCheckpoint.source.machine = machine;
+        line = file.readLine();
+
+        int comment = line.indexOf(';');
+        if(comment >= 0)
+            line.truncate(comment);
+        line = line.trimmed();
+
+        if(acceptLine())
+            return true;
+        if(!running)
+            return false;
+    }
+    return false;
+}
+
+/**
+ * @brief JobStreamer::acceptLine
+ *
+ * Checks the stripped line and prepares it for sending. A line which does not fit in a frame
+ * fails the job, the print would be wrong without it.
+ * @return false if the line is skipped or the job failed
+ */
+bool JobStreamer::acceptLine()
+{
+    if(line.isEmpty())
+        return false;
+
+    if(line.size() > static_cast<int>(MAX_PAYLOAD - MsgGcodeLine::wire_size))
+    {
+        fail("G-code line too long: " + QString::fromLatin1(line.left(40)));
+        return false;
+    }
+
+    /* Stan maszyny jest aktualizowany raz, przy wczytaniu linii */
+    lineCheckpoint.printer = machine;
+    lineIsMove = false;
+    GcodeCommand command;
+    if(GcodeParser::parse(line.constData(), line.size(), &command))
+        lineIsMove = machine.apply(command, &move);
+
+    if(hostPlanning && lineIsMove && memcmp(move.from, move.to, sizeof(move.from)) == 0)
+    {
+        /* Ruch bez przemieszczenia, np. sama zmiana F - segmenty niosą własne prędkości */
+        return false;
+    }
+
+    lineReady = true;
+    return true;
+}
+
+void JobStreamer::checkPlannerReport()
+{
+    const PrinterState &state = cmd->getState();
+    if(state.planner_reports == lastPlannerReport)
+        return;
+    lastPlannerReport = state.planner_reports;
+
+    if(state.planner.total_slots == 0)
+        return;
+
+    if(!plannerReported)
+    {
+        plannerReported = true;
+        firstStarvationCount = state.planner.starvation_count;
+    }
+
+    stats.plannerReports++;
+    stats.deviceStarvations = static_cast<uint16_t>(state.planner.starvation_count - firstStarvationCount);
+
+    /* Pusty bufor drukarki gdy mamy jeszcze co wysłać oznacza zatrzymanie ruchu */
+    if(stats.linesSent > 0 && state.planner.free_slots >= state.planner.total_slots && (lineReady || !file.atEnd()))
+        stats.plannerStarvations++;
+}
+
+/**
+ * @brief JobStreamer::deviceHasRoom
+ *
+ * The report says how many slots were free when the firmware had received command_id.
+ * Commands sent after it are assumed to take a slot each.
+ */
+bool JobStreamer::deviceHasRoom()
+{
+    if(!plannerReported)
+        return true;
+
+    const MsgPlanner &planner = cmd->getState().planner;
+    int unreported = static_cast<uint16_t>(commandId - planner.command_id);
+    int estimatedFree = static_cast<int>(planner.free_slots) - unreported;
+    int fill = static_cast<int>(planner.total_slots) - estimatedFree;
+    int target = qMax(1, planner.total_slots * targetFill / 100);
+
+    return fill < target;
+}
+
+/**
+ * @brief JobStreamer::transportHasRoom
+ *
+ * The MIN queue takes a frame of len bytes and the command can be kept until it is ACKed.
+ * Batches put many commands in a frame, so the frames in the queue don't bound the commands.
+ */
+bool JobStreamer::transportHasRoom(uint16_t len)
+{
+    return inFlightCount < STREAMER_MAX_IN_FLIGHT && protocol->min_queue_has_space_for_frame(len);
+}
+
+/**
+ * @brief JobStreamer::sendSegment
+ *
+ * Queues the next planned segment.
+ * @return false if held by the flow control or the transport, or if the job failed
+ */
+bool JobStreamer::sendSegment()
+{
+    if(!deviceHasRoom())
+    {
+        stats.heldByFlowControl++;
+        return false;
+    }
+
+    if(!transportHasRoom(static_cast<uint16_t>(MsgSegment::wire_size)))
+    {
+        stats.heldByTransport++;
+        return false;
+    }
+
+    const PlannedSegment &segment = segments[segmentIndex];
+    MsgSegment msg;
+    msg.command_id = static_cast<uint16_t>(commandId + 1U);
+    msg.x = static_cast<int32_t>(lroundf(segment.target[GCODE_X] * 1000.0f));
+    msg.y = static_cast<int32_t>(lroundf(segment.target[GCODE_Y] * 1000.0f));
+    msg.z = static_cast<int32_t>(lroundf(segment.target[GCODE_Z] * 1000.0f));
+    msg.e = static_cast<int32_t>(lroundf(segment.target[GCODE_E] * 1000.0f));
+    msg.entry_speed = static_cast<uint32_t>(lroundf(segment.entrySpeed * 1000.0f));
+    msg.cruise_speed = static_cast<uint32_t>(lroundf(segment.cruiseSpeed * 1000.0f));
+    msg.exit_speed = static_cast<uint32_t>(lroundf(segment.exitSpeed * 1000.0f));
+    msg.acceleration = static_cast<uint32_t>(lroundf(planner.getConfig().acceleration * 1000.0f));
+    msg.accel_distance = static_cast<uint32_t>(lroundf(segment.accelDistance * 1000.0f));
+    msg.decel_distance = static_cast<uint32_t>(lroundf(segment.decelDistance * 1000.0f));
+    if(!protocol->min_queue_message(msg))
+    {
+        /* Segment zostaje na następne wywołanie */
+        stats.heldByTransport++;
+        return false;
+    }
+    if(!recordSent(planned[plannedHead]))
+        return false;
+    plannedHead = (plannedHead + 1) % STREAMER_MAX_PLANNED;
+    plannedCount--;
+
+    commandId++;
+    segmentIndex++;
+    stats.segmentsSent++;
+    return true;
+}
+
+/**
+ * @brief JobStreamer::pump
+ *
+ * Queues as many lines as the flow control allows, called from the link poll.
+ */
+void JobStreamer::pump()
+{
+    if(!running || paused || suspended)
+        return;
+
+    checkPlannerReport();
+    trackAcks();
+
+    bool sent = false;
+    while(true)
+    {
+        /* Zaplanowane segmenty poprzedzają bieżącą linię */
+        if(segmentIndex == segmentCount && hostPlanning)
+        {
+            segmentCount = planner.takeReady(segments, PLANNER_BATCH);
+            segmentIndex = 0;
+        }
+        if(segmentIndex < segmentCount)
+        {
+            if(!sendSegment())
+            {
+                /* Zadanie przerwane przy wysyłaniu segmentu */
+                if(!running)
+                    return;
+                break;
+            }
+            sent = true;
+            continue;
+        }
+
+        if(!lineReady && !readLine())
+        {
+            /* Zadanie przerwane przy wczytywaniu linii */
+            if(!running)
+                return;
+
+            if(hostPlanning && planner.pending() > 0)
+            {
+                /* Ostatni ruch kończy się zatrzymaniem */
+                planner.flush();
+                continue;
+            }
+
+            /* Koniec pliku */
+            running = false;
+            file.close();
+            StreamerStats s = getStats();
+            qDebug() << "Info: Job finished, lines:" << s.linesSent
+                     << "segments:" << s.segmentsSent
+                     << "planner starvations:" << s.plannerStarvations
+                     << "device starvations:" << s.deviceStarvations
+                     << "compressed:" << s.compressedIn << "->" << s.compressedOut
+                     << "window:" << static_cast<int>(protocol->min_window()) << "round trip:" << protocol->min_round_trip_ms() << "ms"
+                     << "realtime latency:" << s.realtimeLatencyMs << "ms\n";
+            emit finished();
+            return;
+        }
+
+        if(hostPlanning)
+        {
+            if(lineIsMove)
+            {
+                if(planner.addMove(move))
+                {
+                    planned[(plannedHead + plannedCount) % STREAMER_MAX_PLANNED] = lineCheckpoint;
+                    plannedCount++;
+                    lineReady = false;
+                }
+                continue;
+            }
+            if(planner.pending() > 0)
+            {
+                /* Inna komenda: najpierw wysyłamy cały zaplanowany ruch */
+                planner.flush();
+                continue;
+            }
+        }
+
+        if(!deviceHasRoom())
+        {
+            stats.heldByFlowControl++;
+            break;
+        }
+
+        if(!transportHasRoom(static_cast<uint16_t>(MsgGcodeLine::wire_size + line.size())))
+        {
+            stats.heldByTransport++;
+            break;
+        }
+
+        MsgGcodeLine msg;
+        msg.command_id = static_cast<uint16_t>(commandId + 1U);
+        if(!protocol->min_queue_message(msg, reinterpret_cast<const uint8_t *>(line.constData()), static_cast<uint16_t>(line.size())))
+        {
+            /* Linia zostaje gotowa na następne wywołanie */
+            stats.heldByTransport++;
+            break;
+        }
+        if(!recordSent(lineCheckpoint))
+            return;
+
+        commandId++;
+        lineReady = false;
+        stats.linesSent++;
+        sent = true;
+    }
+
+    if(sent)
+        emit progress(file.pos(), file.size());
+}
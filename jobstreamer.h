@@ -0,0 +1,179 @@
+#ifndef JOBSTREAMER_H
+#define JOBSTREAMER_H
+
+#include <QObject>
+#include <QFile>
+#include <QByteArray>
+#include <QList>
+#include "min.h"
+#include "commandinterpreter.h"
+#include "gcodeparser.h"
+#include "motionplanner.h"
+#include "gcodepreprocessor.h"
+#include "gcodeindex.h"
+
+// Default fill level of the firmware command buffer the streamer tries to keep, in percent. The
+// estimate counts every command sent after the report as a taken slot, so a full buffer is not overfilled
+#define STREAMER_DEFAULT_TARGET_FILL    (100U)
+// Sent commands kept until the transport ACKs them, no more are sent until some are ACKed
+#define STREAMER_MAX_IN_FLIGHT          (256)
+// Moves in the host planner or taken from it and not sent yet
+#define STREAMER_MAX_PLANNED            (PLANNER_CAPACITY + PLANNER_BATCH)
+
+typedef struct {
+    quint32 linesSent;
+    quint32 segmentsSent;            ///< MSG_SEGMENT frames sent in the host planning mode
+    quint32 plannerReports;
+    quint32 plannerStarvations;      ///< Reports of an empty planner while the streamer had more to send
+    quint32 deviceStarvations;       ///< Starvations counted by the firmware since the job started
+    quint32 heldByFlowControl;       ///< Pumps which did not send because the device buffer was at the target
+    quint32 heldByTransport;         ///< Pumps which did not send because the MIN queue was full
+    quint32 resumes;                 ///< Resumes after the link was lost
+    quint32 compressedIn;            ///< Payload bytes of the job sent compressed
+    quint32 compressedOut;           ///< What they were compressed to
+    quint32 realtimeLatencyMs;       ///< Longest a realtime command waited for the wire, over the life of the link
+} StreamerStats;
+
+/**
+ * Everything needed to send a command again: where to read it from and the printer state before it.
+ */
+typedef struct {
+    GcodeSource source;
+    GcodeMachine printer;
+} StreamCheckpoint;
+
+typedef struct {
+    uint32_t queued;                 ///< min_queue_queued_count() of the bulk lane right after queueing
+    StreamCheckpoint checkpoint;
+} InFlightCommand;
+
+/**
+ * @brief JobStreamer
+ *
+ * Sends a G-code file line by line as MSG_GCODE_LINE frames.
+ *
+ * When the firmware reports the state of its command/planner buffer (MSG_PLANNER) the streamer
+ * keeps the buffer at the target fill level: enough queued to never starve on short segments,
+ * but not so much that frames wait in the MIN window and get retransmitted. Firmware which does
+ * not report is fed as fast as the MIN window allows.
+ *
+ * In the host planning mode G0/G1 lines are not sent as text: they go through the MotionPlanner
+ * and the firmware receives ready trapezoids (MSG_SEGMENT) so it does not have to plan them.
+ * Any other command first drains the planner, the path stops there as it would on the printer.
+ *
+ * With preprocessing enabled the file goes through the GcodePreprocessor first, which removes
+ * what would only waste the link (no-op moves, repeated feedrates, collinear pieces).
+ *
+ * A job can start at any checkpoint of the GcodeIndex: the file is seeked to it and the modes and
+ * the E position of the checkpoint are restored on the printer before the first line.
+ *
+ * Every command keeps its checkpoint until the MIN transport ACKs its frame. When the link is lost
+ * suspend() remembers the first command the printer has not received, resumeAfterReconnect() sends
+ * the job again from exactly that command once the transport was reset.
+ *
+ * Pause, resume, feed-rate override and emergency stop go to the printer on the realtime lane of
+ * the transport, ahead of the G-code still waiting in the bulk lane.
+ */
+class JobStreamer : public QObject
+{
+    Q_OBJECT
+
+public:
+    JobStreamer(MinProtocol *protocol, CommandInterpreter *cmd, QObject *parent = nullptr);
+    ~JobStreamer();
+
+    bool start(const QString &fileName, const GcodeIndexEntry *from = nullptr);
+    void stop();
+    void pause();
+    void resume();
+    bool emergencyStop();
+    bool setFeedOverride(uint16_t percent);
+    bool isRunning() const;
+    bool isPaused() const;
+
+    bool suspend();
+    bool resumeAfterReconnect();
+    bool isSuspended() const;
+
+    void setTargetFill(uint8_t percent);
+    bool setHostPlanning(bool enable, const PlannerConfig &config);
+    bool isHostPlanning() const;
+    bool setPreprocessing(bool enable, const PreprocessorOptions &options);
+    bool isPreprocessing() const;
+    PreprocessorStats getPreprocessorStats() const;
+    StreamerStats getStats() const;
+    int getBufferBytes() const;
+
+    void pump();
+
+signals:
+    void progress(qint64 sentBytes, qint64 totalBytes);
+    void finished();
+    /** The job was stopped because it can not be sent as it is, or by an emergency stop */
+    void failed(const QString &reason);
+    /** Started or resumed, pump() has lines to send, or a realtime command was queued */
+    void pumpNeeded();
+
+private:
+    bool readLine();
+    bool acceptLine();
+    void checkPlannerReport();
+    bool deviceHasRoom();
+    bool transportHasRoom(uint16_t len);
+    bool sendSegment();
+    void queuePreamble(const StreamCheckpoint &point);
+    bool recordSent(const StreamCheckpoint &checkpoint);
+    void trackAcks();
+    void fail(const QString &reason);
+    template <class Message>
+    bool queueRealtime(const Message &msg);
+
+    MinProtocol *protocol;
+    CommandInterpreter *cmd;
+    QFile file;
+    QByteArray line;
+    QList<QByteArray> preamble;      ///< Lines sent before the file when starting mid-file
+    StreamCheckpoint preamblePoint;  ///< Where the file continues after the preamble
+    StreamCheckpoint lineCheckpoint; ///< Checkpoint of the ready line
+    bool lineReady;
+    bool running;
+    bool paused;
+    uint8_t targetFill;
+    uint16_t commandId;              ///< Id of the last sent command
+    uint32_t lastPlannerReport;
+    bool plannerReported;
+    uint16_t firstStarvationCount;
+    uint32_t compressedInStart;      ///< Compression counters of the MIN context when the job started
+    uint32_t compressedOutStart;
+    StreamerStats stats;
+
+    /* Planowanie ruchu po stronie hosta */
+    bool hostPlanning;
+    bool lineIsMove;
+    GcodeMove move;
+    GcodeMachine machine;
+    MotionPlanner planner;
+    PlannedSegment segments[PLANNER_BATCH];
+    int segmentCount;
+    int segmentIndex;
+
+    /* Wstępne przetwarzanie G-code przed wysłaniem */
+    bool preprocessing;
+    bool preprocessorFinished;
+    GcodePreprocessor preprocessor;
+
+    /* Wznowienie po utracie połączenia */
+    InFlightCommand inFlight[STREAMER_MAX_IN_FLIGHT];
+    int inFlightHead;
+    int inFlightCount;
+    StreamCheckpoint planned[STREAMER_MAX_PLANNED];    ///< Checkpoints of the moves given to the planner
+    int plannedHead;
+    int plannedCount;
+    bool suspended;
+    bool resumeAtEnd;                ///< Everything was ACKed before the link was lost
+    StreamCheckpoint resumePoint;
+    int64_t resumeOffset;
+    uint32_t resumeSkip;             ///< Preprocessor output of resumeOffset the printer already has
+};
+
+#endif // JOBSTREAMER_H
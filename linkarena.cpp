@@ -0,0 +1,80 @@
+#include "linkarena.h"
+#include <QDebug>
+#include <stdlib.h>
+#include <string.h>
+
+LinkArena::LinkArena(quint32 capacity)
+{
+    /* malloc wyrównuje do max_align_t, tak jak ARENA_ALIGNMENT */
+    block = static_cast<char *>(malloc(capacity));
+    this->capacity = block ? capacity : 0;
+    used = 0;
+    count = 0;
+}
+
+LinkArena::~LinkArena()
+{
+    clear();
+    free(block);
+}
+
+/**
+ * @brief LinkArena::allocate
+ *
+ * Takes the next bytes of the block.
+ * @return nullptr if the block or the entries are used up.
+ */
+void *LinkArena::allocate(quint32 bytes, const char *name)
+{
+    quint32 size = aligned(bytes);
+    if(count == ARENA_MAX_ENTRIES || size > capacity - used)
+    {
+        qWarning() << "Link arena full, can not allocate" << bytes << "bytes for" << name;
+        return nullptr;
+    }
+
+    Entry &entry = entries[count++];
+    entry.memory = block + used;
+    entry.destroy = nullptr;
+    entry.name = name;
+    entry.bytes = size;
+    used += size;
+    return entry.memory;
+}
+
+/**
+ * @brief LinkArena::clear
+ *
+ * Destroys the objects, the last created first, and empties the arena.
+ */
+void LinkArena::clear()
+{
+    while(count > 0)
+    {
+        Entry &entry = entries[--count];
+        if(entry.destroy)
+            entry.destroy(entry.memory);
+    }
+    used = 0;
+}
+
+quint32 LinkArena::getCapacity() const
+{
+    return capacity;
+}
+
+quint32 LinkArena::getUsed() const
+{
+    return used;
+}
+
+quint32 LinkArena::bytesOf(const char *name) const
+{
+    quint32 bytes = 0;
+    for(int i = 0; i < count; i++)
+    {
+        if(strcmp(entries[i].name, name) == 0)
+            bytes += entries[i].bytes;
+    }
+    return bytes;
+}
@@ -0,0 +1,82 @@
+#ifndef LINKARENA_H
+#define LINKARENA_H
+
+#include <QtGlobal>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// Every allocation starts at this alignment, enough for any member of the link state
+#define ARENA_ALIGNMENT         (alignof(std::max_align_t))
+// Most allocations of one arena
+#define ARENA_MAX_ENTRIES       (16)
+
+/**
+ * @brief LinkArena
+ *
+ * A single block for the state of one printer link, allocated once with its final size. Objects
+ * are placed in it one after another, so the state of a link lies together in memory and nothing
+ * of it is freed or allocated while the link runs.
+ *
+ * Objects made with create() are destroyed by clear() or the destructor in the reverse order of
+ * their creation, memory from allocate() is only given back with the block. Objects in the arena
+ * must not have a QObject parent, the parent would delete them.
+ *
+ * Every allocation carries a name, bytesOf() sums them for the footprint of the link.
+ */
+class LinkArena
+{
+public:
+    explicit LinkArena(quint32 capacity);
+    ~LinkArena();
+
+    void *allocate(quint32 bytes, const char *name);
+    void clear();
+
+    template <class T, class... Args>
+    T *create(const char *name, Args&&... args)
+    {
+        void *memory = allocate(sizeof(T), name);
+        if(!memory)
+            return nullptr;
+        T *object = new (memory) T(std::forward<Args>(args)...);
+        entries[count - 1].destroy = &destroy<T>;
+        return object;
+    }
+
+    quint32 getCapacity() const;
+    quint32 getUsed() const;
+    quint32 bytesOf(const char *name) const;
+
+    /**
+     * Space an allocation of the given size takes in the arena.
+     */
+    static quint32 aligned(quint32 bytes)
+    {
+        return (bytes + static_cast<quint32>(ARENA_ALIGNMENT) - 1U) & ~(static_cast<quint32>(ARENA_ALIGNMENT) - 1U);
+    }
+
+private:
+    Q_DISABLE_COPY(LinkArena)
+
+    template <class T>
+    static void destroy(void *object)
+    {
+        static_cast<T *>(object)->~T();
+    }
+
+    typedef struct {
+        void *memory;
+        void (*destroy)(void *);    ///< Destructor of an object from create(), nullptr for raw memory
+        const char *name;
+        quint32 bytes;              ///< Aligned size
+    } Entry;
+
+    char *block;
+    quint32 capacity;
+    quint32 used;
+    Entry entries[ARENA_MAX_ENTRIES];
+    int count;
+};
+
+#endif // LINKARENA_H
@@ -4,6 +4,8 @@
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+    a.setOrganizationName("NESTIMO");
+    a.setApplicationName("print_server");
     MainWindow w;
     w.show();
 
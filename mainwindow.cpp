@@ -1,8 +1,13 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include"QMessageBox"
-#include "min.h"
 #include "types.h"
+#include <QSettings>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QPushButton>
+#include <QCheckBox>
+#include <QFileDialog>
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -10,15 +15,84 @@ MainWindow::MainWindow(QWidget *parent) :
 {
     ui->setupUi(this);
 
+    /* Rejestr portów szeregowych, skanuje w tle i śledzi podłączanie urządzeń */
+    registry = new PortRegistry(this);
+
     /* Utwórz okno konfiguracji RS232 */
-    configure_window = new ConfigureWindow();
+    configure_window = new ConfigureWindow(registry);
     connect(configure_window,SIGNAL(ConfigureResponse(SerialStruct)),this,SLOT(ConfigureResponse(SerialStruct)));
 
-    /* Utórz interfejs komunikacyjny */
-    communication = new Communication();
+    /* Utórz interfejs komunikacyjny wraz z protokołem MIN */
+    link = new PrinterLink(this);
+    link->setPortRegistry(registry);
+    communication = link->getCommunication();
     connect(communication, SIGNAL(communicationError()), this, SLOT(communicationError()));
 
-    protocol = new MinProtocol(communication, &system, &cmd);
+    /* Zadania przydzielane drukarkom, na razie jedna */
+    scheduler = new FarmScheduler(this);
+    farmPrinter = scheduler->addPrinter(link, link->getCapabilities());
+
+    /* Telemetria drukarek dla paneli i klientów WebSocket */
+    QSettings settings;
+    telemetry = new TelemetryBus(this);
+    telemetry->setRate(settings.value("telemetry/rate", TELEMETRY_DEFAULT_RATE_HZ).toInt());
+
+    /* Historia telemetrii w pamięci, okresy przechowywania w sekundach */
+    history = new TelemetryStore();
+    history->setRetention(settings.value("telemetry/rawRetention", TSTORE_RAW_RETENTION / 1000).toLongLong() * 1000,
+                          settings.value("telemetry/secondRetention", TSTORE_SECOND_RETENTION / 1000).toLongLong() * 1000,
+                          settings.value("telemetry/minuteRetention", TSTORE_MINUTE_RETENTION / 1000).toLongLong() * 1000);
+    history->addPrinter();
+    int printer = telemetry->addPrinter();
+    link->setTelemetry(telemetry, history, printer);
+
+    /* Wykresy rysowane poza wątkiem GUI, z historii */
+    qint64 span = settings.value("telemetry/chartSpan", CHART_DEFAULT_SPAN_MS / 1000).toLongLong() * 1000;
+    temperatureChart = new TelemetryChart(history, telemetry);
+    temperatureChart->setSpan(span);
+    temperatureChart->addSeries(printer, TELEMETRY_HOTEND, CHART_VALUE, QColor(220, 50, 30), tr("Hotend"));
+    temperatureChart->addSeries(printer, TELEMETRY_HOTEND_TARGET, CHART_VALUE, QColor(240, 160, 150), tr("Target"));
+    temperatureChart->addSeries(printer, TELEMETRY_BED, CHART_VALUE, QColor(30, 90, 220), tr("Bed"));
+    temperatureChart->addSeries(printer, TELEMETRY_BED_TARGET, CHART_VALUE, QColor(150, 180, 240), tr("Target"));
+    flowChart = new TelemetryChart(history, telemetry);
+    flowChart->setSpan(span);
+    flowChart->addSeries(printer, TELEMETRY_E, CHART_RATE, QColor(40, 160, 60), tr("Flow mm/s"));
+
+    QWidget *charts = new QWidget();
+    QVBoxLayout *layout = new QVBoxLayout(charts);
+    layout->setContentsMargins(2, 2, 2, 2);
+    layout->addWidget(temperatureChart, 2);
+    layout->addWidget(flowChart, 1);
+    ui->tabWidget->addTab(charts, tr("Telemetry"));
+
+    /* Podgląd warstw pliku, indeksowanie i rysowanie w puli wątków podglądu */
+    preview = new ToolpathPreview(this);
+    preview->setBed(link->getCapabilities().bedX, link->getCapabilities().bedY);
+    preview->setCacheSize(settings.value("preview/cacheSize", PREVIEW_CACHE_BYTES).toInt());
+    connect(preview, SIGNAL(opened(quint32)), this, SLOT(previewOpened(quint32)));
+
+    QWidget *previewTab = new QWidget();
+    QVBoxLayout *previewLayout = new QVBoxLayout(previewTab);
+    previewLayout->setContentsMargins(2, 2, 2, 2);
+    QHBoxLayout *previewControls = new QHBoxLayout();
+    QPushButton *previewOpen = new QPushButton(tr("Open..."));
+    QCheckBox *previewTravel = new QCheckBox(tr("Travel"));
+    previewLayer = new QSlider(Qt::Horizontal);
+    previewLayer->setRange(0, 0);
+    previewControls->addWidget(previewOpen);
+    previewControls->addWidget(previewTravel);
+    previewControls->addWidget(previewLayer, 1);
+    previewView = new ToolpathView(preview);
+    previewLayout->addLayout(previewControls);
+    previewLayout->addWidget(previewView, 1);
+    connect(previewOpen, SIGNAL(clicked()), this, SLOT(openPreview()));
+    connect(previewTravel, SIGNAL(toggled(bool)), previewView, SLOT(setTravel(bool)));
+    connect(previewLayer, SIGNAL(valueChanged(int)), previewView, SLOT(setLayer(int)));
+    ui->tabWidget->addTab(previewTab, tr("Preview"));
+
+    /* Sterowanie przez HTTP/WebSocket, we własnym wątku */
+    api = new ControlApi(scheduler, telemetry, this);
+    api->start();
 
     //buttonCallback(this, &MainViewBase::buttonCallbackHandler);
     //communication.
@@ -26,6 +100,13 @@ MainWindow::MainWindow(QWidget *parent) :
 
 MainWindow::~MainWindow()
 {
+    /* Wątek API korzysta z telemetrii, zatrzymany przed nią */
+    delete api;
+    /* Wątki wykresów czytają historię */
+    delete temperatureChart;
+    delete flowChart;
+    link->setTelemetry(nullptr, nullptr, -1);
+    delete history;
     delete ui;
 }
 
@@ -39,6 +120,13 @@ void MainWindow::communicationError()
     /* Wyczyść ID bo rozłączono z urządzeniem */
     //ui->label_device_id->setText("");
 
+    /* Przerwane zadanie zostanie wznowione po ponownym podłączeniu drukarki */
+    if(link->isReconnecting())
+    {
+        QMessageBox::warning(this, tr("Warning!"), tr("The device is unexpectedly removed from the system! The job will resume when it is connected again."));
+        return;
+    }
+
     QMessageBox::critical(this, tr("Error!"), tr("The device is unexpectedly removed from the system!"));
 }
 
@@ -68,20 +156,34 @@ void MainWindow::connectPrinter()
     if(!communication->isConfigured())
         return;
 
-    if(communication->OpenSerialPort()!=0)
+    /* Po ponownym podłączeniu drukarka mogła dostać inny port, szukamy jej po numerze seryjnym */
+    SerialStruct s = communication->GetSerialPort();
+    PortEntry port;
+    if(registry->findBySerialNumber(s.serialNumber, &port) && port.portName != s.sPortName)
+    {
+        s.sPortName = port.portName;
+        communication->SetSerialPort(s);
+    }
+
+    if(link->connectPrinter()!=0)
     {
         return;
     }
 
+    /* Profil drukarki wczytany przy połączeniu */
+    scheduler->setCapabilities(farmPrinter, link->getCapabilities());
+    preview->setBed(link->getCapabilities().bedX, link->getCapabilities().bedY);
     appViewConnected();
 }
 void MainWindow::disconnectPrinter()
 {
-    if(communication->CloseSerialPort()!=0)
+    if(link->disconnectPrinter()!=0)
     {
         return;
     }
 
+    /* Zadania rozłączonej drukarki trafią do innych */
+    scheduler->setCapabilities(farmPrinter, link->getCapabilities());
     appViewDisconnected();
 }
 
@@ -104,3 +206,18 @@ void MainWindow::on_connectButton_clicked()
         connectPrinter();
     }
 }
+
+void MainWindow::openPreview()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, tr("G-code preview"), QString(),
+                                                    tr("G-code (*.gcode *.gco *.g);;All files (*)"));
+    if(!fileName.isEmpty())
+        preview->open(fileName);
+}
+
+void MainWindow::previewOpened(quint32 layers)
+{
+    previewLayer->setRange(0, static_cast<int>(layers));
+    previewLayer->setValue(layers > 0 ? 1 : 0);
+    previewView->setLayer(previewLayer->value());
+}
@@ -2,12 +2,17 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QSlider>
 #include "configurewindow.h"
 #include "communication.h"
-#include "callback.h"
-#include "min.h"
-#include "commandinterpreter.h"
-#include "system.h"
+#include "printerlink.h"
+#include "portregistry.h"
+#include "farmscheduler.h"
+#include "controlapi.h"
+#include "telemetrybus.h"
+#include "telemetrystore.h"
+#include "telemetrychart.h"
+#include "toolpathpreview.h"
 
 namespace Ui {
 class MainWindow;
@@ -28,11 +33,22 @@ private slots:
     void ConfigureResponse(SerialStruct serial);
 
     void on_connectButton_clicked();
+    void openPreview();
+    void previewOpened(quint32 layers);
 
 private:
-    MinProtocol *protocol;
-    System system;
-    CommandInterpreter cmd;
+    PrinterLink *link;
+    PortRegistry *registry;
+    FarmScheduler *scheduler;
+    int farmPrinter;
+    TelemetryBus *telemetry;
+    TelemetryStore *history;
+    TelemetryChart *temperatureChart;
+    TelemetryChart *flowChart;
+    ToolpathPreview *preview;
+    ToolpathView *previewView;
+    QSlider *previewLayer;
+    ControlApi *api;
 
     void connectPrinter();
     void disconnectPrinter();
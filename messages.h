@@ -0,0 +1,214 @@
+// Application messages carried in MIN frames.
+//
+// This header is shared with the printer firmware so it must stay plain C++11 without Qt.
+// All multi-byte fields are little-endian on the wire.
+//
+// Every message is described once by a field list and the codecs are generated from it:
+//
+// -  Msg<Name>              struct with the decoded fields, id and wire_size constants
+// -  Msg<Name>::View        reads the fields in place from a received payload, nothing is copied
+// -  Msg<Name>::encode(w)   writes the fields through a writer (FlatWriter, SpanWriter)
+//
+// To add a message, write its field list and add it to MESSAGES below.
+
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// MIN identifiers, 6 bits (0..63). 0x3e and 0x3f are reserved by MIN, 0x3d carries batches of frames
+// (MIN_BATCH_ID) and is unpacked by MIN itself.
+enum {
+    // Device -> host
+    MSG_ACK = 0x01U,                                // Command acknowledgement
+    MSG_STATUS = 0x02U,                             // Printer state
+    MSG_POSITION = 0x03U,                           // Current position of the axes
+    MSG_TEMPERATURES = 0x04U,                       // Hotend and bed temperatures
+    MSG_PLANNER = 0x05U,                            // Free space in the firmware command/planner buffer
+
+    // Host -> device
+    MSG_MOVE = 0x10U,                               // Linear move
+    MSG_GCODE_LINE = 0x11U,                         // G-code line, the text follows the fields
+    MSG_SEGMENT = 0x12U,                            // Move already planned by the host
+    MSG_EMERGENCY_STOP = 0x20U,                     // Realtime commands
+    MSG_PAUSE = 0x21U,
+    MSG_RESUME = 0x22U,
+    MSG_FEED_OVERRIDE = 0x23U,
+};
+
+// MsgStatus flags
+enum {
+    STATUS_FLAG_HOMED = 0x01U,                      // Axes homed since power-on, a reset of the firmware clears it
+};
+
+// Little-endian access to a single field, used by the generated codecs
+template <typename T>
+struct WireField {
+    static T read(const uint8_t *p)
+    {
+        uint32_t v = 0;
+        for(uint32_t i = 0; i < sizeof(T); i++) {
+            v |= static_cast<uint32_t>(p[i]) << (8U * i);
+        }
+        return static_cast<T>(v);
+    }
+
+    template <class W>
+    static void write(W &w, T value)
+    {
+        uint32_t v = static_cast<uint32_t>(value);
+        for(uint32_t i = 0; i < sizeof(T); i++) {
+            w.put(static_cast<uint8_t>(v >> (8U * i)));
+        }
+    }
+};
+
+// Writes into a contiguous buffer
+struct FlatWriter {
+    uint8_t *p;
+
+    explicit FlatWriter(uint8_t *buf) : p(buf) {}
+    void put(uint8_t byte) { *p++ = byte; }
+};
+
+// Writes into space given in two spans, e.g. reserved in a ring buffer where it wraps at the end (the MIN
+// transport FIFO). The second span is only used once the first one is full.
+struct SpanWriter {
+    uint8_t *p;
+    uint8_t *end;                                   // End of the first span, nullptr once in the second one
+    uint8_t *next;
+
+    SpanWriter(uint8_t *first, uint16_t first_len, uint8_t *second) : p(first), end(first + first_len), next(second) {}
+    void put(uint8_t byte)
+    {
+        if(p == end) {
+            p = next;
+            end = nullptr;
+        }
+        *p++ = byte;
+    }
+    void write(const uint8_t *src, uint16_t len)
+    {
+        if(end != nullptr) {
+            uint16_t n = static_cast<uint16_t>(end - p);
+            if(len <= n) {
+                memcpy(p, src, len);
+                p += len;
+                return;
+            }
+            memcpy(p, src, n);
+            src += n;
+            len = static_cast<uint16_t>(len - n);
+            p = next;
+            end = nullptr;
+        }
+        memcpy(p, src, len);
+        p += len;
+    }
+};
+
+// Field lists: FIELD(type, name). Order defines the wire layout.
+#define MESSAGE_ACK_FIELDS(FIELD) \
+    FIELD(uint16_t, command_id)                     /* Id of the acknowledged command */ \
+    FIELD(uint8_t, result)                          /* 0 - OK, otherwise error code */
+
+#define MESSAGE_STATUS_FIELDS(FIELD) \
+    FIELD(uint8_t, state)                           /* Printer state machine */ \
+    FIELD(uint8_t, flags)                           /* STATUS_FLAG_* */ \
+    FIELD(uint16_t, error_code)
+
+#define MESSAGE_POSITION_FIELDS(FIELD) \
+    FIELD(int32_t, x)                               /* Micrometres */ \
+    FIELD(int32_t, y) \
+    FIELD(int32_t, z) \
+    FIELD(int32_t, e)
+
+#define MESSAGE_TEMPERATURES_FIELDS(FIELD) \
+    FIELD(int16_t, hotend_current)                  /* 0.1 degree Celsius */ \
+    FIELD(int16_t, hotend_target) \
+    FIELD(int16_t, bed_current) \
+    FIELD(int16_t, bed_target)
+
+#define MESSAGE_PLANNER_FIELDS(FIELD) \
+    FIELD(uint16_t, command_id)                     /* Last command received when the report was made */ \
+    FIELD(uint8_t, free_slots)                      /* Free slots in the command/planner buffer */ \
+    FIELD(uint8_t, total_slots) \
+    FIELD(uint16_t, starvation_count)               /* Times the planner ran empty while printing */
+
+#define MESSAGE_MOVE_FIELDS(FIELD) \
+    FIELD(uint16_t, command_id) \
+    FIELD(int32_t, x)                               /* Micrometres, absolute */ \
+    FIELD(int32_t, y) \
+    FIELD(int32_t, z) \
+    FIELD(int32_t, e) \
+    FIELD(uint32_t, feedrate)                       /* Micrometres per second */
+
+#define MESSAGE_GCODE_LINE_FIELDS(FIELD) \
+    FIELD(uint16_t, command_id)
+
+#define MESSAGE_SEGMENT_FIELDS(FIELD) \
+    FIELD(uint16_t, command_id) \
+    FIELD(int32_t, x)                               /* Micrometres, absolute */ \
+    FIELD(int32_t, y) \
+    FIELD(int32_t, z) \
+    FIELD(int32_t, e) \
+    FIELD(uint32_t, entry_speed)                    /* Micrometres per second */ \
+    FIELD(uint32_t, cruise_speed) \
+    FIELD(uint32_t, exit_speed) \
+    FIELD(uint32_t, acceleration)                   /* Micrometres per second squared */ \
+    FIELD(uint32_t, accel_distance)                 /* Micrometres */ \
+    FIELD(uint32_t, decel_distance)
+
+#define MESSAGE_NO_FIELDS(FIELD)
+
+#define MESSAGE_FEED_OVERRIDE_FIELDS(FIELD) \
+    FIELD(uint16_t, percent)
+
+// MESSAGE(Name, min_id, field list)
+#define MESSAGES(MESSAGE) \
+    MESSAGE(Ack, MSG_ACK, MESSAGE_ACK_FIELDS) \
+    MESSAGE(Status, MSG_STATUS, MESSAGE_STATUS_FIELDS) \
+    MESSAGE(Position, MSG_POSITION, MESSAGE_POSITION_FIELDS) \
+    MESSAGE(Temperatures, MSG_TEMPERATURES, MESSAGE_TEMPERATURES_FIELDS) \
+    MESSAGE(Planner, MSG_PLANNER, MESSAGE_PLANNER_FIELDS) \
+    MESSAGE(Move, MSG_MOVE, MESSAGE_MOVE_FIELDS) \
+    MESSAGE(GcodeLine, MSG_GCODE_LINE, MESSAGE_GCODE_LINE_FIELDS) \
+    MESSAGE(Segment, MSG_SEGMENT, MESSAGE_SEGMENT_FIELDS) \
+    MESSAGE(EmergencyStop, MSG_EMERGENCY_STOP, MESSAGE_NO_FIELDS) \
+    MESSAGE(Pause, MSG_PAUSE, MESSAGE_NO_FIELDS) \
+    MESSAGE(Resume, MSG_RESUME, MESSAGE_NO_FIELDS) \
+    MESSAGE(FeedOverride, MSG_FEED_OVERRIDE, MESSAGE_FEED_OVERRIDE_FIELDS)
+
+// Code generation
+#define MESSAGE_FIELD_DECLARE(type, name)           type name;
+#define MESSAGE_FIELD_SIZE(type, name)              + sizeof(type)
+#define MESSAGE_FIELD_ACCESSOR(type, name) \
+    type name() const { return WireField<type>::read(p + offsetof(Layout, name)); }
+#define MESSAGE_FIELD_DECODE(type, name)            m.name = name();
+#define MESSAGE_FIELD_ENCODE(type, name)            WireField<type>::write(w, name);
+
+#define MESSAGE_DEFINE(Name, Id, FIELDS) \
+    struct Msg##Name { \
+        FIELDS(MESSAGE_FIELD_DECLARE) \
+        enum { id = Id, wire_size = 0 FIELDS(MESSAGE_FIELD_SIZE) }; \
+        _Pragma("pack(push, 1)") \
+        struct Layout { FIELDS(MESSAGE_FIELD_DECLARE) }; \
+        _Pragma("pack(pop)") \
+        class View { \
+        public: \
+            explicit View(const uint8_t *payload) : p(payload) {} \
+            const uint8_t *payload() const { return p; } \
+            FIELDS(MESSAGE_FIELD_ACCESSOR) \
+            Msg##Name decode() const { Msg##Name m; FIELDS(MESSAGE_FIELD_DECODE) return m; } \
+        private: \
+            const uint8_t *p; \
+        }; \
+        template <class W> \
+        void encode(W &w) const { (void)w; FIELDS(MESSAGE_FIELD_ENCODE) } \
+    };
+
+MESSAGES(MESSAGE_DEFINE)
+
+#endif // MESSAGES_H
@@ -3,19 +3,21 @@
 // Use authorized under the MIT license.
 
 #include "min.h"
+#include <string.h>
 
-#define TRANSPORT_FIFO_SIZE_FRAMES_MASK             (static_cast<uint8_t>(((1U << TRANSPORT_FIFO_SIZE_FRAMES_BITS) - 1U)))
-#define TRANSPORT_FIFO_SIZE_FRAME_DATA_MASK         (static_cast<uint16_t>(((1U << TRANSPORT_FIFO_SIZE_FRAME_DATA_BITS) - 1U)))
+#define TRANSPORT_WINDOW_MASK                       (static_cast<uint8_t>(TRANSPORT_MAX_WINDOW_SIZE - 1U))
 
 // Number of bytes needed for a frame with a given payload length, excluding stuff bytes
 // 3 header bytes, ID/control byte, length byte, seq byte, 4 byte CRC, EOF byte
-#define ON_WIRE_SIZE(p)                             ((p) + 11U)
+// and 2 more length bytes of an extended frame
+#define ON_WIRE_SIZE(p)                             ((p) + ((p) > MAX_PAYLOAD ? 13U : 11U))
 
 // Special protocol bytes
 enum {
     HEADER_BYTE = 0xaaU,
     STUFF_BYTE = 0x55U,
     EOF_BYTE = 0x55U,
+    EXTENDED_LENGTH = 0xffU,                        // Length byte of an extended frame
 };
 
 // Receiving state machine
@@ -24,6 +26,8 @@ enum {
     RECEIVING_ID_CONTROL,
     RECEIVING_SEQ,
     RECEIVING_LENGTH,
+    RECEIVING_LENGTH_1,                             // Length of an extended frame, big-endian
+    RECEIVING_LENGTH_0,
     RECEIVING_PAYLOAD,
     RECEIVING_CHECKSUM_3,
     RECEIVING_CHECKSUM_2,
@@ -40,12 +44,25 @@ enum {
 #ifndef TRANSPORT_FRAME_RETRANSMIT_TIMEOUT_MS
 #define TRANSPORT_FRAME_RETRANSMIT_TIMEOUT_MS       (50U) // Should be long enough for a whole window to be transmitted plus an ACK / NACK to get back
 #endif
-#ifndef TRANSPORT_MAX_WINDOW_SIZE
-#define TRANSPORT_MAX_WINDOW_SIZE                   (16U)
+// The retransmit timeout follows the round trip time within these, the lower one is also used until it is measured
+#ifndef TRANSPORT_MAX_RETRANSMIT_TIMEOUT_MS
+#define TRANSPORT_MAX_RETRANSMIT_TIMEOUT_MS         (500U)
+#endif
+// Smallest window, one frame more than the realtime reserve
+#define TRANSPORT_MIN_WINDOW                        (TRANSPORT_REALTIME_RESERVED_WINDOW + 1U)
+// The window stops growing once the round trip is longer than the smallest one by more than this or by
+// the smallest one, whichever is more
+#ifndef TRANSPORT_MAX_QUEUE_DELAY_MS
+#define TRANSPORT_MAX_QUEUE_DELAY_MS                (10U)
 #endif
 #ifndef TRANSPORT_IDLE_TIMEOUT_MS
 #define TRANSPORT_IDLE_TIMEOUT_MS                   (1000U)
 #endif
+// A frame waiting for space in the transmit buffer is tried again after this, the drivers do not tell when
+// there is space
+#ifndef TRANSPORT_TX_RETRY_MS
+#define TRANSPORT_TX_RETRY_MS                       (1U)
+#endif
 
 enum {
     // Top bit must be set: these are for the transport protocol to use
@@ -54,8 +71,18 @@ enum {
     RESET = 0xfeU,
 };
 
-// Where the payload data of the frame FIFO is stored
-static uint8_t payloads_ring_buffer[TRANSPORT_FIFO_MAX_FRAME_DATA];
+// Bit 6 of the ID/control byte of a transport frame: the payload is compressed (mincodec.h)
+#define COMPRESSED_FRAME                            (0x40U)
+
+// Flags, second byte of the RESET payload
+#define RESET_REPLY                                 (0x01U)
+
+// Where a frame between min_queue_begin() and min_queue_commit() is written if not straight into the FIFO
+enum {
+    RESERVED_NONE,
+    RESERVED_BATCH,                                 // Open batch, after the ID and length of its record
+    RESERVED_STAGED,                                // Staging buffer, to be compressed
+};
 
 static uint32_t now;
 #endif
@@ -77,11 +104,11 @@ void MinProtocol::min_tx_start()
 
 void MinProtocol::min_tx_finished()
 {
-    //TODO
+    serial->transmitFinished();
 }
 
 // CALLBACK. Handle incoming MIN frame
-void MinProtocol::min_application_handler(uint8_t min_id, uint8_t *min_payload, uint8_t len_payload)
+void MinProtocol::min_application_handler(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload)
 {
     cmd->commandProceed(min_id, min_payload, len_payload);
 }
@@ -93,11 +120,25 @@ uint32_t MinProtocol::min_time_ms(void)
 {
     return static_cast<uint32_t>(system->getCurrentTimeInMs());
 }
+
+// CALLBACK. Current time in microseconds, only differences are used so it may wrap around at 2^32.
+uint32_t MinProtocol::min_time_us(void)
+{
+    return static_cast<uint32_t>(system->getCurrentTimeInUs());
+}
 #endif
 
 MinProtocol::~MinProtocol()
 {
-    free(self);
+    if(owns_context) {
+        free(self);
+    }
+}
+
+// Memory needed for the context given to the constructor
+size_t MinProtocol::min_context_size()
+{
+    return sizeof(struct min_context);
 }
 
 void MinProtocol::crc32_init_context(struct crc32_context *context)
@@ -137,9 +178,9 @@ void MinProtocol::stuffed_tx_byte(uint8_t byte)
     }
 }
 
-void MinProtocol::on_wire_bytes(uint8_t id_control, uint8_t seq, uint8_t *payload_base, uint16_t payload_offset, uint16_t payload_mask, uint8_t payload_len)
+void MinProtocol::on_wire_bytes(uint8_t id_control, uint8_t seq, uint8_t *payload_base, uint16_t payload_offset, uint16_t payload_mask, uint16_t payload_len)
 {
-    uint8_t n, i;
+    uint16_t n, i;
     uint32_t checksum;
 
     self->tx_header_byte_countdown = 2U;
@@ -158,7 +199,15 @@ void MinProtocol::on_wire_bytes(uint8_t id_control, uint8_t seq, uint8_t *payloa
         stuffed_tx_byte(seq);
     }
 
-    stuffed_tx_byte(payload_len);
+    if(payload_len > MAX_PAYLOAD) {
+        // Extended frame, only sent once the other side said it receives them
+        stuffed_tx_byte(EXTENDED_LENGTH);
+        stuffed_tx_byte(static_cast<uint8_t>(payload_len >> 8));
+        stuffed_tx_byte(static_cast<uint8_t>(payload_len & 0xffU));
+    }
+    else {
+        stuffed_tx_byte(static_cast<uint8_t>(payload_len));
+    }
 
     for(i = 0, n = payload_len; n > 0; n--, i++) {
         stuffed_tx_byte(payload_base[payload_offset]);
@@ -183,86 +232,226 @@ void MinProtocol::on_wire_bytes(uint8_t id_control, uint8_t seq, uint8_t *payloa
 
 #ifdef TRANSPORT_PROTOCOL
 
-// Pops frame from front of queue, reclaims its ring buffer space
-void MinProtocol::transport_fifo_pop()
+// Attaches the storage of a lane, sizes must be powers of two
+void MinProtocol::transport_lane_init(struct transport_lane *lane, struct transport_frame *frames, uint16_t max_frames, uint8_t *ring_buffer, uint16_t max_frame_data)
+{
+    lane->frames = frames;
+    lane->ring_buffer = ring_buffer;
+    lane->max_frames = max_frames;
+    lane->max_frame_data = max_frame_data;
+    lane->frames_mask = static_cast<uint8_t>(max_frames - 1U);
+    lane->ring_buffer_mask = static_cast<uint16_t>(max_frame_data - 1U);
+
+    // Counters for diagnosis purposes
+    lane->dropped_frames = 0;
+    lane->worst_latency_ms = 0;
+    lane->n_queued_total = 0;
+    lane->n_acked_total = 0;
+    lane->n_ring_buffer_bytes_max = 0;
+    lane->n_frames_max = 0;
+}
+
+// Pops frame from front of the lane, reclaims its ring buffer space
+void MinProtocol::transport_fifo_pop(struct transport_lane *lane)
 {
 #ifdef ASSERTION_CHECKING
-    assert(self->transport_fifo.n_frames != 0);
+    assert(lane->n_frames != 0);
 #endif
-    struct transport_frame *frame = &self->transport_fifo.frames[self->transport_fifo.head_idx];
+    struct transport_frame *frame = &lane->frames[lane->head_idx];
     min_debug_print("Popping frame id=%d seq=%d\n", frame->min_id, frame->seq);
 
 #ifdef ASSERTION_CHECKING
-    assert(self->transport_fifo.n_ring_buffer_bytes >= frame->payload_len);
+    assert(lane->n_ring_buffer_bytes >= frame->payload_len);
 #endif
 
-    self->transport_fifo.n_frames--;
-    self->transport_fifo.head_idx++;
-    self->transport_fifo.head_idx &= TRANSPORT_FIFO_SIZE_FRAMES_MASK;
-    self->transport_fifo.n_ring_buffer_bytes -= frame->payload_len;
+    lane->n_frames--;
+    lane->head_idx++;
+    lane->head_idx &= lane->frames_mask;
+    lane->n_ring_buffer_bytes -= frame->payload_len;
 }
 
-// Claim a buffer slot from the FIFO. Returns 0 if there is no space.
-struct transport_frame *MinProtocol::transport_fifo_push(uint16_t data_size)
+// Claim a buffer slot from the lane. Returns 0 if there is no space.
+struct transport_frame *MinProtocol::transport_fifo_push(uint8_t lane_idx, uint16_t data_size)
 {
-    // A frame is only queued if there aren't too many frames in the FIFO and there is space in the
+    struct transport_lane *lane = &self->transport_fifo.lanes[lane_idx];
+
+    // A frame is only queued if there aren't too many frames in the lane and there is space in the
     // data ring buffer.
     struct transport_frame *ret = nullptr;
-    if (self->transport_fifo.n_frames < TRANSPORT_FIFO_MAX_FRAMES) {
+    if (lane->n_frames < lane->max_frames) {
         // Is there space in the ring buffer for the frame payload?
-        if(self->transport_fifo.n_ring_buffer_bytes <= TRANSPORT_FIFO_MAX_FRAME_DATA - data_size) {
-            self->transport_fifo.n_frames++;
-            if (self->transport_fifo.n_frames > self->transport_fifo.n_frames_max) {
+        if(data_size <= lane->max_frame_data && lane->n_ring_buffer_bytes <= lane->max_frame_data - data_size) {
+            lane->n_frames++;
+            if (lane->n_frames > lane->n_frames_max) {
                 // High-water mark of FIFO (for diagnostic purposes)
-                self->transport_fifo.n_frames_max = self->transport_fifo.n_frames;
+                lane->n_frames_max = lane->n_frames;
             }
             // Create FIFO entry
-            ret = &(self->transport_fifo.frames[self->transport_fifo.tail_idx]);
-            ret->payload_offset = self->transport_fifo.ring_buffer_tail_offset;
+            ret = &(lane->frames[lane->tail_idx]);
+            ret->payload_offset = lane->ring_buffer_tail_offset;
+            ret->lane = lane_idx;
 
             // Claim ring buffer space
-            self->transport_fifo.n_ring_buffer_bytes += data_size;
-            if(self->transport_fifo.n_ring_buffer_bytes > self->transport_fifo.n_ring_buffer_bytes_max) {
+            lane->n_ring_buffer_bytes += data_size;
+            if(lane->n_ring_buffer_bytes > lane->n_ring_buffer_bytes_max) {
                 // High-water mark of ring buffer usage (for diagnostic purposes)
-                self->transport_fifo.n_ring_buffer_bytes_max = self->transport_fifo.n_ring_buffer_bytes;
+                lane->n_ring_buffer_bytes_max = lane->n_ring_buffer_bytes;
             }
-            self->transport_fifo.ring_buffer_tail_offset += data_size;
-            self->transport_fifo.ring_buffer_tail_offset &= TRANSPORT_FIFO_SIZE_FRAME_DATA_MASK;
+            lane->ring_buffer_tail_offset += data_size;
+            lane->ring_buffer_tail_offset &= lane->ring_buffer_mask;
 
             // Claim FIFO space
-            self->transport_fifo.tail_idx++;
-            self->transport_fifo.tail_idx &= TRANSPORT_FIFO_SIZE_FRAMES_MASK;
+            lane->tail_idx++;
+            lane->tail_idx &= lane->frames_mask;
         }
         else {
-            min_debug_print("No FIFO payload space: data_size=%d, n_ring_buffer_bytes=%d\n", data_size, self->transport_fifo.n_ring_buffer_bytes);
+            min_debug_print("No FIFO payload space: lane=%d, data_size=%d, n_ring_buffer_bytes=%d\n", lane_idx, data_size, lane->n_ring_buffer_bytes);
         }
     }
     else {
-        min_debug_print("No FIFO frame slots\n");
+        min_debug_print("No FIFO frame slots: lane=%d\n", lane_idx);
     }
     return ret;
 }
 
-// Return the nth frame in the FIFO
-struct transport_frame *MinProtocol::transport_fifo_get(uint8_t n)
+// Returns the next frame to put into the window: the oldest unsent frame of the highest priority
+// lane that is allowed to use the free window space. Returns 0 if nothing can be sent.
+struct transport_frame *MinProtocol::transport_fifo_next(uint8_t window_size)
+{
+    for(uint8_t i = 0; i < TRANSPORT_LANES; i++) {
+        struct transport_lane *lane = &self->transport_fifo.lanes[i];
+        uint8_t window_limit = transport_window();
+        if(i != TRANSPORT_LANE_REALTIME) {
+            window_limit -= TRANSPORT_REALTIME_RESERVED_WINDOW;
+        }
+        if((lane->n_frames > lane->n_sent) && (window_size < window_limit)) {
+            return &lane->frames[(lane->head_idx + lane->n_sent) & lane->frames_mask];
+        }
+    }
+    return nullptr;
+}
+
+// Frames allowed in flight: the congestion window within what the other side takes and the limit of this side
+uint8_t MinProtocol::transport_window()
+{
+    uint8_t window = self->transport_fifo.cwnd;
+    if(window > self->transport_fifo.remote_window) {
+        window = self->transport_fifo.remote_window;
+    }
+    if(window > self->max_window) {
+        window = self->max_window;
+    }
+    return window < TRANSPORT_MIN_WINDOW ? static_cast<uint8_t>(TRANSPORT_MIN_WINDOW) : window;
+}
+
+// Retransmit timeout from the smoothed round trip time and its deviation (RFC 6298)
+void MinProtocol::retransmit_timeout_update()
+{
+    struct transport_fifo *fifo = &self->transport_fifo;
+    uint32_t timeout = (fifo->srtt_ms_x8 >> 3) + fifo->rttvar_ms_x4;
+    if(timeout < TRANSPORT_FRAME_RETRANSMIT_TIMEOUT_MS) {
+        timeout = TRANSPORT_FRAME_RETRANSMIT_TIMEOUT_MS;
+    }
+    if(timeout > TRANSPORT_MAX_RETRANSMIT_TIMEOUT_MS) {
+        timeout = TRANSPORT_MAX_RETRANSMIT_TIMEOUT_MS;
+    }
+    fifo->retransmit_timeout_ms = timeout;
+}
+
+// Frames got through: takes a round trip sample from the newest frame ACKed unless it was sent more than
+// once (Karn) and grows the window
+void MinProtocol::window_acked(uint8_t num_acked, uint8_t num_in_window, struct transport_frame *last_acked)
+{
+    struct transport_fifo *fifo = &self->transport_fifo;
+    bool queueing = false;
+
+    if(!last_acked->retransmitted) {
+        uint32_t rtt = now - last_acked->last_sent_time_ms;
+        if(fifo->srtt_ms_x8 == 0) {
+            fifo->srtt_ms_x8 = rtt << 3;
+            fifo->rttvar_ms_x4 = rtt << 1;
+        }
+        else {
+            // RFC 6298 with gains of 1/8 and 1/4, in fixed point
+            int32_t error = static_cast<int32_t>(rtt << 3) - static_cast<int32_t>(fifo->srtt_ms_x8);
+            fifo->srtt_ms_x8 = static_cast<uint32_t>(static_cast<int32_t>(fifo->srtt_ms_x8) + error / 8);
+            uint32_t deviation = static_cast<uint32_t>(error < 0 ? -error : error) >> 1;
+            fifo->rttvar_ms_x4 = fifo->rttvar_ms_x4 - (fifo->rttvar_ms_x4 >> 2) + (deviation >> 2);
+        }
+        retransmit_timeout_update();
+
+        // Frames beyond what the line carries only wait in the transmit buffer, in front of realtime frames
+        if(rtt < fifo->rtt_min_ms) {
+            fifo->rtt_min_ms = rtt;
+        }
+        uint32_t extra = fifo->rtt_min_ms > TRANSPORT_MAX_QUEUE_DELAY_MS ? fifo->rtt_min_ms : TRANSPORT_MAX_QUEUE_DELAY_MS;
+        queueing = rtt > fifo->rtt_min_ms + extra;
+    }
+
+    if(fifo->in_recovery && static_cast<int8_t>(fifo->sn_min - fifo->recover) >= 0) {
+        // The loss is over, so is the back-off of the timeout
+        fifo->in_recovery = false;
+        retransmit_timeout_update();
+    }
+
+    // Only a window that was used grows, one left half empty by the application says nothing about the link
+    if(queueing || num_in_window + TRANSPORT_REALTIME_RESERVED_WINDOW < transport_window() || fifo->cwnd >= TRANSPORT_MAX_WINDOW_SIZE) {
+        return;
+    }
+    if(fifo->cwnd < fifo->ssthresh) {
+        uint16_t cwnd = static_cast<uint16_t>(fifo->cwnd + num_acked);
+        fifo->cwnd = static_cast<uint8_t>(cwnd < fifo->ssthresh ? cwnd : fifo->ssthresh);
+    }
+    else {
+        uint16_t acked = static_cast<uint16_t>(fifo->cwnd_acked + num_acked);
+        if(acked >= fifo->cwnd) {
+            acked = static_cast<uint16_t>(acked - fifo->cwnd);
+            fifo->cwnd++;
+        }
+        fifo->cwnd_acked = static_cast<uint8_t>(acked < fifo->cwnd ? acked : fifo->cwnd - 1U);
+    }
+}
+
+// A frame had to be sent again, once per window of frames this starts a recovery. A frame the other side
+// reported missing was corrupted on the way, the window stays. A timeout halves it: down to
+// TRANSPORT_MIN_WINDOW, one bulk frame next to the realtime reserve, if the other side asks for missing
+// frames and so stopped answering; otherwise a timeout is also how a corrupted frame shows and the window
+// keeps TRANSPORT_INITIAL_WINDOW, a smaller one only slows the recovery.
+void MinProtocol::window_lost(struct transport_frame *frame, bool timed_out)
 {
-    uint8_t idx = self->transport_fifo.head_idx;
-    return &self->transport_fifo.frames[(idx + n) & TRANSPORT_FIFO_SIZE_FRAMES_MASK];
+    struct transport_fifo *fifo = &self->transport_fifo;
+    frame->retransmitted = true;
+    if(fifo->in_recovery) {
+        return;
+    }
+    fifo->recover = fifo->sn_max;
+    fifo->in_recovery = true;
+    if(!timed_out) {
+        return;
+    }
+    uint8_t half = static_cast<uint8_t>(fifo->cwnd / 2U);
+    uint8_t lowest = static_cast<uint8_t>((fifo->remote_features & MIN_FEATURE_NACKS) ? TRANSPORT_MIN_WINDOW : TRANSPORT_INITIAL_WINDOW);
+    fifo->ssthresh = half > lowest ? half : lowest;
+    fifo->cwnd = fifo->ssthresh;
+    fifo->cwnd_acked = 0;
+    fifo->window_decreases++;
+    min_debug_print("Window decreased to %d\n", fifo->cwnd);
 }
 
 // Sends the given frame to the serial line
 void MinProtocol::transport_fifo_send(struct transport_frame *frame)
 {
-    min_debug_print("transport_fifo_send: min_id=%d, seq=%d, payload_len=%d\n", frame->min_id, frame->seq, frame->payload_len);
-    on_wire_bytes(frame->min_id | static_cast<uint8_t>(0x80U), frame->seq, payloads_ring_buffer, frame->payload_offset, TRANSPORT_FIFO_SIZE_FRAME_DATA_MASK, frame->payload_len);
+    struct transport_lane *lane = &self->transport_fifo.lanes[frame->lane];
+    min_debug_print("transport_fifo_send: min_id=%d, seq=%d, payload_len=%d, lane=%d\n", frame->min_id, frame->seq, frame->payload_len, frame->lane);
+    on_wire_bytes(frame->min_id | static_cast<uint8_t>(0x80U), frame->seq, lane->ring_buffer, frame->payload_offset, lane->ring_buffer_mask, frame->payload_len);
     frame->last_sent_time_ms = now;
 }
 
 // We don't queue an ACK frame - we send it straight away (if there's space to do so)
 void MinProtocol::send_ack()
 {
-    // In the embedded end we don't reassemble out-of-order frames and so never ask for retransmits. Payload is
-    // always the same as the sequence number.
+    // Out-of-order frames are not reassembled, a gap is asked for by send_nack(). Payload is always the same
+    // as the sequence number.
     min_debug_print("send ACK: seq=%d\n", self->transport_fifo.rn);
     if(ON_WIRE_SIZE(0) <= min_tx_space()) {
         on_wire_bytes(ACK, self->transport_fifo.rn, &self->transport_fifo.rn, 0, 0xffU, 1U);
@@ -270,26 +459,74 @@ void MinProtocol::send_ack()
     }
 }
 
-// We don't queue an RESET frame - we send it straight away (if there's space to do so)
-void MinProtocol::send_reset()
+// ACK asking for the frames from rn up to the one received: to is the sequence number after it. Sent once per
+// gap, without it the other side waits for its retransmit timeout.
+void MinProtocol::send_nack(uint8_t to)
 {
-    min_debug_print("send RESET\n");
+    min_debug_print("send NACK: seq=%d, to=%d\n", self->transport_fifo.rn, to);
     if(ON_WIRE_SIZE(0) <= min_tx_space()) {
-        on_wire_bytes(RESET, 0, nullptr, 0, 0, 0);
+        on_wire_bytes(ACK, self->transport_fifo.rn, &to, 0, 0xffU, 1U);
+        self->transport_fifo.last_sent_ack_time_ms = now;
+        self->transport_fifo.nack_sent = true;
+    }
+}
+
+// We don't queue an RESET frame - we send it straight away (if there's space to do so)
+// The payload is our features, whether this answers a RESET of the other side, the largest
+// payload we receive (little-endian) and the largest window we take.
+void MinProtocol::send_reset(bool reply)
+{
+    uint8_t payload[5] = {self->features, static_cast<uint8_t>(reply ? RESET_REPLY : 0U),
+                          static_cast<uint8_t>(MAX_FRAME_PAYLOAD & 0xffU), static_cast<uint8_t>(MAX_FRAME_PAYLOAD >> 8),
+                          static_cast<uint8_t>(TRANSPORT_MAX_WINDOW_SIZE)};
+    min_debug_print("send RESET: features=%d, reply=%d\n", self->features, reply);
+    if(ON_WIRE_SIZE(sizeof(payload)) <= min_tx_space()) {
+        on_wire_bytes(RESET, 0, payload, 0, 0xffU, sizeof(payload));
     }
 }
 
 void MinProtocol::transport_fifo_reset()
 {
-    // Clear down the transmission FIFO queue
-    self->transport_fifo.n_frames = 0;
-    self->transport_fifo.head_idx = 0;
-    self->transport_fifo.tail_idx = 0;
-    self->transport_fifo.n_ring_buffer_bytes = 0;
-    self->transport_fifo.ring_buffer_tail_offset = 0;
+    // Clear down the transmission FIFO queues
+    for(uint8_t i = 0; i < TRANSPORT_LANES; i++) {
+        struct transport_lane *lane = &self->transport_fifo.lanes[i];
+        lane->n_frames = 0;
+        lane->n_sent = 0;
+        lane->head_idx = 0;
+        lane->tail_idx = 0;
+        lane->n_ring_buffer_bytes = 0;
+        lane->ring_buffer_tail_offset = 0;
+        // Frames not ACKed are gone, the next frame queued follows the last ACKed one
+        lane->n_queued_total = lane->n_acked_total;
+    }
+#ifdef FRAME_BATCHING
+    self->batch_len = 0;
+    self->batch_frames = 0;
+#endif
     self->transport_fifo.sn_max = 0;
     self->transport_fifo.sn_min = 0;
     self->transport_fifo.rn = 0;
+    self->transport_fifo.nack_sent = false;
+
+    // Features are known again when the other side answers, the windows start from the dictionary
+    self->transport_fifo.remote_features = 0;
+    self->transport_fifo.remote_max_payload = MAX_PAYLOAD;
+    self->transport_fifo.remote_window = TRANSPORT_INITIAL_WINDOW;
+
+    // The link is measured again
+    self->transport_fifo.cwnd = TRANSPORT_INITIAL_WINDOW;
+    self->transport_fifo.ssthresh = TRANSPORT_MAX_WINDOW_SIZE;
+    self->transport_fifo.cwnd_acked = 0;
+    self->transport_fifo.in_recovery = false;
+    self->transport_fifo.srtt_ms_x8 = 0;
+    self->transport_fifo.rttvar_ms_x4 = 0;
+    self->transport_fifo.rtt_min_ms = UINT32_MAX;
+    self->transport_fifo.retransmit_timeout_ms = TRANSPORT_FRAME_RETRANSMIT_TIMEOUT_MS;
+#ifdef PAYLOAD_COMPRESSION
+    min_encoder_reset(&self->tx_encoder);
+    min_codec_reset(&self->rx_decoder);
+    self->rx_decoder_failed = false;
+#endif
 
     // Reset the timers
     self->transport_fifo.last_received_anything_ms = now;
@@ -301,44 +538,499 @@ void MinProtocol::min_transport_reset(bool inform_other_side)
 {
     if (inform_other_side) {
         // Tell the other end we have gone away
-        send_reset();
+        send_reset(false);
     }
 
     // Throw our frames away
     transport_fifo_reset();
 }
 
-// Queues a MIN ID / payload frame into the outgoing FIFO
-// API call.
-// Returns true if the frame was queued OK.
-bool MinProtocol::min_queue_frame(uint8_t min_id, uint8_t *payload, uint8_t payload_len)
+// Claims a FIFO slot for a frame, the caller must write exactly payload_len bytes of its payload before
+// the next min_poll().
+// Returns 0 if there is no space.
+// n_commands is the number of application frames in it, more than one for a batch.
+struct transport_frame *MinProtocol::min_queue_reserve(uint8_t min_id, uint16_t payload_len, uint8_t lane, uint8_t n_commands)
 {
-    struct transport_frame *frame = transport_fifo_push(payload_len); // Claim a FIFO slot, reserve space for payload
+    if(lane >= TRANSPORT_LANES) {
+        lane = TRANSPORT_LANE_BULK;
+    }
+    struct transport_frame *frame = nullptr;
+    if(payload_len <= min_max_payload()) {
+        frame = transport_fifo_push(lane, payload_len); // Claim a FIFO slot, reserve space for payload
+    }
+    else {
+        min_debug_print("Payload too long: len=%d, max=%d\n", payload_len, min_max_payload());
+    }
 
     // We are just queueing here: the poll() function puts the frame into the window and on to the wire
     if(frame != nullptr) {
-        // Copy frame details into frame slot, copy payload into ring buffer
-        frame->min_id = min_id & static_cast<uint8_t>(0x3fU);
+        // Copy frame details into frame slot, bit 6 marks a compressed payload
+        frame->min_id = min_id & static_cast<uint8_t>(0x7fU);
         frame->payload_len = payload_len;
+        frame->queued_time_ms = min_time_ms();
+        frame->n_commands = n_commands;
+        self->transport_fifo.lanes[lane].n_queued_total += n_commands;
+        min_debug_print("Queued ID=%d, len=%d, lane=%d\n", min_id, payload_len, lane);
+    }
+    else {
+        self->transport_fifo.lanes[lane].dropped_frames++;
+        self->transport_fifo.dropped_frames++;
+    }
+    return frame;
+}
+
+// Where the payload of a frame is in the ring buffer of its lane, in two spans if it wraps at the end
+void MinProtocol::transport_fifo_spans(struct transport_frame *frame, struct min_reservation *reservation)
+{
+    struct transport_lane *lane = &self->transport_fifo.lanes[frame->lane];
+    uint16_t to_end = static_cast<uint16_t>(lane->ring_buffer_mask + 1U - frame->payload_offset);
+
+    reservation->span[0] = &lane->ring_buffer[frame->payload_offset];
+    reservation->span[1] = lane->ring_buffer;
+    if(frame->payload_len <= to_end) {
+        reservation->span_len[0] = frame->payload_len;
+        reservation->span_len[1] = 0;
+    }
+    else {
+        reservation->span_len[0] = to_end;
+        reservation->span_len[1] = static_cast<uint16_t>(frame->payload_len - to_end);
+    }
+}
+
+// Queues a MIN ID / payload frame into the outgoing FIFO
+// API call.
+// Returns true if the frame was queued OK.
+bool MinProtocol::min_queue_frame(uint8_t min_id, uint8_t *payload, uint16_t payload_len, uint8_t lane)
+{
+    FrameSpan part(payload, payload_len);
+    return min_queue_frame_gather(min_id, &part, 1U, lane);
+}
+
+// Queues a frame with the payload given in fragments, e.g. a header and a body. Each is copied once,
+// straight into the space reserved for the frame.
+// API call.
+// Returns true if the frame was queued OK.
+bool MinProtocol::min_queue_frame_gather(uint8_t min_id, const FrameSpan *parts, uint8_t n_parts, uint8_t lane)
+{
+    uint32_t payload_len = 0;
+    for(uint8_t i = 0; i < n_parts; i++) {
+        payload_len += parts[i].length;
+    }
+
+    // Longer than any frame, min_queue_begin() drops it
+    struct min_reservation reservation;
+    if(!min_queue_begin(min_id, payload_len > 0xffffU ? static_cast<uint16_t>(0xffffU) : static_cast<uint16_t>(payload_len), &reservation, lane)) {
+        return false;
+    }
+    SpanWriter writer(reservation.span[0], reservation.span_len[0], reservation.span[1]);
+    for(uint8_t i = 0; i < n_parts; i++) {
+        writer.write(parts[i].data, parts[i].length);
+    }
+    min_queue_commit();
+    return true;
+}
+
+// Reserves space for a frame and returns where its payload goes. The caller writes exactly payload_len
+// bytes there and calls min_queue_commit() before anything else is queued and before the next min_poll().
+// A bulk frame is written into the open batch, or into the staging buffer when it is to be compressed,
+// any other frame straight into the FIFO.
+// API call.
+// Returns false if there is no space, then there is nothing to commit.
+bool MinProtocol::min_queue_begin(uint8_t min_id, uint16_t payload_len, struct min_reservation *reservation, uint8_t lane)
+{
+    min_id &= static_cast<uint8_t>(0x3fU);
+    if(lane >= TRANSPORT_LANES) {
+        lane = TRANSPORT_LANE_BULK;
+    }
+#if defined(PAYLOAD_COMPRESSION) || defined(FRAME_BATCHING)
+    uint8_t *staged = nullptr;
+#endif
+#ifdef FRAME_BATCHING
+    if(lane == TRANSPORT_LANE_BULK) {
+        bool batching = min_batching_active() && payload_len <= MAX_PAYLOAD;
+        // Full, or the frame can't be batched: the batch goes first so that the order is kept
+        if(!(batching && batch_fits(payload_len)) && !batch_flush()) {
+            self->transport_fifo.lanes[lane].dropped_frames++;
+            self->transport_fifo.dropped_frames++;
+            return false;
+        }
+        if(batching && batch_fits(payload_len)) {
+            staged = &self->stage_buf[self->batch_len + 2U];
+            self->reserved_to = RESERVED_BATCH;
+        }
+    }
+#endif
+#ifdef PAYLOAD_COMPRESSION
+    // The batch, if any, has just been flushed and the buffer is free. Compressed it fits where it fits
+    // uncompressed, so the commit can't fail.
+    if(staged == nullptr && lane == TRANSPORT_LANE_BULK && min_compression_active() &&
+            payload_len <= min_max_payload() && transport_fifo_has_space(TRANSPORT_LANE_BULK, 1U, payload_len)) {
+        staged = self->stage_buf;
+        self->reserved_to = RESERVED_STAGED;
+    }
+#endif
+#if defined(PAYLOAD_COMPRESSION) || defined(FRAME_BATCHING)
+    if(staged != nullptr) {
+        self->reserved_min_id = min_id;
+        self->reserved_len = payload_len;
+        reservation->span[0] = staged;
+        reservation->span_len[0] = payload_len;
+        reservation->span[1] = nullptr;
+        reservation->span_len[1] = 0;
+        return true;
+    }
+#endif
 
-        uint16_t payload_offset = frame->payload_offset;
-        for(uint32_t i = 0; i < payload_len; i++) {
-            payloads_ring_buffer[payload_offset] = payload[i];
-            payload_offset++;
-            payload_offset &= TRANSPORT_FIFO_SIZE_FRAME_DATA_MASK;
+    struct transport_frame *frame = min_queue_reserve(min_id, payload_len, lane);
+    if(frame == nullptr) {
+        return false;
+    }
+    transport_fifo_spans(frame, reservation);
+    return true;
+}
+
+// Finishes the frame reserved by min_queue_begin(). One written into the FIFO is already queued.
+// API call.
+void MinProtocol::min_queue_commit()
+{
+#if defined(PAYLOAD_COMPRESSION) || defined(FRAME_BATCHING)
+    uint8_t reserved_to = self->reserved_to;
+    self->reserved_to = RESERVED_NONE;
+#endif
+#ifdef FRAME_BATCHING
+    if(reserved_to == RESERVED_BATCH) {
+        if(self->batch_frames == 0) {
+            self->batch_opened_us = min_time_us();
         }
-        min_debug_print("Queued ID=%d, len=%d\n", min_id, payload_len);
+        uint8_t *record = &self->stage_buf[self->batch_len];
+        record[0] = self->reserved_min_id;
+        record[1] = static_cast<uint8_t>(self->reserved_len);
+        self->batch_len = static_cast<uint16_t>(self->batch_len + 2U + self->reserved_len);
+        self->batch_frames++;
+    }
+#endif
+#ifdef PAYLOAD_COMPRESSION
+    if(reserved_to == RESERVED_STAGED) {
+        min_queue_payload(self->reserved_min_id, self->stage_buf, self->reserved_len, TRANSPORT_LANE_BULK, 1U);
+    }
+#endif
+}
+
+// Queues a payload as one frame, compressed if the lane and the other side allow it
+bool MinProtocol::min_queue_payload(uint8_t min_id, const uint8_t *payload, uint16_t payload_len, uint8_t lane, uint8_t n_commands)
+{
+#ifdef PAYLOAD_COMPRESSION
+    if(lane == TRANSPORT_LANE_BULK && min_compression_active() && min_queue_compressed(min_id, payload, payload_len, n_commands)) {
+        return true;
+    }
+#endif
+    struct transport_frame *frame = min_queue_reserve(min_id, payload_len, lane, n_commands);
+    if(frame == nullptr) {
+        return false;
+    }
+    // Copy payload into ring buffer
+    struct min_reservation reservation;
+    transport_fifo_spans(frame, &reservation);
+    SpanWriter writer(reservation.span[0], reservation.span_len[0], reservation.span[1]);
+    writer.write(payload, payload_len);
+    return true;
+}
+
+#ifdef PAYLOAD_COMPRESSION
+// Queues a bulk frame compressed if that makes it shorter.
+// Returns false if it has to be queued as it is.
+bool MinProtocol::min_queue_compressed(uint8_t min_id, const uint8_t *payload, uint16_t payload_len, uint8_t n_commands)
+{
+    // The encoder window takes in every payload it compresses, so only one sure to be queued is compressed.
+    // A frame that fits uncompressed fits compressed.
+    if(payload_len < 2U || payload_len > min_max_payload() || !transport_fifo_has_space(TRANSPORT_LANE_BULK, 1U, payload_len)) {
+        return false;
+    }
+
+    uint8_t compressed[MAX_FRAME_PAYLOAD];
+    uint16_t compressed_len = min_encoder_compress(&self->tx_encoder, payload, payload_len, compressed, static_cast<uint16_t>(payload_len - 1U));
+    if(compressed_len == 0) {
+        self->uncompressed_frames++;
+        return false;
+    }
+
+    struct min_reservation reservation;
+    transport_fifo_spans(min_queue_reserve(static_cast<uint8_t>(min_id | COMPRESSED_FRAME), compressed_len, TRANSPORT_LANE_BULK, n_commands), &reservation);
+    SpanWriter writer(reservation.span[0], reservation.span_len[0], reservation.span[1]);
+    writer.write(compressed, compressed_len);
+    self->compressed_bytes_in += payload_len;
+    self->compressed_bytes_out += compressed_len;
+    return true;
+}
+#endif
+
+#ifdef FRAME_BATCHING
+// Largest payload of a batch
+uint16_t MinProtocol::batch_max()
+{
+    uint16_t limit = min_max_payload();
+    return self->batch_limit < limit ? self->batch_limit : limit;
+}
+
+// Whether a frame still goes into the open batch. Frames in a batch are counted in a byte.
+bool MinProtocol::batch_fits(uint16_t payload_len)
+{
+    return self->batch_frames < 0xffU && self->batch_len + 2U + payload_len <= batch_max();
+}
+
+// Payload length of the open batch in the bulk lane, a batch of one frame goes as that frame
+uint16_t MinProtocol::batch_queued_len()
+{
+    return self->batch_frames == 1U ? static_cast<uint16_t>(self->batch_len - 2U) : self->batch_len;
+}
+
+// Queues the open batch, a batch of one frame as that frame.
+// Returns false if the lane has no space for it; then the batch stays open.
+bool MinProtocol::batch_flush()
+{
+    if(self->batch_frames == 0) {
         return true;
     }
+    bool single = (self->batch_frames == 1U);
+    uint16_t len = batch_queued_len();
+    if(!transport_fifo_has_space(TRANSPORT_LANE_BULK, 1U, len)) {
+        return false;
+    }
+    if(single) {
+        min_queue_payload(self->stage_buf[0], &self->stage_buf[2], len, TRANSPORT_LANE_BULK, 1U);
+    }
     else {
-        self->transport_fifo.dropped_frames++;
+        min_queue_payload(MIN_BATCH_ID, self->stage_buf, len, TRANSPORT_LANE_BULK, self->batch_frames);
+        self->batched_frames += self->batch_frames;
+        self->batches_sent++;
+    }
+    self->batch_len = 0;
+    self->batch_frames = 0;
+    return true;
+}
+
+// Passes the frames of a received batch up one by one
+void MinProtocol::rx_batch(uint8_t *payload, uint16_t payload_len)
+{
+    uint16_t i = 0;
+    while(i + 2U <= payload_len) {
+        uint8_t min_id = payload[i] & static_cast<uint8_t>(0x3fU);
+        uint8_t len = payload[i + 1U];
+        i = static_cast<uint16_t>(i + 2U);
+        if(len > payload_len - i) {
+            break;
+        }
+        min_application_handler(min_id, &payload[i], len);
+        i = static_cast<uint16_t>(i + len);
+    }
+    if(i != payload_len) {
+        min_debug_print("Truncated batch: len=%d, parsed=%d\n", payload_len, i);
+        self->batch_errors++;
+    }
+}
+#endif
+
+// Whether the lane takes n_frames more frames of data_size payload bytes in total
+bool MinProtocol::transport_fifo_has_space(uint8_t lane_idx, uint16_t n_frames, uint16_t data_size)
+{
+    struct transport_lane *lane = &self->transport_fifo.lanes[lane_idx];
+    return lane->n_frames <= lane->max_frames - n_frames &&
+           data_size <= lane->max_frame_data &&
+           lane->n_ring_buffer_bytes <= lane->max_frame_data - data_size;
+}
+
+bool MinProtocol::min_queue_has_space_for_frame(uint16_t payload_len, uint8_t lane) {
+    if(lane >= TRANSPORT_LANES) {
+        lane = TRANSPORT_LANE_BULK;
+    }
+    if(payload_len > min_max_payload()) {
         return false;
     }
+#ifdef FRAME_BATCHING
+    if(lane == TRANSPORT_LANE_BULK && self->batch_frames != 0) {
+        bool batching = min_batching_active() && payload_len <= MAX_PAYLOAD;
+        if(batching && batch_fits(payload_len)) {
+            return true;
+        }
+        // The batch is queued first, the frame then opens a new one or is queued after it
+        if(batching && payload_len + 2U <= batch_max()) {
+            return transport_fifo_has_space(lane, 1U, self->batch_len);
+        }
+        return transport_fifo_has_space(lane, 2U, static_cast<uint16_t>(self->batch_len + payload_len));
+    }
+#endif
+    return transport_fifo_has_space(lane, 1U, payload_len);
+}
+
+// Longest time a frame of the lane waited between queueing and its first transmission
+uint32_t MinProtocol::min_queue_worst_latency_ms(uint8_t lane)
+{
+    return lane < TRANSPORT_LANES ? self->transport_fifo.lanes[lane].worst_latency_ms : 0;
+}
+
+// Frames queued in the lane so far. Together with min_queue_acked_count() it tells which of them
+// the other side has received: frame number n (counting from 1) is ACKed once the ACKed count reaches n.
+// Both wrap around at 2^32. Frames in a batch count one by one, the open batch included.
+uint32_t MinProtocol::min_queue_queued_count(uint8_t lane)
+{
+    if(lane >= TRANSPORT_LANES) {
+        return 0;
+    }
+#ifdef FRAME_BATCHING
+    if(lane == TRANSPORT_LANE_BULK) {
+        return self->transport_fifo.lanes[lane].n_queued_total + self->batch_frames;
+    }
+#endif
+    return self->transport_fifo.lanes[lane].n_queued_total;
+}
+
+uint32_t MinProtocol::min_queue_acked_count(uint8_t lane)
+{
+    return lane < TRANSPORT_LANES ? self->transport_fifo.lanes[lane].n_acked_total : 0;
+}
+
+// RESETs the other side started itself, not the replies to ours: e.g. the firmware after a reboot
+uint32_t MinProtocol::min_resets_received()
+{
+    return self->transport_fifo.resets_received;
+}
+
+// Features announced by the next RESET. Only the compiled in ones can be announced.
+void MinProtocol::min_set_features(uint8_t features)
+{
+    self->features = features & static_cast<uint8_t>(MIN_DEFAULT_FEATURES);
+}
+
+// Limits extended frames below what the other side receives, e.g. so that a frame takes no longer on a slow
+// line than the retransmit timeout allows
+void MinProtocol::min_set_max_payload(uint16_t max_payload)
+{
+    if(max_payload > MAX_FRAME_PAYLOAD) {
+        max_payload = MAX_FRAME_PAYLOAD;
+    }
+    self->max_payload = max_payload;
+}
+
+// Limits the window below what the other side takes, 0 leaves the smallest one
+void MinProtocol::min_set_max_window(uint8_t max_window)
+{
+    self->max_window = max_window < TRANSPORT_MAX_WINDOW_SIZE ? max_window : static_cast<uint8_t>(TRANSPORT_MAX_WINDOW_SIZE);
+}
+
+// Frames the window takes now
+uint8_t MinProtocol::min_window()
+{
+    return transport_window();
+}
+
+// Smoothed round trip time of a frame and its ACK, the time in the transmit buffer included; 0 until measured
+uint32_t MinProtocol::min_round_trip_ms()
+{
+    return self->transport_fifo.srtt_ms_x8 >> 3;
+}
+
+uint32_t MinProtocol::min_retransmit_timeout_ms()
+{
+    return self->transport_fifo.retransmit_timeout_ms;
+}
+
+uint8_t MinProtocol::min_remote_features()
+{
+    return self->transport_fifo.remote_features;
+}
+
+bool MinProtocol::min_compression_active()
+{
+    return (self->features & self->transport_fifo.remote_features & MIN_FEATURE_COMPRESSION) != 0;
 }
 
-bool MinProtocol::min_queue_has_space_for_frame(uint8_t payload_len) {
-    return self->transport_fifo.n_frames < TRANSPORT_FIFO_MAX_FRAMES &&
-           self->transport_fifo.n_ring_buffer_bytes <= TRANSPORT_FIFO_MAX_FRAME_DATA - payload_len;
+// Payload bytes of the bulk frames sent compressed and what they were compressed to, both wrap around at 2^32
+uint32_t MinProtocol::min_compressed_bytes_in()
+{
+#ifdef PAYLOAD_COMPRESSION
+    return self->compressed_bytes_in;
+#else
+    return 0;
+#endif
+}
+
+uint32_t MinProtocol::min_compressed_bytes_out()
+{
+#ifdef PAYLOAD_COMPRESSION
+    return self->compressed_bytes_out;
+#else
+    return 0;
+#endif
+}
+
+// Received compressed frames which did not decode. After one the link stalls until the transport is reset.
+uint32_t MinProtocol::min_decompress_errors()
+{
+#ifdef PAYLOAD_COMPRESSION
+    return self->decompress_errors;
+#else
+    return 0;
+#endif
+}
+
+// Longest an open batch waits for more frames once the bulk lane could send it, 0 turns batching off.
+// min_poll() checks it, so it is rounded up to the poll period.
+void MinProtocol::min_set_batch_deadline_us(uint32_t deadline_us)
+{
+#ifdef FRAME_BATCHING
+    self->batch_deadline_us = deadline_us;
+#else
+    (void)deadline_us;
+#endif
+}
+
+// Bytes per second the line carries, 0 if not known. A whole window of batches has to go out within the
+// retransmit timeout, or the frames are sent again while they still wait in the transmit buffer; this
+// limits the batches on slow lines.
+void MinProtocol::min_set_line_rate(uint32_t bytes_per_s)
+{
+#ifdef FRAME_BATCHING
+    uint32_t limit = MAX_FRAME_PAYLOAD;
+    if(bytes_per_s != 0) {
+        // On the wire, less the frame overhead
+        uint32_t wire = static_cast<uint32_t>(static_cast<uint64_t>(bytes_per_s) * TRANSPORT_FRAME_RETRANSMIT_TIMEOUT_MS / 1000U / TRANSPORT_INITIAL_WINDOW);
+        wire = wire > ON_WIRE_SIZE(0) ? wire - ON_WIRE_SIZE(0) : 0;
+        if(wire < limit) {
+            limit = wire;
+        }
+    }
+    self->batch_limit = static_cast<uint16_t>(limit);
+#else
+    (void)bytes_per_s;
+#endif
+}
+
+bool MinProtocol::min_batching_active()
+{
+#ifdef FRAME_BATCHING
+    return self->batch_deadline_us != 0 && (self->features & self->transport_fifo.remote_features & MIN_FEATURE_BATCHES) != 0;
+#else
+    return false;
+#endif
+}
+
+// Frames sent in batches and the batches, both wrap around at 2^32
+uint32_t MinProtocol::min_batched_frames()
+{
+#ifdef FRAME_BATCHING
+    return self->batched_frames;
+#else
+    return 0;
+#endif
+}
+
+uint32_t MinProtocol::min_batches_sent()
+{
+#ifdef FRAME_BATCHING
+    return self->batches_sent;
+#else
+    return 0;
+#endif
 }
 
 // Finds the frame in the window that was sent least recently
@@ -348,22 +1040,22 @@ struct transport_frame *MinProtocol::find_retransmit_frame()
 
 #ifdef ASSERTION_CHECKS
     assert(window_size > 0);
-    assert(window_size <= self->transport_fifo.nframes);
+    assert(window_size <= TRANSPORT_MAX_WINDOW_SIZE);
 #endif
 
-    // Start with the head of the queue and call this the oldest
-    struct transport_frame *oldest_frame = &self->transport_fifo.frames[self->transport_fifo.head_idx];
+    // Start with the oldest frame in the window
+    uint8_t seq = self->transport_fifo.sn_min;
+    struct transport_frame *oldest_frame = self->transport_fifo.window[seq & TRANSPORT_WINDOW_MASK];
     uint32_t oldest_elapsed_time = now - oldest_frame->last_sent_time_ms;
 
-    uint8_t idx = self->transport_fifo.head_idx;
     for(uint8_t i = 0; i < window_size; i++) {
-        uint32_t elapsed = now - self->transport_fifo.frames[idx].last_sent_time_ms;
+        struct transport_frame *frame = self->transport_fifo.window[seq & TRANSPORT_WINDOW_MASK];
+        uint32_t elapsed = now - frame->last_sent_time_ms;
         if(elapsed > oldest_elapsed_time) { // Strictly older only; otherwise the earlier frame is deemed the older
             oldest_elapsed_time = elapsed;
-            oldest_frame = &self->transport_fifo.frames[idx];
+            oldest_frame = frame;
         }
-        idx++;
-        idx &= TRANSPORT_FIFO_SIZE_FRAMES_MASK;
+        seq++;
     }
 
     return oldest_frame;
@@ -376,7 +1068,7 @@ void MinProtocol::valid_frame_received()
 {
     uint8_t id_control = self->rx_frame_id_control;
     uint8_t *payload = self->rx_frame_payload_buf;
-    uint8_t payload_len = self->rx_control;
+    uint16_t payload_len = self->rx_control;
 
 #ifdef TRANSPORT_PROTOCOL
     uint8_t seq = self->rx_frame_seq;
@@ -398,25 +1090,48 @@ void MinProtocol::valid_frame_received()
             num_in_window = self->transport_fifo.sn_max - self->transport_fifo.sn_min;
 
             if(num_acked <= num_in_window) {
-                self->transport_fifo.sn_min = seq;
 #ifdef ASSERTION_CHECKING
-                assert(self->transport_fifo.n_frames >= num_in_window);
                 assert(num_in_window <= TRANSPORT_MAX_WINDOW_SIZE);
                 assert(num_nacked <= TRANSPORT_MAX_WINDOW_SIZE);
 #endif
                 // Now pop off all the frames up to (but not including) rn
                 // The ACK contains Rn; all frames before Rn are ACKed and can be removed from the window
+                // Frames of a lane are sent in order, so an ACKed frame is always at the head of its lane
                 min_debug_print("Received ACK seq=%d, num_acked=%d, num_nacked=%d\n", seq, num_acked, num_nacked);
+                struct transport_frame *last_acked = nullptr;
                 for(uint8_t i = 0; i < num_acked; i++) {
-                    transport_fifo_pop();
+                    struct transport_frame *acked_frame = self->transport_fifo.window[(self->transport_fifo.sn_min + i) & TRANSPORT_WINDOW_MASK];
+                    struct transport_lane *lane = &self->transport_fifo.lanes[acked_frame->lane];
+#ifdef ASSERTION_CHECKING
+                    assert(acked_frame == &lane->frames[lane->head_idx]);
+#endif
+                    lane->n_sent--;
+                    lane->n_acked_total += acked_frame->n_commands;
+                    transport_fifo_pop(lane);
+                    last_acked = acked_frame;
                 }
-                uint8_t idx = self->transport_fifo.head_idx;
-                // Now retransmit the number of frames that were requested
-                for(uint8_t i = 0; i < num_nacked; i++) {
-                    struct transport_frame *retransmit_frame = &self->transport_fifo.frames[idx];
-                    transport_fifo_send(retransmit_frame);
-                    idx++;
-                    idx &= TRANSPORT_FIFO_SIZE_FRAMES_MASK;
+                self->transport_fifo.sn_min = seq;
+                if(last_acked != nullptr) {
+                    window_acked(num_acked, num_in_window, last_acked);
+                }
+
+                // Now retransmit the frames that were requested. The other side drops every frame after a
+                // missing one, so the rest of the window goes again too: what fits in the transmit buffer now,
+                // the others are due at once and go as the buffer empties.
+                num_in_window -= num_acked;
+                if(num_nacked > 0) {
+                    bool space = true;
+                    for(uint8_t i = 0; i < num_in_window; i++) {
+                        struct transport_frame *retransmit_frame = self->transport_fifo.window[(seq + i) & TRANSPORT_WINDOW_MASK];
+                        window_lost(retransmit_frame, false);
+                        space = space && ON_WIRE_SIZE(retransmit_frame->payload_len) <= min_tx_space();
+                        if(space) {
+                            transport_fifo_send(retransmit_frame);
+                        }
+                        else {
+                            retransmit_frame->last_sent_time_ms = now - self->transport_fifo.retransmit_timeout_ms;
+                        }
+                    }
                 }
             }
             else {
@@ -425,12 +1140,35 @@ void MinProtocol::valid_frame_received()
             }
             break;
         case RESET:
+            if(payload_len >= 2U && (payload[1] & RESET_REPLY)) {
+                // Answer to our RESET: only its features, the transport was reset when ours was sent
+                self->transport_fifo.remote_features = payload[0];
+                if(payload_len >= 4U) {
+                    self->transport_fifo.remote_max_payload = static_cast<uint16_t>(payload[2] | (payload[3] << 8));
+                }
+                if(payload_len >= 5U && payload[4] >= TRANSPORT_MIN_WINDOW) {
+                    self->transport_fifo.remote_window = payload[4];
+                }
+                min_debug_print("Received RESET reply: features=%d\n", payload[0]);
+                break;
+            }
             // If we get a RESET demand then we reset the transport protocol (empty the FIFO, reset the
             // sequence numbers, etc.)
-            // We don't send anything, we just do it. The other end can send frames to see if this end is
+            // We don't send anything else, we just do it. The other end can send frames to see if this end is
             // alive (pings, etc.) or just wait to get application frames.
             self->transport_fifo.resets_received++;
             transport_fifo_reset();
+            if(payload_len >= 1U) {
+                // The other side negotiates, it learns our features from the answer
+                self->transport_fifo.remote_features = payload[0];
+                if(payload_len >= 4U) {
+                    self->transport_fifo.remote_max_payload = static_cast<uint16_t>(payload[2] | (payload[3] << 8));
+                }
+                if(payload_len >= 5U && payload[4] >= TRANSPORT_MIN_WINDOW) {
+                    self->transport_fifo.remote_window = payload[4];
+                }
+                send_reset(true);
+            }
             break;
         default:
             if (id_control & 0x80U) {
@@ -441,9 +1179,28 @@ void MinProtocol::valid_frame_received()
 
                 if (seq == self->transport_fifo.rn) {
                     // Accept this frame as matching the sequence number we were looking for
+#ifdef PAYLOAD_COMPRESSION
+                    if(id_control & COMPRESSED_FRAME) {
+                        // A payload that does not decode means the windows of the two sides differ. Nothing
+                        // compressed is accepted until a reset: the link stalls rather than passing up garbage.
+                        int16_t decoded_len = -1;
+                        if(!self->rx_decoder_failed) {
+                            decoded_len = min_codec_decode(&self->rx_decoder, payload, payload_len, self->rx_decoded_buf, MAX_FRAME_PAYLOAD);
+                        }
+                        if(decoded_len < 0) {
+                            min_debug_print("Corrupt compressed frame seq=%d\n", seq);
+                            self->rx_decoder_failed = true;
+                            self->decompress_errors++;
+                            break;
+                        }
+                        payload = self->rx_decoded_buf;
+                        payload_len = static_cast<uint16_t>(decoded_len);
+                    }
+#endif
 
                     // Now looking for the next one in the sequence
                     self->transport_fifo.rn++;
+                    self->transport_fifo.nack_sent = false;
 
                     // Always send an ACK back for the frame we received
                     // ACKs are short (should be about 9 microseconds to send on the wire) and
@@ -456,12 +1213,22 @@ void MinProtocol::valid_frame_received()
 
                     // Pass frame up to application handler to deal with
                     min_debug_print("Incoming app frame seq=%d, id=%d, payload len=%d\n", seq, id_control & static_cast<uint8_t>(0x3fU), payload_len);
+#ifdef FRAME_BATCHING
+                    if((id_control & static_cast<uint8_t>(0x3fU)) == MIN_BATCH_ID) {
+                        rx_batch(payload, payload_len);
+                        break;
+                    }
+#endif
                     min_application_handler(id_control & static_cast<uint8_t>(0x3fU), payload, payload_len);
                 } else {
                     // Discard this frame because we aren't looking for it: it's either a dupe because it was
                     // retransmitted when our ACK didn't get through in time, or else it's further on in the
-                    // sequence and others got dropped.
+                    // sequence and others got dropped. Those are asked for once, the ones after them are dropped
+                    // until they come again.
                     self->transport_fifo.sequence_mismatch_drop++;
+                    if((self->features & MIN_FEATURE_NACKS) && static_cast<int8_t>(seq - self->transport_fifo.rn) > 0 && !self->transport_fifo.nack_sent) {
+                        send_nack(static_cast<uint8_t>(seq + 1U));
+                    }
                 }
             }
             else {
@@ -475,6 +1242,26 @@ void MinProtocol::valid_frame_received()
 #endif // TRANSPORT_PROTOCOL
 }
 
+// Length of the payload received, the frame goes on to its payload or checksum
+void MinProtocol::rx_length(uint16_t length)
+{
+    self->rx_frame_length = length;
+    self->rx_control = length;
+    if(length > 0) {
+        // Can reduce the RAM size by compiling limits to frame sizes
+        if(length <= MAX_FRAME_PAYLOAD) {
+            self->rx_frame_state = RECEIVING_PAYLOAD;
+        }
+        else {
+            // Frame dropped because it's longer than any frame we can buffer
+            self->rx_frame_state = SEARCHING_FOR_SOF;
+        }
+    }
+    else {
+        self->rx_frame_state = RECEIVING_CHECKSUM_3;
+    }
+}
+
 void MinProtocol::rx_byte(uint8_t byte)
 {
     // Regardless of state, three header bytes means "start of frame" and
@@ -534,22 +1321,23 @@ void MinProtocol::rx_byte(uint8_t byte)
             self->rx_frame_state = RECEIVING_LENGTH;
             break;
         case RECEIVING_LENGTH:
-            self->rx_frame_length = byte;
-            self->rx_control = byte;
             crc32_step(&self->rx_checksum, byte);
-            if(self->rx_frame_length > 0) {
-                // Can reduce the RAM size by compiling limits to frame sizes
-                if(self->rx_frame_length <= MAX_PAYLOAD) {
-                    self->rx_frame_state = RECEIVING_PAYLOAD;
-                }
-                else {
-                    // Frame dropped because it's longer than any frame we can buffer
-                    self->rx_frame_state = SEARCHING_FOR_SOF;
-                }
-            }
-            else {
-                self->rx_frame_state = RECEIVING_CHECKSUM_3;
+#ifdef EXTENDED_FRAMES
+            if(byte == EXTENDED_LENGTH) {
+                self->rx_frame_state = RECEIVING_LENGTH_1;
+                break;
             }
+#endif
+            rx_length(byte);
+            break;
+        case RECEIVING_LENGTH_1:
+            self->rx_frame_length = static_cast<uint16_t>(byte << 8);
+            crc32_step(&self->rx_checksum, byte);
+            self->rx_frame_state = RECEIVING_LENGTH_0;
+            break;
+        case RECEIVING_LENGTH_0:
+            crc32_step(&self->rx_checksum, byte);
+            rx_length(static_cast<uint16_t>(self->rx_frame_length | byte));
             break;
         case RECEIVING_PAYLOAD:
             self->rx_frame_payload_buf[self->rx_frame_payload_bytes++] = byte;
@@ -613,13 +1401,33 @@ void MinProtocol::min_poll(uint8_t *buf, uint32_t buf_len)
     bool remote_connected = (now - self->transport_fifo.last_received_anything_ms < TRANSPORT_IDLE_TIMEOUT_MS);
     bool remote_active = (now - self->transport_fifo.last_received_frame_ms < TRANSPORT_IDLE_TIMEOUT_MS);
 
-    // This sends one new frame or resends one old frame
     window_size = self->transport_fifo.sn_max - self->transport_fifo.sn_min; // Window size
-    if((window_size < TRANSPORT_MAX_WINDOW_SIZE) && (self->transport_fifo.n_frames > window_size)) {
+
+#ifdef FRAME_BATCHING
+    // The open batch goes once its deadline is over and the bulk lane could send it now, or at once when
+    // batching was turned off. Until then it keeps taking frames.
+    if(self->batch_frames != 0) {
+        struct transport_lane *bulk = &self->transport_fifo.lanes[TRANSPORT_LANE_BULK];
+        bool lane_free = bulk->n_frames == bulk->n_sent && window_size < transport_window() - TRANSPORT_REALTIME_RESERVED_WINDOW;
+        if(!min_batching_active() || (lane_free && min_time_us() - self->batch_opened_us >= self->batch_deadline_us)) {
+            batch_flush();
+        }
+    }
+#endif
+
+    // This sends one new frame or resends one old frame
+    struct transport_frame *frame = transport_fifo_next(window_size);
+    if(frame != nullptr) {
         // There are new frames we can send; but don't even bother if there's no buffer space for them
-        struct transport_frame *frame = transport_fifo_get(window_size);
         if(ON_WIRE_SIZE(frame->payload_len) <= min_tx_space()) {
+            struct transport_lane *lane = &self->transport_fifo.lanes[frame->lane];
             frame->seq = self->transport_fifo.sn_max;
+            self->transport_fifo.window[frame->seq & TRANSPORT_WINDOW_MASK] = frame;
+            lane->n_sent++;
+            frame->retransmitted = false;
+            if(now - frame->queued_time_ms > lane->worst_latency_ms) {
+                lane->worst_latency_ms = now - frame->queued_time_ms;
+            }
             transport_fifo_send(frame);
 
             // Move window on
@@ -631,9 +1439,17 @@ void MinProtocol::min_poll(uint8_t *buf, uint32_t buf_len)
         if((window_size > 0) && remote_connected) {
             // There are unacknowledged frames. Can re-send an old frame. Pick the least recently sent one.
             struct transport_frame *oldest_frame = find_retransmit_frame();
-            if(now - oldest_frame->last_sent_time_ms >= TRANSPORT_FRAME_RETRANSMIT_TIMEOUT_MS) {
+            if(now - oldest_frame->last_sent_time_ms >= self->transport_fifo.retransmit_timeout_ms) {
                 // Resending oldest frame if there's a chance there's enough space to send it
                 if(ON_WIRE_SIZE(oldest_frame->payload_len) <= min_tx_space()) {
+                    // Until the round trip is measured the timeout may be too short for the link: the first
+                    // timeout of a loss doubles it until the loss is over. Later the measured one is kept,
+                    // the window stops growing before frames wait much longer than that.
+                    if(!self->transport_fifo.in_recovery && self->transport_fifo.srtt_ms_x8 == 0) {
+                        uint32_t timeout = self->transport_fifo.retransmit_timeout_ms * 2U;
+                        self->transport_fifo.retransmit_timeout_ms = timeout < TRANSPORT_MAX_RETRANSMIT_TIMEOUT_MS ? timeout : TRANSPORT_MAX_RETRANSMIT_TIMEOUT_MS;
+                    }
+                    window_lost(oldest_frame, true);
                     transport_fifo_send(oldest_frame);
                 }
             }
@@ -651,13 +1467,95 @@ void MinProtocol::min_poll(uint8_t *buf, uint32_t buf_len)
 #endif // TRANSPORT_PROTOCOL
 }
 
-MinProtocol::MinProtocol(ISerialCommunication *serial, ISystem *system, ICommandInterpreter *cmd)
+#ifdef TRANSPORT_PROTOCOL
+// The earlier of two deadlines
+static inline uint32_t deadline_min(uint32_t deadline, uint32_t in_ms)
+{
+    return in_ms < deadline ? in_ms : deadline;
+}
+#endif
+
+// Milliseconds until min_poll() has something to do without received data: the same checks as min_poll(),
+// with the time left until each of them fires. 0 if a frame can go out now.
+// API call.
+uint32_t MinProtocol::min_next_deadline_ms()
+{
+    uint32_t deadline = MIN_NO_DEADLINE;
+#ifdef TRANSPORT_PROTOCOL
+    now = min_time_ms();
+
+    bool remote_connected = (now - self->transport_fifo.last_received_anything_ms < TRANSPORT_IDLE_TIMEOUT_MS);
+    bool remote_active = (now - self->transport_fifo.last_received_frame_ms < TRANSPORT_IDLE_TIMEOUT_MS);
+    uint8_t window_size = self->transport_fifo.sn_max - self->transport_fifo.sn_min;
+
+#ifdef FRAME_BATCHING
+    // A batch waiting for the lane, or for space in the bulk ring, is flushed by the min_poll() of the ACK
+    // which frees it: without the space it has no deadline of its own
+    if(self->batch_frames != 0 && transport_fifo_has_space(TRANSPORT_LANE_BULK, 1U, batch_queued_len())) {
+        struct transport_lane *bulk = &self->transport_fifo.lanes[TRANSPORT_LANE_BULK];
+        bool lane_free = bulk->n_frames == bulk->n_sent && window_size < transport_window() - TRANSPORT_REALTIME_RESERVED_WINDOW;
+        if(!min_batching_active()) {
+            return 0;
+        }
+        if(lane_free) {
+            uint32_t waited_us = min_time_us() - self->batch_opened_us;
+            if(waited_us >= self->batch_deadline_us) {
+                return 0;
+            }
+            deadline = deadline_min(deadline, (self->batch_deadline_us - waited_us + 999U) / 1000U);
+        }
+    }
+#endif
+
+    struct transport_frame *frame = transport_fifo_next(window_size);
+    if(frame != nullptr) {
+        if(ON_WIRE_SIZE(frame->payload_len) > min_tx_space()) {
+            return TRANSPORT_TX_RETRY_MS;
+        }
+        return 0;
+    }
+    if((window_size > 0) && remote_connected) {
+        struct transport_frame *oldest_frame = find_retransmit_frame();
+        uint32_t elapsed = now - oldest_frame->last_sent_time_ms;
+        if(elapsed < self->transport_fifo.retransmit_timeout_ms) {
+            deadline = deadline_min(deadline, self->transport_fifo.retransmit_timeout_ms - elapsed);
+        }
+        else {
+            // Frames are resent one at a time, as by a periodic poll, so an ACK on the way saves the rest
+            deadline = deadline_min(deadline, TRANSPORT_TX_RETRY_MS);
+        }
+    }
+
+#ifndef DISABLE_TRANSPORT_ACK_RETRANSMIT
+    // The ACK is repeated until the line goes idle
+    if(remote_active) {
+        uint32_t elapsed = now - self->transport_fifo.last_sent_ack_time_ms;
+        if(elapsed <= TRANSPORT_ACK_RETRANSMIT_TIMEOUT_MS) {
+            deadline = deadline_min(deadline, TRANSPORT_ACK_RETRANSMIT_TIMEOUT_MS + 1U - elapsed);
+        }
+        else {
+            deadline = deadline_min(deadline, ON_WIRE_SIZE(0) <= min_tx_space() ? 0U : TRANSPORT_TX_RETRY_MS);
+        }
+    }
+#endif // DISABLE_TRANSPORT_ACK_RETRANSMIT
+#endif // TRANSPORT_PROTOCOL
+    return deadline;
+}
+
+// Feeds received data into the context, for use as a subscriber of the serial data
+void MinProtocol::min_rx_data(const FrameSpan &data)
+{
+    min_poll(const_cast<uint8_t *>(data.data), data.length);
+}
+
+MinProtocol::MinProtocol(ISerialCommunication *serial, ISystem *system, ICommandInterpreter *cmd, void *context)
 {
     this->serial = serial;
     this->system = system;
     this->cmd = cmd;
 
-    self = static_cast<min_context *>(malloc(sizeof (struct min_context)));
+    owns_context = (context == nullptr);
+    self = static_cast<min_context *>(owns_context ? malloc(sizeof (struct min_context)) : context);
 
     // Initialize context
     self->rx_header_bytes_seen = 0;
@@ -669,16 +1567,54 @@ MinProtocol::MinProtocol(ISerialCommunication *serial, ISystem *system, ICommand
     self->transport_fifo.sequence_mismatch_drop = 0;
     self->transport_fifo.dropped_frames = 0;
     self->transport_fifo.resets_received = 0;
-    self->transport_fifo.n_ring_buffer_bytes_max = 0;
-    self->transport_fifo.n_frames_max = 0;
+    self->features = MIN_DEFAULT_FEATURES;
+    self->max_payload = MAX_FRAME_PAYLOAD;
+    self->max_window = TRANSPORT_MAX_WINDOW_SIZE;
+    self->transport_fifo.window_decreases = 0;
+#ifdef PAYLOAD_COMPRESSION
+    self->compressed_bytes_in = 0;
+    self->compressed_bytes_out = 0;
+    self->uncompressed_frames = 0;
+    self->decompress_errors = 0;
+#endif
+#if defined(PAYLOAD_COMPRESSION) || defined(FRAME_BATCHING)
+    self->reserved_to = RESERVED_NONE;
+#endif
+#ifdef FRAME_BATCHING
+    self->batch_deadline_us = MIN_DEFAULT_BATCH_DEADLINE_US;
+    self->batch_limit = MAX_FRAME_PAYLOAD;
+    self->batch_opened_us = 0;
+    self->batched_frames = 0;
+    self->batches_sent = 0;
+    self->batch_errors = 0;
+#endif
+    transport_lane_init(&self->transport_fifo.lanes[TRANSPORT_LANE_REALTIME],
+                        self->transport_fifo.realtime_frames, TRANSPORT_REALTIME_FIFO_MAX_FRAMES,
+                        self->transport_fifo.realtime_ring_buffer, TRANSPORT_REALTIME_FIFO_MAX_FRAME_DATA);
+    transport_lane_init(&self->transport_fifo.lanes[TRANSPORT_LANE_BULK],
+                        self->transport_fifo.bulk_frames, TRANSPORT_FIFO_MAX_FRAMES,
+                        self->transport_fifo.bulk_ring_buffer, TRANSPORT_FIFO_MAX_FRAME_DATA);
     transport_fifo_reset();
 #endif // TRANSPORT_PROTOCOL
 }
 
+// Largest payload of a frame to the other side: MAX_PAYLOAD, more once both sides agreed on extended frames
+uint16_t MinProtocol::min_max_payload()
+{
+#if defined(TRANSPORT_PROTOCOL) && defined(EXTENDED_FRAMES)
+    if(self->features & self->transport_fifo.remote_features & MIN_FEATURE_EXTENDED_FRAMES) {
+        uint16_t remote = self->transport_fifo.remote_max_payload;
+        uint16_t limit = remote < self->max_payload ? remote : self->max_payload;
+        return limit > MAX_PAYLOAD ? limit : static_cast<uint16_t>(MAX_PAYLOAD);
+    }
+#endif
+    return MAX_PAYLOAD;
+}
+
 // Sends an application MIN frame on the wire (do not put into the transport queue)
-void MinProtocol::min_send_frame(uint8_t min_id, uint8_t *payload, uint8_t payload_len)
+void MinProtocol::min_send_frame(uint8_t min_id, uint8_t *payload, uint16_t payload_len)
 {
-    if((ON_WIRE_SIZE(payload_len) <= min_tx_space())) {
+    if(payload_len <= min_max_payload() && (ON_WIRE_SIZE(payload_len) <= min_tx_space())) {
         on_wire_bytes(min_id & static_cast<uint8_t>(0x3fU), 0, payload, 0, 0xffffU, payload_len);
     }
 }
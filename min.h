@@ -5,8 +5,9 @@
 // send data from a UART on a small MCU over a UART-USB converter plugged into a PC host. A Python implementation
 // of host code is provided (or this code could be compiled for a PC).
 //
-// MIN supports frames of 0-255 bytes (with a lower limit selectable at compile time to reduce RAM). MIN frames
-// have identifier values between 0 and 63.
+// MIN supports frames of 0-254 bytes (with a lower limit selectable at compile time to reduce RAM). MIN frames
+// have identifier values between 0 and 63. Extended frames, when both sides support them, carry up to
+// MAX_EXTENDED_PAYLOAD bytes: their length byte is 255 followed by the length in two bytes, big-endian.
 //
 // An optional transport layer T-MIN can be compiled in. This provides sliding window reliable transmission of frames.
 //
@@ -18,6 +19,32 @@
 // -  Define MAX_PAYLOAD if the size of the frames is to be limited. This is particularly useful with the transport
 //    protocol where a deep FIFO is wanted but not for large frames.
 //
+// -  Define NO_PAYLOAD_COMPRESSION to remove the compression of bulk transport frames (mincodec.h).
+//
+// -  Define NO_EXTENDED_FRAMES to remove the extended frames, or MAX_EXTENDED_PAYLOAD to limit their size.
+//
+// -  Define NO_FRAME_BATCHING to remove the aggregation of small bulk frames. When the other side unpacks
+//    batches, min_queue_frame() collects bulk frames into one frame of MIN_BATCH_ID (records of ID, length and
+//    payload) until it is full or until the batch deadline expires. While the bulk lane still has frames
+//    waiting for the window the batch keeps filling, it could not go out earlier anyway. The other side passes
+//    the frames of a batch up one by one, in order. The realtime lane is never batched.
+//
+// Features of the two sides are negotiated in the RESET frame. Its payload carries the features of the sender,
+// the largest payload and the largest window it can receive. The other side resets and answers with a RESET
+// marked as a reply carrying its own; the reply does not reset anything. A side that does not know the
+// negotiation ignores the payload and never answers, so a feature is only used when both sides announced it.
+//
+// The window of frames in flight adapts to the link, AIMD-style: it grows by a frame per round trip while
+// frames get through (doubling per round trip from TRANSPORT_INITIAL_WINDOW until the first loss) and halves
+// when the retransmit timeout fires. A receiver announcing MIN_FEATURE_NACKS asks once for the frames missing
+// after a gap in the sequence (a NAK); they and the rest of the window are sent again at once without a
+// decrease, on a serial line an isolated loss is a corrupted byte, not a full buffer. With such a receiver a
+// timeout means it stopped answering and the window goes down to TRANSPORT_MIN_WINDOW; with one that never
+// asks every loss ends in a timeout and the window stays at TRANSPORT_INITIAL_WINDOW or more. The
+// retransmit timeout follows the measured round trip time, which includes the time frames wait in the
+// transmit buffer. Sequence numbers stay 8-bit on the wire: go-back-N
+// allows a window of up to 128 frames with them.
+//
 // The API is as follows:
 //
 // -  min_init_context()
@@ -31,12 +58,23 @@
 //
 // -  min_queue_frame()
 //    This queues a transport frame which will will be retransmitted until the other side receives it correctly.
+//    min_queue_frame_gather() takes the payload in fragments (e.g. a header and a body) and copies each once.
+//
+// -  min_queue_begin(), min_queue_commit()
+//    These queue a transport frame without building its payload first: min_queue_begin() reserves the space and
+//    returns where the payload goes, in one or two spans as the FIFO is a ring buffer. The caller writes it
+//    there (min_queue_message() encodes straight into it) and calls min_queue_commit().
 //
 // -  min_poll()
 //    This passes in received bytes to the context associated with the source. Note that if the transport protocol
 //    is included then this must be called regularly to operate the transport state machine even if there are no
 //    incoming bytes.
 //
+// -  min_next_deadline_ms()
+//    Instead of calling min_poll() at a fixed period, it can be called when this says: the time until the next
+//    frame to send, retransmit, ACK or batch deadline. Received data and newly queued frames need a min_poll()
+//    of their own, without them an idle link needs none.
+//
 // There are several callbacks: these must be provided by the programmer and are called by the library:
 //
 // -  min_tx_space()
@@ -55,6 +93,9 @@
 // -  min_time_ms()
 //    This is called to obtain current time in milliseconds. This is used by the MIN transport protocol to drive
 //    timeouts and retransmits.
+//
+// -  min_time_us()
+//    Current time in microseconds, for the batch deadline.
 
 
 #ifndef MIN_H
@@ -66,6 +107,8 @@
 #include "iserialcommunication.h"
 #include "isystem.h"
 #include "icommandinterpreter.h"
+#include "messages.h"
+#include "delegate.h"
 
 #ifdef ASSERTION_CHECKING
 #include <assert.h>
@@ -75,28 +118,103 @@
 #define TRANSPORT_PROTOCOL
 #endif
 
+// Compressed frames rely on the transport for their order
+#if !defined(NO_PAYLOAD_COMPRESSION) && defined(TRANSPORT_PROTOCOL)
+#define PAYLOAD_COMPRESSION
+#include "mincodec.h"
+#endif
+
+#if !defined(NO_FRAME_BATCHING) && defined(TRANSPORT_PROTOCOL)
+#define FRAME_BATCHING
+#endif
+
+// ID of a frame carrying a batch of frames
+#define MIN_BATCH_ID                                (0x3dU)
+// Longest a batch waits for more frames when the line is free, unless set otherwise
+#ifndef MIN_DEFAULT_BATCH_DEADLINE_US
+#define MIN_DEFAULT_BATCH_DEADLINE_US               (2000U)
+#endif
+
+// min_next_deadline_ms() when nothing is due until data is received or a frame is queued
+#define MIN_NO_DEADLINE                             (0xffffffffU)
+
 #ifndef MAX_PAYLOAD
 #define MAX_PAYLOAD                                 (254U)
 #endif
 
-// Powers of two for FIFO management. Default is 16 frames in the FIFO, total of 1024 bytes for frame data
+#ifndef NO_EXTENDED_FRAMES
+#define EXTENDED_FRAMES
+#endif
+
+#ifdef EXTENDED_FRAMES
+// A little under 4 Kbytes, so the largest frame fits in the 4 Kbyte serial transmit buffer
+#ifndef MAX_EXTENDED_PAYLOAD
+#define MAX_EXTENDED_PAYLOAD                        (4064U)
+#endif
+// Largest payload of any frame, the size of the receive buffer
+#define MAX_FRAME_PAYLOAD                           (MAX_EXTENDED_PAYLOAD)
+#else
+#define MAX_FRAME_PAYLOAD                           (MAX_PAYLOAD)
+#endif
+
+// Powers of two for FIFO management. Default is 128 frames in the FIFO so it can fill the largest window,
+// total of 8 Kbytes for frame data, 32 Kbytes with extended frames so a window of full batches fits
 #ifndef TRANSPORT_FIFO_SIZE_FRAMES_BITS
-#define TRANSPORT_FIFO_SIZE_FRAMES_BITS             (4U)
+#define TRANSPORT_FIFO_SIZE_FRAMES_BITS             (7U)
 #endif
 #ifndef TRANSPORT_FIFO_SIZE_FRAME_DATA_BITS
-#define TRANSPORT_FIFO_SIZE_FRAME_DATA_BITS         (10U)
+#ifdef EXTENDED_FRAMES
+#define TRANSPORT_FIFO_SIZE_FRAME_DATA_BITS         (15U)
+#else
+#define TRANSPORT_FIFO_SIZE_FRAME_DATA_BITS         (13U)
+#endif
 #endif
 
 #define TRANSPORT_FIFO_MAX_FRAMES                   (1U << TRANSPORT_FIFO_SIZE_FRAMES_BITS)
 #define TRANSPORT_FIFO_MAX_FRAME_DATA               (1U << TRANSPORT_FIFO_SIZE_FRAME_DATA_BITS)
 
-#if (MAX_PAYLOAD > 255)
-#error "MIN frame payloads can be no bigger than 255 bytes"
+// The realtime lane is small: default is 4 frames, total of 64 bytes for frame data
+#ifndef TRANSPORT_REALTIME_FIFO_SIZE_FRAMES_BITS
+#define TRANSPORT_REALTIME_FIFO_SIZE_FRAMES_BITS    (2U)
+#endif
+#ifndef TRANSPORT_REALTIME_FIFO_SIZE_FRAME_DATA_BITS
+#define TRANSPORT_REALTIME_FIFO_SIZE_FRAME_DATA_BITS (6U)
+#endif
+
+#define TRANSPORT_REALTIME_FIFO_MAX_FRAMES          (1U << TRANSPORT_REALTIME_FIFO_SIZE_FRAMES_BITS)
+#define TRANSPORT_REALTIME_FIFO_MAX_FRAME_DATA      (1U << TRANSPORT_REALTIME_FIFO_SIZE_FRAME_DATA_BITS)
+
+// Number of frames sent but not yet acknowledged. Must be a power of two, the frames in flight are indexed by seq.
+#ifndef TRANSPORT_MAX_WINDOW_SIZE
+#define TRANSPORT_MAX_WINDOW_SIZE                   (128U)
+#endif
+
+// Window a link starts with, also the largest one used with a side that does not announce its window
+#ifndef TRANSPORT_INITIAL_WINDOW
+#define TRANSPORT_INITIAL_WINDOW                    (16U)
+#endif
+
+// Window slots bulk frames can't take, so a realtime frame never has to wait for an ACK to go on the wire
+#ifndef TRANSPORT_REALTIME_RESERVED_WINDOW
+#define TRANSPORT_REALTIME_RESERVED_WINDOW          (1U)
+#endif
+
+// Length 255 marks an extended frame
+#if (MAX_PAYLOAD > 254)
+#error "MIN frame payloads can be no bigger than 254 bytes"
+#endif
+
+#if defined(EXTENDED_FRAMES) && ((MAX_EXTENDED_PAYLOAD <= MAX_PAYLOAD) || (MAX_EXTENDED_PAYLOAD > 16384))
+#error "Extended frame payloads must be bigger than MAX_PAYLOAD and no bigger than 16Kbytes"
 #endif
 
-// Indices into the frames FIFO are uint8_t and so can't have more than 256 frames in a FIFO
-#if (TRANSPORT_FIFO_MAX_FRAMES > 256)
-#error "Transport FIFO frames cannot exceed 256"
+#if (TRANSPORT_FIFO_MAX_FRAME_DATA < MAX_FRAME_PAYLOAD)
+#error "Transport FIFO data must hold the largest frame"
+#endif
+
+// Indices and counts of the frames FIFO are uint8_t and so can't have more than 128 frames in a FIFO
+#if (TRANSPORT_FIFO_MAX_FRAMES > 128)
+#error "Transport FIFO frames cannot exceed 128"
 #endif
 
 // Using a 16-bit offset into the frame data FIFO so it has to be addressable within 64Kbytes
@@ -104,23 +222,105 @@
 #error "Transport FIFO data allocated cannot exceed 64Kbytes"
 #endif
 
+#if ((TRANSPORT_MAX_WINDOW_SIZE & (TRANSPORT_MAX_WINDOW_SIZE - 1U)) != 0) || (TRANSPORT_MAX_WINDOW_SIZE > 128)
+#error "Transport window size must be a power of two no bigger than 128"
+#endif
+
+#if (TRANSPORT_REALTIME_RESERVED_WINDOW >= TRANSPORT_MAX_WINDOW_SIZE)
+#error "Realtime reserved window must leave space for bulk frames"
+#endif
+
+#if (TRANSPORT_INITIAL_WINDOW <= TRANSPORT_REALTIME_RESERVED_WINDOW) || (TRANSPORT_INITIAL_WINDOW > TRANSPORT_MAX_WINDOW_SIZE)
+#error "Initial window must leave space for bulk frames and be no bigger than the window"
+#endif
+
+// Priority lanes of the transport. A frame of a higher priority lane (lower number) is put on the
+// wire before any frame of a lower priority lane which has not been sent yet. Within a lane the
+// order is kept. All lanes share the sequence numbers so the other side sees a single stream.
+enum {
+    TRANSPORT_LANE_REALTIME = 0,                    // Emergency stop, pause, feed-rate override
+    TRANSPORT_LANE_BULK = 1,                        // G-code stream
+    TRANSPORT_LANES = 2,
+};
+
+// Features announced in the RESET frame
+enum {
+    MIN_FEATURE_COMPRESSION = 0x01U,                // Decodes compressed payloads
+    MIN_FEATURE_EXTENDED_FRAMES = 0x02U,            // Receives extended frames
+    MIN_FEATURE_BATCHES = 0x04U,                    // Unpacks batches of frames
+    MIN_FEATURE_NACKS = 0x08U,                      // Asks for the frames missing after a gap
+};
+
+#ifdef PAYLOAD_COMPRESSION
+#define MIN_FEATURES_COMPRESSION                    (MIN_FEATURE_COMPRESSION)
+#else
+#define MIN_FEATURES_COMPRESSION                    (0U)
+#endif
+#ifdef EXTENDED_FRAMES
+#define MIN_FEATURES_EXTENDED_FRAMES                (MIN_FEATURE_EXTENDED_FRAMES)
+#else
+#define MIN_FEATURES_EXTENDED_FRAMES                (0U)
+#endif
+#ifdef FRAME_BATCHING
+#define MIN_FEATURES_BATCHES                        (MIN_FEATURE_BATCHES)
+#else
+#define MIN_FEATURES_BATCHES                        (0U)
+#endif
+#define MIN_DEFAULT_FEATURES                        (MIN_FEATURES_COMPRESSION | MIN_FEATURES_EXTENDED_FRAMES | MIN_FEATURES_BATCHES | MIN_FEATURE_NACKS)
+
 #ifdef TRANSPORT_PROTOCOL
 
+// Space reserved by min_queue_begin(), the second span is empty unless the payload wraps
+struct min_reservation {
+    uint8_t *span[2];
+    uint16_t span_len[2];
+};
+
 struct crc32_context {
     uint32_t crc;
 };
 
 struct transport_frame {
     uint32_t last_sent_time_ms;                     // When frame was last sent (used for re-send timeouts)
+    uint32_t queued_time_ms;                        // When frame was queued (used for latency diagnostics)
     uint16_t payload_offset;                        // Where in the ring buffer the payload is
-    uint8_t payload_len;                            // How big the payload is
+    uint16_t payload_len;                           // How big the payload is
     uint8_t min_id;                                 // ID of frame
     uint8_t seq;                                    // Sequence number of frame
-    char m_padding[3];                              // Padding
+    uint8_t lane;                                   // Priority lane of frame
+    uint8_t n_commands;                             // Frames of the application it carries, more than 1 for a batch
+    bool retransmitted;                             // Sent more than once, its ACK says nothing about the round trip
+};
+
+struct transport_lane {
+    struct transport_frame *frames;                 // Frame slots of this lane
+    uint8_t *ring_buffer;                           // Payload data of this lane
+    uint32_t dropped_frames;                        // Diagnostic counters
+    uint32_t worst_latency_ms;                      // Longest time from queueing to the first transmission
+    uint32_t n_queued_total;                        // Frames ever queued in the lane, less the ones thrown away by a reset
+    uint32_t n_acked_total;                         // Frames ever ACKed by the other side
+                                                    // (both count the frames in batches one by one)
+    uint16_t max_frames;                            // Size of the lane
+    uint16_t max_frame_data;
+    uint16_t ring_buffer_mask;
+    uint16_t n_ring_buffer_bytes;                   // Number of bytes used in the payload ring buffer
+    uint16_t n_ring_buffer_bytes_max;               // Largest number of bytes ever used
+    uint16_t ring_buffer_tail_offset;               // Tail of the payload ring buffer
+    uint8_t frames_mask;
+    uint8_t n_frames;                               // Number of frames in the lane
+    uint8_t n_frames_max;                           // Larger number of frames in the lane
+    uint8_t n_sent;                                 // Frames of this lane in the window (sent, not yet ACKed)
+    uint8_t head_idx;                               // Where frames are taken from in the lane
+    uint8_t tail_idx;                               // Where new frames are added
 };
 
 struct transport_fifo {
-    struct transport_frame frames[TRANSPORT_FIFO_MAX_FRAMES];
+    struct transport_lane lanes[TRANSPORT_LANES];
+    struct transport_frame *window[TRANSPORT_MAX_WINDOW_SIZE]; // Frames in flight, indexed by seq
+    struct transport_frame realtime_frames[TRANSPORT_REALTIME_FIFO_MAX_FRAMES];
+    struct transport_frame bulk_frames[TRANSPORT_FIFO_MAX_FRAMES];
+    uint8_t realtime_ring_buffer[TRANSPORT_REALTIME_FIFO_MAX_FRAME_DATA];
+    uint8_t bulk_ring_buffer[TRANSPORT_FIFO_MAX_FRAME_DATA];
     uint32_t last_sent_ack_time_ms;
     uint32_t last_received_anything_ms;
     uint32_t last_received_frame_ms;
@@ -128,13 +328,20 @@ struct transport_fifo {
     uint32_t spurious_acks;
     uint32_t sequence_mismatch_drop;
     uint32_t resets_received;
-    uint16_t n_ring_buffer_bytes;                   // Number of bytes used in the payload ring buffer
-    uint16_t n_ring_buffer_bytes_max;               // Largest number of bytes ever used
-    uint16_t ring_buffer_tail_offset;               // Tail of the payload ring buffer
-    uint8_t n_frames;                               // Number of frames in the FIFO
-    uint8_t n_frames_max;                           // Larger number of frames in the FIFO
-    uint8_t head_idx;                               // Where frames are taken from in the FIFO
-    uint8_t tail_idx;                               // Where new frames are added
+    uint32_t window_decreases;
+    uint32_t srtt_ms_x8;                            // Smoothed round trip time, eighths of a millisecond, 0 until measured
+    uint32_t rttvar_ms_x4;                          // Its mean deviation, quarters of a millisecond
+    uint32_t rtt_min_ms;                            // Shortest round trip seen
+    uint32_t retransmit_timeout_ms;                 // From the two above, TRANSPORT_FRAME_RETRANSMIT_TIMEOUT_MS until measured
+    uint16_t remote_max_payload;                    // Largest payload the other side receives, MAX_PAYLOAD until it answered
+    uint8_t remote_features;                        // MIN_FEATURE_* of the other side, 0 until it answered a RESET
+    uint8_t remote_window;                          // Largest window the other side takes, TRANSPORT_INITIAL_WINDOW until it answered
+    uint8_t cwnd;                                   // Congestion window, frames
+    uint8_t ssthresh;                               // Below it the window doubles per round trip, above it grows by one
+    uint8_t cwnd_acked;                             // Frames ACKed since the window last grew by one
+    uint8_t recover;                                // sn_max at the last decrease, no other one until it is ACKed
+    bool in_recovery;
+    bool nack_sent;                                 // The missing frame rn was asked for, once until it arrives
     uint8_t sn_min;                                 // Sequence numbers for transport protocol
     uint8_t sn_max;
     uint8_t rn;
@@ -144,18 +351,47 @@ struct transport_fifo {
 struct min_context {
 #ifdef TRANSPORT_PROTOCOL
     struct transport_fifo transport_fifo;           // T-MIN queue of outgoing frames
+    uint16_t max_payload;                           // Largest payload this side sends in an extended frame
+    uint8_t max_window;                             // Largest window this side sends with
+    uint8_t features;                               // MIN_FEATURE_* of this side
+#endif
+#ifdef PAYLOAD_COMPRESSION
+    struct min_encoder tx_encoder;                  // Window of the bulk frames sent compressed
+    struct min_codec rx_decoder;                    // Window of the frames received compressed
+    uint8_t rx_decoded_buf[MAX_FRAME_PAYLOAD];
+    bool rx_decoder_failed;                         // A payload did not decode, the window is lost until a reset
+    uint32_t compressed_bytes_in;                   // Payload bytes of the frames sent compressed
+    uint32_t compressed_bytes_out;                  // Their compressed size
+    uint32_t uncompressed_frames;                   // Bulk frames which did not get shorter
+    uint32_t decompress_errors;
+#endif
+#if defined(PAYLOAD_COMPRESSION) || defined(FRAME_BATCHING)
+    uint8_t stage_buf[MAX_FRAME_PAYLOAD];           // Open batch of bulk frames, or a frame written before it is compressed
+    uint16_t reserved_len;                          // Frame between min_queue_begin() and min_queue_commit()
+    uint8_t reserved_min_id;
+    uint8_t reserved_to;                            // Where it is written if not in the FIFO
+#endif
+#ifdef FRAME_BATCHING
+    uint16_t batch_len;
+    uint8_t batch_frames;                           // Frames in the open batch
+    uint32_t batch_opened_us;                       // When its first frame came
+    uint32_t batch_deadline_us;                     // Longest the batch waits while the line is free, 0 if batching is off
+    uint16_t batch_limit;                           // Largest batch payload for the speed of the line
+    uint32_t batched_frames;                        // Diagnostic counters
+    uint32_t batches_sent;
+    uint32_t batch_errors;                          // Received batches which did not parse to the end
 #endif
-    uint8_t rx_frame_payload_buf[MAX_PAYLOAD];      // Payload received so far
+    uint8_t rx_frame_payload_buf[MAX_FRAME_PAYLOAD]; // Payload received so far
     uint32_t rx_frame_checksum;                     // Checksum received over the wire
     struct crc32_context rx_checksum;               // Calculated checksum for receiving frame
     struct crc32_context tx_checksum;               // Calculated checksum for sending frame
+    uint16_t rx_frame_payload_bytes;                // Length of payload received so far
+    uint16_t rx_frame_length;                       // Length of frame
+    uint16_t rx_control;                            // Length of payload of the frame
     uint8_t rx_header_bytes_seen;                   // Countdown of header bytes to reset state
     uint8_t rx_frame_state;                         // State of receiver
-    uint8_t rx_frame_payload_bytes;                 // Length of payload received so far
     uint8_t rx_frame_id_control;                    // ID and control bit of frame being received
     uint8_t rx_frame_seq;                           // Sequence number of frame being received
-    uint8_t rx_frame_length;                        // Length of frame
-    uint8_t rx_control;                             // Control byte
     uint8_t tx_header_byte_countdown;               // Count out the header bytes
 };
 
@@ -166,40 +402,139 @@ private:
     ISystem *system;
     ICommandInterpreter *cmd;
     min_context *self;
+    bool owns_context;                              // Context allocated by the constructor
 
     void crc32_init_context(struct crc32_context *context);
     void crc32_step(struct crc32_context *context, uint8_t byte);
     uint32_t crc32_finalize(struct crc32_context *context);
     void stuffed_tx_byte(uint8_t byte);
-    void on_wire_bytes(uint8_t id_control, uint8_t seq, uint8_t *payload_base, uint16_t payload_offset, uint16_t payload_mask, uint8_t payload_len);
-    void transport_fifo_pop();
-    struct transport_frame *transport_fifo_push(uint16_t data_size);
-    struct transport_frame *transport_fifo_get(uint8_t n);
+    void on_wire_bytes(uint8_t id_control, uint8_t seq, uint8_t *payload_base, uint16_t payload_offset, uint16_t payload_mask, uint16_t payload_len);
+    void transport_lane_init(struct transport_lane *lane, struct transport_frame *frames, uint16_t max_frames, uint8_t *ring_buffer, uint16_t max_frame_data);
+    void transport_fifo_pop(struct transport_lane *lane);
+    struct transport_frame *transport_fifo_push(uint8_t lane_idx, uint16_t data_size);
+    struct transport_frame *transport_fifo_next(uint8_t window_size);
+    uint8_t transport_window();
+    void retransmit_timeout_update();
+    void window_acked(uint8_t num_acked, uint8_t num_in_window, struct transport_frame *last_acked);
+    void window_lost(struct transport_frame *frame, bool timed_out);
     void transport_fifo_send(struct transport_frame *frame);
     void send_ack();
-    void send_reset();
+    void send_nack(uint8_t to);
+    void send_reset(bool reply);
     void transport_fifo_reset();
     struct transport_frame *find_retransmit_frame();
     void valid_frame_received();
+    void rx_length(uint16_t length);
     void rx_byte(uint8_t byte);
     uint16_t min_tx_space();
     void min_tx_byte(uint8_t byte);
     void min_tx_start();
     void min_tx_finished();
-    void min_application_handler(uint8_t min_id, uint8_t *min_payload, uint8_t len_payload);
+    void min_application_handler(uint8_t min_id, uint8_t *min_payload, uint16_t len_payload);
+    #ifdef TRANSPORT_PROTOCOL
+    struct transport_frame *min_queue_reserve(uint8_t min_id, uint16_t payload_len, uint8_t lane, uint8_t n_commands = 1U);
+    void transport_fifo_spans(struct transport_frame *frame, struct min_reservation *reservation);
+    bool min_queue_payload(uint8_t min_id, const uint8_t *payload, uint16_t payload_len, uint8_t lane, uint8_t n_commands);
+    bool transport_fifo_has_space(uint8_t lane_idx, uint16_t n_frames, uint16_t data_size);
+    #endif
+    #ifdef PAYLOAD_COMPRESSION
+    bool min_queue_compressed(uint8_t min_id, const uint8_t *payload, uint16_t payload_len, uint8_t n_commands);
+    #endif
+    #ifdef FRAME_BATCHING
+    uint16_t batch_max();
+    bool batch_fits(uint16_t payload_len);
+    bool batch_flush();
+    uint16_t batch_queued_len();
+    void rx_batch(uint8_t *payload, uint16_t payload_len);
+    #endif
 
     #ifdef TRANSPORT_PROTOCOL
     uint32_t min_time_ms(void);
+    uint32_t min_time_us(void);
     #endif
 public:
-    MinProtocol(ISerialCommunication *serial, ISystem *system, ICommandInterpreter *cmd);
+    // context, if given, is min_context_size() bytes of memory the caller owns, suitably aligned; by default
+    // the context is allocated with malloc()
+    MinProtocol(ISerialCommunication *serial, ISystem *system, ICommandInterpreter *cmd, void *context = nullptr);
     ~MinProtocol();
+    static size_t min_context_size();
     void min_transport_reset(bool inform_other_side);
     void min_poll(uint8_t *buf, uint32_t buf_len);
-    void min_send_frame(uint8_t min_id, uint8_t *payload, uint8_t payload_len);
+    uint32_t min_next_deadline_ms();
+    void min_rx_data(const FrameSpan &data);
+    void min_send_frame(uint8_t min_id, uint8_t *payload, uint16_t payload_len);
+    uint16_t min_max_payload();
     #ifdef TRANSPORT_PROTOCOL
-    bool min_queue_frame(uint8_t min_id, uint8_t *payload, uint8_t payload_len);
-    bool min_queue_has_space_for_frame(uint8_t payload_len);
+    bool min_queue_frame(uint8_t min_id, uint8_t *payload, uint16_t payload_len, uint8_t lane = TRANSPORT_LANE_BULK);
+    bool min_queue_frame_gather(uint8_t min_id, const FrameSpan *parts, uint8_t n_parts, uint8_t lane = TRANSPORT_LANE_BULK);
+    bool min_queue_begin(uint8_t min_id, uint16_t payload_len, struct min_reservation *reservation, uint8_t lane = TRANSPORT_LANE_BULK);
+    void min_queue_commit();
+    bool min_queue_has_space_for_frame(uint16_t payload_len, uint8_t lane = TRANSPORT_LANE_BULK);
+    uint32_t min_queue_worst_latency_ms(uint8_t lane);
+    uint32_t min_queue_queued_count(uint8_t lane);
+    uint32_t min_queue_acked_count(uint8_t lane);
+    uint32_t min_resets_received();
+    void min_set_features(uint8_t features);
+    void min_set_max_payload(uint16_t max_payload);
+    uint8_t min_remote_features();
+    bool min_compression_active();
+    uint32_t min_compressed_bytes_in();
+    uint32_t min_compressed_bytes_out();
+    uint32_t min_decompress_errors();
+    void min_set_batch_deadline_us(uint32_t deadline_us);
+    void min_set_line_rate(uint32_t bytes_per_s);
+    void min_set_max_window(uint8_t max_window);
+    uint8_t min_window();
+    uint32_t min_round_trip_ms();
+    uint32_t min_retransmit_timeout_ms();
+    bool min_batching_active();
+    uint32_t min_batched_frames();
+    uint32_t min_batches_sent();
+    #endif
+
+    // Encodes a message from messages.h and sends it without the transport
+    template <class Message>
+    void min_send_message(const Message &msg)
+    {
+        uint8_t payload[Message::wire_size + 1U];
+        FlatWriter writer(payload);
+        msg.encode(writer);
+        min_send_frame(static_cast<uint8_t>(Message::id), payload, static_cast<uint16_t>(Message::wire_size));
+    }
+
+    #ifdef TRANSPORT_PROTOCOL
+    // Encodes a message from messages.h straight into the space reserved for it: the transport FIFO, the
+    // open batch or the buffer it is compressed from
+    template <class Message>
+    bool min_queue_message(const Message &msg, uint8_t lane = TRANSPORT_LANE_BULK)
+    {
+        struct min_reservation reservation;
+        if(!min_queue_begin(static_cast<uint8_t>(Message::id), static_cast<uint16_t>(Message::wire_size), &reservation, lane)) {
+            return false;
+        }
+        SpanWriter writer(reservation.span[0], reservation.span_len[0], reservation.span[1]);
+        msg.encode(writer);
+        min_queue_commit();
+        return true;
+    }
+
+    // As above, the payload is the message followed by tail_len bytes of tail (e.g. text of a G-code line)
+    template <class Message>
+    bool min_queue_message(const Message &msg, const uint8_t *tail, uint16_t tail_len, uint8_t lane = TRANSPORT_LANE_BULK)
+    {
+        if(Message::wire_size + tail_len > min_max_payload()) {
+            return false;
+        }
+        struct min_reservation reservation;
+        if(!min_queue_begin(static_cast<uint8_t>(Message::id), static_cast<uint16_t>(Message::wire_size + tail_len), &reservation, lane)) {
+            return false;
+        }
+        SpanWriter writer(reservation.span[0], reservation.span_len[0], reservation.span[1]);
+        msg.encode(writer);
+        writer.write(tail, tail_len);
+        min_queue_commit();
+        return true;
+    }
     #endif
 };
 
@@ -0,0 +1,190 @@
+#include "mincodec.h"
+#include <string.h>
+
+// Common G-code tokens, in the window after every reset. The most frequent ones are at the end,
+// next to the first line. Changing it breaks compatibility with firmware built with the old one.
+static const char dictionary[] =
+    "M104 S M109 S M140 S M190 S M106 S255 M107 M105 M82 M83 M84 G21 G28 G29 G90 G91 "
+    "M201 X M203 X M204 P M205 X M220 S100 M221 S100 M900 K T0 T1 G4 P G4 S G10 G11 "
+    "G2 X G2 I G3 X G3 I J R G92 E0 G0 Z G1 Z0.2 G1 Z F600 F900 F1200 F1500 F1800 F2100 "
+    "F2400 F2700 F3000 F3600 F4200 F4800 F5400 F6000 F7200 F7800 F9000 F10800 F12000 "
+    "G1 E-0.8 G1 E-1 G1 E-2 G1 E0.8 G1 E1 G1 E2 .0000 .5000 0.1 0.2 0.3 0.4 0.5 0.6 "
+    "0.7 0.8 0.9 1.0 1.5 .125 .250 .375 .625 .750 .875 "
+    "X10 X11 X12 X13 X14 X15 X16 X17 X18 X19 X20 Y10 Y11 Y12 Y13 Y14 Y15 Y16 Y17 Y18 Y19 Y20 "
+    "G0 F G0 X G0 Y G1 F G1 Y G1 X1 Y1 E G1 X Y E";
+
+#define DICTIONARY_LENGTH               (sizeof(dictionary) - 1U)
+
+static_assert(DICTIONARY_LENGTH < MIN_CODEC_WINDOW, "MIN codec dictionary must fit in the window");
+
+static void window_fill(uint8_t *window)
+{
+    memset(window, 0, MIN_CODEC_WINDOW - DICTIONARY_LENGTH);
+    memcpy(window + MIN_CODEC_WINDOW - DICTIONARY_LENGTH, dictionary, DICTIONARY_LENGTH);
+}
+
+void min_codec_reset(struct min_codec *codec)
+{
+    window_fill(codec->window);
+    codec->pos = 0;
+}
+
+int16_t min_codec_decode(struct min_codec *codec, const uint8_t *in, uint16_t in_len, uint8_t *out, uint16_t out_max)
+{
+    uint16_t n = 0;
+    uint16_t i = 0;
+
+    while(i < in_len) {
+        uint8_t token = in[i++];
+        if(token < 0x80U || token == MIN_CODEC_ESCAPE) {
+            if(token == MIN_CODEC_ESCAPE) {
+                if(i == in_len) {
+                    return -1;
+                }
+                token = in[i++];
+            }
+            if(n == out_max) {
+                return -1;
+            }
+            out[n++] = token;
+            codec->window[codec->pos] = token;
+            codec->pos = (codec->pos + 1U) & MIN_CODEC_WINDOW_MASK;
+        }
+        else {
+            if(i == in_len) {
+                return -1;
+            }
+            uint8_t length = static_cast<uint8_t>(((token >> 2) & 0x1fU) + MIN_CODEC_MIN_MATCH);
+            uint16_t distance = static_cast<uint16_t>(((token & 0x03U) << 8) | in[i++]);
+            if(distance == 0 || length > out_max - n) {
+                return -1;
+            }
+            // Byte by byte, an overlapping copy repeats the bytes just produced
+            for(uint8_t k = 0; k < length; k++) {
+                uint8_t byte = codec->window[(codec->pos - distance) & MIN_CODEC_WINDOW_MASK];
+                out[n++] = byte;
+                codec->window[codec->pos] = byte;
+                codec->pos = (codec->pos + 1U) & MIN_CODEC_WINDOW_MASK;
+            }
+        }
+    }
+    return static_cast<int16_t>(n);
+}
+
+static inline uint32_t prefix_hash(uint8_t a, uint8_t b, uint8_t c)
+{
+    uint32_t v = (static_cast<uint32_t>(a) << 16) | (static_cast<uint32_t>(b) << 8) | c;
+    return (v * 2654435761U) >> (32U - MIN_ENCODER_HASH_BITS);
+}
+
+void min_encoder_reset(struct min_encoder *encoder)
+{
+    window_fill(encoder->window);
+    memset(encoder->head, 0, sizeof(encoder->head));
+    memset(encoder->prev, 0, sizeof(encoder->prev));
+
+    // The dictionary ends right before the first payload byte. Positions are absolute and the first
+    // payload is at MIN_CODEC_WINDOW, so position 0 is always too far back to be a match.
+    encoder->pos = MIN_CODEC_WINDOW;
+    for(uint32_t p = MIN_CODEC_WINDOW - DICTIONARY_LENGTH; p + 2U < MIN_CODEC_WINDOW; p++) {
+        uint32_t h = prefix_hash(encoder->window[p], encoder->window[p + 1U], encoder->window[p + 2U]);
+        encoder->prev[p] = encoder->head[h];
+        encoder->head[h] = p;
+    }
+}
+
+// Byte at an absolute position: from the payload being compressed or from the window before it
+static inline uint8_t encoder_byte(const struct min_encoder *encoder, const uint8_t *in, uint16_t in_len, uint32_t p)
+{
+    uint32_t k = p - encoder->pos;
+    return k < in_len ? in[k] : encoder->window[p & MIN_CODEC_WINDOW_MASK];
+}
+
+uint16_t min_encoder_compress(struct min_encoder *encoder, const uint8_t *in, uint16_t in_len, uint8_t *out, uint16_t out_max)
+{
+    uint16_t n = 0;
+    uint16_t j = 0;
+
+    while(j < in_len) {
+        uint32_t cur = encoder->pos + j;
+        uint8_t best_length = 0;
+        uint32_t best_distance = 0;
+
+        if(j + 2U < in_len) {
+            uint32_t h = prefix_hash(in[j], in[j + 1U], in[j + 2U]);
+            uint8_t limit = MIN_CODEC_MAX_MATCH;
+            if(in_len - j < limit) {
+                limit = static_cast<uint8_t>(in_len - j);
+            }
+
+            // Positions of payloads which failed to compress may still be in the chains, every
+            // candidate is compared and a chain which does not go back in the window is cut
+            uint32_t candidate = encoder->head[h];
+            uint32_t last_distance = 0;
+            for(uint8_t depth = 0; depth < MIN_ENCODER_MAX_CHAIN; depth++) {
+                uint32_t distance = cur - candidate;
+                if(distance <= last_distance || distance >= MIN_CODEC_WINDOW) {
+                    break;
+                }
+                uint8_t length = 0;
+                while(length < limit && encoder_byte(encoder, in, in_len, candidate + length) == in[j + length]) {
+                    length++;
+                }
+                // 0xff is the escape, the longest match can't have the top distance bits set
+                if(length == MIN_CODEC_MAX_MATCH && distance >= 0x300U) {
+                    length--;
+                }
+                if(length > best_length) {
+                    best_length = length;
+                    best_distance = distance;
+                    if(length == limit) {
+                        break;
+                    }
+                }
+                last_distance = distance;
+                candidate = encoder->prev[candidate & MIN_CODEC_WINDOW_MASK];
+            }
+
+            encoder->prev[cur & MIN_CODEC_WINDOW_MASK] = encoder->head[h];
+            encoder->head[h] = cur;
+        }
+
+        if(best_length >= MIN_CODEC_MIN_MATCH) {
+            if(n + 2U > out_max) {
+                return 0;
+            }
+            out[n++] = static_cast<uint8_t>(0x80U | ((best_length - MIN_CODEC_MIN_MATCH) << 2) | (best_distance >> 8));
+            out[n++] = static_cast<uint8_t>(best_distance & 0xffU);
+
+            // The skipped positions are still worth finding from later lines
+            for(uint8_t k = 1; k < best_length; k++) {
+                uint32_t p = cur + k;
+                uint16_t jk = static_cast<uint16_t>(j + k);
+                if(jk + 2U < in_len) {
+                    uint32_t hk = prefix_hash(in[jk], in[jk + 1U], in[jk + 2U]);
+                    encoder->prev[p & MIN_CODEC_WINDOW_MASK] = encoder->head[hk];
+                    encoder->head[hk] = p;
+                }
+            }
+            j = static_cast<uint16_t>(j + best_length);
+        }
+        else {
+            uint8_t byte = in[j++];
+            uint8_t size = (byte < 0x80U) ? 1U : 2U;
+            if(n + size > out_max) {
+                return 0;
+            }
+            if(size == 2U) {
+                out[n++] = MIN_CODEC_ESCAPE;
+            }
+            out[n++] = byte;
+        }
+    }
+
+    // Compressed, the payload goes into the window as the decoder will put it
+    for(uint16_t k = 0; k < in_len; k++) {
+        encoder->window[(encoder->pos + k) & MIN_CODEC_WINDOW_MASK] = in[k];
+    }
+    encoder->pos += in_len;
+    return n;
+}
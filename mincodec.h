@@ -0,0 +1,66 @@
+// Payload compression for MIN transport frames.
+//
+// This header is shared with the printer firmware so it must stay plain C++11 without Qt.
+//
+// LZ77 with a preset dictionary. Both sides keep the same window of the last MIN_CODEC_WINDOW payload
+// bytes; after a transport reset it holds the dictionary of common G-code tokens, so even the first
+// line finds "G1 X" and " E" in it. Later lines mostly repeat the ones before them.
+//
+// Only the frames sent compressed go through the window, in the order of their sequence numbers. The
+// transport delivers them exactly once and in that order, so the windows of the two sides never
+// diverge. A frame is compressed once when it is queued, a retransmission sends the same bytes.
+//
+// Format of a compressed payload, a sequence of tokens:
+//
+// -  0x00..0x7f                  literal byte
+// -  0xff, b                     literal byte b (0x80..0xff)
+// -  1LLLLLDD, dddddddd          copy L + 3 bytes from D:d bytes back in the window (1..1023),
+//                                the copy may overlap the bytes it produces
+//
+// The decoder needs MIN_CODEC_WINDOW bytes of RAM and the dictionary in ROM.
+
+#ifndef MINCODEC_H
+#define MINCODEC_H
+
+#include <stdint.h>
+
+// Window size; the token format has 10 bits of distance so it can't be changed
+#define MIN_CODEC_WINDOW                (1024U)
+#define MIN_CODEC_WINDOW_MASK           (MIN_CODEC_WINDOW - 1U)
+
+#define MIN_CODEC_MIN_MATCH             (3U)
+#define MIN_CODEC_MAX_MATCH             (MIN_CODEC_MIN_MATCH + 31U)
+#define MIN_CODEC_ESCAPE                (0xffU)
+
+// Encoder hash table of 3 byte prefixes and the longest chain followed per position
+#define MIN_ENCODER_HASH_BITS           (10U)
+#define MIN_ENCODER_HASH_SIZE           (1U << MIN_ENCODER_HASH_BITS)
+#define MIN_ENCODER_MAX_CHAIN           (16U)
+
+struct min_codec {
+    uint8_t window[MIN_CODEC_WINDOW];               // Last payload bytes, the dictionary after a reset
+    uint16_t pos;                                   // Where the next byte goes, wraps at the window size
+};
+
+struct min_encoder {
+    uint8_t window[MIN_CODEC_WINDOW];
+    uint32_t pos;                                   // Bytes ever put in the window, the dictionary included
+    uint32_t head[MIN_ENCODER_HASH_SIZE];           // Last position of every prefix hash, 0 if none
+    uint32_t prev[MIN_CODEC_WINDOW];                // Previous position with the same hash, by position
+};
+
+// Decoder, both sides
+void min_codec_reset(struct min_codec *codec);
+// Payloads are at most 16 Kbytes (MAX_EXTENDED_PAYLOAD).
+// Returns the length of the decoded payload, -1 if the payload is corrupt or does not fit in out_max.
+// After an error the window no longer matches the other side, the transport has to be reset.
+int16_t min_codec_decode(struct min_codec *codec, const uint8_t *in, uint16_t in_len, uint8_t *out, uint16_t out_max);
+
+// Encoder, host side
+void min_encoder_reset(struct min_encoder *encoder);
+// Compresses a payload into out. Returns the compressed length, 0 if it would not be shorter than
+// out_max; then the window is unchanged and the payload has to be sent uncompressed.
+// A payload compressed is in the window: it must be sent.
+uint16_t min_encoder_compress(struct min_encoder *encoder, const uint8_t *in, uint16_t in_len, uint8_t *out, uint16_t out_max);
+
+#endif // MINCODEC_H
@@ -0,0 +1,303 @@
+#include "motionplanner.h"
+#include <math.h>
+#include <string.h>
+
+// Defaults matching a typical Cartesian printer firmware
+#define PLANNER_DEFAULT_ACCELERATION        (1000.0f)
+#define PLANNER_DEFAULT_JUNCTION_DEVIATION  (0.05f)
+#define PLANNER_DEFAULT_MAX_FEEDRATE        (300.0f)
+
+// Limits of the junction cosine, outside them the junction is treated as straight or reversal
+#define PLANNER_COS_LIMIT                   (0.999999f)
+
+MotionPlanner::MotionPlanner()
+{
+    config = defaultConfig();
+
+    float origin[GCODE_AXES] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    reset(origin);
+}
+
+void MotionPlanner::setConfig(const PlannerConfig &config)
+{
+    this->config = config;
+}
+
+const PlannerConfig &MotionPlanner::getConfig() const
+{
+    return config;
+}
+
+PlannerConfig MotionPlanner::defaultConfig()
+{
+    PlannerConfig config;
+    config.acceleration = PLANNER_DEFAULT_ACCELERATION;
+    config.junctionDeviation = PLANNER_DEFAULT_JUNCTION_DEVIATION;
+    config.maxFeedrate = PLANNER_DEFAULT_MAX_FEEDRATE;
+    return config;
+}
+
+void MotionPlanner::reset(const float *position)
+{
+    for(int a = 0; a < GCODE_AXES; a++)
+        start[a] = position[a];
+    count = 0;
+    planned = 0;
+    ready = 0;
+    taken = 0;
+    flushed = false;
+    entry[0] = 0.0f;
+}
+
+int MotionPlanner::pending() const
+{
+    return count - taken;
+}
+
+bool MotionPlanner::isFull() const
+{
+    return count >= PLANNER_CAPACITY;
+}
+
+bool MotionPlanner::addMove(const GcodeMove &move)
+{
+    if(count >= PLANNER_CAPACITY)
+        return false;
+
+    float moved = 0.0f;
+    for(int a = 0; a < GCODE_AXES; a++)
+    {
+        float previous = (count == 0) ? move.from[a] : target[a][count - 1];
+        moved += fabsf(move.to[a] - previous);
+    }
+    if(moved == 0.0f)
+    {
+        /* Nie ma czego planować, np. G1 z samym F */
+        return true;
+    }
+
+    if(count == 0)
+    {
+        /* Nowa ścieżka po zatrzymaniu */
+        for(int a = 0; a < GCODE_AXES; a++)
+            start[a] = move.from[a];
+        entry[0] = 0.0f;
+        flushed = false;
+    }
+
+    for(int a = 0; a < GCODE_AXES; a++)
+        target[a][count] = move.to[a];
+    feedrate[count] = move.feedrate < config.maxFeedrate ? move.feedrate : config.maxFeedrate;
+    count++;
+
+    if(count - planned >= PLANNER_BATCH)
+        plan();
+    return true;
+}
+
+void MotionPlanner::flush()
+{
+    flushed = true;
+    plan();
+}
+
+/**
+ * Deltas, lengths, unit vectors and nominal speeds of the new segments.
+ */
+void MotionPlanner::computeGeometry(int begin, int end)
+{
+    int first = begin;
+    if(begin == 0)
+    {
+        for(int a = 0; a < GCODE_AXES; a++)
+            delta[a][0] = target[a][0] - start[a];
+        first = 1;
+    }
+    for(int a = 0; a < GCODE_AXES; a++)
+    {
+        for(int i = first; i < end; i++)
+            delta[a][i] = target[a][i] - target[a][i - 1];
+    }
+
+    for(int i = begin; i < end; i++)
+    {
+        float dx = delta[GCODE_X][i];
+        float dy = delta[GCODE_Y][i];
+        float dz = delta[GCODE_Z][i];
+        float de = delta[GCODE_E][i];
+        float xyz = sqrtf(dx * dx + dy * dy + dz * dz);
+        float len = xyz > 0.0f ? xyz : fabsf(de);
+        float inv = xyz > 0.0f ? 1.0f / xyz : 0.0f;
+        length[i] = len;
+        unit[0][i] = dx * inv;
+        unit[1][i] = dy * inv;
+        unit[2][i] = dz * inv;
+        nominal[i] = feedrate[i];
+    }
+}
+
+/**
+ * Maximum entry speed of the new segments from the junction deviation model.
+ */
+void MotionPlanner::computeJunctions(int begin, int end)
+{
+    if(begin == 0)
+    {
+        /* Wejście pierwszego segmentu jest ustalone (postój albo wyjście już wysłanego segmentu) */
+        maxEntry[0] = entry[0];
+        begin = 1;
+    }
+    float accelJd = config.acceleration * config.junctionDeviation;
+    for(int i = begin; i < end; i++)
+    {
+        float c = -(unit[0][i - 1] * unit[0][i] + unit[1][i - 1] * unit[1][i] + unit[2][i - 1] * unit[2][i]);
+        c = c > PLANNER_COS_LIMIT ? PLANNER_COS_LIMIT : (c < -PLANNER_COS_LIMIT ? -PLANNER_COS_LIMIT : c);
+        float sinHalf = sqrtf(0.5f * (1.0f - c));
+        float v = sqrtf(accelJd * sinHalf / (1.0f - sinHalf));
+        float limit = nominal[i] < nominal[i - 1] ? nominal[i] : nominal[i - 1];
+        maxEntry[i] = v < limit ? v : limit;
+    }
+}
+
+/**
+ * From the end of the path (where the printer must be able to stop) towards the first
+ * segment which is not final, every entry is limited by the deceleration over the segment.
+ */
+void MotionPlanner::backwardPass()
+{
+    float twoA = 2.0f * config.acceleration;
+    float next = 0.0f;
+    for(int i = count - 1; i > ready; i--)
+    {
+        float reachable = sqrtf(next * next + twoA * length[i]);
+        float e = maxEntry[i] < reachable ? maxEntry[i] : reachable;
+        entry[i] = e;
+        next = e;
+    }
+}
+
+/**
+ * From the first segment which is not final forward, every entry is limited by the
+ * acceleration over the previous segment.
+ */
+void MotionPlanner::forwardPass()
+{
+    float twoA = 2.0f * config.acceleration;
+    for(int i = ready; i < count - 1; i++)
+    {
+        float reachable = sqrtf(entry[i] * entry[i] + twoA * length[i]);
+        if(entry[i + 1] > reachable)
+            entry[i + 1] = reachable;
+    }
+}
+
+/**
+ * Trapezoid (or triangle) of every segment from its entry and exit speed.
+ */
+void MotionPlanner::computeTrapezoids(int begin, int end)
+{
+    float a = config.acceleration;
+    float inv2A = 1.0f / (2.0f * a);
+    for(int i = begin; i < end; i++)
+    {
+        float v0 = entry[i];
+        float v1 = (i + 1 < count) ? entry[i + 1] : 0.0f;
+        float vc = nominal[i];
+        float L = length[i];
+
+        float accel = (vc * vc - v0 * v0) * inv2A;
+        float decel = (vc * vc - v1 * v1) * inv2A;
+
+        /* Za mało drogi na osiągnięcie prędkości nominalnej, profil jest trójkątem */
+        float meet = (2.0f * a * L + v1 * v1 - v0 * v0) * 0.5f * inv2A;
+        meet = meet < 0.0f ? 0.0f : (meet > L ? L : meet);
+        bool triangle = (accel + decel) > L;
+
+        accelDistance[i] = triangle ? meet : accel;
+        decelDistance[i] = triangle ? L - meet : decel;
+        cruise[i] = triangle ? sqrtf(v0 * v0 + 2.0f * a * meet) : vc;
+    }
+}
+
+void MotionPlanner::plan()
+{
+    if(planned < count)
+    {
+        computeGeometry(planned, count);
+        computeJunctions(planned, count);
+        planned = count;
+    }
+
+    backwardPass();
+    forwardPass();
+
+    int newReady = flushed ? count : count - PLANNER_LOOKAHEAD;
+    if(newReady > ready)
+    {
+        computeTrapezoids(ready, newReady);
+        ready = newReady;
+    }
+}
+
+/**
+ * Drops the taken segments, the first kept segment starts where the last taken one ended.
+ */
+void MotionPlanner::compact()
+{
+    if(taken == 0)
+        return;
+    for(int a = 0; a < GCODE_AXES; a++)
+        start[a] = target[a][taken - 1];
+
+    int n = count - taken;
+    size_t bytes = static_cast<size_t>(n) * sizeof(float);
+    for(int a = 0; a < GCODE_AXES; a++)
+    {
+        memmove(target[a], target[a] + taken, bytes);
+        memmove(delta[a], delta[a] + taken, bytes);
+    }
+    for(int a = 0; a < 3; a++)
+        memmove(unit[a], unit[a] + taken, bytes);
+    memmove(length, length + taken, bytes);
+    memmove(nominal, nominal + taken, bytes);
+    memmove(feedrate, feedrate + taken, bytes);
+    memmove(maxEntry, maxEntry + taken, bytes);
+    /* Wejście pierwszego zostawionego segmentu to wyjście ostatniego pobranego, jest już ostateczne */
+    memmove(entry, entry + taken, bytes);
+    memmove(accelDistance, accelDistance + taken, bytes);
+    memmove(decelDistance, decelDistance + taken, bytes);
+    memmove(cruise, cruise + taken, bytes);
+
+    count -= taken;
+    planned -= taken;
+    ready -= taken;
+    taken = 0;
+
+    if(count == 0)
+        entry[0] = 0.0f;
+}
+
+int MotionPlanner::takeReady(PlannedSegment *out, int max)
+{
+    int n = ready - taken;
+    if(n > max)
+        n = max;
+    for(int k = 0; k < n; k++)
+    {
+        int i = taken + k;
+        PlannedSegment &s = out[k];
+        for(int a = 0; a < GCODE_AXES; a++)
+            s.target[a] = target[a][i];
+        s.length = length[i];
+        s.entrySpeed = entry[i];
+        s.cruiseSpeed = cruise[i];
+        s.exitSpeed = (i + 1 < count) ? entry[i + 1] : 0.0f;
+        s.accelDistance = accelDistance[i];
+        s.decelDistance = decelDistance[i];
+    }
+    taken += n;
+
+    if(taken == ready)
+        compact();
+    return n;
+}
@@ -0,0 +1,115 @@
+#ifndef MOTIONPLANNER_H
+#define MOTIONPLANNER_H
+
+#include <stdint.h>
+#include "gcodeparser.h"
+
+// Segments kept by the planner, the arrays are sized for this many
+#ifndef PLANNER_CAPACITY
+#define PLANNER_CAPACITY            (512)
+#endif
+// A segment is final once this many segments follow it
+#ifndef PLANNER_LOOKAHEAD
+#define PLANNER_LOOKAHEAD           (64)
+#endif
+// New segments are planned together once this many are waiting
+#ifndef PLANNER_BATCH
+#define PLANNER_BATCH               (32)
+#endif
+
+#if (PLANNER_LOOKAHEAD + PLANNER_BATCH > PLANNER_CAPACITY)
+#error "Planner capacity must hold the lookahead and a batch"
+#endif
+
+typedef struct {
+    float acceleration;             ///< mm/s^2, same as the firmware setting
+    float junctionDeviation;        ///< mm
+    float maxFeedrate;              ///< mm/s
+} PlannerConfig;
+
+typedef struct {
+    float target[GCODE_AXES];       ///< Absolute position at the end, mm
+    float length;                   ///< mm
+    float entrySpeed;               ///< mm/s
+    float cruiseSpeed;
+    float exitSpeed;
+    float accelDistance;            ///< mm spent accelerating from entrySpeed
+    float decelDistance;            ///< mm spent decelerating to exitSpeed
+} PlannedSegment;
+
+/**
+ * @brief MotionPlanner
+ *
+ * Host side lookahead planner producing trapezoidal segments, the same job the firmware
+ * planner does for every G1 (junction deviation, backward and forward passes).
+ *
+ * The segments are kept as a structure of arrays. Geometry, junction limits and trapezoids
+ * of a batch are computed in plain loops without branches between the arrays so the compiler
+ * vectorises them; only the backward and forward passes are inherently sequential.
+ */
+class MotionPlanner
+{
+public:
+    MotionPlanner();
+
+    void setConfig(const PlannerConfig &config);
+    const PlannerConfig &getConfig() const;
+    static PlannerConfig defaultConfig();
+    void reset(const float *position);
+
+    /**
+     * Adds a move. Moves without XYZ motion (e.g. retracts) are planned on the E axis.
+     *
+     * @return false if the planner is full, take the ready segments first.
+     */
+    bool addMove(const GcodeMove &move);
+
+    /**
+     * Ends the path: the last segment stops, all segments become ready.
+     */
+    void flush();
+
+    /**
+     * Copies out the segments whose speeds are final. Planning itself happens in addMove
+     * once a batch is waiting and in flush.
+     *
+     * @return number of segments written to out.
+     */
+    int takeReady(PlannedSegment *out, int max);
+
+    int pending() const;
+    bool isFull() const;
+
+private:
+    void plan();
+    void computeGeometry(int begin, int end);
+    void computeJunctions(int begin, int end);
+    void backwardPass();
+    void forwardPass();
+    void computeTrapezoids(int begin, int end);
+    void compact();
+
+    PlannerConfig config;
+    float start[GCODE_AXES];        ///< Position before the first kept segment
+
+    // Structure of arrays, index 0 is the oldest kept segment
+    float target[GCODE_AXES][PLANNER_CAPACITY];
+    float delta[GCODE_AXES][PLANNER_CAPACITY];
+    float unit[3][PLANNER_CAPACITY];
+    float length[PLANNER_CAPACITY];
+    float nominal[PLANNER_CAPACITY];         ///< Requested speed, mm/s
+    float feedrate[PLANNER_CAPACITY];
+    float maxEntry[PLANNER_CAPACITY];        ///< Junction limit, mm/s
+    float entry[PLANNER_CAPACITY];           ///< Planned entry speed
+    float accelDistance[PLANNER_CAPACITY];
+    float decelDistance[PLANNER_CAPACITY];
+    float cruise[PLANNER_CAPACITY];
+
+    int count;                      ///< Segments kept
+    int planned;                    ///< Segments with geometry and junctions computed
+    int ready;                      ///< Segments with final speeds
+    int taken;                      ///< Ready segments already copied out
+    bool flushed;
+};
+
+#endif // MOTIONPLANNER_H
@@ -0,0 +1,214 @@
+#include "portregistry.h"
+#include "types.h"
+#include <QtSerialPort/QSerialPortInfo>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QDir>
+
+/* Po podłączeniu adaptera udev tworzy kilka węzłów w krótkim czasie, czekamy aż się uspokoi */
+#define PORT_SCAN_SETTLE_MS     (200)
+/* Gdy nie ma inotify (inne systemy) skanujemy okresowo, ale w tle */
+#define PORT_SCAN_FALLBACK_MS   (2000)
+
+PortScanner::PortScanner()
+{
+    watcher = nullptr;
+    debounce = nullptr;
+}
+
+PortScanner::~PortScanner()
+{
+    delete watcher;
+    delete debounce;
+}
+
+/**
+ * @brief PortScanner::start
+ *
+ * Called in the registry thread, so the watcher and the timer belong to that thread.
+ */
+void PortScanner::start()
+{
+    debounce = new QTimer();
+    debounce->setSingleShot(true);
+    connect(debounce, SIGNAL(timeout()), this, SLOT(settle()));
+
+#ifdef Q_OS_LINUX
+    watcher = new QFileSystemWatcher();
+    watcher->addPath("/dev");
+    watchById();
+    connect(watcher, SIGNAL(directoryChanged(QString)), this, SLOT(directoryChanged(QString)));
+#else
+    debounce->setSingleShot(false);
+    debounce->start(PORT_SCAN_FALLBACK_MS);
+#endif
+
+    rescan();
+}
+
+void PortScanner::watchById()
+{
+    /* /dev/serial/by-id istnieje dopiero po podłączeniu pierwszego adaptera USB */
+    if(watcher && QDir("/dev/serial/by-id").exists() && !watcher->directories().contains("/dev/serial/by-id"))
+        watcher->addPath("/dev/serial/by-id");
+}
+
+/**
+ * @brief PortScanner::ttyNodes
+ *
+ * Cheap readdir of /dev used to filter out changes which are not related to serial ports
+ * (ptys, block devices, etc.) before the expensive enumeration.
+ */
+QStringList PortScanner::ttyNodes()
+{
+    QStringList filters;
+    filters << "ttyUSB*" << "ttyACM*" << "ttyS*" << "ttyAMA*" << "rfcomm*";
+    return QDir("/dev").entryList(filters, QDir::System | QDir::NoDotAndDotDot, QDir::Name);
+}
+
+void PortScanner::directoryChanged(const QString &path)
+{
+    UNUSED(path);
+    watchById();
+    debounce->start(PORT_SCAN_SETTLE_MS);
+}
+
+void PortScanner::settle()
+{
+#ifdef Q_OS_LINUX
+    QStringList nodes = ttyNodes();
+    if(nodes == knownNodes)
+        return;
+#endif
+    rescan();
+}
+
+void PortScanner::rescan()
+{
+    QVector<PortEntry> ports;
+
+    knownNodes = ttyNodes();
+
+    foreach (const QSerialPortInfo &infoport, QSerialPortInfo::availablePorts())
+    {
+        PortEntry entry;
+        entry.portName = infoport.portName();
+        entry.systemLocation = infoport.systemLocation();
+        entry.serialNumber = infoport.serialNumber();
+        entry.description = infoport.description();
+        entry.manufacturer = infoport.manufacturer();
+        entry.vendorId = infoport.hasVendorIdentifier() ? infoport.vendorIdentifier() : 0;
+        entry.productId = infoport.hasProductIdentifier() ? infoport.productIdentifier() : 0;
+        ports.append(entry);
+    }
+
+    emit scanned(ports);
+}
+
+PortRegistry::PortRegistry(QObject *parent) :
+    QObject(parent)
+{
+    qRegisterMetaType<PortEntry>("PortEntry");
+    qRegisterMetaType<QVector<PortEntry> >("QVector<PortEntry>");
+
+    /* Wczytanie zapamiętanych tożsamości drukarek */
+    QSettings settings;
+    settings.beginGroup("printers");
+    foreach (const QString &serialNumber, settings.childKeys())
+    {
+        identities.insert(serialNumber, settings.value(serialNumber).toString());
+    }
+    settings.endGroup();
+
+    scanner = new PortScanner();
+    scanner->moveToThread(&thread);
+    connect(&thread, SIGNAL(started()), scanner, SLOT(start()));
+    connect(&thread, SIGNAL(finished()), scanner, SLOT(deleteLater()));
+    connect(this, SIGNAL(requestRescan()), scanner, SLOT(rescan()));
+    connect(scanner, SIGNAL(scanned(QVector<PortEntry>)), this, SLOT(scanned(QVector<PortEntry>)));
+    thread.start(QThread::LowPriority);
+}
+
+PortRegistry::~PortRegistry()
+{
+    thread.quit();
+    thread.wait();
+}
+
+/**
+ * @brief PortRegistry::ports
+ *
+ * Returns the cached list, it is empty until the first background scan has finished.
+ */
+QVector<PortEntry> PortRegistry::ports() const
+{
+    QMutexLocker locker(&mutex);
+    return cache;
+}
+
+bool PortRegistry::findBySerialNumber(const QString &serialNumber, PortEntry *entry) const
+{
+    if(serialNumber.isEmpty())
+        return false;
+
+    QMutexLocker locker(&mutex);
+    foreach (const PortEntry &port, cache)
+    {
+        if(port.serialNumber == serialNumber)
+        {
+            if(entry)
+                *entry = port;
+            return true;
+        }
+    }
+    return false;
+}
+
+QString PortRegistry::printerIdentity(const QString &serialNumber) const
+{
+    QMutexLocker locker(&mutex);
+    return identities.value(serialNumber);
+}
+
+void PortRegistry::rescan()
+{
+    emit requestRescan();
+}
+
+/**
+ * @brief PortRegistry::assignIdentity
+ *
+ * Serial number is the only thing that survives replugging the printer into another port,
+ * so the identity is bound to it and stored in the settings. Called with the mutex held.
+ */
+QString PortRegistry::assignIdentity(const QString &serialNumber)
+{
+    if(serialNumber.isEmpty())
+        return QString();
+
+    QString id = identities.value(serialNumber);
+    if(id.isEmpty())
+    {
+        id = QString("Printer %1").arg(identities.size() + 1);
+        identities.insert(serialNumber, id);
+
+        QSettings settings;
+        settings.beginGroup("printers");
+        settings.setValue(serialNumber, id);
+        settings.endGroup();
+    }
+    return id;
+}
+
+void PortRegistry::scanned(QVector<PortEntry> ports)
+{
+    {
+        QMutexLocker locker(&mutex);
+        for(int i = 0; i < ports.size(); i++)
+        {
+            ports[i].printerId = assignIdentity(ports[i].serialNumber);
+        }
+        cache = ports;
+    }
+    emit portsChanged();
+}
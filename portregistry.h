@@ -0,0 +1,97 @@
+#ifndef PORTREGISTRY_H
+#define PORTREGISTRY_H
+
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+#include <QMutex>
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+#include <QFileSystemWatcher>
+
+typedef struct {
+    QString portName;
+    QString systemLocation;
+    QString serialNumber;
+    QString description;
+    QString manufacturer;
+    quint16 vendorId;
+    quint16 productId;
+    QString printerId;      ///< Stable identity assigned to the serial number, empty if unknown
+} PortEntry;
+
+/**
+ * @brief PortScanner
+ *
+ * Worker living in the registry thread. Enumerates the serial ports with QSerialPortInfo and
+ * watches /dev (inotify via QFileSystemWatcher) so the expensive enumeration is repeated only
+ * when a tty node really appears or disappears.
+ */
+class PortScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    PortScanner();
+    ~PortScanner();
+
+public slots:
+    void start();
+    void rescan();
+
+private slots:
+    void directoryChanged(const QString &path);
+    void settle();
+
+signals:
+    void scanned(QVector<PortEntry> ports);
+
+private:
+    QStringList ttyNodes();
+    void watchById();
+
+    QFileSystemWatcher *watcher;
+    QTimer *debounce;
+    QStringList knownNodes;
+};
+
+/**
+ * @brief PortRegistry
+ *
+ * Cache of available serial ports kept current in the background. The GUI and the
+ * auto-connect path read ports() which only copies the cached list, they never touch sysfs.
+ */
+class PortRegistry : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PortRegistry(QObject *parent = nullptr);
+    ~PortRegistry();
+
+    QVector<PortEntry> ports() const;
+    bool findBySerialNumber(const QString &serialNumber, PortEntry *entry) const;
+    QString printerIdentity(const QString &serialNumber) const;
+    void rescan();
+
+signals:
+    void portsChanged();
+    void requestRescan();
+
+private slots:
+    void scanned(QVector<PortEntry> ports);
+
+private:
+    QString assignIdentity(const QString &serialNumber);
+
+    QThread thread;
+    PortScanner *scanner;
+    mutable QMutex mutex;
+    QVector<PortEntry> cache;
+    QHash<QString, QString> identities;
+};
+
+Q_DECLARE_METATYPE(PortEntry)
+
+#endif // PORTREGISTRY_H
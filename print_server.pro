@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui serialport
+QT       += core gui serialport network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -34,7 +34,23 @@ SOURCES += \
     icommandinterpreter.cpp \
     isystem.cpp \
     system.cpp \
-    commandinterpreter.cpp
+    commandinterpreter.cpp \
+    portregistry.cpp \
+    jobstreamer.cpp \
+    printerlink.cpp \
+    gcodeparser.cpp \
+    gcodepreprocessor.cpp \
+    gcodeindex.cpp \
+    motionplanner.cpp \
+    printestimator.cpp \
+    farmscheduler.cpp \
+    controlapi.cpp \
+    telemetrybus.cpp \
+    telemetrystore.cpp \
+    telemetrychart.cpp \
+    toolpathpreview.cpp \
+    mincodec.cpp \
+    linkarena.cpp
 
 HEADERS += \
         mainwindow.h \
@@ -47,7 +63,26 @@ HEADERS += \
     isystem.h \
     callback.h \
     system.h \
-    commandinterpreter.h
+    commandinterpreter.h \
+    portregistry.h \
+    messages.h \
+    commanddispatcher.h \
+    delegate.h \
+    jobstreamer.h \
+    printerlink.h \
+    gcodeparser.h \
+    gcodepreprocessor.h \
+    gcodeindex.h \
+    motionplanner.h \
+    printestimator.h \
+    farmscheduler.h \
+    controlapi.h \
+    telemetrybus.h \
+    telemetrystore.h \
+    telemetrychart.h \
+    toolpathpreview.h \
+    mincodec.h \
+    linkarena.h
 
 FORMS += \
         mainwindow.ui \
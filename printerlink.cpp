@@ -0,0 +1,544 @@
+#include "printerlink.h"
+#include <QSettings>
+#include <QDateTime>
+#include <QDebug>
+
+// Capabilities of a printer without a profile
+#define LINK_DEFAULT_BED_X      (200.0f)
+#define LINK_DEFAULT_BED_Y      (200.0f)
+#define LINK_DEFAULT_BED_Z      (200.0f)
+#define LINK_DEFAULT_NOZZLE     (0.4f)
+
+// Names of the parts in the arena of a link
+#define LINK_ARENA_COMMUNICATION    "communication"
+#define LINK_ARENA_PROTOCOL         "protocol"
+#define LINK_ARENA_STREAMER         "streamer"
+#define LINK_ARENA_TIMERS           "timers"
+
+PrinterLink::PrinterLink(QObject *parent) :
+    QObject(parent),
+    arena(arenaSize())
+{
+    /* Cały stan łącza w jednym bloku, obiekty bez rodzica bo usuwa je arena */
+    communication = arena.create<Communication>(LINK_ARENA_COMMUNICATION);
+    Q_CHECK_PTR(communication);
+    connect(communication, SIGNAL(communicationError()), this, SLOT(communicationError()));
+
+    void *context = arena.allocate(static_cast<quint32>(MinProtocol::min_context_size()), LINK_ARENA_PROTOCOL);
+    Q_CHECK_PTR(context);
+    protocol = arena.create<MinProtocol>(LINK_ARENA_PROTOCOL, communication, &system, &cmd, context);
+    Q_CHECK_PTR(protocol);
+    /* Odebrane dane trafiają bezpośrednio do MIN, potem do łącza (ACK zwalnia miejsce na kolejne ramki) */
+    communication->subscribeData<MinProtocol, &MinProtocol::min_rx_data>(protocol);
+    communication->subscribeData<PrinterLink, &PrinterLink::dataReceived>(this);
+
+    streamer = arena.create<JobStreamer>(LINK_ARENA_STREAMER, protocol, &cmd);
+    Q_CHECK_PTR(streamer);
+    connect(streamer, SIGNAL(pumpNeeded()), this, SLOT(wake()));
+
+    pollTimer = arena.create<QTimer>(LINK_ARENA_TIMERS);
+    Q_CHECK_PTR(pollTimer);
+    pollTimer->setTimerType(Qt::PreciseTimer);
+    pollTimer->setSingleShot(true);
+    connect(pollTimer, SIGNAL(timeout()), this, SLOT(poll()));
+
+    reconnectTimer = arena.create<QTimer>(LINK_ARENA_TIMERS);
+    Q_CHECK_PTR(reconnectTimer);
+    connect(reconnectTimer, SIGNAL(timeout()), this, SLOT(tryReconnect()));
+
+    resumeCheckTimer = arena.create<QTimer>(LINK_ARENA_TIMERS);
+    Q_CHECK_PTR(resumeCheckTimer);
+    resumeCheckTimer->setSingleShot(true);
+    connect(resumeCheckTimer, SIGNAL(timeout()), this, SLOT(resumeCheckTimeout()));
+    registry = nullptr;
+    reconnecting = false;
+    checkingResume = false;
+    resetsAtReconnect = 0;
+    statusAtReconnect = 0;
+    decompressErrors = 0;
+    telemetry = nullptr;
+    history = nullptr;
+    telemetryPrinter = -1;
+    lastProgress = -1;
+
+    capabilities.bedX = LINK_DEFAULT_BED_X;
+    capabilities.bedY = LINK_DEFAULT_BED_Y;
+    capabilities.bedZ = LINK_DEFAULT_BED_Z;
+    capabilities.nozzleDiameter = LINK_DEFAULT_NOZZLE;
+    capabilities.speedFactor = 1.0f;
+}
+
+PrinterLink::~PrinterLink()
+{
+    pollTimer->stop();
+    /* Timery, streamer, MIN i port, odwrotnie niż powstały, zanim zniknie interpreter */
+    arena.clear();
+}
+
+/**
+ * @brief PrinterLink::arenaSize
+ *
+ * Everything the constructor places in the arena, the sizes are known at compile time.
+ */
+quint32 PrinterLink::arenaSize()
+{
+    return LinkArena::aligned(sizeof(Communication)) +
+           LinkArena::aligned(static_cast<quint32>(MinProtocol::min_context_size())) +
+           LinkArena::aligned(sizeof(MinProtocol)) +
+           LinkArena::aligned(sizeof(JobStreamer)) +
+           3 * LinkArena::aligned(sizeof(QTimer));
+}
+
+int PrinterLink::connectPrinter()
+{
+    if(communication->OpenSerialPort() != 0)
+        return -1;
+
+    loadProfile();
+
+    /* Nowa sesja, druga strona też zaczyna od zera */
+    protocol->min_transport_reset(true);
+    wake();
+
+    LinkFootprint footprint = getFootprint();
+    qDebug() << "Info: Link footprint" << footprint.total << "bytes, arena" << footprint.arenaCapacity
+             << "(protocol" << footprint.protocol << "streamer" << footprint.streamer << ") buffers" << footprint.buffers << "\n";
+    return 0;
+}
+
+int PrinterLink::disconnectPrinter()
+{
+    reconnecting = false;
+    checkingResume = false;
+    reconnectTimer->stop();
+    resumeCheckTimer->stop();
+    pollTimer->stop();
+    streamer->stop();
+    return communication->CloseSerialPort();
+}
+
+/**
+ * @brief PrinterLink::loadProfile
+ *
+ * Settings of the printer in the "profiles/<serial number>" group, missing keys keep the defaults.
+ */
+void PrinterLink::loadProfile()
+{
+    SerialStruct s = communication->GetSerialPort();
+
+    /* Ramka rozszerzona zajmuje linię najwyżej ok. 10 ms, dużo krócej niż czas do retransmisji */
+    int maxPayload = qMax(s.qiBaudRate / 1000, static_cast<int>(MAX_PAYLOAD));
+    /* 10 bitów na bajt, od tego zależy wielkość paczek */
+    int lineRate = s.qiBaudRate / 10;
+    if(s.serialNumber.isEmpty() || streamer->isRunning())
+    {
+        protocol->min_set_max_payload(static_cast<uint16_t>(qMin(maxPayload, 65535)));
+        protocol->min_set_line_rate(static_cast<uint32_t>(qMax(lineRate, 0)));
+        return;
+    }
+
+    QSettings settings;
+    settings.beginGroup("profiles");
+    settings.beginGroup(s.serialNumber);
+
+    PreprocessorOptions options = GcodePreprocessor::defaultOptions();
+    options.dropNoOps = settings.value("dropNoOps", options.dropNoOps).toBool();
+    options.mergeCollinear = settings.value("mergeCollinear", options.mergeCollinear).toBool();
+    /* Tolerancje z profilu tylko dodatnie, zero dałoby nieskończenie wiele cięciw łuku */
+    options.mergeTolerance = qMax(0.0f, settings.value("mergeTolerance", options.mergeTolerance).toFloat());
+    options.linearizeArcs = settings.value("linearizeArcs", options.linearizeArcs).toBool();
+    options.arcTolerance = qMax(GCODE_MIN_ARC_TOLERANCE, settings.value("arcTolerance", options.arcTolerance).toFloat());
+    options.dedupeFeedrate = settings.value("dedupeFeedrate", options.dedupeFeedrate).toBool();
+    streamer->setPreprocessing(settings.value("preprocess", false).toBool(), options);
+
+    /* Kompresja, ramki rozszerzone i paczki tylko gdy firmware też je zgłosi przy resecie transportu,
+     * o brakujące ramki prosimy zawsze */
+    uint8_t features = MIN_FEATURE_NACKS;
+    if(settings.value("compression", true).toBool())
+        features |= MIN_FEATURE_COMPRESSION;
+    if(settings.value("extendedFrames", true).toBool())
+        features |= MIN_FEATURE_EXTENDED_FRAMES;
+    if(settings.value("batching", true).toBool())
+        features |= MIN_FEATURE_BATCHES;
+    protocol->min_set_features(features);
+    /* Ile paczka czeka na kolejne komendy gdy linia jest wolna, 0 wyłącza paczki */
+    protocol->min_set_batch_deadline_us(settings.value("batchDeadlineUs", MIN_DEFAULT_BATCH_DEADLINE_US).toUInt());
+    lineRate = settings.value("lineRate", lineRate).toInt();
+    protocol->min_set_line_rate(static_cast<uint32_t>(qMax(lineRate, 0)));
+    /* Natywne USB nie ma prędkości linii, tam maxPayload z profilu */
+    maxPayload = settings.value("maxPayload", maxPayload).toInt();
+    protocol->min_set_max_payload(static_cast<uint16_t>(qBound(0, maxPayload, 65535)));
+    /* Okno rośnie samo, tu tylko górna granica */
+    protocol->min_set_max_window(static_cast<uint8_t>(qBound(0, settings.value("maxWindow", TRANSPORT_MAX_WINDOW_SIZE).toInt(), 255)));
+
+    capabilities.bedX = settings.value("bedX", capabilities.bedX).toFloat();
+    capabilities.bedY = settings.value("bedY", capabilities.bedY).toFloat();
+    capabilities.bedZ = settings.value("bedZ", capabilities.bedZ).toFloat();
+    capabilities.nozzleDiameter = settings.value("nozzleDiameter", capabilities.nozzleDiameter).toFloat();
+    capabilities.material = settings.value("material", capabilities.material).toString();
+    capabilities.speedFactor = settings.value("speedFactor", capabilities.speedFactor).toFloat();
+
+    settings.endGroup();
+    settings.endGroup();
+}
+
+Communication *PrinterLink::getCommunication()
+{
+    return communication;
+}
+
+MinProtocol *PrinterLink::getProtocol()
+{
+    return protocol;
+}
+
+CommandInterpreter *PrinterLink::getInterpreter()
+{
+    return &cmd;
+}
+
+JobStreamer *PrinterLink::getStreamer()
+{
+    return streamer;
+}
+
+LinkFootprint PrinterLink::getFootprint() const
+{
+    LinkFootprint footprint;
+    footprint.link = sizeof(PrinterLink);
+    footprint.arenaCapacity = arena.getCapacity();
+    footprint.communication = arena.bytesOf(LINK_ARENA_COMMUNICATION);
+    footprint.protocol = arena.bytesOf(LINK_ARENA_PROTOCOL);
+    footprint.streamer = arena.bytesOf(LINK_ARENA_STREAMER);
+    footprint.timers = arena.bytesOf(LINK_ARENA_TIMERS);
+    footprint.buffers = static_cast<quint32>(communication->getBufferBytes() + streamer->getBufferBytes());
+    footprint.total = footprint.link + footprint.arenaCapacity + footprint.buffers;
+    return footprint;
+}
+
+void PrinterLink::setTelemetry(TelemetryBus *bus, TelemetryStore *store, int printer)
+{
+    if(telemetry || history)
+        disconnect(streamer, SIGNAL(progress(qint64,qint64)), this, SLOT(streamerProgress(qint64,qint64)));
+
+    telemetry = bus;
+    history = store;
+    telemetryPrinter = printer;
+    lastProgress = -1;
+    cmd.setListener(bus || store ? this : nullptr);
+    if(bus || store)
+        connect(streamer, SIGNAL(progress(qint64,qint64)), this, SLOT(streamerProgress(qint64,qint64)));
+}
+
+/**
+ * @brief PrinterLink::onTelemetry
+ *
+ * Called by the interpreter for every received report. The bus only keeps the newest value,
+ * the history gets the frame as received, in the units of the printer.
+ */
+void PrinterLink::onTelemetry(uint8_t min_id, const PrinterState &state)
+{
+    qint32 values[TSTORE_MAX_COLUMNS];
+    switch(min_id)
+    {
+    case MSG_STATUS:
+        if(telemetry)
+            telemetry->publish(telemetryPrinter, TELEMETRY_STATE, state.status.state);
+        values[0] = state.status.state;
+        if(history)
+            history->append(telemetryPrinter, TSTORE_STATE, QDateTime::currentMSecsSinceEpoch(), values);
+        break;
+    case MSG_POSITION:
+        /* Mikrometry na milimetry */
+        if(telemetry)
+        {
+            telemetry->publish(telemetryPrinter, TELEMETRY_X, state.position.x / 1000.0f);
+            telemetry->publish(telemetryPrinter, TELEMETRY_Y, state.position.y / 1000.0f);
+            telemetry->publish(telemetryPrinter, TELEMETRY_Z, state.position.z / 1000.0f);
+            telemetry->publish(telemetryPrinter, TELEMETRY_E, state.position.e / 1000.0f);
+        }
+        values[0] = state.position.x;
+        values[1] = state.position.y;
+        values[2] = state.position.z;
+        values[3] = state.position.e;
+        if(history)
+            history->append(telemetryPrinter, TSTORE_POSITION, QDateTime::currentMSecsSinceEpoch(), values);
+        break;
+    case MSG_TEMPERATURES:
+        /* Dziesiąte części stopnia */
+        if(telemetry)
+        {
+            telemetry->publish(telemetryPrinter, TELEMETRY_HOTEND, state.temperatures.hotend_current / 10.0f);
+            telemetry->publish(telemetryPrinter, TELEMETRY_HOTEND_TARGET, state.temperatures.hotend_target / 10.0f);
+            telemetry->publish(telemetryPrinter, TELEMETRY_BED, state.temperatures.bed_current / 10.0f);
+            telemetry->publish(telemetryPrinter, TELEMETRY_BED_TARGET, state.temperatures.bed_target / 10.0f);
+        }
+        values[0] = state.temperatures.hotend_current;
+        values[1] = state.temperatures.hotend_target;
+        values[2] = state.temperatures.bed_current;
+        values[3] = state.temperatures.bed_target;
+        if(history)
+            history->append(telemetryPrinter, TSTORE_TEMPERATURES, QDateTime::currentMSecsSinceEpoch(), values);
+        break;
+    default:
+        break;
+    }
+}
+
+void PrinterLink::streamerProgress(qint64 sentBytes, qint64 totalBytes)
+{
+    if(totalBytes <= 0)
+        return;
+
+    if(telemetry)
+        telemetry->publish(telemetryPrinter, TELEMETRY_PROGRESS, static_cast<float>(sentBytes) / totalBytes);
+
+    /* Postęp przychodzi z każdą linią, do historii tylko zmiany */
+    qint32 progress = static_cast<qint32>(sentBytes * 10000 / totalBytes);
+    if(history && progress != lastProgress)
+    {
+        history->append(telemetryPrinter, TSTORE_PROGRESS, QDateTime::currentMSecsSinceEpoch(), &progress);
+        lastProgress = progress;
+    }
+}
+
+/**
+ * @brief PrinterLink::poll
+ *
+ * Lets the streamer queue more lines, sends what the transport can send now and runs its timers.
+ */
+void PrinterLink::poll()
+{
+    if(protocol->min_decompress_errors() != decompressErrors)
+        recoverDecoder();
+
+    streamer->pump();
+
+    /* min_poll() wysyła najwyżej jedną ramkę, reszta gotowych wychodzi w tym samym wywołaniu */
+    quint32 deadline = 0;
+    for(int i = 0; i < LINK_MAX_POLLS_PER_WAKEUP && deadline == 0; i++)
+    {
+        protocol->min_poll(nullptr, 0);
+        deadline = protocol->min_next_deadline_ms();
+    }
+    schedule(deadline);
+}
+
+/**
+ * @brief PrinterLink::recoverDecoder
+ *
+ * A compressed frame that did not decode stalls the receiving side of MIN until the transport
+ * is reset. The reset also empties what was queued for sending, so a running job continues
+ * from its first command the printer did not ACK, as after a reconnect.
+ */
+void PrinterLink::recoverDecoder()
+{
+    decompressErrors = protocol->min_decompress_errors();
+    qWarning() << "Warning: Compressed frame from the printer did not decode, resetting the transport";
+
+    /* Zadanie wstrzymane wcześniej (np. czeka na operatora) zostaje wstrzymane */
+    bool resume = !streamer->isSuspended() && streamer->suspend();
+    protocol->min_transport_reset(true);
+    if(resume)
+        streamer->resumeAfterReconnect();
+}
+
+/**
+ * @brief PrinterLink::schedule
+ *
+ * Arms the poll timer for the next deadline of the transport, or stops it if there is none:
+ * an idle link is not woken up until data arrives or a frame is queued.
+ */
+void PrinterLink::schedule(quint32 deadline)
+{
+    /* Zadanie w toku dokłada linie co najmniej co okres */
+    if(streamer->isRunning() && !streamer->isPaused() && !streamer->isSuspended())
+        deadline = qMin(deadline, static_cast<quint32>(LINK_POLL_PERIOD_MS));
+
+    if(deadline == MIN_NO_DEADLINE || !communication->isConnected())
+        pollTimer->stop();
+    else
+        pollTimer->start(static_cast<int>(deadline));
+}
+
+/**
+ * @brief PrinterLink::wake
+ *
+ * Polls the link as soon as the event loop gets to it, e.g. after frames were queued.
+ */
+void PrinterLink::wake()
+{
+    if(communication->isConnected())
+        pollTimer->start(0);
+}
+
+/**
+ * @brief PrinterLink::dataReceived
+ *
+ * Called after MIN took the received data: an ACK or a planner report may let the streamer
+ * send more, and the deadlines have changed.
+ */
+void PrinterLink::dataReceived(const FrameSpan &data)
+{
+    Q_UNUSED(data);
+    if(checkingResume)
+        checkResume();
+    if(communication->isConnected())
+        poll();
+}
+
+void PrinterLink::setPortRegistry(PortRegistry *registry)
+{
+    if(this->registry)
+        disconnect(this->registry, SIGNAL(portsChanged()), this, SLOT(tryReconnect()));
+    this->registry = registry;
+    if(registry)
+        connect(registry, SIGNAL(portsChanged()), this, SLOT(tryReconnect()));
+}
+
+bool PrinterLink::isReconnecting() const
+{
+    return reconnecting;
+}
+
+/**
+ * @brief PrinterLink::isAwaitingResume
+ *
+ * The printer is connected again but the job stays suspended, see resumeJob().
+ */
+bool PrinterLink::isAwaitingResume() const
+{
+    return streamer->isSuspended() && !reconnecting && !checkingResume && communication->isConnected();
+}
+
+/**
+ * @brief PrinterLink::resumeJob
+ *
+ * Continues a job the link did not resume by itself after a reconnect, e.g. when the operator
+ * homed a rebooted printer again.
+ * @return false if no job waits for it
+ */
+bool PrinterLink::resumeJob()
+{
+    if(!streamer->isSuspended() || reconnecting || !communication->isConnected())
+        return false;
+
+    checkingResume = false;
+    resumeCheckTimer->stop();
+    if(!streamer->resumeAfterReconnect())
+        return false;
+    wake();
+    qDebug() << "Info: Job resumed by the operator\n";
+    return true;
+}
+
+const PrinterCapabilities &PrinterLink::getCapabilities() const
+{
+    return capabilities;
+}
+
+void PrinterLink::communicationError()
+{
+    pollTimer->stop();
+    checkingResume = false;
+    resumeCheckTimer->stop();
+
+    /* Zadanie czeka na ponowne podłączenie drukarki */
+    if(streamer->suspend())
+    {
+        reconnecting = true;
+        reconnectTimer->start(LINK_RECONNECT_PERIOD_MS);
+        emit linkLost();
+    }
+}
+
+/**
+ * @brief PrinterLink::tryReconnect
+ *
+ * The printer may come back on another port, it is looked up by its serial number.
+ */
+void PrinterLink::tryReconnect()
+{
+    if(!reconnecting || communication->isConnected())
+        return;
+
+    SerialStruct s = communication->GetSerialPort();
+    PortEntry port;
+    if(registry)
+    {
+        if(!registry->findBySerialNumber(s.serialNumber, &port))
+            return;
+        if(port.portName != s.sPortName)
+        {
+            s.sPortName = port.portName;
+            communication->SetSerialPort(s);
+        }
+    }
+
+    if(communication->OpenSerialPort() != 0)
+        return;
+
+    reconnecting = false;
+    reconnectTimer->stop();
+
+    /* Nowa sesja transportu. Otwarcie portu mogło zrestartować drukarkę (DTR), zadanie
+       wznawiane dopiero gdy raport stanu potwierdzi że niczego nie straciła */
+    protocol->min_transport_reset(true);
+    resetsAtReconnect = protocol->min_resets_received();
+    statusAtReconnect = cmd.getState().status_reports;
+    checkingResume = true;
+    resumeCheckTimer->start(LINK_RESUME_CHECK_MS);
+    wake();
+    qDebug() << "Info: Link restored on" << s.sPortName << "\n";
+    emit linkRestored();
+}
+
+/**
+ * @brief PrinterLink::checkResume
+ *
+ * After a reconnect: a RESET the firmware started itself means it booted again, otherwise the
+ * first new status report decides. Without the homed flag the printer lost its position.
+ */
+void PrinterLink::checkResume()
+{
+    if(protocol->min_resets_received() != resetsAtReconnect)
+    {
+        refuseResume("The printer restarted");
+        return;
+    }
+
+    const PrinterState &state = cmd.getState();
+    if(state.status_reports == statusAtReconnect)
+        return;
+
+    if(!(state.status.flags & STATUS_FLAG_HOMED))
+    {
+        refuseResume("The printer lost its state");
+        return;
+    }
+
+    /* Drukarka zachowała stan, zadanie od pierwszej niepotwierdzonej komendy */
+    checkingResume = false;
+    resumeCheckTimer->stop();
+    streamer->resumeAfterReconnect();
+    wake();
+}
+
+void PrinterLink::resumeCheckTimeout()
+{
+    if(checkingResume)
+        refuseResume("No status report from the printer");
+}
+
+/**
+ * @brief PrinterLink::refuseResume
+ *
+ * Leaves the job suspended for the operator, see resumeJob().
+ */
+void PrinterLink::refuseResume(const QString &reason)
+{
+    checkingResume = false;
+    resumeCheckTimer->stop();
+    qWarning() << "Warning: Job not resumed after the reconnect:" << reason;
+    emit resumeRefused(reason);
+}
@@ -0,0 +1,146 @@
+#ifndef PRINTERLINK_H
+#define PRINTERLINK_H
+
+#include <QObject>
+#include <QTimer>
+#include "communication.h"
+#include "commandinterpreter.h"
+#include "system.h"
+#include "min.h"
+#include "jobstreamer.h"
+#include "portregistry.h"
+#include "telemetrybus.h"
+#include "telemetrystore.h"
+#include "linkarena.h"
+
+// Longest wait between polls while a job is streamed, otherwise the link is polled at the deadlines of the transport
+#define LINK_POLL_PERIOD_MS     (1)
+// min_poll() sends one frame, a wakeup sends up to a window of them
+#define LINK_MAX_POLLS_PER_WAKEUP   (TRANSPORT_MAX_WINDOW_SIZE)
+// Reconnect attempts after the link was lost, in case the port registry does not notice the printer
+#define LINK_RECONNECT_PERIOD_MS    (1000)
+// How long a reconnected printer has to report that it kept its state before the job is left for the operator
+#define LINK_RESUME_CHECK_MS        (3000)
+
+/**
+ * What a printer can print, from its profile. Used by the farm scheduler to match jobs.
+ */
+typedef struct {
+    float bedX;                     ///< Build volume, mm
+    float bedY;
+    float bedZ;
+    float nozzleDiameter;           ///< mm
+    QString material;               ///< Filament loaded, e.g. "PLA"
+    float speedFactor;              ///< Estimated times are divided by this, 1 for the estimator configuration
+} PrinterCapabilities;
+
+/**
+ * Memory of one link, bytes. The parts in the arena have a fixed size, the buffers grow with the
+ * traffic and are counted by their current capacity.
+ */
+typedef struct {
+    quint32 link;                   ///< PrinterLink itself with the interpreter, outside the arena
+    quint32 arenaCapacity;
+    quint32 communication;          ///< Parts in the arena
+    quint32 protocol;               ///< MinProtocol with its context
+    quint32 streamer;
+    quint32 timers;
+    quint32 buffers;                ///< Qt buffers of the port and the streamer, outside the arena
+    quint32 total;
+} LinkFootprint;
+
+/**
+ * @brief PrinterLink
+ *
+ * Everything needed to talk to one printer: the serial port, the MIN context fed from it,
+ * the command interpreter for the received frames and the job streamer.
+ *
+ * When the serial port disappears in the middle of a job the streamer is suspended and the link
+ * waits for the printer (found by its serial number in the port registry) to come back. After the
+ * port is opened again and the transport reset the job continues from the first command the
+ * printer did not ACK, but only once a new status report shows the axes still homed and the
+ * firmware did not start a transport reset itself. Opening the port may reboot the controller
+ * (DTR), a rebooted printer keeps the job suspended until the operator calls resumeJob().
+ *
+ * Temperatures, position, state and job progress are published to the telemetry bus and appended
+ * to the telemetry history, each if set.
+ *
+ * The link is not polled at a fixed period: the poll timer is armed for the next deadline of the
+ * MIN transport (send, retransmit, ACK, batch), received data and the streamer wake it up. An idle
+ * link has no timer running. Code which queues frames on the protocol directly calls wake().
+ *
+ * The communication, the MIN context, the streamer and the timers are all placed in one LinkArena
+ * of the link, destroyed together and in a fixed order with it. getFootprint() tells how much
+ * memory a link takes, also logged on connect.
+ */
+class PrinterLink : public QObject, public ITelemetryListener
+{
+    Q_OBJECT
+
+public:
+    explicit PrinterLink(QObject *parent = nullptr);
+    ~PrinterLink();
+
+    int connectPrinter();
+    int disconnectPrinter();
+    void setPortRegistry(PortRegistry *registry);
+    bool isReconnecting() const;
+    bool isAwaitingResume() const;
+    bool resumeJob();
+    const PrinterCapabilities &getCapabilities() const;
+    void setTelemetry(TelemetryBus *bus, TelemetryStore *store, int printer);
+    virtual void onTelemetry(uint8_t min_id, const PrinterState &state);
+
+    Communication *getCommunication();
+    MinProtocol *getProtocol();
+    CommandInterpreter *getInterpreter();
+    JobStreamer *getStreamer();
+    LinkFootprint getFootprint() const;
+
+signals:
+    void linkLost();
+    void linkRestored();
+    void resumeRefused(const QString &reason);
+
+public slots:
+    void wake();
+
+private slots:
+    void poll();
+    void communicationError();
+    void tryReconnect();
+    void resumeCheckTimeout();
+    void streamerProgress(qint64 sentBytes, qint64 totalBytes);
+
+private:
+    void loadProfile();
+    void schedule(quint32 deadline);
+    void dataReceived(const FrameSpan &data);
+    void checkResume();
+    void recoverDecoder();
+    void refuseResume(const QString &reason);
+    static quint32 arenaSize();
+
+    LinkArena arena;
+    Communication *communication;
+    System system;
+    CommandInterpreter cmd;
+    MinProtocol *protocol;
+    JobStreamer *streamer;
+    QTimer *pollTimer;
+    QTimer *reconnectTimer;
+    QTimer *resumeCheckTimer;
+    PortRegistry *registry;
+    bool reconnecting;
+    bool checkingResume;            ///< Reconnected, waiting for a status report before the job continues
+    quint32 resetsAtReconnect;      ///< RESETs from the firmware when the port was opened again
+    quint32 statusAtReconnect;      ///< Status reports when the port was opened again
+    quint32 decompressErrors;       ///< Decoder failures already handled by a transport reset
+    PrinterCapabilities capabilities;
+    TelemetryBus *telemetry;
+    TelemetryStore *history;
+    int telemetryPrinter;
+    qint32 lastProgress;            ///< Last progress appended to the history, 1/10000
+};
+
+#endif // PRINTERLINK_H
@@ -0,0 +1,599 @@
+#include "printestimator.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QDebug>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#define ESTIMATOR_MAGIC             (0x47455354U)   // "GEST"
+#define ESTIMATOR_PI                (3.14159265358979f)
+
+// Defaults for PLA
+#define ESTIMATOR_DEFAULT_FILAMENT_DIAMETER     (1.75f)
+#define ESTIMATOR_DEFAULT_FILAMENT_DENSITY      (1.24f)
+
+/* Odcinek przy granicy fragmentu, planowany jeszcze raz przy scalaniu */
+typedef struct {
+    GcodeMove move;                 ///< Chained to the previous segment, see ChunkTask::path
+    float time;                     ///< s, as planned inside the chunk
+    quint32 layer;
+} BoundarySegment;
+
+typedef struct {
+    GcodeIndexEntry start;          ///< State before the first line
+    qint64 end;
+    /* Sumy tysięcy krótkich odcinków, float traci tu sekundy */
+    double time;
+    double dwellTime;
+    double filament;
+    quint32 segments;
+    QVector<double> layerTimes;     ///< Index relative to start.layer
+    QVector<BoundarySegment> head;  ///< First segments, up to the first stop
+    QVector<BoundarySegment> tail;  ///< Last segments after the last stop, none of them in head
+    bool headStops;                 ///< The path stops on the printer right after head
+    bool tailStarts;                ///< The path starts from rest on the printer right before tail
+} ChunkEstimate;
+
+/**
+ * Czas odcinka trapezowego: przyspieszanie, jazda ze stałą prędkością i hamowanie.
+ */
+static float segmentTime(const PlannedSegment &s)
+{
+    float time = 0.0f;
+    float cruiseDistance = s.length - s.accelDistance - s.decelDistance;
+    if(s.accelDistance > 0.0f && s.entrySpeed + s.cruiseSpeed > 0.0f)
+        time += 2.0f * s.accelDistance / (s.entrySpeed + s.cruiseSpeed);
+    if(s.decelDistance > 0.0f && s.cruiseSpeed + s.exitSpeed > 0.0f)
+        time += 2.0f * s.decelDistance / (s.cruiseSpeed + s.exitSpeed);
+    if(cruiseDistance > 0.0f && s.cruiseSpeed > 0.0f)
+        time += cruiseDistance / s.cruiseSpeed;
+    return time;
+}
+
+/**
+ * Commands the firmware executes only once the planner is empty, the path stops before them.
+ */
+static bool isStop(const GcodeCommand &command)
+{
+    if(command.letter == 'G')
+        return command.code == 4 || command.code == 28;
+    if(command.letter == 'M')
+        return command.code == 0 || command.code == 1 || command.code == 109
+            || command.code == 190 || command.code == 400;
+    return false;
+}
+
+class ChunkTask : public QRunnable
+{
+public:
+    ChunkTask(const char *data, const QVector<qint64> *layerStarts, const PlannerConfig &config,
+              ChunkEstimate *chunk) :
+        data(data), layerStarts(layerStarts), chunk(chunk)
+    {
+        planner.setConfig(config);
+    }
+    void run();
+
+private:
+    void addMove(const GcodeMove &move);
+    void addArc(const GcodeCommand &command, const float *from, const float *to, float feedrate);
+    void stop();
+    void drain();
+
+    const char *data;
+    const QVector<qint64> *layerStarts;
+    ChunkEstimate *chunk;
+    MotionPlanner planner;
+
+    float path[GCODE_AXES];         ///< End of the last planned move, moves are chained by their deltas so G92 does not break the path
+    quint32 layer;
+    BoundarySegment queued[PLANNER_CAPACITY];   ///< Moves in the planner, ring
+    int added;
+    int taken;
+    BoundarySegment recent[ESTIMATOR_FIXUP_SEGMENTS];   ///< Last segments since the last stop, ring
+    int recentCount;
+    bool stopped;                   ///< The chunk had a stop already
+};
+
+void ChunkTask::run()
+{
+    const GcodeIndexEntry &start = chunk->start;
+    memcpy(path, start.position, sizeof(path));
+    planner.reset(path);
+    added = 0;
+    taken = 0;
+    recentCount = 0;
+    stopped = false;
+
+    GcodeMachine machine;
+    machine.setState(start.position, start.feedrate, start.relative, start.relativeExtrusion);
+    layer = start.layer;
+    int nextLayer = static_cast<int>(std::upper_bound(layerStarts->begin(), layerStarts->end(), start.offset)
+                                     - layerStarts->begin());
+
+    const char *p = data + start.offset;
+    const char *end = data + chunk->end;
+    while(p < end)
+    {
+        const char *nl = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+        const char *lineEnd = nl ? nl : end;
+        qint64 offset = p - data;
+        while(nextLayer < layerStarts->size() && layerStarts->at(nextLayer) <= offset)
+        {
+            layer++;
+            nextLayer++;
+        }
+
+        GcodeCommand command;
+        if(GcodeParser::parse(p, static_cast<int>(lineEnd - p), &command))
+        {
+            float from[GCODE_AXES];
+            memcpy(from, machine.getPosition(), sizeof(from));
+            GcodeMove move;
+            bool linear = machine.apply(command, &move);
+            bool motion = command.letter == 'G' && command.code >= 0 && command.code <= 3;
+
+            if(motion)
+                chunk->filament += machine.getPosition()[GCODE_E] - from[GCODE_E];
+            if(linear)
+            {
+                addMove(move);
+            }
+            else if(motion)
+            {
+                addArc(command, from, machine.getPosition(), machine.getFeedrate());
+            }
+            else if(isStop(command))
+            {
+                stop();
+                if(command.letter == 'G' && command.code == 4)
+                {
+                    float dwell = 0.0f;
+                    if(GCODE_HAS(command, GCODE_P))
+                        dwell = command.value[GCODE_P] / 1000.0f;
+                    else if(GCODE_HAS(command, GCODE_S))
+                        dwell = command.value[GCODE_S];
+                    if(dwell > 0.0f)
+                    {
+                        chunk->dwellTime += dwell;
+                        chunk->time += dwell;
+                        int k = static_cast<int>(layer - start.layer);
+                        if(chunk->layerTimes.size() <= k)
+                            chunk->layerTimes.resize(k + 1);
+                        chunk->layerTimes[k] += dwell;
+                    }
+                }
+            }
+        }
+        p = lineEnd + 1;
+    }
+
+    /* Koniec fragmentu nie jest zatrzymaniem, ścieżkę poprawia scalanie */
+    planner.flush();
+    drain();
+
+    int recentKept = qMin(recentCount, ESTIMATOR_FIXUP_SEGMENTS);
+    int first = qMax(static_cast<int>(chunk->segments) - recentKept, chunk->head.size());
+    for(int i = first; i < static_cast<int>(chunk->segments); i++)
+    {
+        int age = static_cast<int>(chunk->segments) - i;
+        chunk->tail.append(recent[(recentCount - age) % ESTIMATOR_FIXUP_SEGMENTS]);
+    }
+    chunk->tailStarts = stopped && recentCount <= ESTIMATOR_FIXUP_SEGMENTS;
+}
+
+void ChunkTask::addMove(const GcodeMove &move)
+{
+    GcodeMove chained;
+    float moved = 0.0f;
+    for(int a = 0; a < GCODE_AXES; a++)
+    {
+        float d = move.to[a] - move.from[a];
+        chained.from[a] = path[a];
+        chained.to[a] = path[a] + d;
+        moved += fabsf(d);
+    }
+    if(moved == 0.0f)
+        return;
+    chained.feedrate = move.feedrate;
+    chained.rapid = move.rapid;
+
+    if(!planner.addMove(chained))
+    {
+        drain();
+        planner.addMove(chained);
+    }
+    memcpy(path, chained.to, sizeof(path));
+
+    BoundarySegment &segment = queued[added % PLANNER_CAPACITY];
+    segment.move = chained;
+    segment.time = 0.0f;
+    segment.layer = layer;
+    added++;
+}
+
+/**
+ * Łuk dzielony na cięciwy jak w firmware, niepoprawny łuk liczony jako ruch liniowy.
+ */
+void ChunkTask::addArc(const GcodeCommand &command, const float *from, const float *to, float feedrate)
+{
+    GcodeMove move;
+    move.feedrate = feedrate;
+    move.rapid = false;
+    memcpy(move.from, from, sizeof(move.from));
+
+    GcodeArc arc;
+    if(!arc.setup(command, from, to))
+    {
+        memcpy(move.to, to, sizeof(move.to));
+        addMove(move);
+        return;
+    }
+
+    int segments = arc.segments(ESTIMATOR_ARC_TOLERANCE);
+    for(int k = 1; k <= segments; k++)
+    {
+        arc.point(static_cast<float>(k) / static_cast<float>(segments), move.to);
+        addMove(move);
+        memcpy(move.from, move.to, sizeof(move.from));
+    }
+}
+
+void ChunkTask::stop()
+{
+    planner.flush();
+    drain();
+    if(!stopped)
+    {
+        chunk->headStops = chunk->head.size() == static_cast<int>(chunk->segments);
+        stopped = true;
+    }
+    recentCount = 0;
+}
+
+void ChunkTask::drain()
+{
+    PlannedSegment out[PLANNER_BATCH];
+    int n;
+    while((n = planner.takeReady(out, PLANNER_BATCH)) > 0)
+    {
+        for(int k = 0; k < n; k++)
+        {
+            BoundarySegment segment = queued[taken % PLANNER_CAPACITY];
+            taken++;
+            segment.time = segmentTime(out[k]);
+
+            chunk->time += segment.time;
+            int i = static_cast<int>(segment.layer - chunk->start.layer);
+            if(chunk->layerTimes.size() <= i)
+                chunk->layerTimes.resize(i + 1);
+            chunk->layerTimes[i] += segment.time;
+
+            if(!stopped && chunk->head.size() < ESTIMATOR_FIXUP_SEGMENTS)
+                chunk->head.append(segment);
+            recent[recentCount % ESTIMATOR_FIXUP_SEGMENTS] = segment;
+            recentCount++;
+            chunk->segments++;
+        }
+    }
+}
+
+/**
+ * Końcówka fragmentu i początek następnego planowane razem. Segmenty na brzegach okna znowu
+ * zaczynają i kończą się w miejscu, więc poprawiana jest tylko połowa okna po każdej stronie granicy,
+ * chyba że na drukarce ścieżka też się tam zatrzymuje.
+ *
+ * @return change of the total time, s; the layer times are corrected in place
+ */
+static float fixBoundary(MotionPlanner *planner, const ChunkEstimate &before, const ChunkEstimate &after,
+                        PrintEstimate *result)
+{
+    if(before.tail.isEmpty() || after.head.isEmpty())
+        return 0.0f;
+
+    QVector<BoundarySegment> window = before.tail + after.head;
+    float path[GCODE_AXES];
+    memcpy(path, window[0].move.from, sizeof(path));
+    planner->reset(path);
+    for(int i = 0; i < window.size(); i++)
+    {
+        GcodeMove move = window[i].move;
+        for(int a = 0; a < GCODE_AXES; a++)
+        {
+            float d = move.to[a] - move.from[a];
+            move.from[a] = path[a];
+            move.to[a] = path[a] + d;
+        }
+        memcpy(path, move.to, sizeof(path));
+        planner->addMove(move);
+    }
+    planner->flush();
+
+    PlannedSegment out[2 * ESTIMATOR_FIXUP_SEGMENTS];
+    int n = planner->takeReady(out, 2 * ESTIMATOR_FIXUP_SEGMENTS);
+    if(n != window.size())
+        return 0.0f;
+
+    int first = before.tailStarts ? 0 : before.tail.size() / 2;
+    int last = after.headStops ? window.size() : before.tail.size() + (after.head.size() + 1) / 2;
+    float change = 0.0f;
+    for(int i = first; i < last; i++)
+    {
+        float d = segmentTime(out[i]) - window[i].time;
+        change += d;
+        if(window[i].layer < static_cast<quint32>(result->layerTimes.size()))
+            result->layerTimes[static_cast<int>(window[i].layer)] += d;
+    }
+    return change;
+}
+
+PrintEstimator::PrintEstimator()
+{
+    config = defaultConfig();
+    clear();
+}
+
+void PrintEstimator::setConfig(const EstimatorConfig &config)
+{
+    this->config = config;
+}
+
+const EstimatorConfig &PrintEstimator::getConfig() const
+{
+    return config;
+}
+
+EstimatorConfig PrintEstimator::defaultConfig()
+{
+    EstimatorConfig config;
+    config.planner = MotionPlanner::defaultConfig();
+    config.filamentDiameter = ESTIMATOR_DEFAULT_FILAMENT_DIAMETER;
+    config.filamentDensity = ESTIMATOR_DEFAULT_FILAMENT_DENSITY;
+    return config;
+}
+
+void PrintEstimator::clear()
+{
+    fileName.clear();
+    fileSize = 0;
+    fileModified = 0;
+    result.time = 0.0f;
+    result.dwellTime = 0.0f;
+    result.filament = 0.0f;
+    result.filamentMass = 0.0f;
+    result.lines = 0;
+    result.segments = 0;
+    result.layerTimes.clear();
+}
+
+QString PrintEstimator::sidecarName(const QString &fileName)
+{
+    return fileName + ".est";
+}
+
+bool PrintEstimator::open(const QString &fileName)
+{
+    if(load(fileName))
+        return true;
+
+    if(!estimate(fileName))
+        return false;
+
+    if(!save())
+        qWarning() << "Warning: Nie można zapisać oszacowania: " << sidecarName(fileName);
+    return true;
+}
+
+bool PrintEstimator::estimate(const QString &fileName)
+{
+    GcodeIndex index;
+    if(!index.open(fileName))
+        return false;
+    return estimate(index);
+}
+
+/**
+ * @brief PrintEstimator::estimate
+ *
+ * Parallel planning of chunks starting at index checkpoints, then a sequential fix-up of the boundaries.
+ */
+bool PrintEstimator::estimate(const GcodeIndex &index)
+{
+    clear();
+    if(!index.isValid())
+        return false;
+
+    QFile file(index.getFileName());
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Error: Nie można otworzyć pliku G-code: " << index.getFileName() << "\n";
+        return false;
+    }
+    QFileInfo info(file);
+    qint64 size = file.size();
+
+    const char *data = nullptr;
+    if(size > 0)
+    {
+        data = reinterpret_cast<const char *>(file.map(0, size));
+        if(!data)
+        {
+            qDebug() << "Error: Nie można zmapować pliku G-code: " << index.getFileName() << "\n";
+            return false;
+        }
+    }
+
+    const QVector<GcodeIndexEntry> &entries = index.getEntries();
+    QVector<qint64> layerStarts;
+    for(int i = 0; i < entries.size(); i++)
+    {
+        if(entries[i].layerStart)
+            layerStarts.append(entries[i].offset);
+    }
+
+    /* Fragmenty zaczynają się w punktach kontrolnych, stan maszyny jest tam znany */
+    int threads = qMax(1, QThread::idealThreadCount());
+    qint64 count = qBound<qint64>(1, size / INDEX_MIN_CHUNK, threads * INDEX_CHUNKS_PER_THREAD);
+    QVector<ChunkEstimate> chunks;
+    for(qint64 i = 0; i < count && !entries.isEmpty(); i++)
+    {
+        GcodeIndexEntry entry = entries[0];
+        if(i > 0 && !index.findByOffset(size * i / count, &entry))
+            continue;
+        if(!chunks.isEmpty() && entry.offset <= chunks.last().start.offset)
+            continue;
+
+        ChunkEstimate chunk;
+        chunk.start = entry;
+        chunk.end = size;
+        chunk.time = 0.0f;
+        chunk.dwellTime = 0.0f;
+        chunk.filament = 0.0f;
+        chunk.segments = 0;
+        chunk.headStops = false;
+        chunk.tailStarts = false;
+        if(!chunks.isEmpty())
+            chunks.last().end = entry.offset;
+        chunks.append(chunk);
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for(int i = 0; i < chunks.size(); i++)
+        pool.start(new ChunkTask(data, &layerStarts, config.planner, &chunks[i]));
+    pool.waitForDone();
+
+    /* Scalanie: sumy fragmentów i poprawki na granicach */
+    double time = 0.0;
+    double dwellTime = 0.0;
+    double filament = 0.0;
+    result.lines = index.getLineCount();
+    result.layerTimes.fill(0.0f, static_cast<int>(index.getLayerCount()) + 1);
+    for(int i = 0; i < chunks.size(); i++)
+    {
+        const ChunkEstimate &chunk = chunks[i];
+        time += chunk.time;
+        dwellTime += chunk.dwellTime;
+        filament += chunk.filament;
+        result.segments += chunk.segments;
+        for(int k = 0; k < chunk.layerTimes.size(); k++)
+        {
+            int layer = static_cast<int>(chunk.start.layer) + k;
+            if(layer < result.layerTimes.size())
+                result.layerTimes[layer] += static_cast<float>(chunk.layerTimes[k]);
+        }
+        if(i > 0)
+            time += fixBoundary(&planner, chunks[i - 1], chunk, &result);
+    }
+    result.time = static_cast<float>(time);
+    result.dwellTime = static_cast<float>(dwellTime);
+    result.filament = static_cast<float>(filament);
+    float radius = 0.5f * config.filamentDiameter;
+    /* mm^3 -> cm^3 */
+    result.filamentMass = result.filament * ESTIMATOR_PI * radius * radius / 1000.0f * config.filamentDensity;
+
+    if(data)
+        file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
+    file.close();
+
+    fileName = index.getFileName();
+    fileSize = size;
+    fileModified = info.lastModified().toMSecsSinceEpoch();
+    return true;
+}
+
+bool PrintEstimator::save() const
+{
+    if(!isValid())
+        return false;
+
+    QFile file(sidecarName(fileName));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QDataStream out(&file);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    out << quint32(ESTIMATOR_MAGIC) << quint32(ESTIMATOR_VERSION) << fileSize << fileModified
+        << config.planner.acceleration << config.planner.junctionDeviation << config.planner.maxFeedrate
+        << config.filamentDiameter << config.filamentDensity
+        << result.time << result.dwellTime << result.filament << result.filamentMass
+        << result.lines << result.segments << quint32(result.layerTimes.size());
+    for(int i = 0; i < result.layerTimes.size(); i++)
+        out << result.layerTimes[i];
+    return out.status() == QDataStream::Ok;
+}
+
+/**
+ * @brief PrintEstimator::load
+ *
+ * Reads the sidecar, fails if it is missing, damaged, written with another configuration
+ * or the file changed since it was written.
+ */
+bool PrintEstimator::load(const QString &fileName)
+{
+    clear();
+
+    QFileInfo info(fileName);
+    QFile file(sidecarName(fileName));
+    if(!info.exists() || !file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    quint32 magic, version, count;
+    qint64 size, modified;
+    EstimatorConfig saved;
+    in >> magic >> version >> size >> modified
+       >> saved.planner.acceleration >> saved.planner.junctionDeviation >> saved.planner.maxFeedrate
+       >> saved.filamentDiameter >> saved.filamentDensity;
+    if(in.status() != QDataStream::Ok || magic != ESTIMATOR_MAGIC || version != ESTIMATOR_VERSION)
+        return false;
+    if(size != info.size() || modified != info.lastModified().toMSecsSinceEpoch())
+        return false;
+    if(saved.planner.acceleration != config.planner.acceleration
+       || saved.planner.junctionDeviation != config.planner.junctionDeviation
+       || saved.planner.maxFeedrate != config.planner.maxFeedrate
+       || saved.filamentDiameter != config.filamentDiameter
+       || saved.filamentDensity != config.filamentDensity)
+        return false;
+
+    in >> result.time >> result.dwellTime >> result.filament >> result.filamentMass
+       >> result.lines >> result.segments >> count;
+    if(in.status() == QDataStream::Ok)
+    {
+        result.layerTimes.resize(static_cast<int>(count));
+        for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+            in >> result.layerTimes[static_cast<int>(i)];
+    }
+    if(in.status() != QDataStream::Ok)
+    {
+        clear();
+        return false;
+    }
+
+    this->fileName = fileName;
+    fileSize = size;
+    fileModified = modified;
+    return true;
+}
+
+bool PrintEstimator::isValid() const
+{
+    return !fileName.isEmpty();
+}
+
+const QString &PrintEstimator::getFileName() const
+{
+    return fileName;
+}
+
+const PrintEstimate &PrintEstimator::getEstimate() const
+{
+    return result;
+}
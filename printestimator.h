@@ -0,0 +1,84 @@
+#ifndef PRINTESTIMATOR_H
+#define PRINTESTIMATOR_H
+
+#include <QString>
+#include <QVector>
+#include "gcodeindex.h"
+#include "motionplanner.h"
+
+// Segments on each side of a chunk boundary planned again across it in the fix-up
+#define ESTIMATOR_FIXUP_SEGMENTS    (32)
+// mm, furthest a chord of a G2/G3 may be from the arc, the firmware default
+#define ESTIMATOR_ARC_TOLERANCE     (0.01f)
+// Bumped whenever the sidecar layout or the model changes
+#define ESTIMATOR_VERSION           (1)
+
+typedef struct {
+    PlannerConfig planner;          ///< Same as the firmware of the printer
+    float filamentDiameter;         ///< mm
+    float filamentDensity;          ///< g/cm^3
+} EstimatorConfig;
+
+typedef struct {
+    float time;                     ///< s, moves and dwells
+    float dwellTime;                ///< s spent in G4
+    float filament;                 ///< mm pushed by the extruder, retracts subtracted
+    float filamentMass;             ///< g
+    quint32 lines;
+    quint32 segments;               ///< Moves given to the planner, arcs split into chords
+    QVector<float> layerTimes;      ///< s, index is the layer number, 0 is everything before the first layer
+} PrintEstimate;
+
+/**
+ * @brief PrintEstimator
+ *
+ * Print time and filament usage of a G-code file, kept in a sidecar file ("<file>.est") next to it.
+ * The sidecar is used only while the size and modification time of the file and the configuration match.
+ *
+ * The file is split into chunks at checkpoints of its GcodeIndex, which gives the exact machine state
+ * at the start of every chunk, and the chunks are planned in parallel with the same lookahead planner
+ * the streamer uses (acceleration, junction deviation, backward and forward passes). A chunk has to
+ * start and end at rest, so the fix-up plans the last segments of every chunk together with the first
+ * segments of the next one again and replaces the times near the boundary.
+ *
+ * Waiting for temperatures and homing are not counted, their duration depends on the printer.
+ */
+class PrintEstimator
+{
+public:
+    PrintEstimator();
+
+    void setConfig(const EstimatorConfig &config);
+    const EstimatorConfig &getConfig() const;
+    static EstimatorConfig defaultConfig();
+
+    /**
+     * Loads the sidecar of the file, or estimates the file and writes the sidecar.
+     */
+    bool open(const QString &fileName);
+    bool estimate(const QString &fileName);
+
+    /**
+     * Estimates the file of an already open index.
+     */
+    bool estimate(const GcodeIndex &index);
+    bool load(const QString &fileName);
+    bool save() const;
+    void clear();
+
+    bool isValid() const;
+    const QString &getFileName() const;
+    const PrintEstimate &getEstimate() const;
+
+    static QString sidecarName(const QString &fileName);
+
+private:
+    EstimatorConfig config;
+    QString fileName;
+    qint64 fileSize;
+    qint64 fileModified;            ///< ms since epoch
+    PrintEstimate result;
+    MotionPlanner planner;          ///< Used by the fix-up
+};
+
+#endif // PRINTESTIMATOR_H
@@ -1,4 +1,6 @@
 #include "system.h"
+#include <chrono>
+#include <stdint.h>
 
 System::System()
 {
@@ -12,5 +14,14 @@ System::~System()
 
 int System::getCurrentTimeInMs()
 {
-    return 1;
+    /* Monotoniczny zegar, MIN liczy na nim timeouty i opóźnienia (przepełnienie jest obsługiwane przez uint32_t) */
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+int System::getCurrentTimeInUs()
+{
+    /* Ten sam zegar, przepełnia się co ok. 71 minut, MIN liczy różnice na uint32_t */
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return static_cast<int>(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count()));
 }
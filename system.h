@@ -9,6 +9,7 @@ public:
     System();
     ~System();
     virtual int getCurrentTimeInMs();
+    virtual int getCurrentTimeInUs();
 
 };
 
@@ -0,0 +1,210 @@
+#include "telemetrybus.h"
+#include <QDateTime>
+#include <QMutexLocker>
+#include <string.h>
+
+TelemetryBus::TelemetryBus(QObject *parent) :
+    QObject(parent)
+{
+    epoch = QDateTime::currentMSecsSinceEpoch();
+    clock.start();
+    printers = 0;
+    published = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    timer = new QTimer(this);
+    connect(timer, SIGNAL(timeout()), this, SLOT(flush()));
+    setRate(TELEMETRY_DEFAULT_RATE_HZ);
+}
+
+void TelemetryBus::setRate(int hz)
+{
+    if(hz <= 0)
+        hz = TELEMETRY_DEFAULT_RATE_HZ;
+    timer->start(1000 / hz);
+}
+
+int TelemetryBus::addPrinter()
+{
+    int keys;
+    {
+        QMutexLocker locker(&valueMutex);
+        TelemetrySample sample;
+        sample.value = 0.0f;
+        sample.time = 0;
+        for(int field = 0; field < TELEMETRY_FIELDS; field++)
+        {
+            sample.key = static_cast<quint32>(TELEMETRY_KEY(printers, field));
+            latest.append(sample);
+            changes.append(0);
+        }
+        printers++;
+        keys = latest.size();
+    }
+
+    QMutexLocker locker(&subscriberMutex);
+    for(int i = 0; i < subscribers.size(); i++)
+        subscribers[i].pending.resize(keys);
+    return printers - 1;
+}
+
+int TelemetryBus::printerCount() const
+{
+    QMutexLocker locker(&valueMutex);
+    return printers;
+}
+
+/**
+ * @brief TelemetryBus::publish
+ *
+ * Wywoływane przy odbiorze ramki, koszt niezależny od liczby subskrybentów.
+ */
+void TelemetryBus::publish(int printer, int field, float value)
+{
+    QMutexLocker locker(&valueMutex);
+    if(printer < 0 || printer >= printers || field < 0 || field >= TELEMETRY_FIELDS)
+        return;
+
+    int key = TELEMETRY_KEY(printer, field);
+    TelemetrySample &sample = latest[key];
+    sample.value = value;
+    sample.time = epoch + clock.elapsed();
+    if(changes[key]++ == 0)
+        dirty.append(static_cast<quint32>(key));
+    published++;
+}
+
+int TelemetryBus::subscribe()
+{
+    int keys;
+    {
+        QMutexLocker locker(&valueMutex);
+        keys = latest.size();
+    }
+
+    QMutexLocker locker(&subscriberMutex);
+    int id = 0;
+    while(id < subscribers.size() && subscribers[id].active)
+        id++;
+    if(id == subscribers.size())
+        subscribers.resize(id + 1);
+
+    Subscriber &s = subscribers[id];
+    s.active = true;
+    s.pending.fill(0, keys);
+    s.keys.clear();
+    s.dropped = 0;
+    return id;
+}
+
+void TelemetryBus::unsubscribe(int subscriber)
+{
+    QMutexLocker locker(&subscriberMutex);
+    if(subscriber < 0 || subscriber >= subscribers.size())
+        return;
+
+    Subscriber &s = subscribers[subscriber];
+    s.active = false;
+    s.pending.clear();
+    s.keys.clear();
+}
+
+int TelemetryBus::take(int subscriber, QVector<TelemetrySample> *samples)
+{
+    QVector<quint32> keys;
+    {
+        QMutexLocker locker(&subscriberMutex);
+        if(subscriber < 0 || subscriber >= subscribers.size() || !subscribers[subscriber].active)
+            return 0;
+
+        Subscriber &s = subscribers[subscriber];
+        keys.swap(s.keys);
+        for(int i = 0; i < keys.size(); i++)
+            s.pending[static_cast<int>(keys[i])] = 0;
+        stats.delivered += static_cast<quint64>(keys.size());
+    }
+
+    QMutexLocker locker(&valueMutex);
+    for(int i = 0; i < keys.size(); i++)
+        samples->append(latest[static_cast<int>(keys[i])]);
+    return keys.size();
+}
+
+quint64 TelemetryBus::droppedFor(int subscriber) const
+{
+    QMutexLocker locker(&subscriberMutex);
+    if(subscriber < 0 || subscriber >= subscribers.size())
+        return 0;
+    return subscribers[subscriber].dropped;
+}
+
+TelemetryStats TelemetryBus::getStats() const
+{
+    TelemetryStats result;
+    {
+        QMutexLocker locker(&subscriberMutex);
+        result = stats;
+    }
+    QMutexLocker locker(&valueMutex);
+    result.published = published;
+    return result;
+}
+
+/**
+ * @brief TelemetryBus::flush
+ *
+ * Changed keys are taken over with valueMutex held only for the swap, the subscribers are
+ * updated under their own mutex so publish() never waits for the fan-out.
+ */
+void TelemetryBus::flush()
+{
+    flushKeys.clear();
+    flushChanges.clear();
+    {
+        QMutexLocker locker(&valueMutex);
+        if(dirty.isEmpty())
+            return;
+        flushKeys.swap(dirty);
+        for(int i = 0; i < flushKeys.size(); i++)
+        {
+            int key = static_cast<int>(flushKeys[i]);
+            flushChanges.append(changes[key]);
+            changes[key] = 0;
+        }
+    }
+
+    QElapsedTimer fanout;
+    fanout.start();
+    {
+        QMutexLocker locker(&subscriberMutex);
+        for(int i = 0; i < subscribers.size(); i++)
+        {
+            Subscriber &s = subscribers[i];
+            if(!s.active)
+                continue;
+            quint64 dropped = 0;
+            for(int k = 0; k < flushKeys.size(); k++)
+            {
+                int key = static_cast<int>(flushKeys[k]);
+                /* Tylko najnowsza wartość dociera do subskrybenta */
+                dropped += flushChanges[k] - 1;
+                if(s.pending[key])
+                {
+                    dropped++;
+                }
+                else
+                {
+                    s.pending[key] = 1;
+                    s.keys.append(flushKeys[k]);
+                }
+            }
+            s.dropped += dropped;
+            stats.dropped += dropped;
+        }
+        stats.flushes++;
+        stats.lastFanoutNs = fanout.nsecsElapsed();
+        if(stats.lastFanoutNs > stats.maxFanoutNs)
+            stats.maxFanoutNs = stats.lastFanoutNs;
+    }
+    emit updated();
+}
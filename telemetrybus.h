@@ -0,0 +1,131 @@
+#ifndef TELEMETRYBUS_H
+#define TELEMETRYBUS_H
+
+#include <QObject>
+#include <QTimer>
+#include <QMutex>
+#include <QVector>
+#include <QElapsedTimer>
+
+// Flushes per second unless set otherwise ("telemetry/rate")
+#define TELEMETRY_DEFAULT_RATE_HZ   (10)
+
+// Values published for every printer
+enum {
+    TELEMETRY_HOTEND = 0,           ///< degree Celsius
+    TELEMETRY_HOTEND_TARGET,
+    TELEMETRY_BED,
+    TELEMETRY_BED_TARGET,
+    TELEMETRY_X,                    ///< mm
+    TELEMETRY_Y,
+    TELEMETRY_Z,
+    TELEMETRY_E,
+    TELEMETRY_PROGRESS,             ///< 0..1 of the job file sent
+    TELEMETRY_STATE,                ///< Printer state machine, MsgStatus::state
+    TELEMETRY_FIELDS,
+};
+
+#define TELEMETRY_KEY(printer, field)   ((printer) * TELEMETRY_FIELDS + (field))
+
+typedef struct {
+    quint32 key;                    ///< TELEMETRY_KEY()
+    float value;
+    qint64 time;                    ///< ms since epoch
+} TelemetrySample;
+
+typedef struct {
+    quint64 published;              ///< Samples published
+    quint64 flushes;                ///< Flushes with at least one change
+    quint64 delivered;              ///< Samples taken by subscribers
+    quint64 dropped;                ///< Samples replaced by a newer one before a subscriber took them
+    qint64 lastFanoutNs;            ///< Time of the last flush spent on the subscribers
+    qint64 maxFanoutNs;
+} TelemetryStats;
+
+/**
+ * @brief TelemetryBus
+ *
+ * Fan-out of the printer telemetry to many subscribers (dashboards, WebSocket clients).
+ *
+ * publish() is called from the received-frame path and only stores the value as the latest one
+ * of its key and marks the key changed, the cost does not depend on the subscribers. At the
+ * configured rate flush() hands the changed keys to every subscriber: a subscriber keeps one
+ * pending flag per key, not a queue, so a subscriber which does not take() its updates holds at
+ * most one value per key (the newest) and the replaced ones are counted as dropped.
+ *
+ * Subscribers take() from any thread when they are ready for more, e.g. when their socket
+ * has drained, which is the backpressure.
+ */
+class TelemetryBus : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TelemetryBus(QObject *parent = nullptr);
+
+    void setRate(int hz);
+
+    /**
+     * Adds the keys of one more printer.
+     *
+     * @return index of the printer
+     */
+    int addPrinter();
+    int printerCount() const;
+
+    void publish(int printer, int field, float value);
+
+    /**
+     * @return id of the subscriber
+     */
+    int subscribe();
+    void unsubscribe(int subscriber);
+
+    /**
+     * Appends the latest value of every key changed since the previous take().
+     *
+     * @return number of samples appended
+     */
+    int take(int subscriber, QVector<TelemetrySample> *samples);
+    quint64 droppedFor(int subscriber) const;
+
+    TelemetryStats getStats() const;
+
+signals:
+    /**
+     * Emitted after a flush which changed something, subscribers take() when ready.
+     */
+    void updated();
+
+private slots:
+    void flush();
+
+private:
+    typedef struct {
+        bool active;
+        QVector<quint8> pending;    ///< Flag per key, the key changed and was not taken yet
+        QVector<quint32> keys;      ///< Keys with the flag set, in the order they changed
+        quint64 dropped;
+    } Subscriber;
+
+    QTimer *timer;
+    QElapsedTimer clock;
+    qint64 epoch;                   ///< ms since epoch when the clock started
+
+    /* Wartości, chronione przez valueMutex; publish() blokuje tylko ten mutex */
+    mutable QMutex valueMutex;
+    QVector<TelemetrySample> latest;    ///< By key
+    QVector<quint32> changes;       ///< Samples of the key since the last flush
+    QVector<quint32> dirty;         ///< Keys with changes
+    int printers;
+    quint64 published;
+
+    /* Subskrybenci, chronieni przez subscriberMutex */
+    mutable QMutex subscriberMutex;
+    QVector<Subscriber> subscribers;
+    QVector<quint32> flushKeys;     ///< Used by flush() only
+    QVector<quint32> flushChanges;
+    TelemetryStats stats;           ///< Except published
+};
+
+#endif // TELEMETRYBUS_H
@@ -0,0 +1,383 @@
+#include "telemetrychart.h"
+#include <QPainter>
+#include <QFontDatabase>
+#include <QDateTime>
+#include <algorithm>
+#include <float.h>
+
+// Room for the value labels and the legend
+#define CHART_MARGIN_LEFT           (40)
+#define CHART_MARGIN_TOP            (14)
+#define CHART_MARGIN_BOTTOM         (4)
+#define CHART_GRID_LINES            (4)
+
+ChartRenderer::ChartRenderer(TelemetryStore *store)
+{
+    this->store = store;
+    step = 0;
+    first = 0;
+    filled = -1;
+}
+
+void ChartRenderer::setSeries(const QVector<ChartSeries> &series)
+{
+    this->series = series;
+    columns.clear();
+}
+
+/**
+ * @brief ChartRenderer::render
+ *
+ * Moves the columns to now, reads what is new since the previous frame and draws the image.
+ */
+void ChartRenderer::render(qint64 now, qint64 span, const QSize &size)
+{
+    if(size.isEmpty() || series.isEmpty())
+    {
+        emit rendered(QImage());
+        return;
+    }
+
+    int width = size.width();
+    qint64 newStep = qMax<qint64>(1, span / width);
+    qint64 last = now / newStep;
+    qint64 newFirst = last - width + 1;
+
+    Column empty;
+    empty.count = 0;
+    if(newStep != step || columns.size() != series.size() || columns[0].size() != width
+            || newFirst < first || newFirst - first >= width)
+    {
+        /* Nowa skala lub rozmiar, wszystko od nowa */
+        step = newStep;
+        filled = -1;
+        columns.resize(series.size());
+        for(int i = 0; i < columns.size(); i++)
+            columns[i].fill(empty, width);
+    }
+    else if(newFirst != first)
+    {
+        int shift = static_cast<int>(newFirst - first);
+        for(int i = 0; i < columns.size(); i++)
+        {
+            QVector<Column> &c = columns[i];
+            std::copy(c.begin() + shift, c.end(), c.begin());
+            std::fill(c.end() - shift, c.end(), empty);
+        }
+    }
+    first = newFirst;
+
+    /* Ostatnia odczytana kolumna mogła być niepełna, czytana ponownie */
+    qint64 from = qMax(filled, first);
+    for(int i = 0; i < columns.size(); i++)
+    {
+        std::fill(columns[i].begin() + static_cast<int>(from - first), columns[i].end(), empty);
+        fillSeries(i, from, last);
+    }
+    filled = last;
+
+    draw(size);
+}
+
+/**
+ * @brief ChartRenderer::fillSeries
+ *
+ * Columns from..to of one series. A rollup goes to the column of its start, so a column read
+ * again gets exactly the records it got before plus the new ones.
+ */
+void ChartRenderer::fillSeries(int index, qint64 from, qint64 to)
+{
+    const ChartSeries &s = series[index];
+    QVector<Column> &c = columns[index];
+    qint64 begin = from * step;
+    qint64 end = (to + 1) * step - 1;
+
+    if(step >= 1000)
+    {
+        rollups.clear();
+        store->queryRollup(s.printer, s.field, step >= 60 * 1000 ? TSTORE_MINUTES : TSTORE_SECONDS, begin, end, &rollups);
+        for(int i = 0; i < rollups.size(); i++)
+        {
+            const TelemetryRollup &r = rollups[i];
+            qint64 k = r.start / step;
+            if(k < from || k > to)
+                continue;
+            Column &column = c[static_cast<int>(k - first)];
+            if(column.count == 0)
+            {
+                column.min = r.min;
+                column.max = r.max;
+                column.sum = 0.0;
+            }
+            column.min = qMin(column.min, r.min);
+            column.max = qMax(column.max, r.max);
+            column.sum += static_cast<double>(r.avg) * r.count;
+            column.count += r.count;
+        }
+        return;
+    }
+
+    points.clear();
+    store->query(s.printer, s.field, begin, end, &points);
+    for(int i = 0; i < points.size(); i++)
+    {
+        const TelemetryPoint &p = points[i];
+        Column &column = c[static_cast<int>(p.time / step - first)];
+        if(column.count == 0)
+        {
+            column.min = p.value;
+            column.max = p.value;
+            column.sum = 0.0;
+        }
+        column.min = qMin(column.min, p.value);
+        column.max = qMax(column.max, p.value);
+        column.sum += p.value;
+        column.count++;
+    }
+}
+
+/**
+ * @brief ChartRenderer::draw
+ *
+ * A vertical line from min to max per column, joined through the column means.
+ */
+void ChartRenderer::draw(const QSize &size)
+{
+    int width = size.width();
+    int n = series.size();
+    QVector<float> lo(width * n);
+    QVector<float> hi(width * n);
+    QVector<float> mid(width * n);
+    QVector<quint8> valid(width * n, 0);
+
+    float vmin = FLT_MAX;
+    float vmax = -FLT_MAX;
+    for(int i = 0; i < n; i++)
+    {
+        const QVector<Column> &c = columns[i];
+        int prevX = -1;
+        double prevMean = 0.0;
+        for(int x = 0; x < width; x++)
+        {
+            if(c[x].count == 0)
+                continue;
+            double mean = c[x].sum / c[x].count;
+            int k = i * width + x;
+            if(series[i].kind == CHART_RATE)
+            {
+                if(prevX >= 0)
+                {
+                    /* Spadek to retrakcja albo G92, nie przepływ */
+                    float rate = static_cast<float>((mean - prevMean) * 1000.0 / ((x - prevX) * step));
+                    lo[k] = hi[k] = mid[k] = qMax(rate, 0.0f);
+                    valid[k] = 1;
+                }
+                prevX = x;
+                prevMean = mean;
+            }
+            else
+            {
+                lo[k] = c[x].min;
+                hi[k] = c[x].max;
+                mid[k] = static_cast<float>(mean);
+                valid[k] = 1;
+            }
+            /* Skala tylko z widocznej części */
+            if(valid[k] && x >= CHART_MARGIN_LEFT)
+            {
+                vmin = qMin(vmin, lo[k]);
+                vmax = qMax(vmax, hi[k]);
+            }
+        }
+    }
+    if(vmin > vmax)
+    {
+        vmin = 0.0f;
+        vmax = 1.0f;
+    }
+    if(vmax - vmin < 1e-3f)
+    {
+        vmin -= 1.0f;
+        vmax += 1.0f;
+    }
+    float pad = (vmax - vmin) * 0.05f;
+    vmin -= pad;
+    vmax += pad;
+
+    int top = CHART_MARGIN_TOP;
+    int plot = size.height() - CHART_MARGIN_TOP - CHART_MARGIN_BOTTOM;
+    float scale = plot / (vmax - vmin);
+
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    QPainter painter(&image);
+
+    /* Tekst poza wątkiem GUI tylko gdy platforma na to pozwala */
+    bool text = QFontDatabase::supportsThreadedFontRendering();
+    painter.setPen(QColor(225, 225, 225));
+    for(int g = 0; g <= CHART_GRID_LINES; g++)
+    {
+        int y = top + plot * g / CHART_GRID_LINES;
+        painter.drawLine(CHART_MARGIN_LEFT, y, width - 1, y);
+        if(text)
+        {
+            painter.setPen(Qt::gray);
+            float value = vmax - (vmax - vmin) * g / CHART_GRID_LINES;
+            painter.drawText(QRect(0, y - 7, CHART_MARGIN_LEFT - 4, 14), Qt::AlignRight | Qt::AlignVCenter,
+                             QString::number(value, 'f', 1));
+            painter.setPen(QColor(225, 225, 225));
+        }
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        painter.setPen(series[i].color);
+        int prevX = -1;
+        int prevY = 0;
+        for(int x = CHART_MARGIN_LEFT; x < width; x++)
+        {
+            int k = i * width + x;
+            if(!valid[k])
+                continue;
+            int yHi = top + static_cast<int>((vmax - hi[k]) * scale);
+            int yLo = top + static_cast<int>((vmax - lo[k]) * scale);
+            int yMid = top + static_cast<int>((vmax - mid[k]) * scale);
+            if(yHi != yLo)
+                painter.drawLine(x, yHi, x, yLo);
+            if(prevX >= 0)
+                painter.drawLine(prevX, prevY, x, yMid);
+            else
+                painter.drawPoint(x, yMid);
+            prevX = x;
+            prevY = yMid;
+        }
+    }
+
+    if(text)
+    {
+        int x = CHART_MARGIN_LEFT;
+        for(int i = 0; i < n; i++)
+        {
+            painter.setPen(series[i].color);
+            painter.drawText(x, CHART_MARGIN_TOP - 3, series[i].name);
+            x += painter.fontMetrics().width(series[i].name) + 10;
+        }
+    }
+    painter.end();
+
+    emit rendered(image);
+}
+
+TelemetryChart::TelemetryChart(TelemetryStore *store, TelemetryBus *bus, QWidget *parent) :
+    QWidget(parent)
+{
+    qRegisterMetaType<ChartSeries>("ChartSeries");
+    qRegisterMetaType<QVector<ChartSeries> >("QVector<ChartSeries>");
+
+    span = CHART_DEFAULT_SPAN_MS;
+    busy = false;
+    changed = true;
+    lastColumn = -1;
+    setAttribute(Qt::WA_OpaquePaintEvent);
+
+    renderer = new ChartRenderer(store);
+    renderer->moveToThread(&thread);
+    connect(&thread, SIGNAL(finished()), renderer, SLOT(deleteLater()));
+    connect(this, SIGNAL(seriesChanged(QVector<ChartSeries>)), renderer, SLOT(setSeries(QVector<ChartSeries>)));
+    connect(this, SIGNAL(renderRequested(qint64,qint64,QSize)), renderer, SLOT(render(qint64,qint64,QSize)));
+    connect(renderer, SIGNAL(rendered(QImage)), this, SLOT(rendered(QImage)));
+    if(bus)
+        connect(bus, SIGNAL(updated()), this, SLOT(telemetryUpdated()));
+
+    frameTimer = new QTimer(this);
+    connect(frameTimer, SIGNAL(timeout()), this, SLOT(frame()));
+    thread.start();
+}
+
+TelemetryChart::~TelemetryChart()
+{
+    thread.quit();
+    thread.wait();
+}
+
+void TelemetryChart::addSeries(int printer, int field, int kind, const QColor &color, const QString &name)
+{
+    ChartSeries s;
+    s.printer = printer;
+    s.field = field;
+    s.kind = kind;
+    s.color = color;
+    s.name = name;
+    series.append(s);
+    emit seriesChanged(series);
+    changed = true;
+}
+
+void TelemetryChart::setSpan(qint64 span)
+{
+    this->span = qMax<qint64>(1000, span);
+    changed = true;
+}
+
+/**
+ * @brief TelemetryChart::frame
+ *
+ * Requests a frame when samples came or time moved by a pixel column, never a second one
+ * while the renderer is busy.
+ */
+void TelemetryChart::frame()
+{
+    if(busy)
+        return;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 column = now / qMax<qint64>(1, span / qMax(1, width()));
+    if(!changed && column == lastColumn)
+        return;
+
+    busy = true;
+    changed = false;
+    lastColumn = column;
+    emit renderRequested(now, span, size());
+}
+
+void TelemetryChart::telemetryUpdated()
+{
+    changed = true;
+}
+
+void TelemetryChart::rendered(const QImage &image)
+{
+    this->image = image;
+    busy = false;
+    update();
+}
+
+void TelemetryChart::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    if(image.isNull())
+        painter.fillRect(rect(), Qt::white);
+    else
+        painter.drawImage(0, 0, image);
+}
+
+void TelemetryChart::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    changed = true;
+}
+
+void TelemetryChart::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+    changed = true;
+    frameTimer->start(CHART_FRAME_MS);
+}
+
+void TelemetryChart::hideEvent(QHideEvent *event)
+{
+    QWidget::hideEvent(event);
+    frameTimer->stop();
+}
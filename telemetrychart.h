@@ -0,0 +1,123 @@
+#ifndef TELEMETRYCHART_H
+#define TELEMETRYCHART_H
+
+#include <QWidget>
+#include <QThread>
+#include <QTimer>
+#include <QImage>
+#include <QColor>
+#include <QVector>
+#include "telemetrybus.h"
+#include "telemetrystore.h"
+
+// Time shown by a chart unless set otherwise
+#define CHART_DEFAULT_SPAN_MS       (10LL * 60 * 1000)
+// Frame period while the chart is visible, a frame is rendered only if something changed
+#define CHART_FRAME_MS              (16)
+
+enum {
+    CHART_VALUE = 0,                ///< The field as stored
+    CHART_RATE,                     ///< Its rate of change per second, e.g. flow from TELEMETRY_E
+};
+
+typedef struct {
+    int printer;
+    int field;                      ///< TELEMETRY_*
+    int kind;                       ///< CHART_*
+    QColor color;
+    QString name;
+} ChartSeries;
+
+/**
+ * @brief ChartRenderer
+ *
+ * Worker living in the thread of its chart. Reads the telemetry history and draws it into an image.
+ *
+ * Every pixel column covers a fixed slice of time aligned to the epoch and keeps min/max/sum/count of
+ * the samples in it. When the chart only moved forward the columns are shifted and only the new
+ * ones, plus the last one which was still filling, are read from the history. Wide slices are read
+ * from the per second and per minute rollups, so hours of history cost a few thousand records.
+ */
+class ChartRenderer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ChartRenderer(TelemetryStore *store);
+
+public slots:
+    void setSeries(const QVector<ChartSeries> &series);
+    void render(qint64 now, qint64 span, const QSize &size);
+
+signals:
+    void rendered(const QImage &image);
+
+private:
+    typedef struct {
+        float min;
+        float max;
+        double sum;
+        quint32 count;
+    } Column;
+
+    void fillSeries(int index, qint64 from, qint64 to);
+    void draw(const QSize &size);
+
+    TelemetryStore *store;
+    QVector<ChartSeries> series;
+    QVector<QVector<Column> > columns;  ///< Per series, per pixel column
+    qint64 step;                    ///< ms per pixel column
+    qint64 first;                   ///< Column index (time / step) of x = 0
+    qint64 filled;                  ///< Last column read from the history, -1 if none
+    QVector<TelemetryPoint> points;
+    QVector<TelemetryRollup> rollups;
+};
+
+/**
+ * @brief TelemetryChart
+ *
+ * Live chart of telemetry series. The GUI thread only paints the last rendered image, rendering
+ * runs in the thread of the chart and at most one frame is in flight, so a slow frame is dropped,
+ * not queued, and neither input nor the serial path wait for the chart.
+ */
+class TelemetryChart : public QWidget
+{
+    Q_OBJECT
+
+public:
+    TelemetryChart(TelemetryStore *store, TelemetryBus *bus, QWidget *parent = nullptr);
+    ~TelemetryChart();
+
+    void addSeries(int printer, int field, int kind, const QColor &color, const QString &name);
+    void setSpan(qint64 span);
+
+signals:
+    void seriesChanged(const QVector<ChartSeries> &series);
+    void renderRequested(qint64 now, qint64 span, const QSize &size);
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void showEvent(QShowEvent *event);
+    void hideEvent(QHideEvent *event);
+
+private slots:
+    void frame();
+    void telemetryUpdated();
+    void rendered(const QImage &image);
+
+private:
+    QThread thread;
+    ChartRenderer *renderer;
+    QVector<ChartSeries> series;
+    QTimer *frameTimer;
+    QImage image;
+    qint64 span;
+    bool busy;                      ///< A frame is being rendered
+    bool changed;                   ///< New samples or settings since the last frame
+    qint64 lastColumn;              ///< Column of the last frame, a new column needs a frame
+};
+
+Q_DECLARE_METATYPE(ChartSeries)
+
+#endif // TELEMETRYCHART_H
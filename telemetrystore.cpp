@@ -0,0 +1,448 @@
+#include "telemetrystore.h"
+#include <QMutexLocker>
+#include <algorithm>
+
+// Columns of the tables: first field, number of fields, units per unit of the bus
+static const int tableFirst[TSTORE_TABLES] = { TELEMETRY_HOTEND, TELEMETRY_X, TELEMETRY_PROGRESS, TELEMETRY_STATE };
+static const int tableColumns[TSTORE_TABLES] = { 4, 4, 1, 1 };
+static const float tableScale[TSTORE_TABLES] = { 10.0f, 1000.0f, 10000.0f, 1.0f };
+
+static const qint64 rollupPeriod[TSTORE_RESOLUTIONS] = { 1000, 60 * 1000 };
+
+/*
+ * Delta-of-delta codes: '0' for zero, then '10', '110', '1110' with a signed value of the
+ * width below and '1111' with 32 bits. The last code of a value column carries the value
+ * itself, not the delta-of-delta, so any jump fits.
+ */
+static const int timeBits[4] = { 7, 10, 14, 32 };
+static const int valueBits[3] = { 6, 12, 20 };
+
+// Worst case of a row: every column in the last code
+#define TSTORE_ROW_BITS(columns)    (36 * ((columns) + 1))
+
+static void putBits(uchar *data, quint32 &pos, quint64 value, int n)
+{
+    while(n > 0)
+    {
+        int free = 8 - static_cast<int>(pos & 7);
+        int take = n < free ? n : free;
+        quint32 chunk = static_cast<quint32>(value >> (n - take)) & ((1u << take) - 1);
+        data[pos >> 3] |= static_cast<uchar>(chunk << (free - take));
+        pos += static_cast<quint32>(take);
+        n -= take;
+    }
+}
+
+static quint64 getBits(const uchar *data, quint32 &pos, int n)
+{
+    quint64 value = 0;
+    while(n > 0)
+    {
+        int left = 8 - static_cast<int>(pos & 7);
+        int take = n < left ? n : left;
+        quint32 chunk = (static_cast<quint32>(data[pos >> 3]) >> (left - take)) & ((1u << take) - 1);
+        value = (value << take) | chunk;
+        pos += static_cast<quint32>(take);
+        n -= take;
+    }
+    return value;
+}
+
+static qint64 signExtend(quint64 value, int n)
+{
+    return static_cast<qint64>(value << (64 - n)) >> (64 - n);
+}
+
+static bool fits(qint64 value, int n)
+{
+    return value >= -(1LL << (n - 1)) && value < (1LL << (n - 1));
+}
+
+static void putCode(uchar *data, quint32 &pos, int code)
+{
+    if(code < 3)
+        putBits(data, pos, (1u << (code + 2)) - 2, code + 2);
+    else
+        putBits(data, pos, 15, 4);
+}
+
+/*
+ * Number of leading ones up to 4: 0 for '0', 1 for '10' ... 4 for '1111'
+ */
+static int getCode(const uchar *data, quint32 &pos)
+{
+    int ones = 0;
+    while(ones < 4 && getBits(data, pos, 1))
+        ones++;
+    return ones;
+}
+
+TelemetryStore::TelemetryStore()
+{
+    retention[0] = TSTORE_RAW_RETENTION;
+    retention[1 + TSTORE_SECONDS] = TSTORE_SECOND_RETENTION;
+    retention[1 + TSTORE_MINUTES] = TSTORE_MINUTE_RETENTION;
+    rows = 0;
+    samples = 0;
+}
+
+void TelemetryStore::setRetention(qint64 raw, qint64 seconds, qint64 minutes)
+{
+    QMutexLocker locker(&mutex);
+    retention[0] = raw;
+    retention[1 + TSTORE_SECONDS] = seconds;
+    retention[1 + TSTORE_MINUTES] = minutes;
+}
+
+int TelemetryStore::addPrinter()
+{
+    QMutexLocker locker(&mutex);
+    Table table;
+    table.lastTime = 0;
+    table.lastTimeDelta = 0;
+    for(int c = 0; c < TSTORE_MAX_COLUMNS; c++)
+    {
+        table.last[c] = 0;
+        table.lastDelta[c] = 0;
+        for(int res = 0; res < TSTORE_RESOLUTIONS; res++)
+            table.open[res][c].count = 0;
+    }
+    for(int i = 0; i < TSTORE_TABLES; i++)
+        tables.append(table);
+    return tables.size() / TSTORE_TABLES - 1;
+}
+
+int TelemetryStore::printerCount() const
+{
+    QMutexLocker locker(&mutex);
+    return tables.size() / TSTORE_TABLES;
+}
+
+int TelemetryStore::tableOf(int field, int *column)
+{
+    for(int i = 0; i < TSTORE_TABLES; i++)
+    {
+        if(field >= tableFirst[i] && field < tableFirst[i] + tableColumns[i])
+        {
+            if(column)
+                *column = field - tableFirst[i];
+            return i;
+        }
+    }
+    return -1;
+}
+
+void TelemetryStore::append(int printer, int table, qint64 time, const qint32 *values)
+{
+    QMutexLocker locker(&mutex);
+    if(printer < 0 || table < 0 || table >= TSTORE_TABLES || (printer + 1) * TSTORE_TABLES > tables.size())
+        return;
+
+    Table &t = tables[printer * TSTORE_TABLES + table];
+    int columns = tableColumns[table];
+    if(t.blocks.isEmpty() || !appendRow(t, columns, time, values))
+        startBlock(t, columns, time, values);
+    accumulate(t, table, time, values);
+
+    rows++;
+    samples += static_cast<quint64>(columns);
+}
+
+/**
+ * @brief TelemetryStore::appendRow
+ *
+ * @return false if the row does not fit the open block
+ */
+bool TelemetryStore::appendRow(Table &table, int columns, qint64 time, const qint32 *values)
+{
+    Block &block = table.blocks.last();
+    if(block.bits + TSTORE_ROW_BITS(columns) > TSTORE_BLOCK_BYTES * 8)
+        return false;
+
+    qint64 delta = time - table.lastTime;
+    qint64 dod = delta - table.lastTimeDelta;
+    if(!fits(dod, 32))
+        return false;
+
+    uchar *data = reinterpret_cast<uchar *>(block.data.data());
+    if(dod == 0)
+    {
+        putBits(data, block.bits, 0, 1);
+    }
+    else
+    {
+        int code = 0;
+        while(!fits(dod, timeBits[code]))
+            code++;
+        putCode(data, block.bits, code);
+        putBits(data, block.bits, static_cast<quint64>(dod), timeBits[code]);
+    }
+    table.lastTime = time;
+    table.lastTimeDelta = delta;
+
+    for(int c = 0; c < columns; c++)
+    {
+        delta = static_cast<qint64>(values[c]) - table.last[c];
+        dod = delta - table.lastDelta[c];
+        if(dod == 0)
+        {
+            putBits(data, block.bits, 0, 1);
+        }
+        else
+        {
+            int code = 0;
+            while(code < 3 && !fits(dod, valueBits[code]))
+                code++;
+            putCode(data, block.bits, code);
+            if(code < 3)
+                putBits(data, block.bits, static_cast<quint64>(dod), valueBits[code]);
+            else
+                putBits(data, block.bits, static_cast<quint32>(values[c]), 32);
+        }
+        table.last[c] = values[c];
+        table.lastDelta[c] = delta;
+    }
+
+    block.end = time;
+    block.rows++;
+    return true;
+}
+
+/**
+ * @brief TelemetryStore::startBlock
+ *
+ * Closes the open block and stores the row whole as the first one of a new block.
+ */
+void TelemetryStore::startBlock(Table &table, int columns, qint64 time, const qint32 *values)
+{
+    if(!table.blocks.isEmpty())
+    {
+        Block &last = table.blocks.last();
+        last.data.resize(static_cast<int>((last.bits + 7) / 8));
+        last.data.squeeze();
+        trim(table);
+    }
+
+    Block block;
+    block.start = time;
+    block.end = time;
+    block.rows = 1;
+    block.bits = 0;
+    block.data = QByteArray(TSTORE_BLOCK_BYTES, 0);
+    uchar *data = reinterpret_cast<uchar *>(block.data.data());
+    for(int c = 0; c < columns; c++)
+    {
+        putBits(data, block.bits, static_cast<quint32>(values[c]), 32);
+        table.last[c] = values[c];
+        table.lastDelta[c] = 0;
+    }
+    table.lastTime = time;
+    table.lastTimeDelta = 0;
+    table.blocks.append(block);
+}
+
+/**
+ * @brief TelemetryStore::accumulate
+ *
+ * Per second and per minute min/max/avg, a period is stored when the first sample of a later one comes.
+ */
+void TelemetryStore::accumulate(Table &table, int index, qint64 time, const qint32 *values)
+{
+    for(int res = 0; res < TSTORE_RESOLUTIONS; res++)
+    {
+        qint64 start = time - time % rollupPeriod[res];
+        for(int c = 0; c < tableColumns[index]; c++)
+        {
+            Accumulator &acc = table.open[res][c];
+            /* Próbka spóźniona względem otwartego okresu trafia do niego */
+            if(acc.count && start > acc.start)
+            {
+                QVector<TelemetryRollup> &rollups = table.rollups[res][c];
+                rollups.append(rollup(acc, 1.0f / tableScale[index]));
+                acc.count = 0;
+
+                /* Usuwane partiami, nie przy każdym okresie */
+                qint64 cutoff = time - retention[1 + res];
+                if(rollups.first().start < cutoff - retention[1 + res] / 8)
+                {
+                    int n = 0;
+                    while(n < rollups.size() && rollups[n].start < cutoff)
+                        n++;
+                    rollups.remove(0, n);
+                }
+            }
+            if(acc.count == 0)
+            {
+                acc.start = start;
+                acc.min = values[c];
+                acc.max = values[c];
+                acc.sum = 0;
+            }
+            acc.min = qMin(acc.min, values[c]);
+            acc.max = qMax(acc.max, values[c]);
+            acc.sum += values[c];
+            acc.count++;
+        }
+    }
+}
+
+void TelemetryStore::trim(Table &table)
+{
+    qint64 cutoff = table.lastTime - retention[0];
+    int n = 0;
+    while(n < table.blocks.size() - 1 && table.blocks[n].end < cutoff)
+        n++;
+    if(n > 0)
+        table.blocks.remove(0, n);
+}
+
+TelemetryRollup TelemetryStore::rollup(const Accumulator &acc, float scale)
+{
+    TelemetryRollup r;
+    r.start = acc.start;
+    r.min = acc.min * scale;
+    r.max = acc.max * scale;
+    r.avg = static_cast<float>(static_cast<double>(acc.sum) / acc.count) * scale;
+    r.count = acc.count;
+    return r;
+}
+
+/**
+ * @brief TelemetryStore::query
+ *
+ * Decodes the blocks overlapping the range, all columns of a row are read to get to the next one.
+ */
+int TelemetryStore::query(int printer, int field, qint64 from, qint64 to, QVector<TelemetryPoint> *points) const
+{
+    int column;
+    int index = tableOf(field, &column);
+    if(index < 0)
+        return 0;
+
+    QMutexLocker locker(&mutex);
+    if(printer < 0 || (printer + 1) * TSTORE_TABLES > tables.size())
+        return 0;
+
+    const Table &table = tables[printer * TSTORE_TABLES + index];
+    int columns = tableColumns[index];
+    float scale = 1.0f / tableScale[index];
+    int n = 0;
+    for(int i = 0; i < table.blocks.size(); i++)
+    {
+        const Block &block = table.blocks[i];
+        if(block.end < from)
+            continue;
+        if(block.start > to)
+            break;
+
+        const uchar *data = reinterpret_cast<const uchar *>(block.data.constData());
+        quint32 pos = 0;
+        qint64 time = block.start;
+        qint64 timeDelta = 0;
+        qint64 value[TSTORE_MAX_COLUMNS];
+        qint64 delta[TSTORE_MAX_COLUMNS];
+        for(int c = 0; c < columns; c++)
+        {
+            value[c] = static_cast<qint32>(getBits(data, pos, 32));
+            delta[c] = 0;
+        }
+
+        for(quint32 row = 0; row < block.rows; row++)
+        {
+            if(row > 0)
+            {
+                int code = getCode(data, pos);
+                if(code > 0)
+                    timeDelta += signExtend(getBits(data, pos, timeBits[code - 1]), timeBits[code - 1]);
+                time += timeDelta;
+
+                for(int c = 0; c < columns; c++)
+                {
+                    code = getCode(data, pos);
+                    if(code == 4)
+                    {
+                        qint64 v = static_cast<qint32>(getBits(data, pos, 32));
+                        delta[c] = v - value[c];
+                    }
+                    else if(code > 0)
+                    {
+                        delta[c] += signExtend(getBits(data, pos, valueBits[code - 1]), valueBits[code - 1]);
+                    }
+                    value[c] += delta[c];
+                }
+            }
+            if(time > to)
+                break;
+            if(time < from)
+                continue;
+
+            TelemetryPoint point;
+            point.time = time;
+            point.value = value[column] * scale;
+            points->append(point);
+            n++;
+        }
+    }
+    return n;
+}
+
+int TelemetryStore::queryRollup(int printer, int field, int resolution, qint64 from, qint64 to, QVector<TelemetryRollup> *rollups) const
+{
+    int column;
+    int index = tableOf(field, &column);
+    if(index < 0 || resolution < 0 || resolution >= TSTORE_RESOLUTIONS)
+        return 0;
+
+    QMutexLocker locker(&mutex);
+    if(printer < 0 || (printer + 1) * TSTORE_TABLES > tables.size())
+        return 0;
+
+    const Table &table = tables[printer * TSTORE_TABLES + index];
+    const QVector<TelemetryRollup> &stored = table.rollups[resolution][column];
+    qint64 period = rollupPeriod[resolution];
+
+    /* Pierwszy okres kończący się po from */
+    int lo = 0;
+    int hi = stored.size();
+    while(lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if(stored[mid].start + period <= from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int n = 0;
+    for(int i = lo; i < stored.size() && stored[i].start <= to; i++)
+    {
+        rollups->append(stored[i]);
+        n++;
+    }
+
+    /* Bieżący, niezamknięty okres */
+    const Accumulator &acc = table.open[resolution][column];
+    if(acc.count && acc.start + period > from && acc.start <= to)
+    {
+        rollups->append(rollup(acc, 1.0f / tableScale[index]));
+        n++;
+    }
+    return n;
+}
+
+TelemetryStoreStats TelemetryStore::getStats() const
+{
+    QMutexLocker locker(&mutex);
+    TelemetryStoreStats stats;
+    stats.rows = rows;
+    stats.samples = samples;
+    stats.bytes = 0;
+    stats.blocks = 0;
+    for(int i = 0; i < tables.size(); i++)
+    {
+        for(int b = 0; b < tables[i].blocks.size(); b++)
+            stats.bytes += (tables[i].blocks[b].bits + 7) / 8;
+        stats.blocks += tables[i].blocks.size();
+    }
+    return stats;
+}
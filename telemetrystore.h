@@ -0,0 +1,143 @@
+#ifndef TELEMETRYSTORE_H
+#define TELEMETRYSTORE_H
+
+#include <QVector>
+#include <QByteArray>
+#include <QMutex>
+#include "telemetrybus.h"
+
+// Capacity of a block, a full block is closed and shrunk to its data
+#define TSTORE_BLOCK_BYTES          (2048)
+// Default history kept, ms
+#define TSTORE_RAW_RETENTION        (6LL * 3600 * 1000)
+#define TSTORE_SECOND_RETENTION     (6LL * 3600 * 1000)
+#define TSTORE_MINUTE_RETENTION     (7LL * 24 * 3600 * 1000)
+// Most columns of a table
+#define TSTORE_MAX_COLUMNS          (4)
+
+// Tables of a printer, the values of one frame share a table and its time column
+enum {
+    TSTORE_TEMPERATURES = 0,        ///< TELEMETRY_HOTEND .. TELEMETRY_BED_TARGET, 0.1 degree Celsius
+    TSTORE_POSITION,                ///< TELEMETRY_X .. TELEMETRY_E, micrometres
+    TSTORE_PROGRESS,                ///< TELEMETRY_PROGRESS, 1/10000 of the job
+    TSTORE_STATE,                   ///< TELEMETRY_STATE
+    TSTORE_TABLES,
+};
+
+// Resolutions of queryRollup()
+enum {
+    TSTORE_SECONDS = 0,
+    TSTORE_MINUTES,
+    TSTORE_RESOLUTIONS,
+};
+
+typedef struct {
+    qint64 time;                    ///< ms since epoch
+    float value;                    ///< In the units of the bus (degree Celsius, mm, 0..1)
+} TelemetryPoint;
+
+typedef struct {
+    qint64 start;                   ///< ms since epoch, start of the period
+    float min;
+    float max;
+    float avg;
+    quint32 count;                  ///< Samples in the period
+} TelemetryRollup;
+
+typedef struct {
+    quint64 rows;                   ///< Frames appended
+    quint64 samples;                ///< Values appended, rows times the columns of their tables
+    quint64 bytes;                  ///< Compressed data held
+    int blocks;
+} TelemetryStoreStats;
+
+/**
+ * @brief TelemetryStore
+ *
+ * History of the printer telemetry in memory, per printer a table per frame type with one time
+ * column and a column per value.
+ *
+ * Rows are compressed into blocks of TSTORE_BLOCK_BYTES: the first row of a block is stored whole,
+ * the following ones as delta-of-delta of the time and of every column with a variable length
+ * code, so a steady value or a steady rate of change costs one bit. Values are kept as the integers
+ * the printer sends (0.1 degree Celsius, micrometres), not as floats.
+ *
+ * Next to the raw rows min/max/avg are kept per second and per minute, each level with its own
+ * retention, so long ranges are read without decoding the blocks.
+ *
+ * append() is called from the received-frame path, queries from any thread.
+ */
+class TelemetryStore
+{
+public:
+    TelemetryStore();
+
+    void setRetention(qint64 raw, qint64 seconds, qint64 minutes);
+
+    /**
+     * @return index of the printer, the same as in the telemetry bus when both are added together
+     */
+    int addPrinter();
+    int printerCount() const;
+
+    /**
+     * One frame: the values of all columns of the table in the units of the table.
+     */
+    void append(int printer, int table, qint64 time, const qint32 *values);
+
+    /**
+     * Raw samples of a field (TELEMETRY_*) with from <= time <= to, appended in time order.
+     *
+     * @return number of samples appended
+     */
+    int query(int printer, int field, qint64 from, qint64 to, QVector<TelemetryPoint> *points) const;
+    int queryRollup(int printer, int field, int resolution, qint64 from, qint64 to, QVector<TelemetryRollup> *rollups) const;
+
+    TelemetryStoreStats getStats() const;
+
+    /**
+     * Table holding a field, -1 if none.
+     */
+    static int tableOf(int field, int *column = nullptr);
+
+private:
+    typedef struct {
+        qint64 start;               ///< Time of the first row
+        qint64 end;                 ///< Time of the last row
+        quint32 rows;
+        quint32 bits;               ///< Used bits of data
+        QByteArray data;
+    } Block;
+
+    typedef struct {
+        qint64 start;               ///< Start of the period
+        qint32 min;
+        qint32 max;
+        qint64 sum;
+        quint32 count;
+    } Accumulator;
+
+    typedef struct {
+        QVector<Block> blocks;      ///< The last one is open
+        qint64 lastTime;
+        qint64 lastTimeDelta;
+        qint32 last[TSTORE_MAX_COLUMNS];
+        qint64 lastDelta[TSTORE_MAX_COLUMNS];
+        Accumulator open[TSTORE_RESOLUTIONS][TSTORE_MAX_COLUMNS];
+        QVector<TelemetryRollup> rollups[TSTORE_RESOLUTIONS][TSTORE_MAX_COLUMNS];
+    } Table;
+
+    bool appendRow(Table &table, int columns, qint64 time, const qint32 *values);
+    void startBlock(Table &table, int columns, qint64 time, const qint32 *values);
+    void accumulate(Table &table, int index, qint64 time, const qint32 *values);
+    void trim(Table &table);
+    static TelemetryRollup rollup(const Accumulator &acc, float scale);
+
+    mutable QMutex mutex;
+    QVector<Table> tables;          ///< TSTORE_TABLES per printer
+    qint64 retention[TSTORE_RESOLUTIONS + 1];   ///< Raw, seconds, minutes
+    quint64 rows;
+    quint64 samples;
+};
+
+#endif // TELEMETRYSTORE_H
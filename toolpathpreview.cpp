@@ -0,0 +1,576 @@
+#include "toolpathpreview.h"
+#include "gcodeparser.h"
+#include <QFile>
+#include <QRunnable>
+#include <QPainter>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#define PREVIEW_BED_MARGIN          (8)
+
+// Priorities in the pool, shown layers go before the prefetched ones
+#define PREVIEW_PRIORITY_PREFETCH   (0)
+#define PREVIEW_PRIORITY_SHOWN      (1)
+
+/**
+ * Plik G-code zmapowany w pamięci, zwalniany dopiero gdy żadne zadanie go nie używa.
+ */
+class PreviewFile
+{
+public:
+    explicit PreviewFile(const QString &fileName) : file(fileName), data(nullptr), size(0) {}
+    ~PreviewFile()
+    {
+        if(data)
+            file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(data)));
+    }
+
+    bool open()
+    {
+        if(!file.open(QIODevice::ReadOnly))
+            return false;
+        size = file.size();
+        if(size > 0)
+            data = reinterpret_cast<const char *>(file.map(0, size));
+        return size == 0 || data != nullptr;
+    }
+
+    QFile file;
+    const char *data;
+    qint64 size;
+};
+
+class OpenTask : public QRunnable
+{
+public:
+    OpenTask(ToolpathPreview *preview, const QString &fileName, quint32 generation) :
+        preview(preview), fileName(fileName), generation(generation) {}
+    void run()
+    {
+        GcodeIndex *index = new GcodeIndex();
+        if(!index->open(fileName))
+        {
+            delete index;
+            index = nullptr;
+        }
+        preview->finishOpen(generation, index);
+    }
+
+private:
+    ToolpathPreview *preview;
+    QString fileName;
+    quint32 generation;
+};
+
+/**
+ * Buduje bufor jednej warstwy, od punktu kontrolnego indeksu do początku następnej warstwy.
+ */
+class BuildTask : public QRunnable
+{
+public:
+    BuildTask(ToolpathPreview *preview, const QSharedPointer<PreviewFile> &file, const GcodeIndexEntry &start,
+              qint64 end, quint32 layer, quint32 generation) :
+        preview(preview), file(file), start(start), end(end), layer(layer), generation(generation) {}
+    void run();
+
+private:
+    void addSegment(const float *from, const float *to);
+
+    ToolpathPreview *preview;
+    QSharedPointer<PreviewFile> file;
+    GcodeIndexEntry start;
+    qint64 end;
+    quint32 layer;
+    quint32 generation;
+
+    QVector<float> xy;              ///< Points before quantisation, mm
+    QVector<quint32> runs;
+    float z;
+    bool haveZ;
+};
+
+void BuildTask::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+    GcodeMachine machine;
+    machine.setState(start.position, start.feedrate, start.relative, start.relativeExtrusion);
+    z = start.position[GCODE_Z];
+    haveZ = false;
+
+    const char *data = file->data;
+    const char *p = data + start.offset;
+    const char *stop = data + end;
+    while(p < stop)
+    {
+        const char *nl = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(stop - p)));
+        const char *lineEnd = nl ? nl : stop;
+
+        GcodeCommand command;
+        if(GcodeParser::parse(p, static_cast<int>(lineEnd - p), &command))
+        {
+            float from[GCODE_AXES];
+            memcpy(from, machine.getPosition(), sizeof(from));
+            GcodeMove move;
+            if(machine.apply(command, &move))
+            {
+                addSegment(move.from, move.to);
+            }
+            else if(command.letter == 'G' && (command.code == 2 || command.code == 3))
+            {
+                const float *to = machine.getPosition();
+                GcodeArc arc;
+                if(!arc.setup(command, from, to))
+                {
+                    addSegment(from, to);
+                }
+                else
+                {
+                    int segments = arc.segments(PREVIEW_ARC_TOLERANCE);
+                    float a[GCODE_AXES];
+                    float b[GCODE_AXES];
+                    memcpy(a, from, sizeof(a));
+                    for(int k = 1; k <= segments; k++)
+                    {
+                        arc.point(static_cast<float>(k) / static_cast<float>(segments), b);
+                        addSegment(a, b);
+                        memcpy(a, b, sizeof(a));
+                    }
+                }
+            }
+        }
+        p = lineEnd + 1;
+    }
+
+    /* Kwantyzacja do int16 w obrębie warstwy */
+    float minX = FLT_MAX;
+    float minY = FLT_MAX;
+    float maxX = -FLT_MAX;
+    float maxY = -FLT_MAX;
+    for(int i = 0; i < xy.size(); i += 2)
+    {
+        minX = qMin(minX, xy[i]);
+        maxX = qMax(maxX, xy[i]);
+        minY = qMin(minY, xy[i + 1]);
+        maxY = qMax(maxY, xy[i + 1]);
+    }
+
+    PreviewLayer *result = new PreviewLayer();
+    result->layer = layer;
+    result->z = z;
+    result->originX = xy.isEmpty() ? 0.0f : minX;
+    result->originY = xy.isEmpty() ? 0.0f : minY;
+    float extent = xy.isEmpty() ? 0.0f : qMax(maxX - minX, maxY - minY);
+    result->scale = extent > 0.0f ? extent / 65535.0f : 1.0f;
+    result->points.resize(xy.size());
+    for(int i = 0; i < xy.size(); i++)
+    {
+        float origin = (i & 1) ? result->originY : result->originX;
+        long q = lroundf((xy[i] - origin) / result->scale) - 32768;
+        result->points[i] = static_cast<qint16>(qBound(-32768L, q, 32767L));
+    }
+    result->runs = runs;
+
+    preview->finishLayer(generation, result, timer.nsecsElapsed());
+}
+
+/*
+ * Ruchy tylko w Z lub E (retrakcje) nie są rysowane. Kolejne odcinki tego samego rodzaju
+ * stykające się końcami tworzą jedną linię łamaną.
+ */
+void BuildTask::addSegment(const float *from, const float *to)
+{
+    if(from[GCODE_X] == to[GCODE_X] && from[GCODE_Y] == to[GCODE_Y])
+        return;
+
+    bool extrude = to[GCODE_E] > from[GCODE_E];
+    quint32 flag = extrude ? 0 : PREVIEW_TRAVEL;
+    if(extrude && !haveZ)
+    {
+        z = to[GCODE_Z];
+        haveZ = true;
+    }
+
+    int n = xy.size();
+    if(runs.isEmpty() || (runs.last() & PREVIEW_TRAVEL) != flag
+            || xy[n - 2] != from[GCODE_X] || xy[n - 1] != from[GCODE_Y])
+    {
+        runs.append(static_cast<quint32>(n / 2) | flag);
+        xy.append(from[GCODE_X]);
+        xy.append(from[GCODE_Y]);
+    }
+    xy.append(to[GCODE_X]);
+    xy.append(to[GCODE_Y]);
+}
+
+class RasterTask : public QRunnable
+{
+public:
+    RasterTask(ToolpathPreview *preview, const QVector<QSharedPointer<const PreviewLayer> > &layers, quint32 top,
+               const QSize &size, float bedX, float bedY, bool travel) :
+        preview(preview), layers(layers), top(top), size(size), bedX(bedX), bedY(bedY), travel(travel) {}
+    void run();
+
+private:
+    ToolpathPreview *preview;
+    QVector<QSharedPointer<const PreviewLayer> > layers;
+    quint32 top;
+    QSize size;
+    float bedX;
+    float bedY;
+    bool travel;
+};
+
+/**
+ * Rysowanie na CPU (QImage, silnik rastrowy), warstwy od dołu, bieżąca na wierzchu.
+ */
+void RasterTask::run()
+{
+    QImage image(size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(250, 250, 250));
+    QPainter painter(&image);
+
+    /* Stół dopasowany do obrazu, Y w górę */
+    float s = qMin((size.width() - 2 * PREVIEW_BED_MARGIN) / bedX, (size.height() - 2 * PREVIEW_BED_MARGIN) / bedY);
+    s = qMax(s, 0.0f);
+    float ox = (size.width() - bedX * s) / 2.0f;
+    float oy = (size.height() + bedY * s) / 2.0f;
+    painter.setPen(QColor(190, 190, 190));
+    painter.drawRect(QRectF(ox, oy - bedY * s, bedX * s, bedY * s));
+
+    QVector<QPointF> polyline;
+    for(int i = 0; i < layers.size(); i++)
+    {
+        const PreviewLayer &layer = *layers[i];
+        bool current = layer.layer == top;
+        int points = layer.points.size() / 2;
+        for(int r = 0; r < layer.runs.size(); r++)
+        {
+            bool isTravel = (layer.runs[r] & PREVIEW_TRAVEL) != 0;
+            if(isTravel && (!travel || !current))
+                continue;
+
+            int first = static_cast<int>(layer.runs[r] & ~PREVIEW_TRAVEL);
+            int last = r + 1 < layer.runs.size() ? static_cast<int>(layer.runs[r + 1] & ~PREVIEW_TRAVEL) : points;
+            polyline.resize(last - first);
+            for(int k = first; k < last; k++)
+            {
+                float x = layer.originX + (layer.points[2 * k] + 32768) * layer.scale;
+                float y = layer.originY + (layer.points[2 * k + 1] + 32768) * layer.scale;
+                polyline[k - first] = QPointF(ox + x * s, oy - y * s);
+            }
+
+            if(isTravel)
+                painter.setPen(QColor(80, 140, 230));
+            else
+                painter.setPen(current ? QColor(230, 120, 20) : QColor(200, 200, 200));
+            painter.drawPolyline(polyline.constData(), polyline.size());
+        }
+    }
+    painter.end();
+
+    preview->finishRender(image);
+}
+
+ToolpathPreview::ToolpathPreview(QObject *parent) :
+    QObject(parent)
+{
+    fileSize = 0;
+    bedX = 200.0f;
+    bedY = 200.0f;
+    first = 0;
+    last = 0;
+    travel = false;
+    pending = false;
+    drawing = false;
+    generation = 0;
+    index = nullptr;
+    memset(&stats, 0, sizeof(stats));
+    cache.setMaxCost(PREVIEW_CACHE_BYTES);
+}
+
+ToolpathPreview::~ToolpathPreview()
+{
+    pool.clear();
+    pool.waitForDone();
+    delete index;
+}
+
+/**
+ * @brief ToolpathPreview::open
+ *
+ * Starts indexing the file, opened() is emitted when the layers are known. Tasks of the previous
+ * file still running finish on their own, their results are dropped.
+ */
+void ToolpathPreview::open(const QString &fileName)
+{
+    quint32 current;
+    {
+        QMutexLocker locker(&mutex);
+        current = ++generation;
+        delete index;
+        index = nullptr;
+        cache.clear();
+        building.clear();
+        memset(&stats, 0, sizeof(stats));
+    }
+    pool.clear();
+    file.clear();
+    layerStarts.clear();
+    requested.clear();
+    drawing = false;
+    pool.start(new OpenTask(this, fileName, current), PREVIEW_PRIORITY_SHOWN);
+}
+
+quint32 ToolpathPreview::getLayerCount() const
+{
+    return layerStarts.isEmpty() ? 0 : static_cast<quint32>(layerStarts.size() - 1);
+}
+
+void ToolpathPreview::setBed(float x, float y)
+{
+    if(x > 0.0f && y > 0.0f)
+    {
+        bedX = x;
+        bedY = y;
+    }
+}
+
+void ToolpathPreview::setCacheSize(int bytes)
+{
+    QMutexLocker locker(&mutex);
+    cache.setMaxCost(bytes);
+}
+
+PreviewStats ToolpathPreview::getStats() const
+{
+    QMutexLocker locker(&mutex);
+    PreviewStats result = stats;
+    result.cachedBytes = cache.totalCost();
+    return result;
+}
+
+void ToolpathPreview::render(quint32 first, quint32 last, const QSize &size, bool travel)
+{
+    this->first = first;
+    this->last = last;
+    this->size = size;
+    this->travel = travel;
+    pending = true;
+    requested.clear();
+    schedule();
+}
+
+void ToolpathPreview::finishOpen(quint32 generation, GcodeIndex *index)
+{
+    QMutexLocker locker(&mutex);
+    if(generation != this->generation)
+    {
+        delete index;
+        return;
+    }
+    delete this->index;
+    this->index = index;
+    QMetaObject::invokeMethod(this, "indexReady", Qt::QueuedConnection);
+}
+
+void ToolpathPreview::finishLayer(quint32 generation, PreviewLayer *layer, qint64 buildNs)
+{
+    QMutexLocker locker(&mutex);
+    if(generation != this->generation)
+    {
+        delete layer;
+        return;
+    }
+    building.remove(layer->layer);
+    stats.layersBuilt++;
+    stats.buildNs += buildNs;
+    stats.points += static_cast<quint64>(layer->points.size() / 2);
+    if(!layer->points.isEmpty())
+        stats.maxScale = qMax(stats.maxScale, layer->scale);
+    int bytes = static_cast<int>(sizeof(PreviewLayer)) + layer->points.size() * 2 + layer->runs.size() * 4;
+    /* Warstwa większa niż cała pamięć i tak musi zostać narysowana */
+    cache.insert(layer->layer, new LayerRef(layer), qMin(bytes, cache.maxCost()));
+    QMetaObject::invokeMethod(this, "layerReady", Qt::QueuedConnection);
+}
+
+void ToolpathPreview::finishRender(const QImage &image)
+{
+    QMutexLocker locker(&mutex);
+    this->image = image;
+    QMetaObject::invokeMethod(this, "renderReady", Qt::QueuedConnection);
+}
+
+void ToolpathPreview::indexReady()
+{
+    GcodeIndex *ready;
+    {
+        QMutexLocker locker(&mutex);
+        ready = index;
+        index = nullptr;
+    }
+    if(!ready)
+    {
+        qWarning() << "Warning: Nie można zindeksować pliku G-code do podglądu";
+        emit opened(0);
+        return;
+    }
+
+    QSharedPointer<PreviewFile> mapped(new PreviewFile(ready->getFileName()));
+    if(!mapped->open())
+    {
+        qWarning() << "Warning: Nie można zmapować pliku G-code: " << ready->getFileName();
+        delete ready;
+        emit opened(0);
+        return;
+    }
+
+    /* Punkt kontrolny na początku każdej warstwy */
+    const QVector<GcodeIndexEntry> &entries = ready->getEntries();
+    if(!entries.isEmpty())
+        layerStarts.append(entries[0]);
+    for(quint32 layer = 1; layer <= ready->getLayerCount(); layer++)
+    {
+        GcodeIndexEntry entry;
+        if(!ready->findByLayer(layer, &entry))
+            break;
+        layerStarts.append(entry);
+    }
+    file = mapped;
+    fileSize = mapped->size;
+    delete ready;
+
+    emit opened(getLayerCount());
+    schedule();
+}
+
+void ToolpathPreview::layerReady()
+{
+    schedule();
+}
+
+void ToolpathPreview::renderReady()
+{
+    QImage ready;
+    {
+        QMutexLocker locker(&mutex);
+        ready = image;
+        image = QImage();
+    }
+    drawing = false;
+    emit rendered(ready);
+    schedule();
+}
+
+/**
+ * @brief ToolpathPreview::schedule
+ *
+ * Starts the builds of the missing layers around the request and the drawing once the shown
+ * layers are there. Each layer is built at most once per request, a layer dropped by the cache
+ * before the drawing is left out rather than built in a loop.
+ */
+void ToolpathPreview::schedule()
+{
+    if(!file || !pending || layerStarts.isEmpty())
+        return;
+
+    quint32 topLayer = static_cast<quint32>(layerStarts.size() - 1);
+    quint32 hi = qMin(last, topLayer);
+    quint32 lo = qMax(qMin(first, hi), hi >= PREVIEW_MAX_BELOW ? hi - PREVIEW_MAX_BELOW : 0U);
+    quint32 from = lo >= PREVIEW_PREFETCH ? lo - PREVIEW_PREFETCH : 0U;
+    quint32 to = qMin(topLayer, hi + PREVIEW_PREFETCH);
+
+    QVector<LayerRef> layers;
+    bool waiting = false;
+    {
+        QMutexLocker locker(&mutex);
+        /* Najpierw widoczne, od bieżącej w dół */
+        for(quint32 layer = hi + 1; layer-- > lo; )
+        {
+            LayerRef *ref = cache.object(layer);
+            if(ref)
+            {
+                layers.prepend(*ref);
+                continue;
+            }
+            if(!building.contains(layer) && !requested.contains(layer))
+            {
+                building.insert(layer);
+                requested.insert(layer);
+                qint64 end = layer + 1 < static_cast<quint32>(layerStarts.size()) ? layerStarts[layer + 1].offset : fileSize;
+                pool.start(new BuildTask(this, file, layerStarts[layer], end, layer, generation), PREVIEW_PRIORITY_SHOWN);
+            }
+            if(building.contains(layer))
+                waiting = true;
+        }
+        for(quint32 layer = from; layer <= to; layer++)
+        {
+            if((layer >= lo && layer <= hi) || cache.contains(layer) || building.contains(layer) || requested.contains(layer))
+                continue;
+            building.insert(layer);
+            requested.insert(layer);
+            qint64 end = layer + 1 < static_cast<quint32>(layerStarts.size()) ? layerStarts[layer + 1].offset : fileSize;
+            pool.start(new BuildTask(this, file, layerStarts[layer], end, layer, generation), PREVIEW_PRIORITY_PREFETCH);
+        }
+    }
+
+    if(waiting || drawing)
+        return;
+
+    pending = false;
+    drawing = true;
+    pool.start(new RasterTask(this, layers, hi, size, bedX, bedY, travel), PREVIEW_PRIORITY_SHOWN);
+}
+
+ToolpathView::ToolpathView(ToolpathPreview *preview, QWidget *parent) :
+    QWidget(parent)
+{
+    this->preview = preview;
+    layer = 0;
+    travel = false;
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    connect(preview, SIGNAL(rendered(QImage)), this, SLOT(rendered(QImage)));
+}
+
+void ToolpathView::setLayer(int layer)
+{
+    this->layer = static_cast<quint32>(qMax(0, layer));
+    request();
+}
+
+void ToolpathView::setTravel(bool travel)
+{
+    this->travel = travel;
+    request();
+}
+
+void ToolpathView::request()
+{
+    if(width() > 0 && height() > 0)
+        preview->render(0, layer, size(), travel);
+}
+
+void ToolpathView::rendered(const QImage &image)
+{
+    this->image = image;
+    update();
+}
+
+void ToolpathView::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    painter.fillRect(rect(), QColor(250, 250, 250));
+    if(!image.isNull())
+        painter.drawImage((width() - image.width()) / 2, (height() - image.height()) / 2, image);
+}
+
+void ToolpathView::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    request();
+}
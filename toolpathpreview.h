@@ -0,0 +1,161 @@
+#ifndef TOOLPATHPREVIEW_H
+#define TOOLPATHPREVIEW_H
+
+#include <QObject>
+#include <QWidget>
+#include <QThreadPool>
+#include <QSharedPointer>
+#include <QMutex>
+#include <QCache>
+#include <QSet>
+#include <QImage>
+#include <QVector>
+#include "gcodeindex.h"
+
+// Memory for the layer buffers, least recently used layers are dropped beyond it
+#define PREVIEW_CACHE_BYTES         (64 * 1024 * 1024)
+// mm, chords of G2/G3, coarser than the firmware, a pixel is more than this anyway
+#define PREVIEW_ARC_TOLERANCE       (0.05f)
+// Layers built ahead above and below the shown ones
+#define PREVIEW_PREFETCH            (2)
+// Most layers drawn under the current one
+#define PREVIEW_MAX_BELOW           (16)
+
+// Flag of PreviewLayer::runs, the run is a travel move
+#define PREVIEW_TRAVEL              (0x80000000U)
+
+/**
+ * One layer of the toolpath. Points are quantised to int16 over the bounding box of the layer,
+ * for a 300 mm bed a unit is below 5 micrometres.
+ */
+typedef struct {
+    quint32 layer;
+    float z;                        ///< mm, of the first extrusion
+    float originX;                  ///< mm, point (-32768, -32768)
+    float originY;
+    float scale;                    ///< mm per unit
+    QVector<qint16> points;         ///< x, y pairs
+    QVector<quint32> runs;          ///< First point of every polyline, PREVIEW_TRAVEL if it is a travel
+} PreviewLayer;
+
+typedef struct {
+    quint32 layersBuilt;            ///< Builds of the open file finished
+    qint64 buildNs;                 ///< Time of those builds together, over all threads of the pool
+    quint64 points;                 ///< Points of the built layers
+    int cachedBytes;                ///< Layer buffers held by the cache
+    float maxScale;                 ///< Coarsest quantisation of a built layer, mm per unit
+} PreviewStats;
+
+class PreviewFile;
+
+/**
+ * @brief ToolpathPreview
+ *
+ * Layer preview of a G-code file. Everything heavy runs in the pool of the preview: the index of the
+ * file (GcodeIndex, from its sidecar if there is one), building of the layer buffers and drawing.
+ *
+ * A layer is built when it is shown or near the shown ones, each in a task of its own starting at
+ * the index checkpoint of the layer, so the layers are parsed in parallel. The buffers are kept in an
+ * LRU cache bounded by PREVIEW_CACHE_BYTES; the drawing holds references to the layers it draws, so
+ * a layer dropped meanwhile is freed after the frame.
+ */
+class ToolpathPreview : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ToolpathPreview(QObject *parent = nullptr);
+    ~ToolpathPreview();
+
+    void open(const QString &fileName);
+    quint32 getLayerCount() const;
+    void setBed(float x, float y);
+    void setCacheSize(int bytes);
+    PreviewStats getStats() const;
+
+    /**
+     * Draws the layers first..last, last in colour and the ones under it in grey. The image
+     * comes with rendered().
+     */
+    void render(quint32 first, quint32 last, const QSize &size, bool travel);
+
+    /*
+     * Called by the tasks of the pool
+     */
+    void finishOpen(quint32 generation, GcodeIndex *index);
+    void finishLayer(quint32 generation, PreviewLayer *layer, qint64 buildNs);
+    void finishRender(const QImage &image);
+
+signals:
+    void opened(quint32 layers);
+    void rendered(const QImage &image);
+
+private slots:
+    void indexReady();
+    void layerReady();
+    void renderReady();
+
+private:
+    typedef QSharedPointer<const PreviewLayer> LayerRef;
+
+    void schedule();
+
+    QThreadPool pool;
+    QSharedPointer<PreviewFile> file;
+    QVector<GcodeIndexEntry> layerStarts;   ///< Index checkpoint of every layer, 0 is the start of the file
+    qint64 fileSize;
+    float bedX;
+    float bedY;
+
+    /* Żądanie rysowania, wątek GUI */
+    quint32 first;
+    quint32 last;
+    QSize size;
+    bool travel;
+    bool pending;                   ///< Requested and not drawn yet
+    bool drawing;
+    QSet<quint32> requested;        ///< Layers built for the current request
+
+    /* Wspólne z zadaniami, chronione przez mutex */
+    mutable QMutex mutex;
+    quint32 generation;             ///< Bumped by open(), results of older tasks are dropped
+    GcodeIndex *index;              ///< Index just opened, taken over by indexReady()
+    QCache<quint32, LayerRef> cache;
+    QSet<quint32> building;
+    QImage image;
+    PreviewStats stats;             ///< Except cachedBytes
+};
+
+/**
+ * @brief ToolpathView
+ *
+ * Shows the image of the preview, asks for a new one when resized or another layer is chosen.
+ */
+class ToolpathView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    ToolpathView(ToolpathPreview *preview, QWidget *parent = nullptr);
+
+public slots:
+    void setLayer(int layer);
+    void setTravel(bool travel);
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+
+private slots:
+    void rendered(const QImage &image);
+
+private:
+    void request();
+
+    ToolpathPreview *preview;
+    QImage image;
+    quint32 layer;
+    bool travel;
+};
+
+#endif // TOOLPATHPREVIEW_H